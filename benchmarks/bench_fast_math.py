@@ -0,0 +1,84 @@
+"""
+Forward and backward render time of exact vs. approximate math
+(VolumeRenderer.fast_math), and the difference it makes to the image and
+the gradient, for each data format with and without density softplus.
+
+Usage: python benchmarks/bench_fast_math.py [tree.npz] [--device cuda]
+       [--threads 1]
+
+The CPU instruction set is chosen by the SVOX_CPU_ISA environment variable.
+"""
+import argparse
+import time
+import torch
+import svox
+from svox.helpers import _get_c_extension
+from common import add_scene_args, load_scene, camera, time_render, psnr
+
+
+def time_backward(renderer, c2w, focal, args):
+    """
+    Median time of the backward pass of the image (ms), and the gradient
+    of the sum of the image
+    """
+    tree = renderer.tree
+
+    def run():
+        tree.data.grad = None
+        im = renderer.render_persp(c2w, width=args.size, height=args.size,
+                                   fx=focal)
+        if args.device != "cpu":
+            torch.cuda.synchronize()
+        start = time.perf_counter()
+        im.sum().backward()
+        if args.device != "cpu":
+            torch.cuda.synchronize()
+        return (time.perf_counter() - start) * 1e3
+    run()
+    grad = tree.data.grad.clone()
+    times = sorted(run() for _ in range(args.repeats))
+    return times[len(times) // 2], grad
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    add_scene_args(parser)
+    parser.add_argument("--threads", type=int, default=None,
+                        help="CPU threads (default: torch's)")
+    args = parser.parse_args()
+    if args.threads is not None:
+        torch.set_num_threads(args.threads)
+
+    isa = _get_c_extension().cpu_isa() if args.device == "cpu" else args.device
+    print(f"{args.size}x{args.size} on {args.device} ({isa}), "
+          f"exact / fast math")
+    print(f"{'format':<8}{'softplus':<10}{'forward (ms)':>18}"
+          f"{'backward (ms)':>20}{'max diff':>11}{'PSNR (dB)':>11}"
+          f"{'grad diff':>11}")
+    formats = ["RGBA", "SH9", "SH16"] if args.tree is None else [None]
+    for data_format in formats:
+        tree = load_scene(args, data_format)
+        c2w, focal = camera(tree, args)
+        for softplus in [False, True]:
+            fwd, bwd, ims, grads = [], [], [], []
+            for fast_math in [False, True]:
+                ren = svox.VolumeRenderer(tree, density_softplus=softplus)
+                ren.fast_math = fast_math
+                ms, im = time_render(ren, c2w, focal, args)
+                fwd.append(ms)
+                ims.append(im)
+                ms, grad = time_backward(ren, c2w, focal, args)
+                bwd.append(ms)
+                grads.append(grad)
+            # Largest gradient difference, relative to the largest gradient
+            grad_diff = ((grads[1] - grads[0]).abs().max() /
+                         grads[0].abs().max()).item()
+            print(f"{str(tree.data_format):<8}{'yes' if softplus else 'no':<10}"
+                  f"{fwd[0]:>9.1f} /{fwd[1]:>7.1f}"
+                  f"{bwd[0]:>11.1f} /{bwd[1]:>7.1f}"
+                  f"{(ims[1] - ims[0]).abs().max().item():>11.1e}"
+                  f"{psnr(ims[1], ims[0]):>11.1f}{grad_diff:>11.1e}")
+
+
+if __name__ == "__main__":
+    main()
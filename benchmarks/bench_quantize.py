@@ -0,0 +1,51 @@
+"""
+Render time and PSNR against float32 of the compressed tree data formats:
+half precision, int8 quantization (quantize) and palettes (palettize).
+
+Usage: python benchmarks/bench_quantize.py [tree.npz] [--device cuda]
+"""
+import argparse
+import torch
+import svox
+from svox.helpers import DataFormat
+from common import add_scene_args, load_scene, camera, time_render, psnr
+
+
+def data_bytes(tree):
+    return sum(t.numel() * t.element_size() for t in
+               (tree.data, tree.quant, tree.palette, tree.quant_sigma)
+               if t is not None)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    add_scene_args(parser)
+    parser.add_argument("--order", type=int, default=12,
+                        help="log2 of the palette size")
+    args = parser.parse_args()
+
+    tree = load_scene(args)
+    c2w, focal = camera(tree, args)
+    variants = [
+        ("float32", tree),
+        ("float16", tree.partial(dtype=torch.float16)),
+        ("bfloat16", tree.partial(dtype=torch.bfloat16)),
+        ("int8", tree.quantize()),
+    ]
+    if tree.data_format.format != DataFormat.RGBA:
+        variants.append(("int8 per channel", tree.quantize(per_channel=True)))
+    variants.append((f"palette 2^{args.order}", tree.palettize(args.order)))
+
+    print(f"{tree}, {args.size}x{args.size} on {args.device}")
+    print(f"{'data':<18}{'MB':>10}{'time (ms)':>12}{'PSNR (dB)':>12}")
+    ref = None
+    for name, t in variants:
+        ms, im = time_render(svox.VolumeRenderer(t), c2w, focal, args)
+        if ref is None:
+            ref = im
+        print(f"{name:<18}{data_bytes(t) / 2 ** 20:>10.1f}{ms:>12.2f}"
+              f"{psnr(im, ref):>12.2f}")
+
+
+if __name__ == "__main__":
+    main()
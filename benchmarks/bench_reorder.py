@@ -0,0 +1,64 @@
+"""
+Render and query time of a tree with its nodes in refinement order and
+after reorder with each layout.
+
+Usage: python benchmarks/bench_reorder.py [tree.npz] [--device cuda]
+"""
+import argparse
+import time
+import torch
+import svox
+from common import add_scene_args, load_scene, camera, time_render
+
+
+def time_query(tree, points, args):
+    """
+    Median time of querying the points (ms)
+    """
+    times = []
+    for _ in range(args.repeats + 1):
+        if args.device != "cpu":
+            torch.cuda.synchronize()
+        start = time.perf_counter()
+        with torch.no_grad():
+            tree(points)
+        if args.device != "cpu":
+            torch.cuda.synchronize()
+        times.append((time.perf_counter() - start) * 1e3)
+    times = times[1:]
+    return sorted(times)[len(times) // 2]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    add_scene_args(parser)
+    parser.add_argument("--queries", type=int, default=1 << 20)
+    args = parser.parse_args()
+
+    tree = load_scene(args)
+    tree.shrink_to_fit()
+    c2w, focal = camera(tree, args)
+    gen = torch.Generator().manual_seed(0)
+    points = tree.tree2world(torch.rand((args.queries, 3), generator=gen).to(
+            device=args.device, dtype=tree.compute_dtype))
+
+    print(f"{tree}, {args.size}x{args.size} image and {args.queries} "
+          f"queries on {args.device}")
+    print(f"{'layout':<12}{'render (ms)':>14}{'speedup':>10}"
+          f"{'query (ms)':>14}{'speedup':>10}")
+    base = None
+    for layout in [None, "dfs", "bfs", "morton", "veb"]:
+        t = tree.partial()
+        if layout is not None:
+            t.reorder(layout)
+        render_ms, _ = time_render(svox.VolumeRenderer(t), c2w, focal, args)
+        query_ms = time_query(t, points, args)
+        if base is None:
+            base = render_ms, query_ms
+        print(f"{layout or 'as stored':<12}{render_ms:>14.2f}"
+              f"{base[0] / render_ms:>10.2f}{query_ms:>14.2f}"
+              f"{base[1] / query_ms:>10.2f}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,81 @@
+"""
+Scene, camera and timing shared by the rendering benchmarks
+"""
+import time
+import torch
+import svox
+
+
+def add_scene_args(parser):
+    parser.add_argument("tree", nargs="?", default=None,
+                        help="npz tree to load (N3Tree.save); default: a "
+                             "synthetic scene")
+    parser.add_argument("--device", default="cuda" if
+                        torch.cuda.is_available() else "cpu")
+    parser.add_argument("--size", type=int, default=512,
+                        help="image width and height")
+    parser.add_argument("--repeats", type=int, default=10)
+
+
+def load_scene(args, data_format="SH9"):
+    """
+    The tree given, or a synthetic one: a 64^3 grid of random data (of
+    data_format), refined once more around a sphere, with density in a
+    shell only
+    """
+    if args.tree is not None:
+        return svox.N3Tree.load(args.tree, device=args.device)
+    gen = torch.Generator().manual_seed(0)
+    tree = svox.N3Tree(data_format=data_format, init_refine=5)
+    r = (tree.corners + tree.lengths * 0.5 - 0.5).norm(dim=-1)
+    tree[(r > 0.3) & (r < 0.4)].refine()
+    tree.shrink_to_fit()
+    data = torch.randn(tree.data.shape, generator=gen) * 0.5
+    r = (tree.corners + tree.lengths * 0.5 - 0.5).norm(dim=-1)
+    sigma = torch.where((r > 0.32) & (r < 0.38),
+                        torch.rand(r.shape, generator=gen) * 100,
+                        torch.zeros(r.shape))
+    tree.data.data.copy_(data)
+    tree[:, -1:] = sigma[:, None]
+    return tree.partial(device=args.device)
+
+
+def camera(tree, args):
+    """
+    c2w looking down -z at the center of the tree, which fills about two
+    thirds of the image, and the focal length
+    """
+    c2w = torch.eye(4, device=args.device)
+    center = tree.tree2world(torch.full((1, 3), 0.5, device=args.device,
+                                        dtype=tree.compute_dtype))[0]
+    c2w[:3, 3] = center.float()
+    radius = (0.5 / tree.invradius).max().item()
+    c2w[2, 3] += 4 * radius
+    return c2w, float(args.size)
+
+
+def time_render(renderer, c2w, focal, args):
+    """
+    Median time of rendering the image (ms), and the image
+    """
+    def run():
+        with torch.no_grad():
+            return renderer.render_persp(c2w, width=args.size,
+                                         height=args.size, fx=focal)
+    im = run()
+    times = []
+    for _ in range(args.repeats):
+        if args.device != "cpu":
+            torch.cuda.synchronize()
+        start = time.perf_counter()
+        run()
+        if args.device != "cpu":
+            torch.cuda.synchronize()
+        times.append((time.perf_counter() - start) * 1e3)
+    return sorted(times)[len(times) // 2], im
+
+
+def psnr(im, ref):
+    mse = (im.float() - ref.float()).pow(2).mean().item()
+    return float("inf") if mse == 0 else -10 * torch.log10(
+            torch.tensor(mse)).item()
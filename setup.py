@@ -1,7 +1,7 @@
 from setuptools import setup
 import os.path as osp
 
-from torch.utils.cpp_extension import BuildExtension, CUDAExtension
+from torch.utils.cpp_extension import BuildExtension, CppExtension, CUDAExtension, CUDA_HOME
 
 ROOT_DIR = osp.dirname(osp.abspath(__file__))
 
@@ -11,19 +11,40 @@ exec(open('svox/version.py', 'r').read())
 CUDA_FLAGS = []
 INSTALL_REQUIREMENTS = []
 
+CPU_SOURCES = [
+    'svox/csrc/svox.cpp',
+    'svox/csrc/svox_cpu.cpp',
+    'svox/csrc/rt_cpu.cpp',
+    'svox/csrc/simd_avx2.cpp',
+    'svox/csrc/simd_avx512.cpp',
+    'svox/csrc/quantizer.cpp',
+    'svox/csrc/reorder.cpp',
+]
+CUDA_SOURCES = [
+    'svox/csrc/svox_kernel.cu',
+    'svox/csrc/rt_kernel.cu',
+]
+INCLUDE_DIRS = [osp.join(ROOT_DIR, "svox", "csrc", "include")]
+
 try:
-    ext_modules = [
-        CUDAExtension('svox.csrc', [
-            'svox/csrc/svox.cpp',
-            'svox/csrc/svox_kernel.cu',
-            'svox/csrc/rt_kernel.cu',
-            'svox/csrc/quantizer.cpp',
-        ], include_dirs=[osp.join(ROOT_DIR, "svox", "csrc", "include")],
-        optional=True),
-    ]
+    if CUDA_HOME is not None:
+        ext_modules = [
+            CUDAExtension('svox.csrc', CPU_SOURCES + CUDA_SOURCES,
+            include_dirs=INCLUDE_DIRS,
+            define_macros=[('WITH_CUDA', None)],
+            optional=True),
+        ]
+    else:
+        import warnings
+        warnings.warn("CUDA not found, building CPU-only extension")
+        ext_modules = [
+            CppExtension('svox.csrc', CPU_SOURCES,
+            include_dirs=INCLUDE_DIRS,
+            optional=True),
+        ]
 except:
     import warnings
-    warnings.warn("Failed to build CUDA extension")
+    warnings.warn("Failed to build C++/CUDA extension")
     ext_modules = []
 
 setup(
@@ -29,68 +29,7 @@
 #include <torch/extension.h>
 #include <cuda.h>
 #include <cuda_runtime.h>
-
-namespace {
-namespace device {
-
-template <typename scalar_t>
-__device__ __inline__ void clamp_coord(scalar_t* __restrict__ q) {
-    for (int i = 0; i < 3; ++i) {
-        q[i] = max(scalar_t(0.0), min(scalar_t(1.0) - 1e-6, q[i]));
-    }
-}
-
-template <typename scalar_t>
-__device__ __inline__ void transform_coord(scalar_t* __restrict__ q,
-                                           const scalar_t* __restrict__ offset,
-                                           const scalar_t* __restrict__ scaling) {
-    for (int i = 0; i < 3; ++i) {
-        q[i] = offset[i] + scaling[i] * q[i];
-    }
-}
-
-template <typename scalar_t>
-__device__ __inline__ scalar_t* query_single_from_root(
-    torch::PackedTensorAccessor64<scalar_t, 5, torch::RestrictPtrTraits>
-        data,
-    const torch::PackedTensorAccessor32<int32_t, 4, torch::RestrictPtrTraits>
-        child,
-    scalar_t* __restrict__ xyz_inout,
-    scalar_t* __restrict__ cube_sz_out,
-    int64_t* __restrict__ node_id_out=nullptr) {
-    const scalar_t N = child.size(1);
-    clamp_coord<scalar_t>(xyz_inout);
-
-    int32_t node_id = 0;
-    int32_t u, v, w;
-    *cube_sz_out = N;
-    while (true) {
-        xyz_inout[0] *= N;
-        xyz_inout[1] *= N;
-        xyz_inout[2] *= N;
-        u = floor(xyz_inout[0]);
-        v = floor(xyz_inout[1]);
-        w = floor(xyz_inout[2]);
-        xyz_inout[0] -= u;
-        xyz_inout[1] -= v;
-        xyz_inout[2] -= w;
-
-        const int32_t skip = child[node_id][u][v][w];
-        if (skip == 0) {
-            if (node_id_out != nullptr) {
-                *node_id_out = node_id * int64_t(N * N * N) +
-                               u * int32_t(N * N) + v * int32_t(N) + w;
-            }
-            return &data[node_id][u][v][w][0];
-        }
-        *cube_sz_out *= N;
-        node_id += skip;
-    }
-    return nullptr;
-}
-
-}  // namespace device
-}  // namespace
+#include "common.hpp"
 
 #define CUDA_GET_THREAD_ID(tid, Q) const int tid = blockIdx.x * blockDim.x + threadIdx.x; \
                       if (tid >= Q) return
@@ -134,39 +73,3 @@ __host__ int get_sp_cores(cudaDeviceProp devProp) {
 }
 }  // namespace
 
-
-#if !defined(__CUDA_ARCH__) || __CUDA_ARCH__ >= 600
-#else
-__device__ inline double atomicAdd(double* address, double val){
-    unsigned long long int* address_as_ull = (unsigned long long int*)address;
-    unsigned long long int old = *address_as_ull, assumed;
-    do {
-        assumed = old;
-        old = atomicCAS(address_as_ull, assumed,
-                __double_as_longlong(val + __longlong_as_double(assumed)));
-    } while (assumed != old);
-    return __longlong_as_double(old);
-}
-#endif
-
-__device__ inline void atomicMax(float* result, float value){
-    unsigned* result_as_u = (unsigned*)result;
-    unsigned old = *result_as_u, assumed;
-    do {
-        assumed = old;
-        old = atomicCAS(result_as_u, assumed,
-                __float_as_int(fmaxf(value, __int_as_float(assumed))));
-    } while (old != assumed);
-    return;
-}
-
-__device__ inline void atomicMax(double* result, double value){
-    unsigned long long int* result_as_ull = (unsigned long long int*)result;
-    unsigned long long int old = *result_as_ull, assumed;
-    do {
-        assumed = old;
-        old = atomicCAS(result_as_ull, assumed,
-                __double_as_longlong(fmaxf(value, __longlong_as_double(assumed))));
-    } while (old != assumed);
-    return;
-}
@@ -0,0 +1,450 @@
+/*
+ * Copyright 2021 PlenOctree Authors
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Helpers shared by the CUDA kernels and the CPU implementation.
+// Everything here must compile both with nvcc and a plain C++ compiler.
+
+#pragma once
+
+#include <torch/extension.h>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+
+#ifdef __CUDACC__
+#define SVOX_HOST_DEVICE __host__ __device__
+#define SVOX_CONSTANT __device__ __constant__
+#else
+#define SVOX_HOST_DEVICE
+#define SVOX_CONSTANT
+#endif
+
+#ifdef __CUDACC__
+#if !defined(__CUDA_ARCH__) || __CUDA_ARCH__ >= 600
+#else
+__device__ inline double atomicAdd(double* address, double val){
+    unsigned long long int* address_as_ull = (unsigned long long int*)address;
+    unsigned long long int old = *address_as_ull, assumed;
+    do {
+        assumed = old;
+        old = atomicCAS(address_as_ull, assumed,
+                __double_as_longlong(val + __longlong_as_double(assumed)));
+    } while (assumed != old);
+    return __longlong_as_double(old);
+}
+#endif
+
+__device__ inline float atomicMax(float* result, float value){
+    unsigned* result_as_u = (unsigned*)result;
+    unsigned old = *result_as_u, assumed;
+    do {
+        assumed = old;
+        old = atomicCAS(result_as_u, assumed,
+                __float_as_int(fmaxf(value, __int_as_float(assumed))));
+    } while (old != assumed);
+    return __int_as_float(old);
+}
+
+__device__ inline double atomicMax(double* result, double value){
+    unsigned long long int* result_as_ull = (unsigned long long int*)result;
+    unsigned long long int old = *result_as_ull, assumed;
+    do {
+        assumed = old;
+        old = atomicCAS(result_as_ull, assumed,
+                __double_as_longlong(fmax(value, __longlong_as_double(assumed))));
+    } while (old != assumed);
+    return __longlong_as_double(old);
+}
+#endif  // __CUDACC__
+
+namespace {
+namespace device {
+
+SVOX_HOST_DEVICE inline float _fmin(float a, float b) { return fminf(a, b); }
+SVOX_HOST_DEVICE inline double _fmin(double a, double b) { return fmin(a, b); }
+SVOX_HOST_DEVICE inline float _fmax(float a, float b) { return fmaxf(a, b); }
+SVOX_HOST_DEVICE inline double _fmax(double a, double b) { return fmax(a, b); }
+
+// Atomic add/max usable from both device code and CPU worker threads;
+// _atomic_max returns the previous value
+template <typename scalar_t>
+SVOX_HOST_DEVICE inline void _atomic_add(scalar_t* ptr, scalar_t val) {
+#ifdef __CUDA_ARCH__
+    atomicAdd(ptr, val);
+#else
+    auto* aptr = reinterpret_cast<std::atomic<scalar_t>*>(ptr);
+    scalar_t old = aptr->load(std::memory_order_relaxed);
+    while (!aptr->compare_exchange_weak(old, old + val,
+                std::memory_order_relaxed));
+#endif
+}
+
+template <typename scalar_t>
+SVOX_HOST_DEVICE inline scalar_t _atomic_max(scalar_t* ptr, scalar_t val) {
+#ifdef __CUDA_ARCH__
+    return atomicMax(ptr, val);
+#else
+    auto* aptr = reinterpret_cast<std::atomic<scalar_t>*>(ptr);
+    scalar_t old = aptr->load(std::memory_order_relaxed);
+    while (old < val && !aptr->compare_exchange_weak(old, val,
+                std::memory_order_relaxed));
+    return old;
+#endif
+}
+
+// Gradient sink adding straight into a dense buffer with atomics, as used
+// by the CUDA kernels. The CPU implementation instead accumulates into
+// thread-local buffers (see cpu_grad.hpp); both expose add(offset, val).
+template <typename scalar_t>
+struct AtomicGradSink {
+    scalar_t* __restrict__ data;
+    SVOX_HOST_DEVICE inline void add(int64_t offset, scalar_t val) {
+        _atomic_add(data + offset, val);
+    }
+};
+
+template <typename scalar_t>
+SVOX_HOST_DEVICE inline void clamp_coord(scalar_t* __restrict__ q) {
+    for (int i = 0; i < 3; ++i) {
+        q[i] = _fmax(scalar_t(0.0), _fmin(scalar_t(1.0 - 1e-6), q[i]));
+    }
+}
+
+template <typename scalar_t>
+SVOX_HOST_DEVICE inline void transform_coord(scalar_t* __restrict__ q,
+                                             const scalar_t* __restrict__ offset,
+                                             const scalar_t* __restrict__ scaling) {
+    for (int i = 0; i < 3; ++i) {
+        q[i] = offset[i] + scaling[i] * q[i];
+    }
+}
+
+SVOX_HOST_DEVICE inline int32_t _popcount(uint32_t x) {
+#ifdef __CUDA_ARCH__
+    return __popc(x);
+#else
+    return __builtin_popcount(x);
+#endif
+}
+
+// Number of 32-bit words of the child mask of a node of N^3 slots (see
+// TreeSpec::child_bits)
+SVOX_HOST_DEVICE inline int32_t child_mask_words(int32_t N) {
+    return (N * N * N + 31) >> 5;
+}
+
+// Number of slots with a child before slot i of node node_id, over the
+// whole tree, from the compact encoding of child (see TreeSpec::child_bits),
+// of words mask words per node: the node's base plus the number of set bits
+// before bit i of its mask
+SVOX_HOST_DEVICE inline int32_t child_rank(
+        const int32_t* __restrict__ child_bits,
+        int32_t words, int32_t node_id, int32_t i) {
+    const int32_t* __restrict__ bits =
+        child_bits + int64_t(node_id) * (words + 1);
+    int32_t rank = bits[0] +
+        _popcount(uint32_t(bits[1 + (i >> 5)]) & ((1u << (i & 31)) - 1));
+    for (int k = 1; k <= (i >> 5); ++k) rank += _popcount(bits[k]);
+    return rank;
+}
+
+// child entry of slot i of node node_id, from its compact encoding: 0 if
+// the slot's mask bit is clear, else the entry of child_list at its rank
+SVOX_HOST_DEVICE inline int32_t compact_child(
+        const int32_t* __restrict__ child_bits,
+        const int32_t* __restrict__ child_list,
+        int32_t words, int32_t node_id, int32_t i) {
+    const uint32_t word = child_bits[int64_t(node_id) * (words + 1) + 1 + (i >> 5)];
+    if (!((word >> (i & 31)) & 1)) return 0;
+    return child_list[child_rank(child_bits, words, node_id, i)];
+}
+
+// Row of the data holding the leaf at slot `leaf` (node * N^3 + i) of a tree
+// of branching factor N: the slot itself, or for leaf-packed data (see
+// TreeSpec::packed_leaves), the slot less the number of slots with a child
+// before it, counted from child_bits
+SVOX_HOST_DEVICE inline int64_t leaf_row(
+        const int32_t* __restrict__ child_bits,
+        bool packed_leaves, int32_t N, int64_t leaf) {
+    if (!packed_leaves) return leaf;
+    const int32_t N3 = N * N * N;
+    return leaf - child_rank(child_bits, child_mask_words(N),
+                             int32_t(leaf / N3), int32_t(leaf % N3));
+}
+
+// data_t is the type of the data (see PackedTreeSpec), scalar_t that of
+// the position. If child_bits is given, reads the child entries from it and
+// child_list (see TreeSpec::child_bits) instead of child; with
+// packed_leaves, data holds only the leaves (see TreeSpec::packed_leaves).
+template <typename scalar_t, typename data_t = scalar_t>
+SVOX_HOST_DEVICE inline data_t* query_single_from_root(
+    torch::PackedTensorAccessor64<data_t, 5, torch::RestrictPtrTraits>
+        data,
+    const torch::PackedTensorAccessor32<int32_t, 4, torch::RestrictPtrTraits>
+        child,
+    scalar_t* __restrict__ xyz_inout,
+    scalar_t* __restrict__ cube_sz_out,
+    int64_t* __restrict__ node_id_out=nullptr,
+    const int32_t* __restrict__ child_bits=nullptr,
+    const int32_t* __restrict__ child_list=nullptr,
+    bool packed_leaves=false) {
+    const scalar_t N = child.size(1);
+    const int32_t words = child_mask_words(child.size(1));
+    clamp_coord<scalar_t>(xyz_inout);
+
+    int32_t node_id = 0;
+    int32_t u, v, w;
+    *cube_sz_out = N;
+    while (true) {
+        xyz_inout[0] *= N;
+        xyz_inout[1] *= N;
+        xyz_inout[2] *= N;
+        u = floor(xyz_inout[0]);
+        v = floor(xyz_inout[1]);
+        w = floor(xyz_inout[2]);
+        xyz_inout[0] -= u;
+        xyz_inout[1] -= v;
+        xyz_inout[2] -= w;
+
+        const int32_t skip = child_bits != nullptr ?
+            compact_child(child_bits, child_list, words, node_id,
+                          (u * int32_t(N) + v) * int32_t(N) + w) :
+            child[node_id][u][v][w];
+        if (skip == 0) {
+            const int64_t slot = node_id * int64_t(N * N * N) +
+                                 u * int32_t(N * N) + v * int32_t(N) + w;
+            if (node_id_out != nullptr) *node_id_out = slot;
+            if (packed_leaves) {
+                return &data[leaf_row(child_bits, true, child.size(1), slot)]
+                            [0][0][0][0];
+            }
+            return &data[node_id][u][v][w][0];
+        }
+        *cube_sz_out *= N;
+        node_id += skip;
+    }
+    return nullptr;
+}
+
+// Number of tree levels whose nodes TreeWalker remembers; leaves below that
+// are still found, by descending from the deepest remembered node
+#define SVOX_WALKER_LEVELS 16
+
+// query_single_from_root for a sequence of nearby positions, e.g. the
+// samples along a ray. Keeps the path from the root to the last leaf found;
+// the next query pops only until a node containing the position, then
+// descends from there. Consecutive samples mostly land in a sibling of the
+// previous leaf, so this saves most of the dependent child loads of
+// descending from the root. For N a power of 2 the results are identical
+// to query_single_from_root.
+//
+// If the tree's ropes are given (see node_rope in svox_core.hpp), a
+// position outside the current node is instead reached by following the
+// rope of the face it left through, to the node of equal size across it (or
+// the node holding the larger leaf there), so crossing a node boundary costs
+// one rope load and usually a one-level descent rather than a pop to the
+// common ancestor and back.
+// node[l] then holds the node at depth l that was last entered, which need
+// not be an ancestor of node[l + 1].
+//
+// If the compact encoding of the tree's child array is given (see
+// TreeSpec::child_bits), the descent reads it instead, and finds the leaves
+// of leaf-packed data, as query_single_from_root does.
+template <typename scalar_t>
+struct TreeWalker {
+    // node[l] is the node at level l of the path (node[0] is the root),
+    // with minimum corner corner[l] in [0, 1]^3
+    int32_t node[SVOX_WALKER_LEVELS];
+    scalar_t corner[SVOX_WALKER_LEVELS][3];
+    // Number of levels on the path, and N^(levels - 1)
+    int levels;
+    scalar_t scale;
+    // [M, 6] ropes and [M, 2] parent_depth of the tree, or nullptr
+    const int32_t* __restrict__ ropes;
+    const int32_t* __restrict__ parent_depth;
+    // [M, N, N, N] maximum sigma of the subtree at each slot, or nullptr;
+    // see skip_empty
+    const scalar_t* __restrict__ max_sigma;
+    scalar_t empty_sigma;
+    // Compact child encoding of the tree, or nullptr, and whether its data
+    // is leaf-packed
+    const int32_t* __restrict__ child_bits;
+    const int32_t* __restrict__ child_list;
+    bool packed_leaves;
+
+    SVOX_HOST_DEVICE TreeWalker(const int32_t* __restrict__ ropes=nullptr,
+                                const int32_t* __restrict__ parent_depth=nullptr,
+                                const int32_t* __restrict__ child_bits=nullptr,
+                                const int32_t* __restrict__ child_list=nullptr,
+                                bool packed_leaves=false)
+        : levels(1), scale(1.0), ropes(ropes), parent_depth(parent_depth),
+          max_sigma(nullptr), empty_sigma(0.0), child_bits(child_bits),
+          child_list(child_list), packed_leaves(packed_leaves) {
+        node[0] = 0;
+        corner[0][0] = corner[0][1] = corner[0][2] = 0.0;
+    }
+
+    // Stop the descent at subtrees whose maximum (raw) sigma given by
+    // max_sigma is <= sigma; query then returns nullptr, with the position
+    // and cube size of that subtree's cell in place of a leaf voxel's, so
+    // the caller can step over the whole subtree at once
+    SVOX_HOST_DEVICE void skip_empty(const scalar_t* __restrict__ max_sigma,
+                                     scalar_t sigma) {
+        this->max_sigma = max_sigma;
+        empty_sigma = sigma;
+    }
+
+    template <typename data_t>
+    SVOX_HOST_DEVICE inline data_t* query(
+        torch::PackedTensorAccessor64<data_t, 5, torch::RestrictPtrTraits>
+            data,
+        const torch::PackedTensorAccessor32<int32_t, 4, torch::RestrictPtrTraits>
+            child,
+        scalar_t* __restrict__ xyz_inout,
+        scalar_t* __restrict__ cube_sz_out,
+        int64_t* __restrict__ node_id_out=nullptr) {
+        const scalar_t N = child.size(1);
+        clamp_coord<scalar_t>(xyz_inout);
+
+        int l = levels - 1;
+        if (ropes != nullptr) {
+            // Follow ropes until at a node containing the position
+            for (int hops = 0; ; ++hops) {
+                int face = -1;
+                for (int i = 0; i < 3 && face < 0; ++i) {
+                    const scalar_t local = (xyz_inout[i] - corner[l][i]) * scale;
+                    if (local < 0) face = 2 * i;
+                    else if (local >= 1) face = 2 * i + 1;
+                }
+                if (face < 0) break;
+                const int32_t next = hops < SVOX_WALKER_LEVELS ?
+                                     ropes[node[l] * 6 + face] : -1;
+                if (next < 0) {
+                    // Past the boundary of the tree (not reached by clamped
+                    // positions) or far from the last leaf; restart from the
+                    // root
+                    l = 0;
+                    scale = 1.0;
+                    break;
+                }
+                const int next_l = parent_depth[next * 2 + 1];
+                scalar_t next_scale = scale;
+                for (int j = l; j > next_l; --j) next_scale /= N;
+                // Its corner is that of its own grid cell containing the
+                // center of the equal-size region across the face
+                for (int i = 0; i < 3; ++i) {
+                    scalar_t center = corner[l][i] + scalar_t(0.5) / scale;
+                    if (i == face >> 1) center += (face & 1) ? 1 / scale : -1 / scale;
+                    corner[next_l][i] = floor(center * next_scale) / next_scale;
+                }
+                node[next_l] = next;
+                l = next_l;
+                scale = next_scale;
+            }
+            // Ropes only lead to neighbors of the same size or larger; climb
+            // out of empty ones so that their empty ancestor is stepped over
+            // as a whole
+            while (max_sigma != nullptr && l > 0) {
+                const int32_t parent_slot = parent_depth[node[l] * 2];
+                if (max_sigma[parent_slot] > empty_sigma) break;
+                const scalar_t parent_scale = scale / N;
+                for (int i = 0; i < 3; ++i) {
+                    corner[l - 1][i] = floor(corner[l][i] * parent_scale +
+                                             scalar_t(0.5) / N) / parent_scale;
+                }
+                node[l - 1] = parent_slot / int32_t(N * N * N);
+                scale = parent_scale;
+                --l;
+            }
+        } else {
+            // Pop to the deepest node containing the position
+            for (; l > 0; --l) {
+                bool inside = true;
+                for (int i = 0; i < 3; ++i) {
+                    const scalar_t local = (xyz_inout[i] - corner[l][i]) * scale;
+                    inside = inside && local >= 0 && local < 1;
+                }
+                if (inside) break;
+                scale /= N;
+            }
+        }
+        for (int i = 0; i < 3; ++i) {
+            xyz_inout[i] = (xyz_inout[i] - corner[l][i]) * scale;
+        }
+
+        const int32_t words = child_mask_words(child.size(1));
+        int32_t node_id = node[l];
+        int32_t u, v, w;
+        *cube_sz_out = scale * N;
+        while (true) {
+            xyz_inout[0] *= N;
+            xyz_inout[1] *= N;
+            xyz_inout[2] *= N;
+            u = floor(xyz_inout[0]);
+            v = floor(xyz_inout[1]);
+            w = floor(xyz_inout[2]);
+            xyz_inout[0] -= u;
+            xyz_inout[1] -= v;
+            xyz_inout[2] -= w;
+
+            const int32_t skip = child_bits != nullptr ?
+                compact_child(child_bits, child_list, words, node_id,
+                              (u * int32_t(N) + v) * int32_t(N) + w) :
+                child[node_id][u][v][w];
+            const int64_t slot = node_id * int64_t(N * N * N) +
+                                 u * int32_t(N * N) + v * int32_t(N) + w;
+            if (skip == 0) {
+                levels = l + 1;
+                if (node_id_out != nullptr) *node_id_out = slot;
+                if (packed_leaves) {
+                    return &data[leaf_row(child_bits, true, child.size(1), slot)]
+                                [0][0][0][0];
+                }
+                return &data[node_id][u][v][w][0];
+            }
+            if (max_sigma != nullptr && max_sigma[slot] <= empty_sigma) {
+                levels = l + 1;
+                if (node_id_out != nullptr) *node_id_out = -1;
+                return nullptr;
+            }
+            if (l + 1 < SVOX_WALKER_LEVELS) {
+                const scalar_t child_sz = 1 / *cube_sz_out;
+                corner[l + 1][0] = corner[l][0] + u * child_sz;
+                corner[l + 1][1] = corner[l][1] + v * child_sz;
+                corner[l + 1][2] = corner[l][2] + w * child_sz;
+                node[l + 1] = node_id + skip;
+                scale = *cube_sz_out;
+                ++l;
+            }
+            *cube_sz_out *= N;
+            node_id += skip;
+        }
+        return nullptr;
+    }
+};
+
+}  // namespace device
+}  // namespace
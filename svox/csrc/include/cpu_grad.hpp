@@ -0,0 +1,88 @@
+/*
+ * Copyright 2021 PlenOctree Authors
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Thread-local gradient accumulation for the CPU backward passes
+
+#pragma once
+
+#include <torch/extension.h>
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Rather than adding atomically into one dense gradient tensor (as the CUDA
+// kernels do), every worker thread adds into its own copy. Copies are split
+// into fixed-size blocks allocated on first touch, so a thread only pays for
+// the parts of the tree its rays actually visited. reduce_into() then sums
+// the copies block by block in parallel. (Not in an anonymous namespace, so
+// that it can be handed to the SIMD kernels in simd_*.cpp.)
+template <typename scalar_t>
+class GradBuffer {
+public:
+    static constexpr int BLOCK_BITS = 12;
+    static constexpr int64_t BLOCK_SIZE = int64_t(1) << BLOCK_BITS;
+
+    // Accumulator for one thread's copy; has the same add(offset, val)
+    // interface as device::AtomicGradSink
+    struct Sink {
+        std::unique_ptr<scalar_t[]>* blocks;
+        inline void add(int64_t offset, scalar_t val) {
+            std::unique_ptr<scalar_t[]>& block = blocks[offset >> BLOCK_BITS];
+            if (!block) block.reset(new scalar_t[BLOCK_SIZE]());
+            block[offset & (BLOCK_SIZE - 1)] += val;
+        }
+    };
+
+    explicit GradBuffer(int64_t size) :
+        size_(size), n_blocks_((size + BLOCK_SIZE - 1) >> BLOCK_BITS),
+        n_threads_(at::get_num_threads()), blocks_(n_threads_ * n_blocks_) {}
+
+    // Sink of the calling worker thread (within at::parallel_for)
+    Sink local() {
+        return Sink{&blocks_[at::get_thread_num() * n_blocks_]};
+    }
+
+    // Adds the sum of all thread copies to the contiguous buffer out
+    void reduce_into(scalar_t* out) {
+        at::parallel_for(0, n_blocks_, 1, [&](int64_t begin, int64_t end) {
+            for (int64_t b = begin; b < end; ++b) {
+                scalar_t* dst = out + (b << BLOCK_BITS);
+                const int64_t len = std::min(BLOCK_SIZE, size_ - (b << BLOCK_BITS));
+                for (int64_t t = 0; t < n_threads_; ++t) {
+                    const std::unique_ptr<scalar_t[]>& block =
+                        blocks_[t * n_blocks_ + b];
+                    if (!block) continue;
+                    for (int64_t i = 0; i < len; ++i) dst[i] += block[i];
+                }
+            }
+        });
+    }
+
+private:
+    const int64_t size_, n_blocks_, n_threads_;
+    std::vector<std::unique_ptr<scalar_t[]>> blocks_;
+};
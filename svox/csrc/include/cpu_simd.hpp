@@ -0,0 +1,166 @@
+/*
+ * Copyright 2021 PlenOctree Authors
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Runtime selection of the SIMD code paths used by the CPU implementation.
+// The SIMD kernels live in simd_avx2.cpp / simd_avx512.cpp, which compile
+// their code for the respective ISA via target pragmas (so the extension
+// itself is built for the baseline ISA); they are only called after
+// checking the CPU features at runtime.
+
+#pragma once
+
+#include <torch/extension.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include "data_spec_packed.cuh"
+#include "cpu_grad.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SVOX_X86_SIMD
+#endif
+
+enum CpuIsa {
+    CPU_ISA_SCALAR,
+    CPU_ISA_AVX2,
+    CPU_ISA_AVX512,
+};
+
+inline CpuIsa detect_cpu_isa() {
+#ifdef SVOX_X86_SIMD
+    __builtin_cpu_init();
+    // VL lets the compiler keep scalars in xmm16-31 without full zmm moves
+    // (which would leave the upper state dirty for the libm calls)
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl"))
+        return CPU_ISA_AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return CPU_ISA_AVX2;
+#endif
+    return CPU_ISA_SCALAR;
+}
+
+// ISA used by the CPU kernels: the best one supported by this CPU, which may
+// be lowered by setting the environment variable SVOX_CPU_ISA to one of
+// scalar, avx2, avx512 (e.g. for benchmarking)
+inline CpuIsa cpu_isa() {
+    static const CpuIsa isa = [] {
+        CpuIsa best = detect_cpu_isa();
+        const char* env = std::getenv("SVOX_CPU_ISA");
+        if (env == nullptr) return best;
+        CpuIsa want = best;
+        if (std::strcmp(env, "scalar") == 0) want = CPU_ISA_SCALAR;
+        else if (std::strcmp(env, "avx2") == 0) want = CPU_ISA_AVX2;
+        else if (std::strcmp(env, "avx512") == 0) want = CPU_ISA_AVX512;
+        return want < best ? want : best;
+    }();
+    return isa;
+}
+
+inline const char* cpu_isa_name(CpuIsa isa) {
+    switch (isa) {
+        case CPU_ISA_AVX2: return "avx2";
+        case CPU_ISA_AVX512: return "avx512";
+        default: return "scalar";
+    }
+}
+
+// Entry points of the SIMD kernels, one set per ISA
+#define SVOX_DECLARE_SIMD_KERNELS                                          \
+    /* Leaf index of the points [begin, end) (see svox_packet.hpp) */      \
+    void query_leaves(PackedTreeSpec<float>& tree,                         \
+                      const torch::PackedTensorAccessor32<float, 2,        \
+                          torch::RestrictPtrTraits> indices,               \
+                      int64_t begin, int64_t end, int64_t* leaf_out);      \
+    /* Packet-trace rays [begin, end) of a batch (see rt_packet.hpp),      \
+       recording their samples in log if it is not empty, and their        \
+       final transmittance in trans if not null */                         \
+    void render_rays(PackedTreeSpec<float>& tree,                          \
+                     PackedRaysSpec<float>& rays,                          \
+                     RenderOptions& opt,                                   \
+                     torch::PackedTensorAccessor32<float, 2,               \
+                         torch::RestrictPtrTraits> out,                    \
+                     int64_t begin, int64_t end,                           \
+                     PackedSampleLog<float>& log,                          \
+                     float* trans);                                        \
+    /* Packet-trace one square image tile */                               \
+    void render_image_tile(PackedTreeSpec<float>& tree,                    \
+                           PackedCameraSpec<float>& cam,                   \
+                           RenderOptions& opt,                             \
+                           int tile_size, int64_t tile,                    \
+                           torch::PackedTensorAccessor32<float, 3,         \
+                               torch::RestrictPtrTraits> out,              \
+                           float* trans);                                  \
+    /* Backward of render_rays, with the SH bases evaluated in SIMD;       \
+       in one pass if fwd_out and fwd_trans (from render_rays) are given */\
+    void render_rays_backward(PackedTreeSpec<float>& tree,                 \
+                              const torch::PackedTensorAccessor32<float, 2,\
+                                  torch::RestrictPtrTraits> grad_output,   \
+                              PackedRaysSpec<float>& rays,                 \
+                              RenderOptions& opt,                          \
+                              GradBuffer<float>::Sink& grad_data_out,      \
+                              int64_t begin, int64_t end,                  \
+                              PackedSampleLog<float>& log,                 \
+                              const float* fwd_out,                        \
+                              const float* fwd_trans);                     \
+    /* Backward of render_image_tile */                                    \
+    void render_image_tile_backward(PackedTreeSpec<float>& tree,           \
+                                    const torch::PackedTensorAccessor32<   \
+                                        float, 3,                          \
+                                        torch::RestrictPtrTraits>          \
+                                        grad_output,                       \
+                                    PackedCameraSpec<float>& cam,          \
+                                    RenderOptions& opt,                    \
+                                    int tile_size, int64_t tile,           \
+                                    GradBuffer<float>::Sink& grad_data_out,\
+                                    const float* fwd_out,                  \
+                                    const float* fwd_trans);               \
+    /* se_grad of rays [begin, end) */                                     \
+    void se_grad_rays(PackedTreeSpec<float>& tree,                         \
+                      PackedRaysSpec<float>& rays,                         \
+                      RenderOptions& opt,                                  \
+                      torch::PackedTensorAccessor32<float, 2,              \
+                          torch::RestrictPtrTraits> color_ref,             \
+                      torch::PackedTensorAccessor32<float, 2,              \
+                          torch::RestrictPtrTraits> color_out,             \
+                      GradBuffer<float>::Sink& grad_out,                   \
+                      GradBuffer<float>::Sink& hessdiag_out,               \
+                      int64_t begin, int64_t end);                         \
+    /* se_grad of one square image tile */                                 \
+    void se_grad_image_tile(PackedTreeSpec<float>& tree,                   \
+                            PackedCameraSpec<float>& cam,                  \
+                            RenderOptions& opt,                            \
+                            int tile_size, int64_t tile,                   \
+                            torch::PackedTensorAccessor32<float, 3,        \
+                                torch::RestrictPtrTraits> color_ref,       \
+                            torch::PackedTensorAccessor32<float, 3,        \
+                                torch::RestrictPtrTraits> color_out,       \
+                            GradBuffer<float>::Sink& grad_out,             \
+                            GradBuffer<float>::Sink& hessdiag_out);
+
+namespace simd {
+namespace avx2 { SVOX_DECLARE_SIMD_KERNELS }
+namespace avx512 { SVOX_DECLARE_SIMD_KERNELS }
+}  // namespace simd
@@ -26,20 +26,88 @@
 
 #pragma once
 
-#include <c10/cuda/CUDAGuard.h>
 #include <torch/extension.h>
+#include <cstdint>
 #include <tuple>
 
+#ifdef WITH_CUDA
+#include <c10/cuda/CUDAGuard.h>
 #define DEVICE_GUARD(_ten) \
     const at::cuda::OptionalCUDAGuard device_guard(device_of(_ten));
+#else
+#define DEVICE_GUARD(_ten)
+#endif
 
 // Changed from x.type().is_cuda() due to deprecation
 #define CHECK_CUDA(x) TORCH_CHECK(x.is_cuda(), #x " must be a CUDA tensor")
+#define CHECK_CPU(x) TORCH_CHECK(!x.is_cuda(), #x " must be a CPU tensor")
 #define CHECK_CONTIGUOUS(x) \
     TORCH_CHECK(x.is_contiguous(), #x " must be contiguous")
 #define CHECK_INPUT(x) \
     CHECK_CUDA(x);     \
     CHECK_CONTIGUOUS(x)
+#define CHECK_CPU_INPUT(x) \
+    CHECK_CPU(x);     \
+    CHECK_CONTIGUOUS(x)
+
+// Type the kernels compute in for tree data of type data_type: float for
+// data stored in half precision (float16 / bfloat16), quantized (int8, see
+// TreeSpec::quant) or as palette indices (int16 / int32, see
+// TreeSpec::palette), else data_type. The rays, outputs, gradient accumulators
+// and the tree's offset, scaling, extra_data, max_sigma and _weight_accum
+// are of this type.
+inline at::ScalarType compute_type(at::ScalarType data_type) {
+    return data_type == at::kHalf || data_type == at::kBFloat16 ||
+           data_type == at::kChar || data_type == at::kShort ||
+           data_type == at::kInt ? at::kFloat : data_type;
+}
+
+#define SVOX_PRIVATE_CASE_DATA_TYPE(_data_type, _data_t, _scalar_t, ...) \
+    case _data_type: {                                                   \
+        using data_t = _data_t;                                          \
+        using scalar_t = _scalar_t;                                      \
+        return __VA_ARGS__();                                            \
+    }
+
+#define SVOX_PRIVATE_CASES_FLOAT_DATA_TYPES(...)                          \
+    SVOX_PRIVATE_CASE_DATA_TYPE(at::kFloat, float, float, __VA_ARGS__)    \
+    SVOX_PRIVATE_CASE_DATA_TYPE(at::kDouble, double, double, __VA_ARGS__) \
+    SVOX_PRIVATE_CASE_DATA_TYPE(at::kHalf, at::Half, float, __VA_ARGS__)  \
+    SVOX_PRIVATE_CASE_DATA_TYPE(at::kBFloat16, at::BFloat16, float,       \
+                                __VA_ARGS__)
+
+// AT_DISPATCH_FLOATING_TYPES over the types of tree data, including half
+// precision: defines data_t, the type stored, and scalar_t = compute_type
+#define SVOX_DISPATCH_DATA_TYPES(TYPE, NAME, ...)                         \
+    [&] {                                                                 \
+        const at::ScalarType _st = TYPE;                                  \
+        switch (_st) {                                                    \
+            SVOX_PRIVATE_CASES_FLOAT_DATA_TYPES(__VA_ARGS__)              \
+            default:                                                      \
+                TORCH_CHECK(false, NAME, " not implemented for '",        \
+                            toString(_st), "'");                          \
+        }                                                                 \
+    }()
+
+// SVOX_DISPATCH_DATA_TYPES, also over int8 (quantized) and int16 / int32
+// (palette index) data, which only the forward rendering and the
+// acceleration structures it reads support
+#define SVOX_DISPATCH_RENDER_TYPES(TYPE, NAME, ...)                       \
+    [&] {                                                                 \
+        const at::ScalarType _st = TYPE;                                  \
+        switch (_st) {                                                    \
+            SVOX_PRIVATE_CASES_FLOAT_DATA_TYPES(__VA_ARGS__)              \
+            SVOX_PRIVATE_CASE_DATA_TYPE(at::kChar, int8_t, float,         \
+                                        __VA_ARGS__)                      \
+            SVOX_PRIVATE_CASE_DATA_TYPE(at::kShort, int16_t, float,       \
+                                        __VA_ARGS__)                      \
+            SVOX_PRIVATE_CASE_DATA_TYPE(at::kInt, int32_t, float,         \
+                                        __VA_ARGS__)                      \
+            default:                                                      \
+                TORCH_CHECK(false, NAME, " not implemented for '",        \
+                            toString(_st), "'");                          \
+        }                                                                 \
+    }()
 
 enum DataFormat {
     FORMAT_RGBA,
@@ -61,8 +129,20 @@ struct RaysSpec {
         TORCH_CHECK(dirs.is_floating_point());
         TORCH_CHECK(vdirs.is_floating_point());
     }
+
+    inline void check_cpu() {
+        CHECK_CPU_INPUT(origins);
+        CHECK_CPU_INPUT(dirs);
+        CHECK_CPU_INPUT(vdirs);
+        TORCH_CHECK(origins.is_floating_point());
+        TORCH_CHECK(dirs.is_floating_point());
+        TORCH_CHECK(vdirs.is_floating_point());
+    }
 };
 
+// data (and density) may be stored in half precision, and data quantized to
+// int8 (see quant) or replaced by palette indices (see palette); the other
+// floating point tensors are of compute_type(data.scalar_type())
 struct TreeSpec {
     torch::Tensor data;
     torch::Tensor child;
@@ -72,6 +152,67 @@ struct TreeSpec {
     torch::Tensor scaling;
     torch::Tensor _weight_accum;
     bool _weight_accum_max;
+    // Optional [M, 6] face neighbor links (see build_ropes); empty if absent
+    torch::Tensor ropes;
+    // Optional [M, N, N, N] subtree maximum sigma (see build_max_sigma);
+    // empty if absent
+    torch::Tensor max_sigma;
+    // Optional [M, N, N, N] copy of the raw sigma of each slot (data[..., -1]),
+    // which the renderer reads in place of the data; empty if absent
+    torch::Tensor density;
+    // For int8 data only (else empty): [M, N, N, N, 2 B] scale and offset of
+    // each of the B blocks of equal size into which the coefficients of a
+    // slot (data[..., :-1]) are split; a coefficient q stands for
+    // scale * q + offset. The sigma of such a tree is in density (of the
+    // compute type), and data[..., -1] is unused.
+    torch::Tensor quant;
+    // For int16 / int32 data only (else empty): [P, D - 1] palette (codebook)
+    // of coefficient vectors of the compute type. data is then [M, N, N, N, 1],
+    // the index of the palette row holding the coefficients of each slot, and
+    // the sigma of the tree is in density, as for int8 data.
+    torch::Tensor palette;
+    // Optional compact encoding of child, which the tree descents read in
+    // its place; empty if absent. child_bits is [M, 1 + W]: for each node,
+    // the index in child_list of the entry of its first child, then a mask of
+    // its slots that have a child, in W = ceil(N^3 / 32) words (bit i & 31 of
+    // word i >> 5 for slot i). child_list holds the (nonzero) child entries
+    // of those slots, in node and slot order. For octrees, 8 bytes per node
+    // plus 4 per child, instead of 32 bytes per node.
+    torch::Tensor child_bits;
+    torch::Tensor child_list;
+    // Whether data is leaf-packed: [L, 1, 1, 1, D], holding only the slots
+    // without a child, in slot order, where the leaf at slot s is at row s
+    // less the number of slots with a child before it (counted from
+    // child_bits, which is then required). Slot-indexed arrays (density,
+    // max_sigma, quant, the sample log) are unaffected.
+    bool packed_leaves = false;
+    // Optional dense bricks standing in for uniformly refined subtrees
+    // (see N3Tree.to_bricks); empty if absent. bricks is [B, R, R, R, D], of
+    // the type of data (which must be floating point); brick is [M] int32,
+    // for each node the brick holding the R^3 cells of its subtree, or -1.
+    // The slots of such a node have no child; their data holds the mean
+    // coefficients and the maximum sigma of the cells they cover, which all
+    // but trace_ray read. Only the forward pass without a sample log
+    // supports bricks.
+    torch::Tensor bricks;
+    torch::Tensor brick;
+
+    // Number of values the data holds per slot (coefficients and sigma),
+    // data.size(4) unless the data indexes a palette
+    inline int64_t data_dim() {
+        return palette.defined() && palette.numel() ?
+            palette.size(1) + 1 : data.size(4);
+    }
+
+    // Whether the tree has dense bricks (see bricks)
+    inline bool has_bricks() {
+        return bricks.defined() && bricks.numel();
+    }
+
+    // Options of the outputs and gradient buffers of the kernels
+    inline torch::TensorOptions compute_options() {
+        return data.options().dtype(compute_type(data.scalar_type()));
+    }
 
     inline void check() {
         CHECK_INPUT(data);
@@ -85,6 +226,198 @@ struct TreeSpec {
         if (_weight_accum.numel()) {
             CHECK_INPUT(_weight_accum);
         }
+        if (ropes.defined() && ropes.numel()) {
+            CHECK_INPUT(ropes);
+        }
+        if (max_sigma.defined() && max_sigma.numel()) {
+            CHECK_INPUT(max_sigma);
+        }
+        if (density.defined() && density.numel()) {
+            CHECK_INPUT(density);
+            TORCH_CHECK(density.numel() == child.numel(),
+                        "density must have one value per slot of child");
+        }
+        if (quant.defined() && quant.numel()) {
+            CHECK_INPUT(quant);
+        }
+        if (palette.defined() && palette.numel()) {
+            CHECK_INPUT(palette);
+        }
+        if (child_bits.defined() && child_bits.numel()) {
+            CHECK_INPUT(child_bits);
+            CHECK_INPUT(child_list);
+        }
+        if (has_bricks()) {
+            CHECK_INPUT(bricks);
+            CHECK_INPUT(brick);
+        }
+        check_quant();
+        check_palette();
+        check_child_bits();
+        check_packed_leaves();
+        check_bricks();
+    }
+
+    inline void check_cpu() {
+        CHECK_CPU_INPUT(data);
+        CHECK_CPU_INPUT(child);
+        CHECK_CPU_INPUT(parent_depth);
+        if (extra_data.numel()) {
+            CHECK_CPU_INPUT(extra_data);
+        }
+        CHECK_CPU_INPUT(offset);
+        CHECK_CPU_INPUT(scaling);
+        if (_weight_accum.numel()) {
+            CHECK_CPU_INPUT(_weight_accum);
+        }
+        if (ropes.defined() && ropes.numel()) {
+            CHECK_CPU_INPUT(ropes);
+        }
+        if (max_sigma.defined() && max_sigma.numel()) {
+            CHECK_CPU_INPUT(max_sigma);
+        }
+        if (density.defined() && density.numel()) {
+            CHECK_CPU_INPUT(density);
+            TORCH_CHECK(density.numel() == child.numel(),
+                        "density must have one value per slot of child");
+        }
+        if (quant.defined() && quant.numel()) {
+            CHECK_CPU_INPUT(quant);
+        }
+        if (palette.defined() && palette.numel()) {
+            CHECK_CPU_INPUT(palette);
+        }
+        if (child_bits.defined() && child_bits.numel()) {
+            CHECK_CPU_INPUT(child_bits);
+            CHECK_CPU_INPUT(child_list);
+        }
+        if (has_bricks()) {
+            CHECK_CPU_INPUT(bricks);
+            CHECK_CPU_INPUT(brick);
+        }
+        check_quant();
+        check_palette();
+        check_child_bits();
+        check_packed_leaves();
+        check_bricks();
+    }
+
+    inline void check_quant() {
+        const bool quantized = quant.defined() && quant.numel();
+        TORCH_CHECK(quantized == (data.scalar_type() == at::kChar),
+                    "quant must be given for, and only for, int8 data");
+        if (!quantized) return;
+        TORCH_CHECK(density.defined() && density.numel() &&
+                    density.scalar_type() == compute_type(at::kChar) &&
+                    quant.scalar_type() == compute_type(at::kChar),
+                    "int8 data requires density, and quant and density "
+                    "of the compute dtype");
+        TORCH_CHECK(quant.dim() == 5 && quant.size(4) % 2 == 0 &&
+                    quant.numel() / quant.size(4) == child.numel(),
+                    "quant must be of shape [M, N, N, N, 2 B]");
+        TORCH_CHECK((data.size(4) - 1) % (quant.size(4) / 2) == 0,
+                    "quant blocks must split the coefficients evenly");
+    }
+
+    inline void check_child_bits() {
+        if (!child_bits.defined() || !child_bits.numel()) return;
+        const int64_t N3 = child.size(1) * child.size(2) * child.size(3);
+        TORCH_CHECK(child_bits.scalar_type() == at::kInt &&
+                    child_list.scalar_type() == at::kInt,
+                    "child_bits and child_list must be int32");
+        TORCH_CHECK(child_bits.dim() == 2 &&
+                    child_bits.size(0) == child.size(0) &&
+                    child_bits.size(1) == 1 + (N3 + 31) / 32,
+                    "child_bits must be of shape [M, 1 + ceil(N^3 / 32)]");
+    }
+
+    inline void check_packed_leaves() {
+        if (!packed_leaves) return;
+        TORCH_CHECK(child_bits.defined() && child_bits.numel(),
+                    "leaf-packed data requires child_bits");
+        TORCH_CHECK(data.size(1) == 1 && data.size(2) == 1 &&
+                    data.size(3) == 1 &&
+                    data.size(0) == child.numel() - child_list.numel(),
+                    "leaf-packed data must be of shape [L, 1, 1, 1, D], for "
+                    "the L slots without a child");
+    }
+
+    inline void check_bricks() {
+        if (!has_bricks()) return;
+        TORCH_CHECK(data.is_floating_point() &&
+                    bricks.scalar_type() == data.scalar_type(),
+                    "bricks need floating point data, and must be of its type");
+        TORCH_CHECK(bricks.dim() == 5 && bricks.size(1) == bricks.size(2) &&
+                    bricks.size(1) == bricks.size(3) &&
+                    bricks.size(4) == data.size(4),
+                    "bricks must be of shape [B, R, R, R, D]");
+        TORCH_CHECK(brick.scalar_type() == at::kInt && brick.dim() == 1 &&
+                    brick.size(0) == child.size(0),
+                    "brick must be int32, of shape [M]");
+    }
+
+    // For the passes other than the forward one without a sample log
+    inline void check_no_bricks() {
+        TORCH_CHECK(!has_bricks(), "Trees with bricks are only rendered "
+                    "forward, without a sample log (see TreeSpec::bricks)");
+    }
+
+    inline void check_palette() {
+        const bool indexed = palette.defined() && palette.numel();
+        TORCH_CHECK(indexed == (data.scalar_type() == at::kShort ||
+                                data.scalar_type() == at::kInt),
+                    "palette must be given for, and only for, int16/int32 data");
+        if (!indexed) return;
+        TORCH_CHECK(density.defined() && density.numel() &&
+                    density.scalar_type() == compute_type(at::kInt) &&
+                    palette.scalar_type() == compute_type(at::kInt),
+                    "palette index data requires density, and palette and "
+                    "density of the compute dtype");
+        TORCH_CHECK(palette.dim() == 2 && data.size(4) == 1,
+                    "palette must be of shape [P, D - 1], and data of shape "
+                    "[M, N, N, N, 1]");
+    }
+};
+
+// Per-ray log of the samples composited by the forward pass (see
+// volume_render_log), which the backward pass replays instead of walking
+// the tree again. Holds up to S samples per ray; an empty log is absent.
+struct SampleLog {
+    // [B, S] int32 leaf of each sample, indexing data.view(-1, data_dim)
+    torch::Tensor leaf;
+    // [B, S] step length of each sample
+    torch::Tensor delta_t;
+    // [B] int32 number of samples logged, -1 if the ray had more than S
+    torch::Tensor count;
+
+    inline bool empty() {
+        return !leaf.defined() || leaf.numel() == 0;
+    }
+
+    inline void check_sizes(torch::Tensor& data, int64_t n_rays) {
+        TORCH_CHECK(leaf.scalar_type() == at::kInt, "leaf must be int32");
+        TORCH_CHECK(count.scalar_type() == at::kInt, "count must be int32");
+        TORCH_CHECK(delta_t.scalar_type() == compute_type(data.scalar_type()),
+                    "delta_t must have the tree's compute dtype");
+        TORCH_CHECK(leaf.ndimension() == 2 && leaf.size(0) == n_rays);
+        TORCH_CHECK(delta_t.sizes() == leaf.sizes());
+        TORCH_CHECK(count.ndimension() == 1 && count.size(0) == n_rays);
+        TORCH_CHECK(data.numel() / data.size(4) <= INT32_MAX,
+                    "Too many leaves for a sample log");
+    }
+
+    inline void check(torch::Tensor& data, int64_t n_rays) {
+        CHECK_INPUT(leaf);
+        CHECK_INPUT(delta_t);
+        CHECK_INPUT(count);
+        check_sizes(data, n_rays);
+    }
+
+    inline void check_cpu(torch::Tensor& data, int64_t n_rays) {
+        CHECK_CPU_INPUT(leaf);
+        CHECK_CPU_INPUT(delta_t);
+        CHECK_CPU_INPUT(count);
+        check_sizes(data, n_rays);
     }
 };
 
@@ -101,6 +434,13 @@ struct CameraSpec {
         TORCH_CHECK(c2w.ndimension() == 2);
         TORCH_CHECK(c2w.size(1) == 4);
     }
+
+    inline void check_cpu() {
+        CHECK_CPU_INPUT(c2w);
+        TORCH_CHECK(c2w.is_floating_point());
+        TORCH_CHECK(c2w.ndimension() == 2);
+        TORCH_CHECK(c2w.size(1) == 4);
+    }
 };
 
 // CUDA-ready
@@ -123,6 +463,9 @@ struct RenderOptions {
 
     bool density_softplus;
     float rgb_padding;
+
+    // Use the approximate exp/log of rt_core.hpp in the renderer
+    bool fast_math;
 };
 
 using QueryResult = std::tuple<torch::Tensor, torch::Tensor>;
@@ -26,6 +26,7 @@
 
 #pragma once
 #include "data_spec.hpp"
+#include <type_traits>
 
 template<class scalar_t>
 struct SingleRaySpec {
@@ -38,8 +39,8 @@ template<class scalar_t>
 struct PackedRaysSpec {
     PackedRaysSpec(RaysSpec& ray) :
         origins(ray.origins.packed_accessor32<scalar_t, 2, torch::RestrictPtrTraits>()),
-        vdirs(ray.vdirs.packed_accessor32<scalar_t, 2, torch::RestrictPtrTraits>()),
-        dirs(ray.dirs.packed_accessor32<scalar_t, 2, torch::RestrictPtrTraits>()) { }
+        dirs(ray.dirs.packed_accessor32<scalar_t, 2, torch::RestrictPtrTraits>()),
+        vdirs(ray.vdirs.packed_accessor32<scalar_t, 2, torch::RestrictPtrTraits>()) { }
 
     const torch::PackedTensorAccessor32<scalar_t, 2, torch::RestrictPtrTraits>
         origins;
@@ -53,20 +54,54 @@ struct PackedRaysSpec {
     }
 };
 
-template<class scalar_t>
+// Type of the density of a tree of data of type data_t: that of the data,
+// but the compute type scalar_t for integer data (int8, see TreeSpec::quant,
+// or palette indices, see TreeSpec::palette)
+template<class scalar_t, class data_t>
+struct DensityType {
+    using type = typename std::conditional<std::is_integral<data_t>::value,
+                                           scalar_t, data_t>::type;
+};
+
+// data_t is the type of the stored data (and density), scalar_t that of the
+// rest of the tree and of the computations (see compute_type)
+template<class scalar_t, class data_t = scalar_t>
 struct PackedTreeSpec {
+    using density_t = typename DensityType<scalar_t, data_t>::type;
+
     PackedTreeSpec(TreeSpec& tree) :
-        data(tree.data.packed_accessor64<scalar_t, 5, torch::RestrictPtrTraits>()),
+        data(tree.data.packed_accessor64<data_t, 5, torch::RestrictPtrTraits>()),
         child(tree.child.packed_accessor32<int32_t, 4, torch::RestrictPtrTraits>()),
         parent_depth(tree.parent_depth.packed_accessor32<int32_t, 2, torch::RestrictPtrTraits>()),
         extra_data(tree.extra_data.packed_accessor32<scalar_t, 2, torch::RestrictPtrTraits>()),
         offset(tree.offset.data<scalar_t>()),
         scaling(tree.scaling.data<scalar_t>()),
         weight_accum(tree._weight_accum.numel() > 0 ? tree._weight_accum.data<scalar_t>() : nullptr),
-        weight_accum_max(tree._weight_accum_max)
+        weight_accum_max(tree._weight_accum_max),
+        ropes(tree.ropes.defined() && tree.ropes.numel() > 0 ? tree.ropes.data<int32_t>() : nullptr),
+        max_sigma(tree.max_sigma.defined() && tree.max_sigma.numel() > 0 ?
+                  tree.max_sigma.data<scalar_t>() : nullptr),
+        density(tree.density.defined() && tree.density.numel() > 0 ?
+                tree.density.data<density_t>() : nullptr),
+        quant(tree.quant.defined() && tree.quant.numel() > 0 ?
+              tree.quant.data<scalar_t>() : nullptr),
+        quant_blocks(quant != nullptr ? tree.quant.size(4) / 2 : 0),
+        quant_block_size(quant != nullptr ?
+                         (tree.data.size(4) - 1) / quant_blocks : 0),
+        palette(tree.palette.defined() && tree.palette.numel() > 0 ?
+                tree.palette.data<scalar_t>() : nullptr),
+        palette_dim(palette != nullptr ? tree.palette.size(1) : 0),
+        child_bits(tree.child_bits.defined() && tree.child_bits.numel() > 0 ?
+                   tree.child_bits.data<int32_t>() : nullptr),
+        child_list(child_bits != nullptr ?
+                   tree.child_list.data<int32_t>() : nullptr),
+        packed_leaves(tree.packed_leaves),
+        bricks(tree.has_bricks() ? tree.bricks.data<data_t>() : nullptr),
+        brick(bricks != nullptr ? tree.brick.data<int32_t>() : nullptr),
+        brick_res(bricks != nullptr ? tree.bricks.size(1) : 0)
      { }
 
-    torch::PackedTensorAccessor64<scalar_t, 5, torch::RestrictPtrTraits>
+    torch::PackedTensorAccessor64<data_t, 5, torch::RestrictPtrTraits>
         data;
     const torch::PackedTensorAccessor32<int32_t, 4, torch::RestrictPtrTraits>
         child;
@@ -78,6 +113,51 @@ struct PackedTreeSpec {
     const scalar_t* __restrict__ scaling;
     scalar_t* __restrict__ weight_accum;
     bool weight_accum_max;
+    const int32_t* __restrict__ ropes;
+    const scalar_t* __restrict__ max_sigma;
+    const density_t* __restrict__ density;
+    // Scale and offset of the blocks of int8 data (see TreeSpec::quant);
+    // null for other data
+    const scalar_t* __restrict__ quant;
+    int32_t quant_blocks;
+    int32_t quant_block_size;
+    // Palette rows indexed by the data (see TreeSpec::palette); null for
+    // other data
+    const scalar_t* __restrict__ palette;
+    int32_t palette_dim;
+    // Compact encoding of child (see TreeSpec::child_bits); null if absent
+    const int32_t* __restrict__ child_bits;
+    const int32_t* __restrict__ child_list;
+    // Whether data holds only the leaves (see TreeSpec::packed_leaves)
+    bool packed_leaves;
+    // Dense bricks of side brick_res, and the brick of each node (see
+    // TreeSpec::bricks); null if absent
+    const data_t* __restrict__ bricks;
+    const int32_t* __restrict__ brick;
+    int32_t brick_res;
+};
+
+// One ray's row of a SampleLog; leaf is null if there is no log
+template<class scalar_t>
+struct SingleSampleLog {
+    int32_t* __restrict__ leaf = nullptr;
+    scalar_t* __restrict__ delta_t = nullptr;
+    int32_t* __restrict__ count = nullptr;
+    int32_t capacity = 0;
+};
+
+template<class scalar_t>
+struct PackedSampleLog {
+    PackedSampleLog(SampleLog& log) :
+        leaf(log.empty() ? nullptr : log.leaf.data<int32_t>()),
+        delta_t(log.empty() ? nullptr : log.delta_t.data<scalar_t>()),
+        count(log.empty() ? nullptr : log.count.data<int32_t>()),
+        capacity(log.empty() ? 0 : log.leaf.size(1)) { }
+
+    int32_t* __restrict__ leaf;
+    scalar_t* __restrict__ delta_t;
+    int32_t* __restrict__ count;
+    int32_t capacity;
 };
 
 template<class scalar_t>
@@ -0,0 +1,1292 @@
+/*
+ * Copyright 2021 PlenOctree Authors
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Ray tracing routines shared by the CUDA kernels (rt_kernel.cu)
+// and the CPU implementation (rt_cpu.cpp)
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include "common.hpp"
+#include "data_spec_packed.cuh"
+
+namespace {
+namespace device {
+// SH Coefficients from https://github.com/google/spherical-harmonics
+SVOX_CONSTANT const float C0 = 0.28209479177387814;
+SVOX_CONSTANT const float C1 = 0.4886025119029199;
+SVOX_CONSTANT const float C2[] = {
+    1.0925484305920792,
+    -1.0925484305920792,
+    0.31539156525252005,
+    -1.0925484305920792,
+    0.5462742152960396
+};
+
+SVOX_CONSTANT const float C3[] = {
+    -0.5900435899266435,
+    2.890611442640554,
+    -0.4570457994644658,
+    0.3731763325901154,
+    -0.4570457994644658,
+    1.445305721320277,
+    -0.5900435899266435
+};
+
+SVOX_CONSTANT const float C4[] = {
+    2.5033429417967046,
+    -1.7701307697799304,
+    0.9461746957575601,
+    -0.6690465435572892,
+    0.10578554691520431,
+    -0.6690465435572892,
+    0.47308734787878004,
+    -1.7701307697799304,
+    0.6258357354491761,
+};
+
+
+// expf / logf, or with fast (opt.fast_math) approximations: in device code
+// the __expf / __logf intrinsics (exp: max error 2 + 1.173 |x| ulp; log: max
+// absolute error 2^-21.41 on [0.5, 2], else 3 ulp; see the CUDA programming
+// guide), on the host the polynomials of vexp_fast / vlog_fast (see
+// simd.hpp; exp: max relative error 3e-6; log, of positive normal x: max
+// absolute error 4e-6), inlined in place of calls into libm.
+SVOX_HOST_DEVICE inline float _fast_exp(float x) {
+#ifdef __CUDA_ARCH__
+    return __expf(x);
+#else
+    x = x < -87.f ? -87.f : (x > 88.f ? 88.f : x);
+    // Rounded to the nearest integer by the addition of 1.5 * 2^23
+    const float fn = (x * 1.44269504f + 12582912.f) - 12582912.f;
+    x -= fn * 0.693359375f;
+    x -= fn * -2.12194440e-4f;
+    float y = 4.151289141e-2f;
+    y = y * x + 1.678731137e-1f;
+    y = y * x + 5.000301432e-1f;
+    y = y * x + 9.999669306e-1f;
+    y = y * x + 1.f;
+    const int32_t pow2_bits = (int32_t(fn) + 127) << 23;
+    float pow2;
+    memcpy(&pow2, &pow2_bits, sizeof(pow2));
+    return y * pow2;
+#endif
+}
+
+SVOX_HOST_DEVICE inline float _fast_log(float x) {
+#ifdef __CUDA_ARCH__
+    return __logf(x);
+#else
+    // x = 2^e m with m in [sqrt(1/2), sqrt(2)), and log(m) = log(1 + f)
+    int32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    float e = float((bits >> 23) - 127);
+    bits = (bits & 0x007fffff) | 0x3f800000;
+    float m;
+    memcpy(&m, &bits, sizeof(m));
+    if (m > 1.41421356f) {
+        m *= 0.5f;
+        e += 1.f;
+    }
+    const float f = m - 1.f, z = f * f;
+    float r = -1.470183767e-1f;
+    r = r * f + 2.192427519e-1f;
+    r = r * f - 2.525221590e-1f;
+    r = r * f + 3.327249280e-1f;
+    return f - 0.5f * z + f * z * r + e * -2.12194440e-4f + e * 0.693359375f;
+#endif
+}
+
+SVOX_HOST_DEVICE inline float _exp(float x, bool fast) {
+    return fast ? _fast_exp(x) : expf(x);
+}
+
+// Shifted softplus log(1 + exp(x - 1)) applied to the density; x - 1 past
+// 20, where it rounds to x - 1, is passed through (as torch's softplus
+// does) rather than overflowing exp
+template <typename scalar_t>
+SVOX_HOST_DEVICE inline float _softplus_m1(scalar_t x, bool fast) {
+    const float y = float(x) - 1.f;
+    if (y > 20.f) return y;
+    return fast ? _fast_log(1 + _fast_exp(y)) : logf(1 + expf(y));
+}
+
+SVOX_HOST_DEVICE inline float _sigmoid(float x, bool fast) {
+#ifdef __CUDA_ARCH__
+    if (fast) return __fdividef(1.f, 1.f + __expf(-x));
+#endif
+    return 1 / (1 + _exp(-x, fast));
+}
+
+template<typename scalar_t>
+SVOX_HOST_DEVICE inline static scalar_t _norm(
+                scalar_t* dir) {
+    return sqrtf(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+}
+
+template<typename scalar_t>
+SVOX_HOST_DEVICE inline static void _normalize(
+                scalar_t* dir) {
+    scalar_t norm = _norm(dir);
+    dir[0] /= norm; dir[1] /= norm; dir[2] /= norm;
+}
+
+template<typename scalar_t>
+SVOX_HOST_DEVICE inline static scalar_t _dot3(
+        const scalar_t* __restrict__ u,
+        const scalar_t* __restrict__ v) {
+    return u[0] * v[0] + u[1] * v[1] + u[2] * v[2];
+}
+
+
+// Calculate basis functions depending on format, for given view directions
+template <typename scalar_t>
+SVOX_HOST_DEVICE inline void maybe_precalc_basis(
+    const int format,
+    const int basis_dim,
+    const torch::PackedTensorAccessor32<scalar_t, 2, torch::RestrictPtrTraits>
+        extra,
+    const scalar_t* __restrict__ dir,
+    scalar_t* __restrict__ out) {
+    switch(format) {
+        case FORMAT_ASG:
+            {
+                // UNTESTED ASG
+                for (int i = 0; i < basis_dim; ++i) {
+                    const auto& ptr = extra[i];
+                    scalar_t S = _dot3(dir, &ptr[8]);
+                    scalar_t dot_x = _dot3(dir, &ptr[2]);
+                    scalar_t dot_y = _dot3(dir, &ptr[5]);
+                    out[i] = S * expf(-ptr[0] * dot_x * dot_x
+                                      -ptr[1] * dot_y * dot_y) / basis_dim;
+                }
+            }  // ASG
+            break;
+        case FORMAT_SG:
+            {
+                for (int i = 0; i < basis_dim; ++i) {
+                    const auto& ptr = extra[i];
+                    out[i] = expf(ptr[0] * (_dot3(dir, &ptr[1]) - 1.f)) / basis_dim;
+                }
+            }  // SG
+            break;
+        case FORMAT_SH:
+            {
+                out[0] = C0;
+                const scalar_t x = dir[0], y = dir[1], z = dir[2];
+                const scalar_t xx = x * x, yy = y * y, zz = z * z;
+                const scalar_t xy = x * y, yz = y * z, xz = x * z;
+                switch (basis_dim) {
+                    case 25:
+                        out[16] = C4[0] * xy * (xx - yy);
+                        out[17] = C4[1] * yz * (3 * xx - yy);
+                        out[18] = C4[2] * xy * (7 * zz - 1.f);
+                        out[19] = C4[3] * yz * (7 * zz - 3.f);
+                        out[20] = C4[4] * (zz * (35 * zz - 30) + 3);
+                        out[21] = C4[5] * xz * (7 * zz - 3);
+                        out[22] = C4[6] * (xx - yy) * (7 * zz - 1.f);
+                        out[23] = C4[7] * xz * (xx - 3 * yy);
+                        out[24] = C4[8] * (xx * (xx - 3 * yy) - yy * (3 * xx - yy));
+                        [[fallthrough]];
+                    case 16:
+                        out[9] = C3[0] * y * (3 * xx - yy);
+                        out[10] = C3[1] * xy * z;
+                        out[11] = C3[2] * y * (4 * zz - xx - yy);
+                        out[12] = C3[3] * z * (2 * zz - 3 * xx - 3 * yy);
+                        out[13] = C3[4] * x * (4 * zz - xx - yy);
+                        out[14] = C3[5] * z * (xx - yy);
+                        out[15] = C3[6] * x * (xx - 3 * yy);
+                        [[fallthrough]];
+                    case 9:
+                        out[4] = C2[0] * xy;
+                        out[5] = C2[1] * yz;
+                        out[6] = C2[2] * (2.0 * zz - xx - yy);
+                        out[7] = C2[3] * xz;
+                        out[8] = C2[4] * (xx - yy);
+                        [[fallthrough]];
+                    case 4:
+                        out[1] = -C1 * y;
+                        out[2] = C1 * z;
+                        out[3] = -C1 * x;
+                }
+            }  // SH
+            break;
+
+        default:
+            // Do nothing
+            break;
+    }  // switch
+}
+
+// Contraction of the basis functions with a leaf's coefficients for one
+// output channel, as used by the tracing routines below. The CPU SIMD
+// kernels substitute a vectorized version (see sh_simd.hpp).
+struct ScalarBasisOps {
+    template <typename scalar_t, typename data_t>
+    SVOX_HOST_DEVICE static inline scalar_t dot(
+            const scalar_t* __restrict__ basis_fn,
+            const data_t* __restrict__ coeff,
+            int min_comp, int max_comp) {
+        scalar_t tmp = 0.0;
+        for (int i = min_comp; i <= max_comp; ++i) {
+            tmp += basis_fn[i] * scalar_t(coeff[i]);
+        }
+        return tmp;
+    }
+};
+
+template <typename scalar_t>
+SVOX_HOST_DEVICE inline scalar_t _get_delta_scale(
+    const scalar_t* __restrict__ scaling,
+    scalar_t* __restrict__ dir) {
+    dir[0] *= scaling[0];
+    dir[1] *= scaling[1];
+    dir[2] *= scaling[2];
+    scalar_t delta_scale = 1.f / _norm(dir);
+    dir[0] *= delta_scale;
+    dir[1] *= delta_scale;
+    dir[2] *= delta_scale;
+    return delta_scale;
+}
+
+template <typename scalar_t>
+SVOX_HOST_DEVICE inline void _dda_unit(
+        const scalar_t* __restrict__ cen,
+        const scalar_t* __restrict__ invdir,
+        scalar_t* __restrict__ tmin,
+        scalar_t* __restrict__ tmax) {
+    // Intersect unit AABB
+    scalar_t t1, t2;
+    *tmin = 0.0f;
+    *tmax = 1e9f;
+#pragma unroll
+    for (int i = 0; i < 3; ++i) {
+        t1 = - cen[i] * invdir[i];
+        t2 = t1 +  invdir[i];
+        *tmin = _fmax(*tmin, _fmin(t1, t2));
+        *tmax = _fmin(*tmax, _fmax(t1, t2));
+    }
+}
+
+template <typename scalar_t>
+SVOX_HOST_DEVICE inline void cam2world_ray(
+    int ix, int iy,
+    scalar_t* dir,
+    scalar_t* origin,
+    const PackedCameraSpec<scalar_t>& __restrict__ cam) {
+    scalar_t x = (ix - 0.5 * cam.width) / cam.fx;
+    scalar_t y = -(iy - 0.5 * cam.height) / cam.fy;
+    scalar_t z = sqrtf(x * x + y * y + 1.0);
+    x /= z; y /= z; z = -1.0f / z;
+    dir[0] = cam.c2w[0][0] * x + cam.c2w[0][1] * y + cam.c2w[0][2] * z;
+    dir[1] = cam.c2w[1][0] * x + cam.c2w[1][1] * y + cam.c2w[1][2] * z;
+    dir[2] = cam.c2w[2][0] * x + cam.c2w[2][1] * y + cam.c2w[2][2] * z;
+    origin[0] = cam.c2w[0][3]; origin[1] = cam.c2w[1][3]; origin[2] = cam.c2w[2][3];
+}
+
+
+template <typename scalar_t>
+SVOX_HOST_DEVICE inline static void maybe_world2ndc(
+        RenderOptions& __restrict__ opt,
+        scalar_t* __restrict__ dir,
+        scalar_t* __restrict__ cen, scalar_t near = 1.f) {
+    if (opt.ndc_width < 0)
+        return;
+    scalar_t t = -(near + cen[2]) / dir[2];
+    for (int i = 0; i < 3; ++i) {
+        cen[i] = cen[i] + t * dir[i];
+    }
+
+    dir[0] = -((2 * opt.ndc_focal) / opt.ndc_width) * (dir[0] / dir[2] - cen[0] / cen[2]);
+    dir[1] = -((2 * opt.ndc_focal) / opt.ndc_height) * (dir[1] / dir[2] - cen[1] / cen[2]);
+    dir[2] = -2 * near / cen[2];
+
+    cen[0] = -((2 * opt.ndc_focal) / opt.ndc_width) * (cen[0] / cen[2]);
+    cen[1] = -((2 * opt.ndc_focal) / opt.ndc_height) * (cen[1] / cen[2]);
+    cen[2] = 1 + 2 * near / cen[2];
+
+    _normalize(dir);
+}
+
+// Largest raw sigma for which a leaf's sigma, after the optional softplus,
+// is <= sigma_thresh (less a margin for the rounding of _softplus_m1 and the
+// approximate exp/log of fast_math mode); false if there is none
+template <typename scalar_t>
+SVOX_HOST_DEVICE inline bool _empty_sigma(
+        RenderOptions& __restrict__ opt,
+        scalar_t sigma_thresh,
+        scalar_t* __restrict__ out) {
+    if (!opt.density_softplus) {
+        *out = sigma_thresh;
+        return true;
+    }
+    if (sigma_thresh <= 0) return false;
+    const scalar_t raw = 1 + log(expm1(sigma_thresh));
+    *out = raw - scalar_t(1e-3) * (1 + fabs(raw));
+    return true;
+}
+
+// Lets walker step over the subtrees of tree (if it has max_sigma) whose
+// leaves all have sigma <= sigma_thresh, which the tracing loops pass over
+// anyway
+template <typename scalar_t, typename data_t>
+SVOX_HOST_DEVICE inline void _maybe_skip_empty(
+        TreeWalker<scalar_t>& walker,
+        PackedTreeSpec<scalar_t, data_t>& __restrict__ tree,
+        RenderOptions& __restrict__ opt,
+        scalar_t sigma_thresh) {
+    scalar_t empty_sigma;
+    if (tree.max_sigma != nullptr && _empty_sigma(opt, sigma_thresh, &empty_sigma)) {
+        walker.skip_empty(tree.max_sigma, empty_sigma);
+    }
+}
+
+// Raw sigma of the leaf at slot leaf (node * N^3 + cell), whose data is at
+// tree_val; read from the tree's density array if it has one, which spares
+// loading the data of the leaves whose samples do not contribute
+template <typename scalar_t, typename data_t>
+SVOX_HOST_DEVICE inline scalar_t _leaf_sigma(
+        PackedTreeSpec<scalar_t, data_t>& __restrict__ tree,
+        const data_t* __restrict__ tree_val,
+        int64_t leaf,
+        int data_dim) {
+    return scalar_t(tree.density != nullptr ? tree.density[leaf] :
+                    tree_val[data_dim - 1]);
+}
+
+// Data of the leaf at slot leaf (node * N^3 + cell), also for leaf-packed
+// data (see TreeSpec::packed_leaves)
+template <typename scalar_t, typename data_t>
+SVOX_HOST_DEVICE inline const data_t* _leaf_data(
+        PackedTreeSpec<scalar_t, data_t>& __restrict__ tree,
+        int64_t leaf) {
+    return tree.data.data() + leaf_row(tree.child_bits, tree.packed_leaves,
+                                       tree.child.size(1), leaf) *
+                              tree.data.size(4);
+}
+
+// Output channel t of the leaf at slot leaf, whose data is at tree_val,
+// before the sigmoid: the contraction of its coefficients with the basis
+// functions, or its value for RGBA. Int8 data (see TreeSpec::quant) is
+// dequantized as a whole, as scale * dot(basis_fn, q) + offset * basis_sum
+// for the sum basis_sum of the basis functions, since a channel's
+// coefficients lie in one block. Palette index data (see TreeSpec::palette)
+// reads the coefficients from the palette row it indexes.
+template <typename basis_ops_t, typename scalar_t, typename data_t>
+SVOX_HOST_DEVICE inline scalar_t _leaf_channel(
+        PackedTreeSpec<scalar_t, data_t>& __restrict__ tree,
+        const data_t* __restrict__ tree_val,
+        int64_t leaf,
+        int t,
+        const scalar_t* __restrict__ basis_fn,
+        scalar_t basis_sum,
+        RenderOptions& __restrict__ opt) {
+    const bool rgba = opt.format == FORMAT_RGBA;
+    const int off = rgba ? t : t * opt.basis_dim;
+    if (tree.palette != nullptr) {
+        const scalar_t* __restrict__ row =
+            tree.palette + int64_t(tree_val[0]) * tree.palette_dim;
+        return rgba ? row[off] : basis_ops_t::dot(basis_fn, row + off,
+                                                  opt.min_comp, opt.max_comp);
+    }
+    const scalar_t val = rgba ? scalar_t(tree_val[off]) :
+        basis_ops_t::dot(basis_fn, tree_val + off, opt.min_comp, opt.max_comp);
+    if (tree.quant == nullptr) return val;
+    const scalar_t* __restrict__ q = tree.quant +
+        2 * (leaf * tree.quant_blocks + off / tree.quant_block_size);
+    return q[0] * val + q[1] * (rgba ? scalar_t(1) : basis_sum);
+}
+
+// If the leaf at slot leaf (node * N^3 + cell) is in a node replaced by a
+// dense brick (see TreeSpec::bricks), returns the brick's data, with its
+// minimum corner corner_out and scale (cells per unit) scale_out in the unit
+// cube, and the distance t_exit_out along the ray (of inverse direction
+// invdir, as for _dda_unit) to where the ray leaves it, from the position
+// xyz of the unit cube, at which TreeWalker::query found the leaf and left
+// the position local in it and its cube size cube_sz; else returns nullptr
+template <typename scalar_t, typename data_t>
+SVOX_HOST_DEVICE inline const data_t* _brick_enter(
+        PackedTreeSpec<scalar_t, data_t>& __restrict__ tree,
+        int64_t leaf,
+        const scalar_t* __restrict__ xyz,
+        const scalar_t* __restrict__ local,
+        scalar_t cube_sz,
+        const scalar_t* __restrict__ invdir,
+        scalar_t* __restrict__ corner_out,
+        scalar_t* __restrict__ scale_out,
+        scalar_t* __restrict__ t_exit_out) {
+    const int32_t N = tree.child.size(1);
+    const int32_t N3 = N * N * N;
+    const int32_t b = tree.brick[leaf / N3];
+    if (b < 0) return nullptr;
+    const int32_t cell = leaf % N3;
+    const int32_t uvw[3] = {cell / (N * N), (cell / N) % N, cell % N};
+    const scalar_t node_sz = cube_sz / N;
+    scalar_t q[3], pos[3] = {xyz[0], xyz[1], xyz[2]};
+    clamp_coord<scalar_t>(pos);
+    for (int i = 0; i < 3; ++i) {
+        // Position in the node
+        q[i] = (uvw[i] + local[i]) / N;
+        corner_out[i] = pos[i] - q[i] / node_sz;
+    }
+    scalar_t tmin, tmax;
+    _dda_unit(q, invdir, &tmin, &tmax);
+    *t_exit_out = (tmax - tmin) / node_sz;
+    *scale_out = node_sz * tree.brick_res;
+    const int64_t R = tree.brick_res;
+    return tree.bricks + b * R * R * R * tree.data.size(4);
+}
+
+// Data of the cell of the dense brick at brick_val (see _brick_enter, for
+// corner and scale) containing the position xyz_inout of the unit cube,
+// which becomes the position in the cell, with cube_sz_out its cube size,
+// as for TreeWalker::query; a regular grid lookup, without descent
+template <typename scalar_t, typename data_t>
+SVOX_HOST_DEVICE inline const data_t* _brick_query(
+        PackedTreeSpec<scalar_t, data_t>& __restrict__ tree,
+        const data_t* __restrict__ brick_val,
+        const scalar_t* __restrict__ corner,
+        scalar_t scale,
+        scalar_t* __restrict__ xyz_inout,
+        scalar_t* __restrict__ cube_sz_out) {
+    const int32_t R = tree.brick_res;
+    clamp_coord<scalar_t>(xyz_inout);
+    for (int i = 0; i < 3; ++i) {
+        xyz_inout[i] = (xyz_inout[i] - corner[i]) * scale / R;
+    }
+    clamp_coord<scalar_t>(xyz_inout);
+    int64_t cell = 0;
+    for (int i = 0; i < 3; ++i) {
+        xyz_inout[i] *= R;
+        const int32_t c = floor(xyz_inout[i]);
+        xyz_inout[i] -= c;
+        cell = cell * R + c;
+    }
+    *cube_sz_out = scale;
+    return brick_val + cell * tree.data.size(4);
+}
+
+// Row i of the sample log (no log if log is empty)
+template <typename scalar_t>
+SVOX_HOST_DEVICE inline SingleSampleLog<scalar_t> sample_log_row(
+        PackedSampleLog<scalar_t>& log, int64_t i) {
+    SingleSampleLog<scalar_t> row;
+    if (log.leaf != nullptr) {
+        row.leaf = log.leaf + i * log.capacity;
+        row.delta_t = log.delta_t + i * log.capacity;
+        row.count = log.count + i;
+        row.capacity = log.capacity;
+    }
+    return row;
+}
+
+// Appends a sample at leaf (node * N^3 + cell) to the ray's log, of which
+// *n_logged samples are taken; a ray with too many samples gets
+// n_logged = -1, and the backward pass traces it instead
+template <typename scalar_t>
+SVOX_HOST_DEVICE inline void _log_sample(
+        const SingleSampleLog<scalar_t>& log,
+        int32_t* __restrict__ n_logged,
+        int64_t leaf,
+        scalar_t delta_t) {
+    if (*n_logged < 0) return;
+    if (*n_logged >= log.capacity) {
+        *n_logged = -1;
+        return;
+    }
+    log.leaf[*n_logged] = int32_t(leaf);
+    log.delta_t[*n_logged] = delta_t;
+    ++*n_logged;
+}
+
+// basis_fn_in optionally provides the ray's basis functions (as computed by
+// maybe_precalc_basis for ray.vdir), e.g. when evaluated for a batch of rays.
+// If log has a row, the samples composited are recorded there for
+// trace_ray_backward, and trans_out (if given) receives the ray's final
+// transmittance. In the dense bricks of the tree, if any (see
+// TreeSpec::bricks), the ray marches their grid cell by cell, as in
+// grid_trace_ray, without going back to the tree.
+template <typename scalar_t, typename basis_ops_t = ScalarBasisOps,
+          typename data_t = scalar_t>
+SVOX_HOST_DEVICE inline void trace_ray(
+        PackedTreeSpec<scalar_t, data_t>& __restrict__ tree,
+        SingleRaySpec<scalar_t> ray,
+        RenderOptions& __restrict__ opt,
+        torch::TensorAccessor<scalar_t, 1, torch::RestrictPtrTraits, int32_t> out,
+        const scalar_t* __restrict__ basis_fn_in = nullptr,
+        SingleSampleLog<scalar_t> log = SingleSampleLog<scalar_t>(),
+        scalar_t* __restrict__ trans_out = nullptr) {
+    const scalar_t delta_scale = _get_delta_scale(tree.scaling, ray.dir);
+
+    scalar_t tmin, tmax;
+    scalar_t invdir[3];
+    const int data_dim = tree.data.size(4);
+    const int out_data_dim = out.size(0);
+
+#pragma unroll
+    for (int i = 0; i < 3; ++i) {
+        invdir[i] = 1.0 / (ray.dir[i] + 1e-9);
+    }
+    _dda_unit(ray.origin, invdir, &tmin, &tmax);
+
+    if (tmax < 0 || tmin > tmax) {
+        // Ray doesn't hit box
+        for (int j = 0; j < out_data_dim; ++j) {
+            out[j] = opt.background_brightness;
+        }
+        if (log.leaf != nullptr) *log.count = 0;
+        if (trans_out != nullptr) *trans_out = 1.f;
+        return;
+    } else {
+        for (int j = 0; j < out_data_dim; ++j) {
+            out[j] = 0.f;
+        }
+        scalar_t pos[3];
+        scalar_t basis_tmp[25];
+        const scalar_t* __restrict__ basis_fn = basis_fn_in;
+        if (basis_fn == nullptr) {
+            maybe_precalc_basis<scalar_t>(opt.format, opt.basis_dim,
+                    tree.extra_data, ray.vdir, basis_tmp);
+            basis_fn = basis_tmp;
+        }
+
+        scalar_t basis_sum = 0.f;
+        if (tree.quant != nullptr && opt.format != FORMAT_RGBA) {
+            for (int i = opt.min_comp; i <= opt.max_comp; ++i) {
+                basis_sum += basis_fn[i];
+            }
+        }
+
+        scalar_t light_intensity = 1.f;
+        scalar_t t = tmin;
+        scalar_t cube_sz;
+        const scalar_t d_rgb_pad = 1 + 2 * opt.rgb_padding;
+        int32_t n_logged = 0;
+        TreeWalker<scalar_t> walker(tree.ropes, tree.parent_depth.data(),
+                                    tree.child_bits, tree.child_list,
+                                    tree.packed_leaves);
+        _maybe_skip_empty(walker, tree, opt, scalar_t(opt.sigma_thresh));
+        // Dense brick (see TreeSpec::bricks) the ray is in until t reaches
+        // brick_tmax, and the slot through which it entered, at which the
+        // weights of its cells are accumulated
+        const data_t* __restrict__ brick_val = nullptr;
+        scalar_t brick_tmax = 0.f, brick_scale = 0.f, brick_corner[3];
+        int64_t brick_leaf = -1;
+        while (t < tmax) {
+            for (int j = 0; j < 3; ++j) {
+                pos[j] = ray.origin[j] + t * ray.dir[j];
+            }
+
+            int64_t node_id;
+            const data_t* tree_val = nullptr;
+            bool in_brick = t < brick_tmax;
+            if (!in_brick) {
+                tree_val = walker.query(tree.data, tree.child, pos,
+                        &cube_sz, &node_id);
+                if (tree.brick != nullptr && tree_val != nullptr) {
+                    scalar_t xyz[3], t_exit;
+                    for (int j = 0; j < 3; ++j) {
+                        xyz[j] = ray.origin[j] + t * ray.dir[j];
+                    }
+                    brick_val = _brick_enter(tree, node_id, xyz, pos, cube_sz,
+                            invdir, brick_corner, &brick_scale, &t_exit);
+                    if (brick_val != nullptr) {
+                        in_brick = true;
+                        brick_tmax = t + t_exit;
+                        brick_leaf = node_id;
+                        for (int j = 0; j < 3; ++j) pos[j] = xyz[j];
+                    }
+                }
+            }
+            if (in_brick) {
+                tree_val = _brick_query(tree, brick_val, brick_corner,
+                        brick_scale, pos, &cube_sz);
+                node_id = brick_leaf;
+            }
+
+            scalar_t att;
+            scalar_t subcube_tmin, subcube_tmax;
+            _dda_unit(pos, invdir, &subcube_tmin, &subcube_tmax);
+
+            const scalar_t t_subcube = (subcube_tmax - subcube_tmin) / cube_sz;
+            const scalar_t delta_t = t_subcube + opt.step_size;
+            if (tree_val == nullptr) {
+                // Empty subtree, stepped over at once
+                t += delta_t;
+                continue;
+            }
+            // The density array, if any, holds the slots' sigma, not the cells'
+            scalar_t sigma = in_brick ? scalar_t(tree_val[data_dim - 1]) :
+                             _leaf_sigma(tree, tree_val, node_id, data_dim);
+            if (opt.density_softplus) sigma = _softplus_m1(sigma, opt.fast_math);
+            if (sigma > opt.sigma_thresh) {
+                att = _exp(-delta_t * delta_scale * sigma, opt.fast_math);
+                const scalar_t weight = light_intensity * (1.f - att);
+
+                for (int t = 0; t < out_data_dim; ++ t) {
+                    const scalar_t tmp = _leaf_channel<basis_ops_t>(tree,
+                            tree_val, node_id, t, basis_fn, basis_sum, opt);
+                    out[t] += weight * (_sigmoid(tmp, opt.fast_math) * d_rgb_pad - opt.rgb_padding);
+                }
+                light_intensity *= att;
+
+                if (tree.weight_accum != nullptr) {
+                    if (tree.weight_accum_max) {
+                        _atomic_max(&tree.weight_accum[node_id], weight);
+                    } else {
+                        _atomic_add(&tree.weight_accum[node_id], weight);
+                    }
+                }
+                if (log.leaf != nullptr) {
+                    _log_sample(log, &n_logged, node_id, delta_t);
+                }
+
+                if (light_intensity <= opt.stop_thresh) {
+                    // Full opacity, stop
+                    scalar_t scale = 1.0 / (1.0 - light_intensity);
+                    for (int j = 0; j < out_data_dim; ++j) {
+                        out[j] *= scale;
+                    }
+                    if (log.leaf != nullptr) *log.count = n_logged;
+                    if (trans_out != nullptr) *trans_out = light_intensity;
+                    return;
+                }
+            }
+            t += delta_t;
+        }
+        for (int j = 0; j < out_data_dim; ++j) {
+            out[j] += light_intensity * opt.background_brightness;
+        }
+        if (log.leaf != nullptr) *log.count = n_logged;
+        if (trans_out != nullptr) *trans_out = light_intensity;
+    }
+}
+
+// Color of the sample at tree_val dotted with grad_output; also adds the
+// gradient wrt. its coefficients, for a sample of weight weight, to
+// grad_data_out at leaf_offset (PASS 2 of trace_ray_backward)
+template <typename scalar_t, typename grad_sink_t, typename basis_ops_t,
+          typename data_t>
+SVOX_HOST_DEVICE inline scalar_t _backward_color(
+        const data_t* __restrict__ tree_val,
+        int64_t leaf_offset,
+        scalar_t weight,
+        const scalar_t* __restrict__ basis_fn,
+    const torch::TensorAccessor<scalar_t, 1, torch::RestrictPtrTraits, int32_t>
+        grad_output,
+        RenderOptions& __restrict__ opt,
+        grad_sink_t& grad_data_out) {
+    const int out_data_dim = grad_output.size(0);
+    const scalar_t d_rgb_pad = 1 + 2 * opt.rgb_padding;
+    scalar_t total_color = 0.f;
+    if (opt.format != FORMAT_RGBA) {
+        for (int t = 0; t < out_data_dim; ++ t) {
+            int off = t * opt.basis_dim;
+            const scalar_t tmp = basis_ops_t::dot(basis_fn,
+                    tree_val + off, opt.min_comp, opt.max_comp);
+            const scalar_t sigmoid = _sigmoid(tmp, opt.fast_math);
+            const scalar_t tmp2 = weight * sigmoid * (1.0 - sigmoid) *
+                                 grad_output[t] * d_rgb_pad;
+            for (int i = opt.min_comp; i <= opt.max_comp; ++i) {
+                const scalar_t toadd = basis_fn[i] * tmp2;
+                grad_data_out.add(leaf_offset + off + i, toadd);
+            }
+            total_color += (sigmoid * d_rgb_pad - opt.rgb_padding)
+                            * grad_output[t];
+        }
+    } else {
+        for (int j = 0; j < out_data_dim; ++j) {
+            const scalar_t sigmoid = _sigmoid(scalar_t(tree_val[j]), opt.fast_math);
+            const scalar_t toadd = weight * sigmoid * (
+                    1.f - sigmoid) * grad_output[j] * d_rgb_pad;
+            grad_data_out.add(leaf_offset + j, toadd);
+            total_color += (sigmoid * d_rgb_pad - opt.rgb_padding)
+                            * grad_output[j];
+        }
+    }
+    return total_color;
+}
+
+// Color of the sample at tree_val dotted with grad_output (PASS 1 of
+// trace_ray_backward)
+template <typename scalar_t, typename basis_ops_t, typename data_t>
+SVOX_HOST_DEVICE inline scalar_t _color_dot(
+        const data_t* __restrict__ tree_val,
+        const scalar_t* __restrict__ basis_fn,
+    const torch::TensorAccessor<scalar_t, 1, torch::RestrictPtrTraits, int32_t>
+        grad_output,
+        RenderOptions& __restrict__ opt) {
+    const int out_data_dim = grad_output.size(0);
+    const scalar_t d_rgb_pad = 1 + 2 * opt.rgb_padding;
+    scalar_t total_color = 0.f;
+    if (opt.format != FORMAT_RGBA) {
+        for (int t = 0; t < out_data_dim; ++ t) {
+            int off = t * opt.basis_dim;
+            const scalar_t tmp = basis_ops_t::dot(basis_fn,
+                    tree_val + off, opt.min_comp, opt.max_comp);
+            total_color += (_sigmoid(tmp, opt.fast_math) * d_rgb_pad - opt.rgb_padding)
+                            * grad_output[t];
+        }
+    } else {
+        for (int j = 0; j < out_data_dim; ++j) {
+            total_color += (_sigmoid(scalar_t(tree_val[j]), opt.fast_math) * d_rgb_pad - opt.rgb_padding)
+                            * grad_output[j];
+        }
+    }
+    return total_color;
+}
+
+// The ray's output out from trace_ray dotted with grad_output: the total
+// that PASS 1 of trace_ray_backward accumulates
+template <typename scalar_t>
+SVOX_HOST_DEVICE inline scalar_t _output_accum(
+        const scalar_t* __restrict__ out,
+    const torch::TensorAccessor<scalar_t, 1, torch::RestrictPtrTraits, int32_t>
+        grad_output) {
+    scalar_t accum = 0.0;
+    for (int j = 0; j < grad_output.size(0); ++j) {
+        accum += out[j] * grad_output[j];
+    }
+    return accum;
+}
+
+// Scale of the output of a ray of final transmittance light_intensity:
+// 1 / (1 - light_intensity) if trace_ray stopped it at stop_thresh, else 1.
+// The output C of a stopped ray is then as if the background had color C
+// (C = S + light_intensity C for the colors composited S), so PASS 2 of the
+// backward passes need only scale the gradients.
+template <typename scalar_t>
+SVOX_HOST_DEVICE inline scalar_t _stop_scale(
+        scalar_t light_intensity,
+        RenderOptions& __restrict__ opt) {
+    return light_intensity <= opt.stop_thresh ?
+        scalar_t(1.0 / (1.0 - light_intensity)) : scalar_t(1.0);
+}
+
+// Ends PASS 1 of trace_ray_backward: accum, the colors composited (dotted
+// with grad_output), becomes the ray's output given its final
+// transmittance light_intensity, with the background added or, for a ray
+// stopped at stop_thresh, scaled as by trace_ray
+template <typename scalar_t>
+SVOX_HOST_DEVICE inline scalar_t _finish_accum(
+        scalar_t accum,
+        scalar_t light_intensity,
+    const torch::TensorAccessor<scalar_t, 1, torch::RestrictPtrTraits, int32_t>
+        grad_output,
+        RenderOptions& __restrict__ opt) {
+    if (light_intensity <= opt.stop_thresh) {
+        return accum * _stop_scale(light_intensity, opt);
+    }
+    scalar_t total_grad = 0.f;
+    for (int j = 0; j < grad_output.size(0); ++j)
+        total_grad += grad_output[j];
+    return accum + light_intensity * opt.background_brightness * total_grad;
+}
+
+// PASS 2 of trace_ray_backward for one sample at tree_val (leaf_offset in
+// the data, of data_dim values), over delta_t: adds the gradients wrt. its
+// coefficients and density, given the output scale (_stop_scale) and
+// accum, the output (dotted with grad_output) not yet composited before
+// it, and updates light_intensity and accum. Returns false if the ray
+// stops after it.
+template <typename scalar_t, typename grad_sink_t, typename basis_ops_t,
+          typename data_t>
+SVOX_HOST_DEVICE inline bool _backward_sample(
+        const data_t* __restrict__ tree_val,
+        int64_t leaf_offset,
+        int data_dim,
+        scalar_t delta_t,
+        scalar_t delta_scale,
+        scalar_t scale,
+        const scalar_t* __restrict__ basis_fn,
+    const torch::TensorAccessor<scalar_t, 1, torch::RestrictPtrTraits, int32_t>
+        grad_output,
+        RenderOptions& __restrict__ opt,
+        scalar_t* __restrict__ light_intensity,
+        scalar_t* __restrict__ accum,
+        grad_sink_t& grad_data_out) {
+    const scalar_t raw_sigma = scalar_t(tree_val[data_dim - 1]);
+    const scalar_t sigma = opt.density_softplus ?
+        _softplus_m1(raw_sigma, opt.fast_math) : raw_sigma;
+    const scalar_t att = _exp(-delta_t * sigma * delta_scale, opt.fast_math);
+    const scalar_t weight = *light_intensity * (1.f - att);
+    const scalar_t total_color = _backward_color<scalar_t, grad_sink_t,
+          basis_ops_t>(tree_val, leaf_offset, weight * scale, basis_fn,
+                       grad_output, opt, grad_data_out);
+    *light_intensity *= att;
+    *accum -= weight * total_color;
+    grad_data_out.add(
+            leaf_offset + data_dim - 1,
+            delta_t * delta_scale * scale * (
+                total_color * *light_intensity - *accum)
+                *  (opt.density_softplus ?
+                    _sigmoid(raw_sigma - 1, opt.fast_math)
+                    : 1)
+            );
+    return *light_intensity > opt.stop_thresh;
+}
+
+// Gradient of trace_ray's output (dotted with grad_output), over the same
+// samples: those of density above sigma_thresh, up to where the ray
+// stops at stop_thresh, and with the output renormalized there.
+//
+// If log has a row for the ray, in which trace_ray recorded all of its
+// samples, the samples logged are used and the tree is not walked. Given
+// the ray's output fwd_out and final transmittance fwd_trans from
+// trace_ray, PASS 1 (which finds them) is skipped.
+template <typename scalar_t, typename grad_sink_t,
+          typename basis_ops_t = ScalarBasisOps, typename data_t = scalar_t>
+SVOX_HOST_DEVICE inline void trace_ray_backward(
+    PackedTreeSpec<scalar_t, data_t>& __restrict__ tree,
+    const torch::TensorAccessor<scalar_t, 1, torch::RestrictPtrTraits, int32_t>
+        grad_output,
+        SingleRaySpec<scalar_t> ray,
+        RenderOptions& __restrict__ opt,
+        grad_sink_t& grad_data_out,
+        const scalar_t* __restrict__ basis_fn_in = nullptr,
+        SingleSampleLog<scalar_t> log = SingleSampleLog<scalar_t>(),
+        const scalar_t* __restrict__ fwd_out = nullptr,
+        const scalar_t* __restrict__ fwd_trans = nullptr) {
+    const scalar_t delta_scale = _get_delta_scale(tree.scaling, ray.dir);
+
+    scalar_t tmin, tmax;
+    scalar_t invdir[3];
+    const int data_dim = tree.data.size(4);
+
+#pragma unroll
+    for (int i = 0; i < 3; ++i) {
+        invdir[i] = 1.0 / (ray.dir[i] + 1e-9);
+    }
+    _dda_unit(ray.origin, invdir, &tmin, &tmax);
+
+    if (tmax < 0 || tmin > tmax) {
+        // Ray doesn't hit box
+        return;
+    } else {
+        scalar_t pos[3];
+        scalar_t basis_tmp[25];
+        const scalar_t* __restrict__ basis_fn = basis_fn_in;
+        if (basis_fn == nullptr) {
+            maybe_precalc_basis<scalar_t>(opt.format, opt.basis_dim,
+                    tree.extra_data, ray.vdir, basis_tmp);
+            basis_fn = basis_tmp;
+        }
+        const bool use_log = log.leaf != nullptr && *log.count >= 0;
+        const data_t* __restrict__ data = tree.data.data();
+
+        scalar_t accum = 0.0, light_intensity = 1.f;
+        // PASS 1
+        if (fwd_out != nullptr) {
+            accum = _output_accum(fwd_out, grad_output);
+            light_intensity = *fwd_trans;
+        } else if (use_log) {
+            for (int32_t k = 0; k < *log.count; ++k) {
+                const data_t* tree_val = _leaf_data(tree, log.leaf[k]);
+                scalar_t sigma = scalar_t(tree_val[data_dim - 1]);
+                if (opt.density_softplus) sigma = _softplus_m1(sigma, opt.fast_math);
+                const scalar_t att = _exp(-log.delta_t[k] * sigma * delta_scale,
+                                          opt.fast_math);
+                const scalar_t weight = light_intensity * (1.f - att);
+                accum += weight * _color_dot<scalar_t, basis_ops_t>(
+                        tree_val, basis_fn, grad_output, opt);
+                light_intensity *= att;
+            }
+            accum = _finish_accum(accum, light_intensity, grad_output, opt);
+        } else {
+            scalar_t t = tmin, cube_sz;
+            TreeWalker<scalar_t> walker(tree.ropes, tree.parent_depth.data(),
+                                        tree.child_bits, tree.child_list,
+                                        tree.packed_leaves);
+            _maybe_skip_empty(walker, tree, opt, scalar_t(opt.sigma_thresh));
+            while (t < tmax) {
+                for (int j = 0; j < 3; ++j) pos[j] = ray.origin[j] + t * ray.dir[j];
+
+                int64_t leaf;
+                const data_t* tree_val = walker.query(
+                        tree.data, tree.child, pos, &cube_sz, &leaf);
+
+                scalar_t att;
+                scalar_t subcube_tmin, subcube_tmax;
+                _dda_unit(pos, invdir, &subcube_tmin, &subcube_tmax);
+
+                const scalar_t t_subcube = (subcube_tmax - subcube_tmin) / cube_sz;
+                const scalar_t delta_t = t_subcube + opt.step_size;
+                if (tree_val == nullptr) {
+                    // Empty subtree, stepped over at once
+                    t += delta_t;
+                    continue;
+                }
+                scalar_t sigma = _leaf_sigma(tree, tree_val, leaf, data_dim);
+                if (opt.density_softplus) sigma = _softplus_m1(sigma, opt.fast_math);
+                if (sigma > opt.sigma_thresh) {
+                    att = _exp(-delta_t * sigma * delta_scale, opt.fast_math);
+                    const scalar_t weight = light_intensity * (1.f - att);
+                    accum += weight * _color_dot<scalar_t, basis_ops_t>(
+                            tree_val, basis_fn, grad_output, opt);
+                    light_intensity *= att;
+                    if (light_intensity <= opt.stop_thresh) break;
+                }
+                t += delta_t;
+            }
+            accum = _finish_accum(accum, light_intensity, grad_output, opt);
+        }
+        const scalar_t scale = _stop_scale(light_intensity, opt);
+
+        // PASS 2
+        light_intensity = 1.f;
+        if (use_log) {
+            for (int32_t k = 0; k < *log.count; ++k) {
+                const int64_t curr_leaf_offset = _leaf_data(tree, log.leaf[k]) - data;
+                _backward_sample<scalar_t, grad_sink_t, basis_ops_t>(
+                        data + curr_leaf_offset, curr_leaf_offset, data_dim,
+                        log.delta_t[k], delta_scale, scale, basis_fn,
+                        grad_output, opt, &light_intensity, &accum,
+                        grad_data_out);
+            }
+            return;
+        }
+        {
+            scalar_t t = tmin, cube_sz;
+            TreeWalker<scalar_t> walker(tree.ropes, tree.parent_depth.data(),
+                                        tree.child_bits, tree.child_list,
+                                        tree.packed_leaves);
+            _maybe_skip_empty(walker, tree, opt, scalar_t(opt.sigma_thresh));
+            while (t < tmax) {
+                for (int j = 0; j < 3; ++j) pos[j] = ray.origin[j] + t * ray.dir[j];
+                int64_t leaf;
+                const data_t* tree_val = walker.query(tree.data,
+                        tree.child, pos, &cube_sz, &leaf);
+
+                scalar_t subcube_tmin, subcube_tmax;
+                _dda_unit(pos, invdir, &subcube_tmin, &subcube_tmax);
+
+                const scalar_t t_subcube = (subcube_tmax - subcube_tmin) / cube_sz;
+                const scalar_t delta_t = t_subcube + opt.step_size;
+                if (tree_val == nullptr) {
+                    // Empty subtree, stepped over at once
+                    t += delta_t;
+                    continue;
+                }
+                scalar_t sigma = _leaf_sigma(tree, tree_val, leaf, data_dim);
+                if (opt.density_softplus) sigma = _softplus_m1(sigma, opt.fast_math);
+                if (sigma > opt.sigma_thresh) {
+                    // Reuse offset on gradient
+                    const int64_t curr_leaf_offset = tree_val - data;
+                    if (!_backward_sample<scalar_t, grad_sink_t, basis_ops_t>(
+                                tree_val, curr_leaf_offset, data_dim,
+                                delta_t, delta_scale, scale, basis_fn, grad_output,
+                                opt, &light_intensity, &accum,
+                                grad_data_out)) {
+                        break;
+                    }
+                }
+                t += delta_t;
+            }
+        }
+    }
+}  // trace_ray_backward
+
+
+template <typename scalar_t, typename grad_sink_t,
+          typename basis_ops_t = ScalarBasisOps, typename data_t = scalar_t>
+SVOX_HOST_DEVICE inline void trace_ray_se_grad_hess(
+    PackedTreeSpec<scalar_t, data_t>& __restrict__ tree,
+    SingleRaySpec<scalar_t> ray,
+    RenderOptions& __restrict__ opt,
+    torch::TensorAccessor<scalar_t, 1, torch::RestrictPtrTraits, int32_t> color_ref,
+    torch::TensorAccessor<scalar_t, 1, torch::RestrictPtrTraits, int32_t> color_out,
+        grad_sink_t& grad_data_out,
+        grad_sink_t& hessdiag_out,
+        const scalar_t* __restrict__ basis_fn_in = nullptr) {
+    const scalar_t delta_scale = _get_delta_scale(tree.scaling, ray.dir);
+
+    scalar_t tmin, tmax;
+    scalar_t invdir[3];
+    const int data_dim = tree.data.size(4);
+    const int out_data_dim = color_out.size(0);
+
+#pragma unroll
+    for (int i = 0; i < 3; ++i) {
+        invdir[i] = 1.0 / (ray.dir[i] + 1e-9);
+    }
+    _dda_unit(ray.origin, invdir, &tmin, &tmax);
+
+    if (tmax < 0 || tmin > tmax) {
+        // Ray doesn't hit box
+        for (int j = 0; j < out_data_dim; ++j) {
+            color_out[j] = opt.background_brightness;
+        }
+        return;
+    } else {
+        scalar_t pos[3];
+        scalar_t basis_tmp[25];
+        const scalar_t* __restrict__ basis_fn = basis_fn_in;
+        if (basis_fn == nullptr) {
+            maybe_precalc_basis<scalar_t>(opt.format, opt.basis_dim,
+                    tree.extra_data, ray.vdir, basis_tmp);
+            basis_fn = basis_tmp;
+        }
+
+        const scalar_t d_rgb_pad = 1 + 2 * opt.rgb_padding;
+        // Output, and its scale (_stop_scale) as for trace_ray_backward
+        scalar_t color_accum[4] = {0, 0, 0, 0};
+        scalar_t scale;
+
+        // PASS 1 - compute residual (trace_ray_se_grad_hess)
+        {
+            scalar_t light_intensity = 1.f, t = tmin, cube_sz;
+            TreeWalker<scalar_t> walker(tree.ropes, tree.parent_depth.data(),
+                                        tree.child_bits, tree.child_list,
+                                        tree.packed_leaves);
+            _maybe_skip_empty(walker, tree, opt, scalar_t(opt.sigma_thresh));
+            while (t < tmax) {
+                for (int j = 0; j < 3; ++j) {
+                    pos[j] = ray.origin[j] + t * ray.dir[j];
+                }
+
+                int64_t leaf;
+                const data_t* tree_val = walker.query(tree.data, tree.child,
+                        pos, &cube_sz, &leaf);
+
+                scalar_t att;
+                scalar_t subcube_tmin, subcube_tmax;
+                _dda_unit(pos, invdir, &subcube_tmin, &subcube_tmax);
+
+                const scalar_t t_subcube = (subcube_tmax - subcube_tmin) / cube_sz;
+                const scalar_t delta_t = t_subcube + opt.step_size;
+                if (tree_val == nullptr) {
+                    // Empty subtree, stepped over at once
+                    t += delta_t;
+                    continue;
+                }
+                scalar_t sigma = _leaf_sigma(tree, tree_val, leaf, data_dim);
+                if (opt.density_softplus) sigma = _softplus_m1(sigma, opt.fast_math);
+                if (sigma > opt.sigma_thresh) {
+                    att = _exp(-delta_t * delta_scale * sigma, opt.fast_math);
+                    const scalar_t weight = light_intensity * (1.f - att);
+
+                    if (opt.format != FORMAT_RGBA) {
+                        for (int t = 0; t < out_data_dim; ++ t) {
+                            int off = t * opt.basis_dim;
+                            const scalar_t tmp = basis_ops_t::dot(basis_fn,
+                                    tree_val + off, opt.min_comp, opt.max_comp);
+                            color_out[t] += weight * (_sigmoid(tmp, opt.fast_math) * d_rgb_pad - opt.rgb_padding);
+                        }
+                    } else {
+                        for (int j = 0; j < out_data_dim; ++j) {
+                            color_out[j] += weight * (_sigmoid(scalar_t(tree_val[j]), opt.fast_math) *
+                                    d_rgb_pad - opt.rgb_padding);
+                        }
+                    }
+                    light_intensity *= att;
+                    if (light_intensity <= opt.stop_thresh) break;
+                }
+                t += delta_t;
+            }
+            // Add background intensity & color (or scale, as trace_ray)
+            // -> residual
+            scale = _stop_scale(light_intensity, opt);
+            for (int j = 0; j < out_data_dim; ++j) {
+                if (light_intensity <= opt.stop_thresh) {
+                    color_out[j] *= scale;
+                } else {
+                    color_out[j] += light_intensity * opt.background_brightness;
+                }
+                color_accum[j] = color_out[j];
+                color_out[j] -= color_ref[j];
+            }
+        }
+
+        // PASS 2 - compute RGB gradient (trace_ray_se_grad_hess)
+        {
+            scalar_t light_intensity = 1.f, t = tmin, cube_sz;
+            TreeWalker<scalar_t> walker(tree.ropes, tree.parent_depth.data(),
+                                        tree.child_bits, tree.child_list,
+                                        tree.packed_leaves);
+            _maybe_skip_empty(walker, tree, opt, scalar_t(opt.sigma_thresh));
+            while (t < tmax) {
+                for (int j = 0; j < 3; ++j) pos[j] = ray.origin[j] + t * ray.dir[j];
+
+                int64_t leaf;
+                const data_t* tree_val = walker.query(
+                        tree.data, tree.child, pos, &cube_sz, &leaf);
+
+                scalar_t att;
+                scalar_t subcube_tmin, subcube_tmax;
+                _dda_unit(pos, invdir, &subcube_tmin, &subcube_tmax);
+
+                const scalar_t t_subcube = (subcube_tmax - subcube_tmin) / cube_sz;
+                const scalar_t delta_t = t_subcube + opt.step_size;
+                if (tree_val == nullptr) {
+                    // Empty subtree, stepped over at once
+                    t += delta_t;
+                    continue;
+                }
+                // Reuse offset on gradient
+                const int64_t curr_leaf_offset = tree_val - tree.data.data();
+                scalar_t sigma = _leaf_sigma(tree, tree_val, leaf, data_dim);
+                if (opt.density_softplus) sigma = _softplus_m1(sigma, opt.fast_math);
+                if (sigma > opt.sigma_thresh) {
+                    att = _exp(-delta_t * sigma * delta_scale, opt.fast_math);
+                    const scalar_t weight = light_intensity * (1.f - att) * scale;
+
+                    if (opt.format != FORMAT_RGBA) {
+                        for (int t = 0; t < out_data_dim; ++ t) {
+                            int off = t * opt.basis_dim;
+                            const scalar_t tmp = basis_ops_t::dot(basis_fn,
+                                    tree_val + off, opt.min_comp, opt.max_comp);
+                            const scalar_t sigmoid = _sigmoid(tmp, opt.fast_math);
+                            const scalar_t grad_ci = weight * sigmoid * (1.0 - sigmoid) *
+                                                  d_rgb_pad;
+                            // const scalar_t d2_term =
+                            //     (1.f - 2.f * sigmoid) * color_out[t];
+                            for (int i = opt.min_comp; i <= opt.max_comp; ++i) {
+                                const scalar_t grad_wi = basis_fn[i] * grad_ci;
+                                grad_data_out.add(curr_leaf_offset + off + i, grad_wi * color_out[t]);
+                                hessdiag_out.add(curr_leaf_offset + off + i,
+                                        // grad_wi * basis_fn[i] * (grad_ci +
+                                        //         d2_term)                   // Newton
+                                        grad_wi * grad_wi                     // Gauss-Newton
+                                    );
+                            }
+                        }
+                    } else {
+                        for (int j = 0; j < out_data_dim; ++j) {
+                            const scalar_t sigmoid = _sigmoid(scalar_t(tree_val[j]), opt.fast_math);
+                            const scalar_t grad_ci = weight * sigmoid * (
+                                    1.f - sigmoid) * d_rgb_pad;
+                            // const scalar_t d2_term = (1.f - 2.f * sigmoid) * color_out[j];
+                            grad_data_out.add(curr_leaf_offset + j, grad_ci * color_out[j]);
+                            // Newton
+                            // hessdiag_out.add(curr_leaf_offset + j, grad_ci * (grad_ci + d2_term));
+                            // Gauss-Newton
+                            hessdiag_out.add(curr_leaf_offset + j, grad_ci * grad_ci);
+                        }
+                    }
+                    light_intensity *= att;
+                    if (light_intensity <= opt.stop_thresh) break;
+                }
+                t += delta_t;
+            }
+        }
+
+        // PASS 3 - finish computing sigma gradient (trace_ray_se_grad_hess)
+        {
+            scalar_t light_intensity = 1.f, t = tmin, cube_sz;
+            scalar_t color_curr[4];
+            TreeWalker<scalar_t> walker(tree.ropes, tree.parent_depth.data(),
+                                        tree.child_bits, tree.child_list,
+                                        tree.packed_leaves);
+            _maybe_skip_empty(walker, tree, opt, scalar_t(opt.sigma_thresh));
+            while (t < tmax) {
+                for (int j = 0; j < 3; ++j) pos[j] = ray.origin[j] + t * ray.dir[j];
+                int64_t leaf;
+                const data_t* tree_val = walker.query(tree.data,
+                        tree.child, pos, &cube_sz, &leaf);
+
+                scalar_t att;
+                scalar_t subcube_tmin, subcube_tmax;
+                _dda_unit(pos, invdir, &subcube_tmin, &subcube_tmax);
+
+                const scalar_t t_subcube = (subcube_tmax - subcube_tmin) / cube_sz;
+                const scalar_t delta_t = t_subcube + opt.step_size;
+                if (tree_val == nullptr) {
+                    // Empty subtree, stepped over at once
+                    t += delta_t;
+                    continue;
+                }
+                // Reuse offset on gradient
+                const int64_t curr_leaf_offset = tree_val - tree.data.data();
+                scalar_t sigma = _leaf_sigma(tree, tree_val, leaf, data_dim);
+                const scalar_t raw_sigma = sigma;
+                if (opt.density_softplus) sigma = _softplus_m1(sigma, opt.fast_math);
+                if (sigma > opt.sigma_thresh) {
+                    att = _exp(-delta_t * sigma * delta_scale, opt.fast_math);
+                    const scalar_t weight = light_intensity * (1.f - att);
+
+                    if (opt.format != FORMAT_RGBA) {
+                        for (int u = 0; u < out_data_dim; ++ u) {
+                            int off = u * opt.basis_dim;
+                            const scalar_t tmp = basis_ops_t::dot(basis_fn,
+                                    tree_val + off, opt.min_comp, opt.max_comp);
+                            color_curr[u] = _sigmoid(tmp, opt.fast_math) * d_rgb_pad - opt.rgb_padding;
+                            color_accum[u] -= weight * color_curr[u];
+                        }
+                    } else {
+                        for (int j = 0; j < out_data_dim; ++j) {
+                            color_curr[j] = _sigmoid(scalar_t(tree_val[j]), opt.fast_math) * d_rgb_pad - opt.rgb_padding;
+                            color_accum[j] -= weight * color_curr[j];
+                        }
+                    }
+                    light_intensity *= att;
+                    for (int j = 0; j < out_data_dim; ++j) {
+                        const scalar_t grad_sigma = delta_t * delta_scale * scale * (
+                                color_curr[j] * light_intensity - color_accum[j]);
+                        // Newton
+                        // const scalar_t grad2_sigma =
+                        //     grad_sigma * (grad_sigma - delta_t * delta_scale * color_out[j]);
+                        // Gauss-Newton
+                        const scalar_t grad2_sigma = grad_sigma * grad_sigma;
+                        if (opt.density_softplus) {
+                            const scalar_t sigmoid = _sigmoid(raw_sigma - 1, opt.fast_math);
+                            const scalar_t d_sigmoid = sigmoid * (1.f - sigmoid);
+                            // FIXME not sure this works
+                            grad_data_out.add(curr_leaf_offset + data_dim - 1, grad_sigma *
+                                    color_out[j] * sigmoid);
+                            hessdiag_out.add(curr_leaf_offset + data_dim - 1,
+                                    grad2_sigma * sigmoid * sigmoid
+                                    + grad_sigma *  d_sigmoid);
+                        } else {
+                            grad_data_out.add(curr_leaf_offset + data_dim - 1,
+                                    grad_sigma * color_out[j]);
+                            hessdiag_out.add(curr_leaf_offset + data_dim - 1, grad2_sigma);
+                        }
+                    }
+                    if (light_intensity <= opt.stop_thresh) break;
+                }
+                t += delta_t;
+            }
+        }
+        // Residual -> color
+        for (int j = 0; j < out_data_dim; ++j) {
+            color_out[j] += color_ref[j];
+        }
+    }
+}  // trace_ray_se_grad_hess
+
+}  // namespace device
+
+// Compute RGB output dimension from input dimension & SH degree
+inline int get_out_data_dim(int format, int basis_dim, int in_data_dim) {
+    if (format != FORMAT_RGBA) {
+        return (in_data_dim - 1) / basis_dim;
+    } else {
+        return in_data_dim - 1;
+    }
+}
+
+}  // namespace
@@ -0,0 +1,508 @@
+/*
+ * Copyright 2021 PlenOctree Authors
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Packet ray tracer for the CPU renderer: W = V::W rays (8 for AVX2, 16 for
+// AVX-512) march through the tree together, one ray per SIMD lane. Each step
+// performs trace_ray's loop body for all lanes at once: the batched descent
+// of svox_packet.hpp, followed by the subcube _dda_unit, and sigma / color
+// coefficients are gathered from data. When a ray finishes, its lane is
+// refilled with the next ray, so lanes stay busy despite the very different
+// ray lengths. Only float trees with up to 4 output channels are supported.
+//
+// The backward and se_grad passes still trace one ray at a time, but take
+// rays in blocks of W to evaluate their SH bases together (sh_simd.hpp).
+//
+// Include from simd_avx2.cpp / simd_avx512.cpp only, after simd.hpp.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include "data_spec_packed.cuh"
+#include "rt_core.hpp"
+#include "cpu_grad.hpp"
+#include "svox_packet.hpp"
+#include "sh_simd.hpp"
+
+namespace simd {
+namespace {
+
+// Feeds the rays [begin, end) of a batch, with id the ray's index
+struct RayBatchFeeder {
+    PackedTreeSpec<float>& tree;
+    PackedRaysSpec<float>& rays;
+    int64_t cur, end;
+
+    bool next(float* origin, float* dir, float* vdir, int64_t* id) {
+        if (cur >= end) return false;
+        for (int j = 0; j < 3; ++j) {
+            origin[j] = rays.origins[cur][j];
+            dir[j] = rays.dirs[cur][j];
+            vdir[j] = rays.vdirs[cur][j];
+        }
+        device::transform_coord<float>(origin, tree.offset, tree.scaling);
+        *id = cur++;
+        return true;
+    }
+};
+
+// Feeds the camera rays of one image tile, in the same order as
+// for_each_tile_ray in rt_cpu.cpp, with id = iy * width + ix
+struct ImageTileFeeder {
+    PackedTreeSpec<float>& tree;
+    PackedCameraSpec<float>& cam;
+    RenderOptions& opt;
+    int ix_begin, ix_end, iy_end;
+    int ix, iy;
+
+    ImageTileFeeder(PackedTreeSpec<float>& tree, PackedCameraSpec<float>& cam,
+                    RenderOptions& opt, int tile_size, int64_t tile) :
+        tree(tree), cam(cam), opt(opt) {
+        const int64_t tiles_x = (cam.width + tile_size - 1) / tile_size;
+        iy = tile / tiles_x * tile_size;
+        ix_begin = ix = tile % tiles_x * tile_size;
+        iy_end = std::min(cam.height, iy + tile_size);
+        ix_end = std::min(cam.width, ix_begin + tile_size);
+    }
+
+    bool next(float* origin, float* dir, float* vdir, int64_t* id) {
+        if (ix >= ix_end) {
+            ix = ix_begin;
+            ++iy;
+        }
+        if (iy >= iy_end) return false;
+        device::cam2world_ray(ix, iy, dir, origin, cam);
+        for (int j = 0; j < 3; ++j) vdir[j] = dir[j];
+        device::maybe_world2ndc(opt, dir, origin);
+        device::transform_coord<float>(origin, tree.offset, tree.scaling);
+        *id = int64_t(iy) * cam.width + ix;
+        ++ix;
+        return true;
+    }
+};
+
+// Render all rays produced by feeder, passing their colors and final
+// transmittance to write(id, color, trans); equivalent to calling trace_ray
+// on each of them (with row id of log, if given)
+template <typename feeder_t, typename write_t>
+void trace_packet(
+        PackedTreeSpec<float>& __restrict__ tree,
+        RenderOptions& __restrict__ opt,
+        const int out_data_dim,
+        feeder_t& feeder,
+        const write_t& write,
+        PackedSampleLog<float>* log = nullptr) {
+    constexpr int W = V::W;
+    const int data_dim = tree.data.size(4);
+    const float* data = tree.data.data();
+    const bool use_basis = opt.format != FORMAT_RGBA;
+    const bool use_sh = opt.format == FORMAT_SH;
+    const float d_rgb_pad = 1 + 2 * opt.rgb_padding;
+
+    // Lane state, SoA
+    alignas(64) float org[3][W], dir[3][W], invdir[3][W];
+    alignas(64) float t[W], tmax[W], light[W], delta_scale[W];
+    alignas(64) float out[4][W];
+    alignas(64) float basis_fn[25][W];
+    alignas(64) float vdir_sh[3][W];
+    alignas(64) float tmp[W];
+    alignas(64) int32_t tmpi[W];
+    int64_t ray_id[W];
+    int32_t n_logged[W];
+    std::memset(org, 0, sizeof(org));
+    std::memset(dir, 0, sizeof(dir));
+    std::memset(invdir, 0, sizeof(invdir));
+    std::memset(t, 0, sizeof(t));
+    std::memset(tmax, 0, sizeof(tmax));
+    std::memset(light, 0, sizeof(light));
+    std::memset(delta_scale, 0, sizeof(delta_scale));
+    std::memset(out, 0, sizeof(out));
+    std::memset(basis_fn, 0, sizeof(basis_fn));
+    std::memset(vdir_sh, 0, sizeof(vdir_sh));
+
+    // Lanes holding a ray, and those of which still need their SH basis
+    unsigned active = 0, fresh = 0;
+    bool rays_left = true;
+    float background[4];
+    for (int j = 0; j < 4; ++j) background[j] = opt.background_brightness;
+
+    // Start the next ray which enters the tree in lane i
+    // (rays missing it are written out straight away)
+    auto refill = [&](int i) {
+        float origin[3], rdir[3], vdir[3], rinvdir[3], basis_tmp[25];
+        int64_t id;
+        while (rays_left) {
+            if (!feeder.next(origin, rdir, vdir, &id)) {
+                rays_left = false;
+                return;
+            }
+            const float ds = device::_get_delta_scale(tree.scaling, rdir);
+            for (int j = 0; j < 3; ++j) {
+                rinvdir[j] = 1.0 / (rdir[j] + 1e-9);
+            }
+            float tmin, tm;
+            device::_dda_unit(origin, rinvdir, &tmin, &tm);
+            if (!(tmin < tm)) {
+                // Ray doesn't hit box, or marches zero steps
+                write(id, background, 1.f);
+                if (log != nullptr) log->count[id] = 0;
+                continue;
+            }
+            for (int j = 0; j < 3; ++j) {
+                org[j][i] = origin[j];
+                dir[j][i] = rdir[j];
+                invdir[j][i] = rinvdir[j];
+            }
+            t[i] = tmin;
+            tmax[i] = tm;
+            light[i] = 1.f;
+            delta_scale[i] = ds;
+            for (int j = 0; j < out_data_dim; ++j) out[j][i] = 0.f;
+            if (use_sh) {
+                for (int j = 0; j < 3; ++j) vdir_sh[j][i] = vdir[j];
+                fresh |= 1u << i;
+            } else if (use_basis) {
+                device::maybe_precalc_basis<float>(opt.format, opt.basis_dim,
+                        tree.extra_data, vdir, basis_tmp);
+                for (int j = opt.min_comp; j <= opt.max_comp; ++j) {
+                    basis_fn[j][i] = basis_tmp[j];
+                }
+            }
+            ray_id[i] = id;
+            n_logged[i] = 0;
+            active |= 1u << i;
+            return;
+        }
+    };
+
+    // Evaluate the SH basis of all newly started rays at once
+    auto update_basis = [&]() {
+        if (!fresh) return;
+        V::vf sh[25];
+        sh_basis(V::load(vdir_sh[0]), V::load(vdir_sh[1]), V::load(vdir_sh[2]),
+                 opt.basis_dim, sh);
+        const V::vm m = V::from_bits(fresh);
+        for (int j = opt.min_comp; j <= opt.max_comp; ++j) {
+            V::store(basis_fn[j], V::sel(m, sh[j], V::load(basis_fn[j])));
+        }
+        fresh = 0;
+    };
+
+    // Write out the color of lane i and start a new ray there
+    auto retire = [&](int i) {
+        float val[4];
+        for (int j = 0; j < out_data_dim; ++j) val[j] = out[j][i];
+        write(ray_id[i], val, light[i]);
+        if (log != nullptr) log->count[ray_id[i]] = n_logged[i];
+        active &= ~(1u << i);
+        refill(i);
+    };
+
+    for (int i = 0; i < W; ++i) refill(i);
+    update_basis();
+
+    const V::vf zero = V::set1(0.f), one = V::set1(1.f);
+    Descender desc(tree.child.data(), tree.child.size(1));
+    if (tree.child_bits != nullptr) desc.compact(tree.child_bits, tree.child_list);
+    float empty_sigma;
+    if (tree.max_sigma != nullptr &&
+        device::_empty_sigma(opt, opt.sigma_thresh, &empty_sigma)) {
+        desc.skip_empty(tree.max_sigma, empty_sigma);
+    }
+    const V::vi data_dimi = V::set1i(data_dim);
+    const V::vf step_size = V::set1(opt.step_size);
+
+    while (active) {
+        const V::vm act = V::from_bits(active);
+        const V::vf tv = V::load(t);
+        V::vf pos[3];
+        for (int j = 0; j < 3; ++j) {
+            pos[j] = V::add(V::load(org[j]), V::mul(tv, V::load(dir[j])));
+        }
+        desc.clamp(pos);
+        V::vf cube_sz;
+        V::vm empty;
+        const V::vi leaf = desc.descend(pos, act, cube_sz, &empty);
+        // Lanes at a leaf; the others step over an empty subtree
+        const V::vm at_leaf = V::mandnot(act, empty);
+
+        // _dda_unit on the leaf's subcube
+        V::vf subcube_tmin = zero, subcube_tmax = V::set1(1e9f);
+        for (int j = 0; j < 3; ++j) {
+            const V::vf inv = V::load(invdir[j]);
+            const V::vf t1 = V::sub(zero, V::mul(pos[j], inv));
+            const V::vf t2 = V::add(t1, inv);
+            subcube_tmin = V::max(subcube_tmin, V::min(t1, t2));
+            subcube_tmax = V::min(subcube_tmax, V::max(t1, t2));
+        }
+        const V::vf delta_t = V::add(
+                V::div(V::sub(subcube_tmax, subcube_tmin), cube_sz), step_size);
+
+        const V::vi leaf_off = V::muli(leaf, data_dimi);
+        V::vf sigma = tree.density != nullptr ?
+            V::gather(tree.density, leaf, at_leaf, zero) :
+            V::gather(data, V::addi(leaf_off, V::set1i(data_dim - 1)),
+                      at_leaf, zero);
+        if (opt.density_softplus) sigma = vsoftplus_m1(sigma, opt.fast_math);
+        const V::vm sm = V::mand(at_leaf, V::gt(sigma, V::set1(opt.sigma_thresh)));
+        unsigned stopped = 0;
+        if (V::bits(sm)) {
+            const V::vf att = vexp(V::mul(V::mul(V::sub(zero, delta_t),
+                            V::load(delta_scale)), sigma), opt.fast_math);
+            V::vf light_intensity = V::load(light);
+            const V::vf weight = V::mul(light_intensity, V::sub(one, att));
+
+            for (int c = 0; c < out_data_dim; ++c) {
+                V::vf val;
+                if (use_basis) {
+                    const int off = c * opt.basis_dim;
+                    val = zero;
+                    for (int i = opt.min_comp; i <= opt.max_comp; ++i) {
+                        val = V::fmadd(V::load(basis_fn[i]),
+                                V::gather(data, V::addi(leaf_off, V::set1i(off + i)),
+                                          sm, zero), val);
+                    }
+                } else {
+                    val = V::gather(data, V::addi(leaf_off, V::set1i(c)), sm, zero);
+                }
+                const V::vf color = V::sub(V::mul(vsigmoid(val, opt.fast_math), V::set1(d_rgb_pad)),
+                                           V::set1(opt.rgb_padding));
+                const V::vf out_c = V::load(out[c]);
+                V::store(out[c], V::sel(sm, V::add(out_c, V::mul(weight, color)), out_c));
+            }
+            light_intensity = V::sel(sm, V::mul(light_intensity, att), light_intensity);
+            V::store(light, light_intensity);
+
+            if (log != nullptr) {
+                V::store(tmp, delta_t);
+                V::storei(tmpi, leaf);
+                for (unsigned b = V::bits(sm); b; b &= b - 1) {
+                    const int i = __builtin_ctz(b);
+                    device::_log_sample(device::sample_log_row(*log, ray_id[i]),
+                                        &n_logged[i], tmpi[i], tmp[i]);
+                }
+            }
+            if (tree.weight_accum != nullptr) {
+                V::store(tmp, weight);
+                V::storei(tmpi, leaf);
+                for (unsigned b = V::bits(sm); b; b &= b - 1) {
+                    const int i = __builtin_ctz(b);
+                    if (tree.weight_accum_max) {
+                        device::_atomic_max(&tree.weight_accum[tmpi[i]], tmp[i]);
+                    } else {
+                        device::_atomic_add(&tree.weight_accum[tmpi[i]], tmp[i]);
+                    }
+                }
+            }
+            stopped = V::bits(V::mand(sm, V::le(light_intensity,
+                            V::set1(opt.stop_thresh))));
+        }
+        const V::vf t_next = V::add(tv, delta_t);
+        V::store(t, t_next);
+        const unsigned finished = active & ~stopped &
+                                  ~V::bits(V::lt(t_next, V::load(tmax)));
+
+        for (unsigned b = stopped; b; b &= b - 1) {
+            // Full opacity, stop
+            const int i = __builtin_ctz(b);
+            const float scale = 1.0 / (1.0 - light[i]);
+            for (int j = 0; j < out_data_dim; ++j) out[j][i] *= scale;
+            retire(i);
+        }
+        for (unsigned b = finished; b; b &= b - 1) {
+            const int i = __builtin_ctz(b);
+            for (int j = 0; j < out_data_dim; ++j) {
+                out[j][i] += light[i] * opt.background_brightness;
+            }
+            retire(i);
+        }
+        update_basis();
+    }
+}
+
+// Calls f(ray, basis_fn, id) for each ray produced by feeder. Rays are
+// taken W at a time, so that their SH basis functions can be evaluated
+// together; used by the per-ray backward and se_grad kernels below.
+template <typename feeder_t, typename func_t>
+void for_each_ray_block(
+        PackedTreeSpec<float>& __restrict__ tree,
+        RenderOptions& __restrict__ opt,
+        feeder_t& feeder,
+        const func_t& f) {
+    constexpr int W = V::W;
+    float origin[W][3], dir[W][3], vdir[W][3];
+    alignas(64) float vdir_sh[3][W];
+    alignas(64) float basis_sh[25][W];
+    int64_t id[W];
+    while (true) {
+        int n = 0;
+        while (n < W && feeder.next(origin[n], dir[n], vdir[n], &id[n])) ++n;
+        if (n == 0) break;
+        if (opt.format == FORMAT_SH) {
+            for (int i = 0; i < W; ++i) {
+                for (int j = 0; j < 3; ++j) vdir_sh[j][i] = i < n ? vdir[i][j] : 0.f;
+            }
+            V::vf sh[25];
+            sh_basis(V::load(vdir_sh[0]), V::load(vdir_sh[1]), V::load(vdir_sh[2]),
+                     opt.basis_dim, sh);
+            for (int j = opt.min_comp; j <= opt.max_comp; ++j) {
+                V::store(basis_sh[j], sh[j]);
+            }
+            // sh_basis passes vectors by value, so the compiler does not
+            // clear the upper state after it before the scalar tracing
+            V::zeroupper();
+        }
+        for (int i = 0; i < n; ++i) {
+            float basis_fn[25];
+            if (opt.format == FORMAT_SH) {
+                for (int j = opt.min_comp; j <= opt.max_comp; ++j) {
+                    basis_fn[j] = basis_sh[j][i];
+                }
+            } else {
+                device::maybe_precalc_basis<float>(opt.format, opt.basis_dim,
+                        tree.extra_data, vdir[i], basis_fn);
+            }
+            f(SingleRaySpec<float>{origin[i], dir[i], vdir[i]}, basis_fn, id[i]);
+        }
+        if (n < W) break;
+    }
+}
+
+void render_rays_impl(
+        PackedTreeSpec<float>& tree,
+        PackedRaysSpec<float>& rays,
+        RenderOptions& opt,
+    torch::PackedTensorAccessor32<float, 2, torch::RestrictPtrTraits> out,
+        int64_t begin, int64_t end,
+        PackedSampleLog<float>& log,
+        float* trans) {
+    RayBatchFeeder feeder{tree, rays, begin, end};
+    trace_packet(tree, opt, out.size(1), feeder,
+            [&](int64_t id, const float* color, float light) {
+        for (int j = 0; j < out.size(1); ++j) out[id][j] = color[j];
+        if (trans != nullptr) trans[id] = light;
+    }, log.leaf != nullptr ? &log : nullptr);
+}
+
+void render_image_tile_impl(
+        PackedTreeSpec<float>& tree,
+        PackedCameraSpec<float>& cam,
+        RenderOptions& opt,
+        int tile_size, int64_t tile,
+    torch::PackedTensorAccessor32<float, 3, torch::RestrictPtrTraits> out,
+        float* trans) {
+    ImageTileFeeder feeder(tree, cam, opt, tile_size, tile);
+    trace_packet(tree, opt, out.size(2), feeder,
+            [&](int64_t id, const float* color, float light) {
+        auto pix = out[id / cam.width][id % cam.width];
+        for (int j = 0; j < pix.size(0); ++j) pix[j] = color[j];
+        if (trans != nullptr) trans[id] = light;
+    });
+}
+
+void render_rays_backward_impl(
+        PackedTreeSpec<float>& tree,
+    const torch::PackedTensorAccessor32<float, 2, torch::RestrictPtrTraits>
+        grad_output,
+        PackedRaysSpec<float>& rays,
+        RenderOptions& opt,
+        GradBuffer<float>::Sink& grad_data_out,
+        int64_t begin, int64_t end,
+        PackedSampleLog<float>& log,
+        const float* fwd_out, const float* fwd_trans) {
+    RayBatchFeeder feeder{tree, rays, begin, end};
+    const int out_data_dim = grad_output.size(1);
+    for_each_ray_block(tree, opt, feeder,
+            [&](SingleRaySpec<float> ray, const float* basis_fn, int64_t id) {
+        device::trace_ray_backward<float, GradBuffer<float>::Sink, SimdBasisOps>(
+                tree, grad_output[id], ray, opt, grad_data_out, basis_fn,
+                device::sample_log_row(log, id),
+                fwd_out != nullptr ? fwd_out + id * out_data_dim : nullptr,
+                fwd_out != nullptr ? fwd_trans + id : nullptr);
+    });
+}
+
+void render_image_tile_backward_impl(
+        PackedTreeSpec<float>& tree,
+    const torch::PackedTensorAccessor32<float, 3, torch::RestrictPtrTraits>
+        grad_output,
+        PackedCameraSpec<float>& cam,
+        RenderOptions& opt,
+        int tile_size, int64_t tile,
+        GradBuffer<float>::Sink& grad_data_out,
+        const float* fwd_out, const float* fwd_trans) {
+    ImageTileFeeder feeder(tree, cam, opt, tile_size, tile);
+    const int out_data_dim = grad_output.size(2);
+    for_each_ray_block(tree, opt, feeder,
+            [&](SingleRaySpec<float> ray, const float* basis_fn, int64_t id) {
+        device::trace_ray_backward<float, GradBuffer<float>::Sink, SimdBasisOps>(
+                tree, grad_output[id / cam.width][id % cam.width], ray, opt,
+                grad_data_out, basis_fn, SingleSampleLog<float>(),
+                fwd_out != nullptr ? fwd_out + id * out_data_dim : nullptr,
+                fwd_out != nullptr ? fwd_trans + id : nullptr);
+    });
+}
+
+void se_grad_rays_impl(
+        PackedTreeSpec<float>& tree,
+        PackedRaysSpec<float>& rays,
+        RenderOptions& opt,
+    torch::PackedTensorAccessor32<float, 2, torch::RestrictPtrTraits> color_ref,
+    torch::PackedTensorAccessor32<float, 2, torch::RestrictPtrTraits> color_out,
+        GradBuffer<float>::Sink& grad_out,
+        GradBuffer<float>::Sink& hessdiag_out,
+        int64_t begin, int64_t end) {
+    RayBatchFeeder feeder{tree, rays, begin, end};
+    for_each_ray_block(tree, opt, feeder,
+            [&](SingleRaySpec<float> ray, const float* basis_fn, int64_t id) {
+        device::trace_ray_se_grad_hess<float, GradBuffer<float>::Sink, SimdBasisOps>(
+                tree, ray, opt, color_ref[id], color_out[id],
+                grad_out, hessdiag_out, basis_fn);
+    });
+}
+
+void se_grad_image_tile_impl(
+        PackedTreeSpec<float>& tree,
+        PackedCameraSpec<float>& cam,
+        RenderOptions& opt,
+        int tile_size, int64_t tile,
+    torch::PackedTensorAccessor32<float, 3, torch::RestrictPtrTraits> color_ref,
+    torch::PackedTensorAccessor32<float, 3, torch::RestrictPtrTraits> color_out,
+        GradBuffer<float>::Sink& grad_out,
+        GradBuffer<float>::Sink& hessdiag_out) {
+    ImageTileFeeder feeder(tree, cam, opt, tile_size, tile);
+    for_each_ray_block(tree, opt, feeder,
+            [&](SingleRaySpec<float> ray, const float* basis_fn, int64_t id) {
+        const int64_t iy = id / cam.width, ix = id % cam.width;
+        device::trace_ray_se_grad_hess<float, GradBuffer<float>::Sink, SimdBasisOps>(
+                tree, ray, opt, color_ref[iy][ix], color_out[iy][ix],
+                grad_out, hessdiag_out, basis_fn);
+    });
+}
+
+}  // namespace
+}  // namespace simd
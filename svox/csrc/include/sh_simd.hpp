@@ -0,0 +1,120 @@
+/*
+ * Copyright 2021 PlenOctree Authors
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Vectorized basis functions for the CPU SIMD kernels: spherical harmonics
+// evaluated for V::W view directions at once (SoA), and SimdBasisOps, the
+// FMA-vector replacement of ScalarBasisOps (rt_core.hpp) used to contract
+// a leaf's coefficients with a ray's basis functions.
+//
+// Include from simd_avx2.cpp / simd_avx512.cpp only, after simd.hpp
+// and rt_core.hpp.
+
+#pragma once
+
+#include "rt_core.hpp"
+
+namespace simd {
+namespace {
+
+// maybe_precalc_basis for FORMAT_SH, for the view directions (x, y, z) of
+// all lanes: out[i] receives basis function i of every lane
+inline void sh_basis(V::vf x, V::vf y, V::vf z, int basis_dim, V::vf* out) {
+    using namespace device;
+    const V::vf xx = V::mul(x, x), yy = V::mul(y, y), zz = V::mul(z, z);
+    const V::vf xy = V::mul(x, y), yz = V::mul(y, z), xz = V::mul(x, z);
+    out[0] = V::set1(C0);
+    switch (basis_dim) {
+        case 25:
+            {
+                const V::vf xx_yy = V::sub(xx, yy);
+                const V::vf zz7_1 = V::sub(V::mul(V::set1(7.f), zz), V::set1(1.f));
+                const V::vf zz7_3 = V::sub(V::mul(V::set1(7.f), zz), V::set1(3.f));
+                out[16] = V::mul(V::set1(C4[0]), V::mul(xy, xx_yy));
+                out[17] = V::mul(V::set1(C4[1]), V::mul(yz, V::sub(V::mul(V::set1(3.f), xx), yy)));
+                out[18] = V::mul(V::set1(C4[2]), V::mul(xy, zz7_1));
+                out[19] = V::mul(V::set1(C4[3]), V::mul(yz, zz7_3));
+                out[20] = V::mul(V::set1(C4[4]), V::fmadd(zz,
+                            V::sub(V::mul(V::set1(35.f), zz), V::set1(30.f)), V::set1(3.f)));
+                out[21] = V::mul(V::set1(C4[5]), V::mul(xz, zz7_3));
+                out[22] = V::mul(V::set1(C4[6]), V::mul(xx_yy, zz7_1));
+                out[23] = V::mul(V::set1(C4[7]), V::mul(xz, V::sub(xx, V::mul(V::set1(3.f), yy))));
+                out[24] = V::mul(V::set1(C4[8]), V::sub(
+                            V::mul(xx, V::sub(xx, V::mul(V::set1(3.f), yy))),
+                            V::mul(yy, V::sub(V::mul(V::set1(3.f), xx), yy))));
+            }
+            [[fallthrough]];
+        case 16:
+            {
+                const V::vf zz4_xx_yy = V::sub(V::sub(V::mul(V::set1(4.f), zz), xx), yy);
+                out[9] = V::mul(V::set1(C3[0]), V::mul(y, V::sub(V::mul(V::set1(3.f), xx), yy)));
+                out[10] = V::mul(V::set1(C3[1]), V::mul(xy, z));
+                out[11] = V::mul(V::set1(C3[2]), V::mul(y, zz4_xx_yy));
+                out[12] = V::mul(V::set1(C3[3]), V::mul(z, V::sub(V::sub(V::mul(V::set1(2.f), zz),
+                                    V::mul(V::set1(3.f), xx)), V::mul(V::set1(3.f), yy))));
+                out[13] = V::mul(V::set1(C3[4]), V::mul(x, zz4_xx_yy));
+                out[14] = V::mul(V::set1(C3[5]), V::mul(z, V::sub(xx, yy)));
+                out[15] = V::mul(V::set1(C3[6]), V::mul(x, V::sub(xx, V::mul(V::set1(3.f), yy))));
+            }
+            [[fallthrough]];
+        case 9:
+            out[4] = V::mul(V::set1(C2[0]), xy);
+            out[5] = V::mul(V::set1(C2[1]), yz);
+            out[6] = V::mul(V::set1(C2[2]), V::sub(V::sub(V::mul(V::set1(2.f), zz), xx), yy));
+            out[7] = V::mul(V::set1(C2[3]), xz);
+            out[8] = V::mul(V::set1(C2[4]), V::sub(xx, yy));
+            [[fallthrough]];
+        case 4:
+            out[1] = V::mul(V::set1(-C1), y);
+            out[2] = V::mul(V::set1(C1), z);
+            out[3] = V::mul(V::set1(-C1), x);
+    }
+}
+
+// Drop-in for ScalarBasisOps: the products are formed W at a time with FMA
+// (the tail with a masked load) and summed horizontally at the end
+struct SimdBasisOps {
+    static inline float dot(
+            const float* __restrict__ basis_fn,
+            const float* __restrict__ coeff,
+            int min_comp, int max_comp) {
+        const int n = max_comp - min_comp + 1;
+        basis_fn += min_comp;
+        coeff += min_comp;
+        V::vf acc = V::set1(0.f);
+        int i = 0;
+        for (; i + V::W <= n; i += V::W) {
+            acc = V::fmadd(V::loadu(basis_fn + i), V::loadu(coeff + i), acc);
+        }
+        if (i < n) {
+            acc = V::fmadd(V::loadu_n(basis_fn + i, n - i),
+                           V::loadu_n(coeff + i, n - i), acc);
+        }
+        return V::hsum(acc);
+    }
+};
+
+}  // namespace
+}  // namespace simd
@@ -0,0 +1,322 @@
+/*
+ * Copyright 2021 PlenOctree Authors
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Thin wrappers around AVX2 / AVX-512 intrinsics, giving the SIMD kernels
+// one generic interface (V::vf float vector, V::vi int32 vector, V::vm lane
+// mask). Only include this from simd_avx2.cpp / simd_avx512.cpp, after
+// enabling the matching target; the ISA is selected by defining
+// SVOX_SIMD_AVX2 or SVOX_SIMD_AVX512.
+
+#pragma once
+
+#include <immintrin.h>
+#include <cstdint>
+
+namespace simd {
+namespace {
+
+#ifdef SVOX_SIMD_AVX2
+struct V {
+    static constexpr int W = 8;
+    typedef __m256 vf;
+    typedef __m256i vi;
+    typedef __m256 vm;
+
+    static inline vf load(const float* p) { return _mm256_load_ps(p); }
+    static inline vf loadu(const float* p) { return _mm256_loadu_ps(p); }
+    // Load p[0, n), zeroing the other lanes (without touching memory there)
+    static inline vf loadu_n(const float* p, int n) {
+        const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        return _mm256_maskload_ps(p, _mm256_cmpgt_epi32(_mm256_set1_epi32(n), lane));
+    }
+    static inline void store(float* p, vf a) { _mm256_store_ps(p, a); }
+    static inline vf set1(float a) { return _mm256_set1_ps(a); }
+    static inline vf add(vf a, vf b) { return _mm256_add_ps(a, b); }
+    static inline vf sub(vf a, vf b) { return _mm256_sub_ps(a, b); }
+    static inline vf mul(vf a, vf b) { return _mm256_mul_ps(a, b); }
+    static inline vf div(vf a, vf b) { return _mm256_div_ps(a, b); }
+    // a * b + c
+    static inline vf fmadd(vf a, vf b, vf c) { return _mm256_fmadd_ps(a, b, c); }
+    static inline vf min(vf a, vf b) { return _mm256_min_ps(a, b); }
+    static inline vf max(vf a, vf b) { return _mm256_max_ps(a, b); }
+    // Sum of all lanes
+    static inline float hsum(vf a) {
+        __m128 s = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+        s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+        s = _mm_add_ss(s, _mm_movehdup_ps(s));
+        return _mm_cvtss_f32(s);
+    }
+    static inline vf round(vf a) {
+        return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    }
+    // Clears the upper register halves before running scalar code that calls
+    // into libm (compiled for SSE), which stalls on dirty upper state
+    static inline void zeroupper() { _mm256_zeroupper(); }
+
+    static inline vi loadi(const int32_t* p) {
+        return _mm256_load_si256(reinterpret_cast<const __m256i*>(p));
+    }
+    static inline void storei(int32_t* p, vi a) {
+        _mm256_store_si256(reinterpret_cast<__m256i*>(p), a);
+    }
+    static inline vi set1i(int32_t a) { return _mm256_set1_epi32(a); }
+    static inline vi addi(vi a, vi b) { return _mm256_add_epi32(a, b); }
+    static inline vi subi(vi a, vi b) { return _mm256_sub_epi32(a, b); }
+    static inline vi muli(vi a, vi b) { return _mm256_mullo_epi32(a, b); }
+    // Truncating float -> int conversion and back
+    static inline vi cvti(vf a) { return _mm256_cvttps_epi32(a); }
+    static inline vf cvtf(vi a) { return _mm256_cvtepi32_ps(a); }
+    static inline vi andi(vi a, vi b) { return _mm256_and_si256(a, b); }
+    static inline vi ori(vi a, vi b) { return _mm256_or_si256(a, b); }
+    // Logical right shift by n
+    static inline vi srli(vi a, int n) { return _mm256_srli_epi32(a, n); }
+    // Left shift of each lane by the matching lane of n
+    static inline vi sllvi(vi a, vi n) { return _mm256_sllv_epi32(a, n); }
+    // Bits of the float lanes as int32, and back
+    static inline vi asi(vf a) { return _mm256_castps_si256(a); }
+    static inline vf asf(vi a) { return _mm256_castsi256_ps(a); }
+    // 2^n for integer n in the normal range
+    static inline vf pow2i(vi n) {
+        return _mm256_castsi256_ps(_mm256_slli_epi32(
+                    _mm256_add_epi32(n, _mm256_set1_epi32(127)), 23));
+    }
+
+    static inline vm lt(vf a, vf b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static inline vm le(vf a, vf b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+    static inline vm gt(vf a, vf b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    static inline vm eqi(vi a, vi b) {
+        return _mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b));
+    }
+    static inline vm mand(vm a, vm b) { return _mm256_and_ps(a, b); }
+    static inline vm mor(vm a, vm b) { return _mm256_or_ps(a, b); }
+    // a & ~b
+    static inline vm mandnot(vm a, vm b) { return _mm256_andnot_ps(b, a); }
+    static inline unsigned bits(vm m) { return unsigned(_mm256_movemask_ps(m)); }
+    static inline vm from_bits(unsigned b) {
+        const __m256i lane_bit = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+        const __m256i sel = _mm256_and_si256(_mm256_set1_epi32(int(b)), lane_bit);
+        return _mm256_castsi256_ps(_mm256_cmpeq_epi32(sel, lane_bit));
+    }
+    // m ? a : b
+    static inline vf sel(vm m, vf a, vf b) { return _mm256_blendv_ps(b, a, m); }
+    static inline vi seli(vm m, vi a, vi b) {
+        return _mm256_blendv_epi8(b, a, _mm256_castps_si256(m));
+    }
+
+    // Masked gathers of base[idx]; masked-off lanes return src
+    static inline vf gather(const float* base, vi idx, vm m, vf src) {
+        return _mm256_mask_i32gather_ps(src, base, idx, m, 4);
+    }
+    static inline vi gatheri(const int32_t* base, vi idx, vm m, vi src) {
+        return _mm256_mask_i32gather_epi32(src, base, idx,
+                                           _mm256_castps_si256(m), 4);
+    }
+};
+#endif  // SVOX_SIMD_AVX2
+
+#ifdef SVOX_SIMD_AVX512
+struct V {
+    static constexpr int W = 16;
+    typedef __m512 vf;
+    typedef __m512i vi;
+    typedef __mmask16 vm;
+
+    static inline vf load(const float* p) { return _mm512_load_ps(p); }
+    static inline vf loadu(const float* p) { return _mm512_loadu_ps(p); }
+    static inline vf loadu_n(const float* p, int n) {
+        return _mm512_maskz_loadu_ps(__mmask16((1u << n) - 1), p);
+    }
+    static inline void store(float* p, vf a) { _mm512_store_ps(p, a); }
+    static inline vf set1(float a) { return _mm512_set1_ps(a); }
+    static inline vf add(vf a, vf b) { return _mm512_add_ps(a, b); }
+    static inline vf sub(vf a, vf b) { return _mm512_sub_ps(a, b); }
+    static inline vf mul(vf a, vf b) { return _mm512_mul_ps(a, b); }
+    static inline vf div(vf a, vf b) { return _mm512_div_ps(a, b); }
+    static inline vf fmadd(vf a, vf b, vf c) { return _mm512_fmadd_ps(a, b, c); }
+    static inline vf min(vf a, vf b) { return _mm512_min_ps(a, b); }
+    static inline vf max(vf a, vf b) { return _mm512_max_ps(a, b); }
+    static inline float hsum(vf a) { return _mm512_reduce_add_ps(a); }
+    static inline vf round(vf a) {
+        return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    }
+    static inline void zeroupper() { _mm256_zeroupper(); }
+
+    static inline vi loadi(const int32_t* p) { return _mm512_load_si512(p); }
+    static inline void storei(int32_t* p, vi a) { _mm512_store_si512(p, a); }
+    static inline vi set1i(int32_t a) { return _mm512_set1_epi32(a); }
+    static inline vi addi(vi a, vi b) { return _mm512_add_epi32(a, b); }
+    static inline vi subi(vi a, vi b) { return _mm512_sub_epi32(a, b); }
+    static inline vi muli(vi a, vi b) { return _mm512_mullo_epi32(a, b); }
+    static inline vi cvti(vf a) { return _mm512_cvttps_epi32(a); }
+    static inline vf cvtf(vi a) { return _mm512_cvtepi32_ps(a); }
+    static inline vi andi(vi a, vi b) { return _mm512_and_si512(a, b); }
+    static inline vi ori(vi a, vi b) { return _mm512_or_si512(a, b); }
+    static inline vi srli(vi a, int n) { return _mm512_srli_epi32(a, n); }
+    static inline vi sllvi(vi a, vi n) { return _mm512_sllv_epi32(a, n); }
+    static inline vi asi(vf a) { return _mm512_castps_si512(a); }
+    static inline vf asf(vi a) { return _mm512_castsi512_ps(a); }
+    static inline vf pow2i(vi n) {
+        return _mm512_castsi512_ps(_mm512_slli_epi32(
+                    _mm512_add_epi32(n, _mm512_set1_epi32(127)), 23));
+    }
+
+    static inline vm lt(vf a, vf b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+    static inline vm le(vf a, vf b) { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+    static inline vm gt(vf a, vf b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+    static inline vm eqi(vi a, vi b) { return _mm512_cmpeq_epi32_mask(a, b); }
+    static inline vm mand(vm a, vm b) { return vm(a & b); }
+    static inline vm mor(vm a, vm b) { return vm(a | b); }
+    static inline vm mandnot(vm a, vm b) { return vm(a & ~b); }
+    static inline unsigned bits(vm m) { return unsigned(m); }
+    static inline vm from_bits(unsigned b) { return vm(b); }
+    static inline vf sel(vm m, vf a, vf b) { return _mm512_mask_blend_ps(m, b, a); }
+    static inline vi seli(vm m, vi a, vi b) { return _mm512_mask_blend_epi32(m, b, a); }
+
+    static inline vf gather(const float* base, vi idx, vm m, vf src) {
+        return _mm512_mask_i32gather_ps(src, m, idx, base, 4);
+    }
+    static inline vi gatheri(const int32_t* base, vi idx, vm m, vi src) {
+        return _mm512_mask_i32gather_epi32(src, m, idx, base, 4);
+    }
+};
+#endif  // SVOX_SIMD_AVX512
+
+// Number of set bits of each lane (AVX-512 VPOPCNTDQ is not assumed)
+inline V::vi vpopcnt(V::vi x) {
+    x = V::subi(x, V::andi(V::srli(x, 1), V::set1i(0x55555555)));
+    x = V::addi(V::andi(x, V::set1i(0x33333333)),
+                V::andi(V::srli(x, 2), V::set1i(0x33333333)));
+    x = V::andi(V::addi(x, V::srli(x, 4)), V::set1i(0x0F0F0F0F));
+    return V::srli(V::muli(x, V::set1i(0x01010101)), 24);
+}
+
+// exp(x) using range reduction and a Cephes-style polynomial;
+// relative error within ~2 ulp (inputs below -87.3 give ~1e-38 instead of 0)
+inline V::vf vexp(V::vf x) {
+    x = V::min(V::max(x, V::set1(-87.3365448f)), V::set1(88.7228391f));
+    const V::vf fx = V::round(V::mul(x, V::set1(1.44269504088896341f)));
+    x = V::sub(x, V::mul(fx, V::set1(0.693359375f)));
+    x = V::sub(x, V::mul(fx, V::set1(-2.12194440e-4f)));
+    V::vf y = V::set1(1.9875691500e-4f);
+    y = V::fmadd(y, x, V::set1(1.3981999507e-3f));
+    y = V::fmadd(y, x, V::set1(8.3334519073e-3f));
+    y = V::fmadd(y, x, V::set1(4.1665795894e-2f));
+    y = V::fmadd(y, x, V::set1(1.6666665459e-1f));
+    y = V::fmadd(y, x, V::set1(5.0000001201e-1f));
+    y = V::fmadd(y, V::mul(x, x), V::add(x, V::set1(1.f)));
+    return V::mul(y, V::pow2i(V::cvti(fx)));
+}
+
+// exp(x) as vexp, with a degree-4 minimax polynomial instead:
+// max relative error 3e-6 (used with opt.fast_math)
+inline V::vf vexp_fast(V::vf x) {
+    x = V::min(V::max(x, V::set1(-87.f)), V::set1(88.f));
+    const V::vf fx = V::round(V::mul(x, V::set1(1.44269504f)));
+    x = V::sub(x, V::mul(fx, V::set1(0.693359375f)));
+    x = V::sub(x, V::mul(fx, V::set1(-2.12194440e-4f)));
+    V::vf y = V::set1(4.151289141e-2f);
+    y = V::fmadd(y, x, V::set1(1.678731137e-1f));
+    y = V::fmadd(y, x, V::set1(5.000301432e-1f));
+    y = V::fmadd(y, x, V::set1(9.999669306e-1f));
+    y = V::fmadd(y, x, V::set1(1.f));
+    return V::mul(y, V::pow2i(V::cvti(fx)));
+}
+
+// exp, approximate if fast (opt.fast_math)
+inline V::vf vexp(V::vf x, bool fast) {
+    return fast ? vexp_fast(x) : vexp(x);
+}
+
+// Splits positive normal x into 2^e m with m in [sqrt(1/2), sqrt(2));
+// returns f = m - 1, with e in e_out
+inline V::vf _vlog_reduce(V::vf x, V::vf& e_out) {
+    const V::vi bits = V::asi(x);
+    V::vf e = V::cvtf(V::addi(V::srli(bits, 23), V::set1i(-127)));
+    V::vf m = V::asf(V::ori(V::andi(bits, V::set1i(0x007fffff)),
+                            V::set1i(0x3f800000)));
+    const V::vm big = V::gt(m, V::set1(1.41421356f));
+    m = V::sel(big, V::mul(m, V::set1(0.5f)), m);
+    e_out = V::sel(big, V::add(e, V::set1(1.f)), e);
+    return V::sub(m, V::set1(1.f));
+}
+
+// log(2^e (1 + f)) given r = (log(1 + f) - f + f^2 / 2) / f^3
+inline V::vf _vlog_finish(V::vf f, V::vf e, V::vf r) {
+    const V::vf z = V::mul(f, f);
+    V::vf y = V::fmadd(V::mul(f, z), r, V::fmadd(z, V::set1(-0.5f), f));
+    y = V::fmadd(e, V::set1(-2.12194440e-4f), y);
+    return V::fmadd(e, V::set1(0.693359375f), y);
+}
+
+// log(x) of positive normal x using range reduction and a Cephes-style
+// polynomial; relative error within ~2 ulp
+inline V::vf vlog(V::vf x) {
+    V::vf e;
+    const V::vf f = _vlog_reduce(x, e);
+    V::vf r = V::set1(7.0376836292e-2f);
+    r = V::fmadd(r, f, V::set1(-1.1514610310e-1f));
+    r = V::fmadd(r, f, V::set1(1.1676998740e-1f));
+    r = V::fmadd(r, f, V::set1(-1.2420140846e-1f));
+    r = V::fmadd(r, f, V::set1(1.4249322787e-1f));
+    r = V::fmadd(r, f, V::set1(-1.6668057665e-1f));
+    r = V::fmadd(r, f, V::set1(2.0000714765e-1f));
+    r = V::fmadd(r, f, V::set1(-2.4999993993e-1f));
+    r = V::fmadd(r, f, V::set1(3.3333331174e-1f));
+    return _vlog_finish(f, e, r);
+}
+
+// log(x) as vlog, with a degree-3 polynomial for r instead (fitted to the
+// reduced range): max absolute error 4e-6 (used with opt.fast_math)
+inline V::vf vlog_fast(V::vf x) {
+    V::vf e;
+    const V::vf f = _vlog_reduce(x, e);
+    V::vf r = V::set1(-1.470183767e-1f);
+    r = V::fmadd(r, f, V::set1(2.192427519e-1f));
+    r = V::fmadd(r, f, V::set1(-2.525221590e-1f));
+    r = V::fmadd(r, f, V::set1(3.327249280e-1f));
+    return _vlog_finish(f, e, r);
+}
+
+// log, approximate if fast (opt.fast_math)
+inline V::vf vlog(V::vf x, bool fast) {
+    return fast ? vlog_fast(x) : vlog(x);
+}
+
+// Shifted softplus of the density, as _softplus_m1 in rt_core.hpp
+inline V::vf vsoftplus_m1(V::vf x, bool fast) {
+    const V::vf one = V::set1(1.f);
+    const V::vf y = V::sub(x, one);
+    return V::sel(V::gt(y, V::set1(20.f)), y,
+                  vlog(V::add(one, vexp(V::min(y, V::set1(20.f)), fast)), fast));
+}
+
+inline V::vf vsigmoid(V::vf x, bool fast) {
+    const V::vf one = V::set1(1.f);
+    return V::div(one, V::add(one, vexp(V::sub(V::set1(0.f), x), fast)));
+}
+
+}  // namespace
+}  // namespace simd
@@ -0,0 +1,161 @@
+/*
+ * Copyright 2021 PlenOctree Authors
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Tree query routines shared by the CUDA kernels (svox_kernel.cu) and the
+// CPU implementation (svox_cpu.cpp)
+
+#pragma once
+
+#include <cstdint>
+#include "common.hpp"
+#include "data_spec_packed.cuh"
+
+namespace {
+namespace device {
+
+// Leaf of the tree at world position xyz_ind, in data: the tree's data, or
+// a tensor of its shape, e.g. a gradient (possibly of another type, value_t)
+template <typename value_t, typename scalar_t, typename data_t>
+SVOX_HOST_DEVICE inline value_t* get_tree_leaf_ptr(
+       torch::PackedTensorAccessor64<value_t, 5, torch::RestrictPtrTraits>
+        data,
+       PackedTreeSpec<scalar_t, data_t>& __restrict__ tree,
+       const scalar_t* __restrict__ xyz_ind,
+       int64_t* node_id=nullptr) {
+    scalar_t xyz[3] = {xyz_ind[0], xyz_ind[1], xyz_ind[2]};
+    transform_coord<scalar_t>(xyz, tree.offset, tree.scaling);
+    scalar_t _cube_sz;
+    return query_single_from_root<scalar_t>(data, tree.child,
+            xyz, &_cube_sz, node_id, tree.child_bits, tree.child_list,
+            tree.packed_leaves);
+}
+
+// Rope of face `face` (2 * axis, +1 for the upper side) of node node_id:
+// the node of equal size adjacent across that face; or where the tree is
+// coarser there, the node whose leaf is adjacent; or -1 on the boundary of
+// the tree. Found by going up to the nearest ancestor with a cell on the
+// other side of the face, then down again along the path mirrored about it.
+// Only nodes above depth SVOX_WALKER_LEVELS (which TreeWalker reads ropes
+// of) get ropes, the rest -1.
+SVOX_HOST_DEVICE inline int32_t node_rope(
+       const torch::PackedTensorAccessor32<int32_t, 4, torch::RestrictPtrTraits>
+        child,
+       const torch::PackedTensorAccessor32<int32_t, 2, torch::RestrictPtrTraits>
+        parent_depth,
+       int32_t node_id, int face) {
+    const int32_t N = child.size(1);
+    const int axis = face >> 1, dir = (face & 1) ? 1 : -1;
+    const int32_t depth = parent_depth[node_id][1];
+    // Unused and deleted nodes have depth 0 and parent -1 respectively
+    if (depth <= 0 || depth >= SVOX_WALKER_LEVELS ||
+        parent_depth[node_id][0] < 0) {
+        return -1;
+    }
+
+    // path[k] is the cell to enter k + 1 levels above node_id on the way down
+    int32_t path[SVOX_WALKER_LEVELS][3];
+    int32_t node = node_id;
+    int k = 0;
+    while (true) {
+        if (k == depth) return -1;
+        int32_t packed = parent_depth[node][0];
+        for (int i = 2; i >= 0; --i) {
+            path[k][i] = packed % N;
+            packed /= N;
+        }
+        node = packed;
+        const int32_t across = path[k][axis] + dir;
+        if (across >= 0 && across < N) {
+            path[k++][axis] = across;
+            break;
+        }
+        path[k++][axis] = dir > 0 ? 0 : N - 1;
+    }
+    while (k > 0) {
+        --k;
+        const int32_t skip = child[node][path[k][0]][path[k][1]][path[k][2]];
+        if (skip == 0) break;
+        node += skip;
+    }
+    return node;
+}
+
+// Subtree maximum sigma for empty space skipping (TreeWalker::skip_empty):
+// max_sigma[slot] is the largest raw sigma over the leaves below the slot,
+// or its own sigma for a leaf. Built in two passes over the nodes, each
+// parallel: max_sigma_init_node writes a node's leaf sigmas, and -inf at its
+// internal slots; then max_sigma_climb_node raises the slot holding the
+// node, and the slots above it in turn, to the node's largest leaf sigma,
+// stopping at the first one that already is at least as large.
+template <typename scalar_t, typename data_t>
+SVOX_HOST_DEVICE inline void max_sigma_init_node(
+       PackedTreeSpec<scalar_t, data_t>& __restrict__ tree,
+       int32_t node_id,
+       scalar_t* __restrict__ max_sigma_out) {
+    const int32_t N3 = tree.child.size(1) * tree.child.size(1) * tree.child.size(1);
+    const int D = tree.data.size(4);
+    const int32_t* __restrict__ child = tree.child.data() + node_id * N3;
+    max_sigma_out += int64_t(node_id) * N3;
+    for (int32_t i = 0; i < N3; ++i) {
+        const int64_t leaf = int64_t(node_id) * N3 + i;
+        // The density array, if any, holds the sigmas (of int8 data, only it)
+        max_sigma_out[i] = child[i] == 0 ? (tree.density != nullptr ?
+                scalar_t(tree.density[leaf]) :
+                scalar_t(tree.data.data()[leaf_row(tree.child_bits,
+                        tree.packed_leaves, tree.child.size(1), leaf) * D +
+                        D - 1])) : scalar_t(-INFINITY);
+    }
+}
+
+template <typename scalar_t, typename data_t>
+SVOX_HOST_DEVICE inline void max_sigma_climb_node(
+       PackedTreeSpec<scalar_t, data_t>& __restrict__ tree,
+       int32_t node_id,
+       scalar_t* __restrict__ max_sigma_out) {
+    const int32_t N3 = tree.child.size(1) * tree.child.size(1) * tree.child.size(1);
+    const int32_t* __restrict__ child = tree.child.data();
+    int32_t parent = tree.parent_depth[node_id][0];
+    // Only nodes linked from their parent's slot are in the tree (unused
+    // rows have parent 0, deleted nodes -1)
+    if (node_id == 0 || parent < 0 || child[parent] != node_id - parent / N3) {
+        return;
+    }
+    // The leaf slots hold their final values after the first pass, and
+    // climbing never writes them
+    const scalar_t* sigma = max_sigma_out + int64_t(node_id) * N3;
+    scalar_t val = -INFINITY;
+    for (int32_t i = 0; i < N3; ++i) {
+        if (child[node_id * N3 + i] == 0) val = _fmax(val, sigma[i]);
+    }
+    while (_atomic_max(max_sigma_out + parent, val) < val) {
+        const int32_t up = parent / N3;
+        if (up == 0) break;
+        parent = tree.parent_depth[up][0];
+    }
+}
+
+}  // namespace device
+}  // namespace
@@ -0,0 +1,209 @@
+/*
+ * Copyright 2021 PlenOctree Authors
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Batched tree descent for the CPU SIMD kernels: query_single_from_root for
+// V::W points at a time, gathering child[node_id][u][v][w] (or ranking the
+// slots through the compact child masks) for all lanes at each level. Used
+// for point queries (query_vertical etc.) and by the packet ray tracer
+// (rt_packet.hpp).
+//
+// Include from simd_avx2.cpp / simd_avx512.cpp only, after simd.hpp.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include "common.hpp"
+#include "data_spec_packed.cuh"
+
+namespace simd {
+namespace {
+
+struct Descender {
+    const int32_t* __restrict__ child;
+    V::vf Nf;
+    V::vi Ni, N2i, N3i;
+    // See skip_empty
+    const float* __restrict__ max_sigma;
+    V::vf empty_sigma;
+    // See compact
+    const int32_t* __restrict__ child_bits;
+    const int32_t* __restrict__ child_list;
+    int words;
+
+    Descender(const int32_t* child, int N) : child(child),
+        Nf(V::set1(float(N))), Ni(V::set1i(N)), N2i(V::set1i(N * N)),
+        N3i(V::set1i(N * N * N)), max_sigma(nullptr), child_bits(nullptr),
+        child_list(nullptr), words(device::child_mask_words(N)) {}
+
+    // As the child_bits argument of TreeWalker: read the child entries from
+    // the compact encoding (see TreeSpec::child_bits) instead of child
+    void compact(const int32_t* child_bits, const int32_t* child_list) {
+        this->child_bits = child_bits;
+        this->child_list = child_list;
+    }
+
+    // As TreeWalker::skip_empty: stop at subtrees whose maximum sigma in
+    // max_sigma is <= sigma, flagging the lane as empty
+    void skip_empty(const float* max_sigma, float sigma) {
+        this->max_sigma = max_sigma;
+        empty_sigma = V::set1(sigma);
+    }
+
+    // compact_child of slot i of node node for the lanes in m (0 elsewhere):
+    // the node's base plus the set bits below the slot in the words up to
+    // the slot's, whose own bit says whether there is a child at all
+    inline V::vi compact_gather(V::vi node, V::vi i, V::vm m) const {
+        const V::vi zeroi = V::set1i(0), onei = V::set1i(1);
+        const V::vi row = V::muli(node, V::set1i(words + 1));
+        const V::vi word_id = V::srli(i, 5);
+        const V::vi bit = V::sllvi(onei, V::andi(i, V::set1i(31)));
+        const V::vi below = V::subi(bit, onei);
+        V::vi rank = V::gatheri(child_bits, row, m, zeroi);
+        V::vm has = V::from_bits(0), rest = m;
+        for (int k = 0; V::bits(rest); ++k) {
+            const V::vi word = V::gatheri(child_bits + 1 + k, row, rest, zeroi);
+            const V::vm last = V::mand(rest, V::eqi(word_id, V::set1i(k)));
+            rank = V::addi(rank, vpopcnt(V::seli(last, V::andi(word, below), word)));
+            has = V::mor(has, V::mandnot(last, V::eqi(V::andi(word, bit), zeroi)));
+            rest = V::mandnot(rest, last);
+        }
+        return V::gatheri(child_list, rank, has, zeroi);
+    }
+
+    // Clamp positions to the unit cube, as in clamp_coord
+    inline void clamp(V::vf* pos) const {
+        for (int j = 0; j < 3; ++j) {
+            pos[j] = V::max(V::set1(0.f), V::min(V::set1(float(1.0 - 1e-6)), pos[j]));
+        }
+    }
+
+    // One level of the descent for the lanes in m. Lanes reaching a leaf get
+    // its index (node_id * N^3 + offset, as node_id_out of
+    // query_single_from_root) in leaf, the others move to the child node;
+    // returns the lanes which still need to descend. With skip_empty, lanes
+    // stopping at an empty subtree are added to empty.
+    inline V::vm step(V::vf* pos, V::vi& node, V::vi& leaf, V::vm m,
+                      V::vm* empty = nullptr) const {
+        V::vi uvw[3];
+        for (int j = 0; j < 3; ++j) {
+            const V::vf s = V::mul(pos[j], Nf);
+            uvw[j] = V::cvti(s);
+            pos[j] = V::sel(m, V::sub(s, V::cvtf(uvw[j])), pos[j]);
+        }
+        const V::vi slot = V::addi(V::muli(uvw[0], N2i),
+                                   V::addi(V::muli(uvw[1], Ni), uvw[2]));
+        const V::vi idx = V::addi(V::muli(node, N3i), slot);
+        const V::vi zeroi = V::set1i(0);
+        const V::vi skip = child_bits != nullptr ?
+            compact_gather(node, slot, m) : V::gatheri(child, idx, m, zeroi);
+        leaf = V::seli(m, idx, leaf);
+        node = V::addi(node, skip);
+        V::vm down = V::mandnot(m, V::eqi(skip, zeroi));
+        if (max_sigma != nullptr && V::bits(down)) {
+            const V::vm e = V::mand(down, V::le(
+                        V::gather(max_sigma, idx, down, empty_sigma), empty_sigma));
+            *empty = V::mor(*empty, e);
+            down = V::mandnot(down, e);
+        }
+        return down;
+    }
+
+    // Full descent from the root for the (clamped) positions of the lanes
+    // in m; on return pos holds the position within the leaf voxel and
+    // cube_sz the inverse voxel size. With skip_empty, the lanes which
+    // stopped at an empty subtree are returned in empty, with pos and
+    // cube_sz those of the subtree's cell.
+    inline V::vi descend(V::vf* pos, V::vm m, V::vf& cube_sz,
+                         V::vm* empty = nullptr) const {
+        V::vi node = V::set1i(0), leaf = node;
+        V::vm empty_tmp = V::from_bits(0);
+        if (empty == nullptr) empty = &empty_tmp;
+        *empty = V::from_bits(0);
+        cube_sz = Nf;
+        while (true) {
+            m = step(pos, node, leaf, m, empty);
+            if (!V::bits(m)) break;
+            cube_sz = V::sel(m, V::mul(cube_sz, Nf), cube_sz);
+        }
+        return leaf;
+    }
+};
+
+// Leaf index of each of the points [begin, end) (given in tree coordinates,
+// before transform_coord), stored to leaf_out[0, end - begin). Points are
+// processed in blocks of QUERY_BLOCK vectors which descend together level
+// by level, so that the gathers of independent vectors overlap.
+void query_leaves_impl(
+        PackedTreeSpec<float>& tree,
+        const torch::PackedTensorAccessor32<float, 2, torch::RestrictPtrTraits> indices,
+        int64_t begin, int64_t end,
+        int64_t* __restrict__ leaf_out) {
+    constexpr int W = V::W;
+    constexpr int QUERY_BLOCK = 4;
+    Descender desc(tree.child.data(), tree.child.size(1));
+    if (tree.child_bits != nullptr) desc.compact(tree.child_bits, tree.child_list);
+
+    alignas(64) float xyz[3][QUERY_BLOCK * W];
+    alignas(64) int32_t leaf_tmp[QUERY_BLOCK * W];
+    for (int64_t blk = begin; blk < end; blk += QUERY_BLOCK * W) {
+        const int n = int(std::min<int64_t>(QUERY_BLOCK * W, end - blk));
+        for (int i = 0; i < n; ++i) {
+            for (int j = 0; j < 3; ++j) {
+                xyz[j][i] = tree.offset[j] + tree.scaling[j] * indices[blk + i][j];
+            }
+        }
+        for (int i = n; i < QUERY_BLOCK * W; ++i) {
+            xyz[0][i] = xyz[1][i] = xyz[2][i] = 0.f;
+        }
+
+        V::vf pos[QUERY_BLOCK][3];
+        V::vi node[QUERY_BLOCK], leaf[QUERY_BLOCK];
+        V::vm m[QUERY_BLOCK];
+        unsigned any = 0;
+        for (int b = 0; b < QUERY_BLOCK; ++b) {
+            for (int j = 0; j < 3; ++j) pos[b][j] = V::load(&xyz[j][b * W]);
+            desc.clamp(pos[b]);
+            node[b] = leaf[b] = V::set1i(0);
+            const int n_lanes = std::max(0, std::min(W, n - b * W));
+            m[b] = V::from_bits((1u << n_lanes) - 1);
+            any |= V::bits(m[b]);
+        }
+        while (any) {
+            any = 0;
+            for (int b = 0; b < QUERY_BLOCK; ++b) {
+                if (!V::bits(m[b])) continue;
+                m[b] = desc.step(pos[b], node[b], leaf[b], m[b]);
+                any |= V::bits(m[b]);
+            }
+        }
+        for (int b = 0; b < QUERY_BLOCK; ++b) V::storei(&leaf_tmp[b * W], leaf[b]);
+        for (int i = 0; i < n; ++i) leaf_out[blk - begin + i] = leaf_tmp[i];
+    }
+}
+
+}  // namespace
+}  // namespace simd
@@ -0,0 +1,189 @@
+/*
+ * Copyright 2021 PlenOctree Authors
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Node orders for N3Tree.reorder: permutations of the nodes of a tree that
+// put nodes a descent visits in turn close together in memory
+
+#include <torch/extension.h>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace {
+
+enum NodeLayout {
+    // Depth-first (preorder), children in slot order
+    LAYOUT_DFS,
+    // Breadth-first, so that the children of a node are contiguous
+    LAYOUT_BFS,
+    // Depth-first, children in Morton (Z) order of their cells; the same
+    // as LAYOUT_DFS for octrees
+    LAYOUT_MORTON,
+    // van Emde Boas: the top half of the levels, then each subtree below
+    // it, recursively
+    LAYOUT_VEB,
+};
+
+// Slots of a node in Morton order of their cells (u, v, w)
+std::vector<int32_t> morton_slots(int32_t N) {
+    int bits = 0;
+    while ((1 << bits) < N) ++bits;
+    std::vector<std::pair<int64_t, int32_t>> codes;
+    for (int32_t u = 0; u < N; ++u)
+        for (int32_t v = 0; v < N; ++v)
+            for (int32_t w = 0; w < N; ++w) {
+                int64_t code = 0;
+                for (int b = bits - 1; b >= 0; --b) {
+                    code = (code << 3) | (((u >> b) & 1) << 2) |
+                           (((v >> b) & 1) << 1) | ((w >> b) & 1);
+                }
+                codes.emplace_back(code, (u * N + v) * N + w);
+            }
+    std::sort(codes.begin(), codes.end());
+    std::vector<int32_t> slots;
+    for (const auto& c : codes) slots.push_back(c.second);
+    return slots;
+}
+
+// Children (node ids) of each node, in the order of slots, as CSR
+struct NodeChildren {
+    std::vector<int64_t> begin;
+    std::vector<int32_t> ids;
+
+    NodeChildren(const int32_t* child, int64_t M, int32_t N3,
+                 const std::vector<int32_t>& slots) : begin(M + 1) {
+        for (int64_t node = 0; node < M; ++node) {
+            begin[node] = ids.size();
+            for (int32_t i : slots) {
+                const int32_t skip = child[node * N3 + i];
+                if (skip != 0) ids.push_back(int32_t(node + skip));
+            }
+        }
+        begin[M] = ids.size();
+    }
+};
+
+void _order_dfs(const NodeChildren& ch, std::vector<int32_t>& order) {
+    std::vector<int32_t> stack = {0};
+    while (!stack.empty()) {
+        const int32_t node = stack.back();
+        stack.pop_back();
+        order.push_back(node);
+        for (int64_t k = ch.begin[node + 1]; k > ch.begin[node]; --k) {
+            stack.push_back(ch.ids[k - 1]);
+        }
+    }
+}
+
+void _order_bfs(const NodeChildren& ch, std::vector<int32_t>& order) {
+    order.push_back(0);
+    for (size_t head = 0; head < order.size(); ++head) {
+        const int32_t node = order[head];
+        for (int64_t k = ch.begin[node]; k < ch.begin[node + 1]; ++k) {
+            order.push_back(ch.ids[k]);
+        }
+    }
+}
+
+// Appends the nodes levels below node, in depth-first order
+void _nodes_below(const NodeChildren& ch, int32_t node, int levels,
+                  std::vector<int32_t>& out) {
+    if (levels == 0) {
+        out.push_back(node);
+        return;
+    }
+    for (int64_t k = ch.begin[node]; k < ch.begin[node + 1]; ++k) {
+        _nodes_below(ch, ch.ids[k], levels - 1, out);
+    }
+}
+
+// Lays out the first `levels` levels of the subtree at node
+void _order_veb(const NodeChildren& ch, int32_t node, int levels,
+                std::vector<int32_t>& order) {
+    if (levels == 1) {
+        order.push_back(node);
+        return;
+    }
+    const int top = (levels + 1) / 2;
+    _order_veb(ch, node, top, order);
+    std::vector<int32_t> bottom;
+    _nodes_below(ch, node, top, bottom);
+    for (int32_t sub : bottom) {
+        _order_veb(ch, sub, levels - top, order);
+    }
+}
+
+}  // namespace
+
+// Permutation of the nodes of the tree with the [M, N, N, N] child array
+// child (relative offsets, root at 0) into layout (see NodeLayout): the
+// old id of the node to place at each new index; the root stays first.
+// All M nodes must be reachable from the root.
+torch::Tensor reorder_nodes(torch::Tensor child, int64_t layout) {
+    TORCH_CHECK(child.is_contiguous());
+    TORCH_CHECK(!child.is_cuda());
+    TORCH_CHECK(child.scalar_type() == at::kInt);
+    TORCH_CHECK(child.dim() == 4);
+    TORCH_CHECK(layout >= LAYOUT_DFS && layout <= LAYOUT_VEB,
+                "Unknown node layout ", layout);
+    const int64_t M = child.size(0);
+    const int32_t N = child.size(1), N3 = N * N * N;
+
+    std::vector<int32_t> slots(N3);
+    for (int32_t i = 0; i < N3; ++i) slots[i] = i;
+    if (layout == LAYOUT_MORTON) slots = morton_slots(N);
+    NodeChildren ch(child.data_ptr<int32_t>(), M, N3, slots);
+
+    std::vector<int32_t> order;
+    order.reserve(M);
+    switch (layout) {
+        case LAYOUT_BFS:
+            _order_bfs(ch, order);
+            break;
+        case LAYOUT_VEB: {
+            // Number of levels, from the breadth-first order
+            std::vector<int32_t> bfs, level(M, 1);
+            _order_bfs(ch, bfs);
+            int levels = 1;
+            for (int32_t node : bfs) {
+                levels = std::max(levels, level[node]);
+                for (int64_t k = ch.begin[node]; k < ch.begin[node + 1]; ++k) {
+                    level[ch.ids[k]] = level[node] + 1;
+                }
+            }
+            _order_veb(ch, 0, levels, order);
+            break;
+        }
+        default:
+            _order_dfs(ch, order);
+    }
+    TORCH_CHECK(int64_t(order.size()) == M,
+                "Tree has nodes unreachable from the root (free nodes?)");
+
+    torch::Tensor result = torch::empty({M}, child.options().dtype(at::kLong));
+    std::copy(order.begin(), order.end(), result.data_ptr<int64_t>());
+    return result;
+}
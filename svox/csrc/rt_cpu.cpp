@@ -0,0 +1,914 @@
+/*
+ * Copyright 2021 PlenOctree Authors
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// CPU implementation of the volume renderer. The per-ray tracing routines
+// are shared with the CUDA kernels (see rt_core.hpp); here we only
+// distribute rays over the ATen intra-op thread pool. Where possible the
+// forward pass instead uses the SIMD packet tracer (rt_packet.hpp), and the
+// backward / se_grad passes evaluate the basis functions and contract the
+// coefficients with SIMD (sh_simd.hpp).
+
+#include <torch/extension.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "data_spec_packed.cuh"
+#include "rt_core.hpp"
+#include "cpu_grad.hpp"
+#include "cpu_simd.hpp"
+
+// Minimum number of rays handed to a CPU worker at once
+#define CPU_GRAIN_SIZE 64
+// Default edge length (pixels) of the square image tiles
+#define CPU_TILE_SIZE 16
+
+namespace {
+namespace cpu {
+
+// Whether the forward pass can use the SIMD packet tracer, which handles
+// float trees (not leaf-packed, without bricks) with up to 4 output
+// channels
+bool use_packet_tracer(TreeSpec& tree, RenderOptions& opt, int out_data_dim) {
+    return cpu_isa() != CPU_ISA_SCALAR &&
+           tree.data.scalar_type() == at::kFloat && !tree.packed_leaves &&
+           !tree.has_bricks() &&
+           tree.data.is_contiguous() && tree.child.is_contiguous() &&
+           tree.data.numel() < (int64_t(1) << 31) &&
+           out_data_dim <= 4 && opt.basis_dim <= 25;
+}
+
+void packet_render_rays(
+        PackedTreeSpec<float>& tree,
+        PackedRaysSpec<float>& rays,
+        RenderOptions& opt,
+    torch::PackedTensorAccessor32<float, 2, torch::RestrictPtrTraits> out,
+        int64_t begin, int64_t end,
+        PackedSampleLog<float>& log,
+        float* trans) {
+#ifdef SVOX_X86_SIMD
+    if (cpu_isa() == CPU_ISA_AVX512) {
+        simd::avx512::render_rays(tree, rays, opt, out, begin, end, log, trans);
+    } else {
+        simd::avx2::render_rays(tree, rays, opt, out, begin, end, log, trans);
+    }
+#endif
+}
+
+void packet_render_image_tile(
+        PackedTreeSpec<float>& tree,
+        PackedCameraSpec<float>& cam,
+        RenderOptions& opt,
+        int tile_size, int64_t tile,
+    torch::PackedTensorAccessor32<float, 3, torch::RestrictPtrTraits> out,
+        float* trans) {
+#ifdef SVOX_X86_SIMD
+    if (cpu_isa() == CPU_ISA_AVX512) {
+        simd::avx512::render_image_tile(tree, cam, opt, tile_size, tile, out,
+                                        trans);
+    } else {
+        simd::avx2::render_image_tile(tree, cam, opt, tile_size, tile, out,
+                                      trans);
+    }
+#endif
+}
+
+// Not reached: use_packet_tracer is false for other than float trees
+template <typename scalar_t, typename data_t>
+void packet_render_image_tile(
+        PackedTreeSpec<scalar_t, data_t>& tree,
+        PackedCameraSpec<scalar_t>& cam,
+        RenderOptions& opt,
+        int tile_size, int64_t tile,
+    torch::PackedTensorAccessor32<scalar_t, 3, torch::RestrictPtrTraits> out,
+        scalar_t* trans) {
+    TORCH_CHECK(false, "SIMD packet tracer only supports float");
+}
+
+// Whether the backward and se_grad passes can use the SIMD basis evaluation
+// and coefficient contraction, which handle float trees
+bool use_simd_basis(TreeSpec& tree, RenderOptions& opt) {
+    return cpu_isa() != CPU_ISA_SCALAR &&
+           tree.data.scalar_type() == at::kFloat &&
+           tree.data.is_contiguous() && opt.basis_dim <= 25;
+}
+
+void simd_render_rays_backward(
+        PackedTreeSpec<float>& tree,
+    const torch::PackedTensorAccessor32<float, 2, torch::RestrictPtrTraits>
+        grad_output,
+        PackedRaysSpec<float>& rays,
+        RenderOptions& opt,
+        GradBuffer<float>::Sink& grad_data_out,
+        int64_t begin, int64_t end,
+        PackedSampleLog<float>& log,
+        const float* fwd_out, const float* fwd_trans) {
+#ifdef SVOX_X86_SIMD
+    if (cpu_isa() == CPU_ISA_AVX512) {
+        simd::avx512::render_rays_backward(tree, grad_output, rays, opt,
+                                           grad_data_out, begin, end, log,
+                                           fwd_out, fwd_trans);
+    } else {
+        simd::avx2::render_rays_backward(tree, grad_output, rays, opt,
+                                         grad_data_out, begin, end, log,
+                                         fwd_out, fwd_trans);
+    }
+#endif
+}
+
+void simd_render_image_tile_backward(
+        PackedTreeSpec<float>& tree,
+    const torch::PackedTensorAccessor32<float, 3, torch::RestrictPtrTraits>
+        grad_output,
+        PackedCameraSpec<float>& cam,
+        RenderOptions& opt,
+        int tile_size, int64_t tile,
+        GradBuffer<float>::Sink& grad_data_out,
+        const float* fwd_out, const float* fwd_trans) {
+#ifdef SVOX_X86_SIMD
+    if (cpu_isa() == CPU_ISA_AVX512) {
+        simd::avx512::render_image_tile_backward(tree, grad_output, cam, opt,
+                tile_size, tile, grad_data_out, fwd_out, fwd_trans);
+    } else {
+        simd::avx2::render_image_tile_backward(tree, grad_output, cam, opt,
+                tile_size, tile, grad_data_out, fwd_out, fwd_trans);
+    }
+#endif
+}
+
+void simd_se_grad_rays(
+        PackedTreeSpec<float>& tree,
+        PackedRaysSpec<float>& rays,
+        RenderOptions& opt,
+    torch::PackedTensorAccessor32<float, 2, torch::RestrictPtrTraits> color_ref,
+    torch::PackedTensorAccessor32<float, 2, torch::RestrictPtrTraits> color_out,
+        GradBuffer<float>::Sink& grad_out,
+        GradBuffer<float>::Sink& hessdiag_out,
+        int64_t begin, int64_t end) {
+#ifdef SVOX_X86_SIMD
+    if (cpu_isa() == CPU_ISA_AVX512) {
+        simd::avx512::se_grad_rays(tree, rays, opt, color_ref, color_out,
+                                   grad_out, hessdiag_out, begin, end);
+    } else {
+        simd::avx2::se_grad_rays(tree, rays, opt, color_ref, color_out,
+                                 grad_out, hessdiag_out, begin, end);
+    }
+#endif
+}
+
+void simd_se_grad_image_tile(
+        PackedTreeSpec<float>& tree,
+        PackedCameraSpec<float>& cam,
+        RenderOptions& opt,
+        int tile_size, int64_t tile,
+    torch::PackedTensorAccessor32<float, 3, torch::RestrictPtrTraits> color_ref,
+    torch::PackedTensorAccessor32<float, 3, torch::RestrictPtrTraits> color_out,
+        GradBuffer<float>::Sink& grad_out,
+        GradBuffer<float>::Sink& hessdiag_out) {
+#ifdef SVOX_X86_SIMD
+    if (cpu_isa() == CPU_ISA_AVX512) {
+        simd::avx512::se_grad_image_tile(tree, cam, opt, tile_size, tile,
+                color_ref, color_out, grad_out, hessdiag_out);
+    } else {
+        simd::avx2::se_grad_image_tile(tree, cam, opt, tile_size, tile,
+                color_ref, color_out, grad_out, hessdiag_out);
+    }
+#endif
+}
+
+// Not reached: use_simd_basis is false for other than float trees
+template <typename scalar_t, typename data_t>
+void simd_render_image_tile_backward(
+        PackedTreeSpec<scalar_t, data_t>& tree,
+    const torch::PackedTensorAccessor32<scalar_t, 3, torch::RestrictPtrTraits>
+        grad_output,
+        PackedCameraSpec<scalar_t>& cam,
+        RenderOptions& opt,
+        int tile_size, int64_t tile,
+        typename GradBuffer<scalar_t>::Sink& grad_data_out,
+        const scalar_t* fwd_out, const scalar_t* fwd_trans) {
+    TORCH_CHECK(false, "SIMD basis evaluation only supports float");
+}
+
+template <typename scalar_t, typename data_t>
+void simd_se_grad_image_tile(
+        PackedTreeSpec<scalar_t, data_t>& tree,
+        PackedCameraSpec<scalar_t>& cam,
+        RenderOptions& opt,
+        int tile_size, int64_t tile,
+    torch::PackedTensorAccessor32<scalar_t, 3, torch::RestrictPtrTraits> color_ref,
+    torch::PackedTensorAccessor32<scalar_t, 3, torch::RestrictPtrTraits> color_out,
+        typename GradBuffer<scalar_t>::Sink& grad_out,
+        typename GradBuffer<scalar_t>::Sink& hessdiag_out) {
+    TORCH_CHECK(false, "SIMD basis evaluation only supports float");
+}
+
+void render_ray_packet_kernel(
+        PackedTreeSpec<float> tree,
+        PackedRaysSpec<float> rays,
+        RenderOptions opt,
+    torch::PackedTensorAccessor32<float, 2, torch::RestrictPtrTraits>
+        out,
+        PackedSampleLog<float> log,
+        float* trans) {
+    at::parallel_for(0, rays.origins.size(0), CPU_GRAIN_SIZE,
+            [&](int64_t begin, int64_t end) {
+        packet_render_rays(tree, rays, opt, out, begin, end, log, trans);
+    });
+}
+
+template <typename scalar_t, typename data_t>
+void render_ray_kernel(
+        PackedTreeSpec<scalar_t, data_t> tree,
+        PackedRaysSpec<scalar_t> rays,
+        RenderOptions opt,
+    torch::PackedTensorAccessor32<scalar_t, 2, torch::RestrictPtrTraits>
+        out,
+        PackedSampleLog<scalar_t> log,
+        scalar_t* trans) {
+    at::parallel_for(0, rays.origins.size(0), CPU_GRAIN_SIZE,
+            [&](int64_t begin, int64_t end) {
+        for (int64_t tid = begin; tid < end; ++tid) {
+            scalar_t origin[3] = {rays.origins[tid][0], rays.origins[tid][1], rays.origins[tid][2]};
+            device::transform_coord<scalar_t>(origin, tree.offset, tree.scaling);
+            scalar_t dir[3] = {rays.dirs[tid][0], rays.dirs[tid][1], rays.dirs[tid][2]};
+            device::trace_ray<scalar_t>(
+                tree,
+                SingleRaySpec<scalar_t>{origin, dir, &rays.vdirs[tid][0]},
+                opt,
+                out[tid],
+                nullptr,
+                device::sample_log_row(log, tid),
+                trans + tid);
+        }
+    });
+}
+
+// Distributes a fixed number of work items (e.g. image tiles) over the
+// intra-op thread pool with work stealing. Items start out split into one
+// contiguous range per worker, so neighbouring tiles (which touch the same
+// part of the tree) stay on one thread; a worker whose range runs dry steals
+// the back half of the largest remaining range.
+class WorkStealingScheduler {
+public:
+    WorkStealingScheduler(int64_t n_items, int n_workers) :
+        n_workers_(std::max(1, n_workers)), ranges_(n_workers_) {
+        TORCH_CHECK(n_items < (int64_t(1) << 31), "Too many work items");
+        for (int i = 0; i < n_workers_; ++i) {
+            ranges_[i].val.store(_pack(n_items * i / n_workers_,
+                                       n_items * (i + 1) / n_workers_));
+        }
+    }
+
+    // Calls f(item) exactly once for every item, from the worker threads
+    template <typename F>
+    void run(const F& f) {
+        at::parallel_for(0, n_workers_, 1, [&](int64_t begin, int64_t end) {
+            for (int64_t w = begin; w < end; ++w) {
+                int64_t item;
+                while (_pop(w, &item) || _steal(w, &item)) {
+                    f(item);
+                }
+            }
+        });
+    }
+
+private:
+    struct alignas(64) Range {
+        std::atomic<uint64_t> val;
+    };
+
+    static uint64_t _pack(int64_t begin, int64_t end) {
+        return (uint64_t(begin) << 32) | uint64_t(end);
+    }
+    static int64_t _begin(uint64_t v) { return int64_t(v >> 32); }
+    static int64_t _end(uint64_t v) { return int64_t(v & 0xFFFFFFFFu); }
+
+    // Take the front item of worker w's own range
+    bool _pop(int64_t w, int64_t* item) {
+        std::atomic<uint64_t>& range = ranges_[w].val;
+        uint64_t v = range.load();
+        while (_begin(v) < _end(v)) {
+            if (range.compare_exchange_weak(v, _pack(_begin(v) + 1, _end(v)))) {
+                *item = _begin(v);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Move the back half of the largest other range to worker w (which is
+    // empty) and take its first item. Returns false once all work is taken.
+    bool _steal(int64_t w, int64_t* item) {
+        while (true) {
+            int64_t victim = -1, best = 0;
+            uint64_t v = 0;
+            for (int i = 0; i < n_workers_; ++i) {
+                const uint64_t cur = ranges_[i].val.load();
+                const int64_t remain = _end(cur) - _begin(cur);
+                if (remain > best) {
+                    best = remain;
+                    victim = i;
+                    v = cur;
+                }
+            }
+            if (victim < 0) return false;
+            const int64_t n_steal = (best + 1) / 2;
+            const int64_t split = _end(v) - n_steal;
+            if (ranges_[victim].val.compare_exchange_strong(v,
+                        _pack(_begin(v), split))) {
+                *item = split;
+                ranges_[w].val.store(_pack(split + 1, split + n_steal));
+                return true;
+            }
+        }
+    }
+
+    const int n_workers_;
+    std::vector<Range> ranges_;
+};
+
+// Generates the tree-space ray of every pixel in the given tile and
+// calls f(ix, iy, ray)
+template <typename scalar_t, typename data_t, typename func_t>
+void for_each_tile_ray(
+        PackedTreeSpec<scalar_t, data_t>& tree,
+        PackedCameraSpec<scalar_t>& cam,
+        RenderOptions& opt,
+        int tile_size, int64_t tile,
+        const func_t& f) {
+    const int64_t tiles_x = (cam.width + tile_size - 1) / tile_size;
+    const int iy_begin = tile / tiles_x * tile_size;
+    const int ix_begin = tile % tiles_x * tile_size;
+    const int iy_end = std::min(cam.height, iy_begin + tile_size);
+    const int ix_end = std::min(cam.width, ix_begin + tile_size);
+    for (int iy = iy_begin; iy < iy_end; ++iy) {
+        for (int ix = ix_begin; ix < ix_end; ++ix) {
+            scalar_t dir[3], origin[3];
+            device::cam2world_ray(ix, iy, dir, origin, cam);
+            scalar_t vdir[3] = {dir[0], dir[1], dir[2]};
+            device::maybe_world2ndc(opt, dir, origin);
+
+            device::transform_coord<scalar_t>(origin, tree.offset, tree.scaling);
+            f(ix, iy, SingleRaySpec<scalar_t>{origin, dir, vdir});
+        }
+    }
+}
+
+template <typename scalar_t, typename data_t>
+void render_image_kernel(
+        PackedTreeSpec<scalar_t, data_t> tree,
+        PackedCameraSpec<scalar_t> cam,
+        RenderOptions opt,
+        int tile_size,
+        bool use_packet,
+    torch::PackedTensorAccessor32<scalar_t, 3, torch::RestrictPtrTraits>
+        out,
+        scalar_t* trans,
+    torch::PackedTensorAccessor32<float, 2, torch::RestrictPtrTraits>
+        tile_ms) {
+    const int64_t tiles_y = tile_ms.size(0), tiles_x = tile_ms.size(1);
+    WorkStealingScheduler sched(tiles_x * tiles_y, at::get_num_threads());
+    sched.run([&](int64_t tile) {
+        const auto start = std::chrono::steady_clock::now();
+        if (use_packet) {
+            packet_render_image_tile(tree, cam, opt, tile_size, tile, out,
+                                     trans);
+        } else {
+            for_each_tile_ray(tree, cam, opt, tile_size, tile,
+                    [&](int ix, int iy, SingleRaySpec<scalar_t> ray) {
+                device::trace_ray<scalar_t>(tree, ray, opt, out[iy][ix],
+                        nullptr, SingleSampleLog<scalar_t>(),
+                        trans + iy * cam.width + ix);
+            });
+        }
+        tile_ms[tile / tiles_x][tile % tiles_x] =
+            std::chrono::duration<float, std::milli>(
+                std::chrono::steady_clock::now() - start).count();
+    });
+}
+
+void render_ray_backward_simd_kernel(
+        PackedTreeSpec<float> tree,
+    const torch::PackedTensorAccessor32<float, 2, torch::RestrictPtrTraits>
+        grad_output,
+        PackedRaysSpec<float> rays,
+        RenderOptions opt,
+        PackedSampleLog<float> log,
+        const float* fwd_out,
+        const float* fwd_trans,
+        GradBuffer<float>& grad_data_out) {
+    at::parallel_for(0, rays.origins.size(0), CPU_GRAIN_SIZE,
+            [&](int64_t begin, int64_t end) {
+        auto grad_sink = grad_data_out.local();
+        simd_render_rays_backward(tree, grad_output, rays, opt, grad_sink,
+                                  begin, end, log, fwd_out, fwd_trans);
+    });
+}
+
+template <typename scalar_t, typename data_t>
+void render_ray_backward_kernel(
+        PackedTreeSpec<scalar_t, data_t> tree,
+    const torch::PackedTensorAccessor32<scalar_t, 2, torch::RestrictPtrTraits>
+        grad_output,
+        PackedRaysSpec<scalar_t> rays,
+        RenderOptions opt,
+        PackedSampleLog<scalar_t> log,
+        const scalar_t* fwd_out,
+        const scalar_t* fwd_trans,
+        GradBuffer<scalar_t>& grad_data_out) {
+    const int out_data_dim = grad_output.size(1);
+    at::parallel_for(0, rays.origins.size(0), CPU_GRAIN_SIZE,
+            [&](int64_t begin, int64_t end) {
+        auto grad_sink = grad_data_out.local();
+        for (int64_t tid = begin; tid < end; ++tid) {
+            scalar_t origin[3] = {rays.origins[tid][0], rays.origins[tid][1], rays.origins[tid][2]};
+            device::transform_coord<scalar_t>(origin, tree.offset, tree.scaling);
+            scalar_t dir[3] = {rays.dirs[tid][0], rays.dirs[tid][1], rays.dirs[tid][2]};
+            device::trace_ray_backward<scalar_t>(
+                tree,
+                grad_output[tid],
+                SingleRaySpec<scalar_t>{origin, dir, &rays.vdirs[tid][0]},
+                opt,
+                grad_sink,
+                nullptr,
+                device::sample_log_row(log, tid),
+                fwd_out ? fwd_out + tid * out_data_dim : nullptr,
+                fwd_trans ? fwd_trans + tid : nullptr);
+        }
+    });
+}
+
+template <typename scalar_t, typename data_t>
+void render_image_backward_kernel(
+        PackedTreeSpec<scalar_t, data_t> tree,
+    const torch::PackedTensorAccessor32<scalar_t, 3, torch::RestrictPtrTraits>
+        grad_output,
+        PackedCameraSpec<scalar_t> cam,
+        RenderOptions opt,
+        int tile_size,
+        bool use_simd,
+        const scalar_t* fwd_out,
+        const scalar_t* fwd_trans,
+        GradBuffer<scalar_t>& grad_data_out) {
+    const int out_data_dim = grad_output.size(2);
+    const int64_t tiles_y = (cam.height + tile_size - 1) / tile_size;
+    const int64_t tiles_x = (cam.width + tile_size - 1) / tile_size;
+    WorkStealingScheduler sched(tiles_x * tiles_y, at::get_num_threads());
+    sched.run([&](int64_t tile) {
+        auto grad_sink = grad_data_out.local();
+        if (use_simd) {
+            simd_render_image_tile_backward(tree, grad_output, cam, opt,
+                                            tile_size, tile, grad_sink,
+                                            fwd_out, fwd_trans);
+            return;
+        }
+        for_each_tile_ray(tree, cam, opt, tile_size, tile,
+                [&](int ix, int iy, SingleRaySpec<scalar_t> ray) {
+            const int64_t id = iy * cam.width + ix;
+            device::trace_ray_backward<scalar_t>(
+                tree, grad_output[iy][ix], ray, opt, grad_sink, nullptr,
+                SingleSampleLog<scalar_t>(),
+                fwd_out ? fwd_out + id * out_data_dim : nullptr,
+                fwd_trans ? fwd_trans + id : nullptr);
+        });
+    });
+}
+
+void se_grad_simd_kernel(
+        PackedTreeSpec<float> tree,
+        PackedRaysSpec<float> rays,
+        RenderOptions opt,
+    torch::PackedTensorAccessor32<float, 2, torch::RestrictPtrTraits> color_ref,
+    torch::PackedTensorAccessor32<float, 2, torch::RestrictPtrTraits> color_out,
+        GradBuffer<float>& grad_out,
+        GradBuffer<float>& hessdiag_out) {
+    const int64_t Q = rays.origins.size(0);
+    WorkStealingScheduler sched((Q + CPU_GRAIN_SIZE - 1) / CPU_GRAIN_SIZE,
+                                at::get_num_threads());
+    sched.run([&](int64_t chunk) {
+        auto grad_sink = grad_out.local();
+        auto hessdiag_sink = hessdiag_out.local();
+        simd_se_grad_rays(tree, rays, opt, color_ref, color_out,
+                          grad_sink, hessdiag_sink, chunk * CPU_GRAIN_SIZE,
+                          std::min(Q, (chunk + 1) * CPU_GRAIN_SIZE));
+    });
+}
+
+template <typename scalar_t, typename data_t>
+void se_grad_kernel(
+        PackedTreeSpec<scalar_t, data_t> tree,
+        PackedRaysSpec<scalar_t> rays,
+        RenderOptions opt,
+    torch::PackedTensorAccessor32<scalar_t, 2, torch::RestrictPtrTraits> color_ref,
+    torch::PackedTensorAccessor32<scalar_t, 2, torch::RestrictPtrTraits> color_out,
+        GradBuffer<scalar_t>& grad_out,
+        GradBuffer<scalar_t>& hessdiag_out) {
+    // Each ray makes three passes, and their lengths vary a lot; hand out
+    // fixed-size chunks of rays with work stealing
+    const int64_t Q = rays.origins.size(0);
+    WorkStealingScheduler sched((Q + CPU_GRAIN_SIZE - 1) / CPU_GRAIN_SIZE,
+                                at::get_num_threads());
+    sched.run([&](int64_t chunk) {
+        auto grad_sink = grad_out.local();
+        auto hessdiag_sink = hessdiag_out.local();
+        const int64_t end = std::min(Q, (chunk + 1) * CPU_GRAIN_SIZE);
+        for (int64_t tid = chunk * CPU_GRAIN_SIZE; tid < end; ++tid) {
+            scalar_t origin[3] = {rays.origins[tid][0], rays.origins[tid][1], rays.origins[tid][2]};
+            device::transform_coord<scalar_t>(origin, tree.offset, tree.scaling);
+            scalar_t dir[3] = {rays.dirs[tid][0], rays.dirs[tid][1], rays.dirs[tid][2]};
+            device::trace_ray_se_grad_hess<scalar_t>(
+                tree,
+                SingleRaySpec<scalar_t>{origin, dir, &rays.vdirs[tid][0]},
+                opt,
+                color_ref[tid],
+                color_out[tid],
+                grad_sink,
+                hessdiag_sink);
+        }
+    });
+}
+
+template <typename scalar_t, typename data_t>
+void se_grad_persp_kernel(
+        PackedTreeSpec<scalar_t, data_t> tree,
+        PackedCameraSpec<scalar_t> cam,
+        RenderOptions opt,
+        int tile_size,
+    torch::PackedTensorAccessor32<scalar_t, 3, torch::RestrictPtrTraits>
+        color_ref,
+    torch::PackedTensorAccessor32<scalar_t, 3, torch::RestrictPtrTraits>
+        color_out,
+        bool use_simd,
+        GradBuffer<scalar_t>& grad_out,
+        GradBuffer<scalar_t>& hessdiag_out) {
+    const int64_t tiles_y = (cam.height + tile_size - 1) / tile_size;
+    const int64_t tiles_x = (cam.width + tile_size - 1) / tile_size;
+    WorkStealingScheduler sched(tiles_x * tiles_y, at::get_num_threads());
+    sched.run([&](int64_t tile) {
+        auto grad_sink = grad_out.local();
+        auto hessdiag_sink = hessdiag_out.local();
+        if (use_simd) {
+            simd_se_grad_image_tile(tree, cam, opt, tile_size, tile,
+                    color_ref, color_out, grad_sink, hessdiag_sink);
+            return;
+        }
+        for_each_tile_ray(tree, cam, opt, tile_size, tile,
+                [&](int ix, int iy, SingleRaySpec<scalar_t> ray) {
+            device::trace_ray_se_grad_hess<scalar_t>(
+                tree, ray, opt,
+                color_ref[iy][ix],
+                color_out[iy][ix],
+                grad_sink,
+                hessdiag_sink);
+        });
+    });
+}
+
+// Per-ray optional tensor t (e.g. the forward output passed to backward):
+// its data, or null if t is undefined
+template <typename scalar_t>
+scalar_t* optional_data(torch::Tensor& t) {
+    return t.defined() ? t.data_ptr<scalar_t>() : nullptr;
+}
+
+// Render rays, recording their samples in log (unless empty); returns the
+// colors and the final transmittance of each ray
+std::tuple<torch::Tensor, torch::Tensor> render_rays(
+        TreeSpec& tree, RaysSpec& rays, RenderOptions& opt, SampleLog& log) {
+    tree.check_cpu();
+    rays.check_cpu();
+    const auto Q = rays.origins.size(0);
+    if (!log.empty()) {
+        tree.check_no_bricks();
+        log.check_cpu(tree.data, Q);
+    }
+
+    int out_data_dim = get_out_data_dim(opt.format, opt.basis_dim, tree.data_dim());
+    torch::Tensor result = torch::zeros({Q, out_data_dim}, rays.origins.options());
+    torch::Tensor trans = torch::empty({Q}, rays.origins.options());
+    if (use_packet_tracer(tree, opt, out_data_dim) &&
+            rays.origins.scalar_type() == at::kFloat) {
+        render_ray_packet_kernel(tree, rays, opt,
+                result.packed_accessor32<float, 2, torch::RestrictPtrTraits>(),
+                log, trans.data_ptr<float>());
+    } else {
+        SVOX_DISPATCH_RENDER_TYPES(tree.data.scalar_type(), __FUNCTION__, [&] {
+                render_ray_kernel<scalar_t, data_t>(
+                        tree, rays, opt,
+                        result.packed_accessor32<scalar_t, 2, torch::RestrictPtrTraits>(),
+                        log, trans.data_ptr<scalar_t>());
+        });
+    }
+    return std::template tuple<torch::Tensor, torch::Tensor>(result, trans);
+}
+
+// Render an image in tiles of tile_size^2 pixels; returns the image, the
+// time taken by each tile (ms) and the final transmittance of each pixel
+std::tuple<torch::Tensor, torch::Tensor, torch::Tensor> render_image(
+        TreeSpec& tree, CameraSpec& cam, RenderOptions& opt, int tile_size) {
+    tree.check_cpu();
+    cam.check_cpu();
+    TORCH_CHECK(tile_size > 0, "tile_size must be positive");
+    const int tiles_y = (cam.height + tile_size - 1) / tile_size;
+    const int tiles_x = (cam.width + tile_size - 1) / tile_size;
+
+    int out_data_dim = get_out_data_dim(opt.format, opt.basis_dim, tree.data_dim());
+    torch::Tensor result = torch::zeros({cam.height, cam.width, out_data_dim},
+            tree.compute_options());
+    torch::Tensor tile_ms = torch::zeros({tiles_y, tiles_x},
+            tree.data.options().dtype(torch::kFloat32));
+    torch::Tensor trans = torch::empty({cam.height, cam.width},
+            tree.compute_options());
+
+    const bool use_packet = use_packet_tracer(tree, opt, out_data_dim);
+    SVOX_DISPATCH_RENDER_TYPES(tree.data.scalar_type(), __FUNCTION__, [&] {
+            render_image_kernel<scalar_t, data_t>(
+                    tree, cam, opt, tile_size, use_packet,
+                    result.packed_accessor32<scalar_t, 3, torch::RestrictPtrTraits>(),
+                    trans.data_ptr<scalar_t>(),
+                    tile_ms.packed_accessor32<float, 2, torch::RestrictPtrTraits>());
+    });
+    return std::template tuple<torch::Tensor, torch::Tensor, torch::Tensor>(
+            result, tile_ms, trans);
+}
+
+// Checks the forward output out and transmittance trans given to a fused
+// backward pass, of the shape of grad_output (undefined if not fused)
+void check_forward_output(torch::Tensor& out, torch::Tensor& trans,
+                          torch::Tensor& grad_output) {
+    if (!out.defined()) return;
+    CHECK_CPU_INPUT(out);
+    CHECK_CPU_INPUT(trans);
+    TORCH_CHECK(out.sizes() == grad_output.sizes(),
+                "out must have the shape of grad_output");
+    TORCH_CHECK(trans.numel() * grad_output.size(-1) == out.numel(),
+                "trans must have one value per ray");
+    TORCH_CHECK(out.scalar_type() == grad_output.scalar_type() &&
+                trans.scalar_type() == grad_output.scalar_type());
+}
+
+// Backward of render_rays; in one pass per ray if the forward output and
+// transmittance are given (defined)
+torch::Tensor render_rays_backward(
+        TreeSpec& tree, RaysSpec& rays, RenderOptions& opt, SampleLog& log,
+        torch::Tensor fwd_out, torch::Tensor fwd_trans,
+        torch::Tensor grad_output) {
+    tree.check_cpu();
+    tree.check_no_bricks();
+    rays.check_cpu();
+    CHECK_CPU_INPUT(grad_output);
+    if (!log.empty()) log.check_cpu(tree.data, rays.origins.size(0));
+    check_forward_output(fwd_out, fwd_trans, grad_output);
+
+    torch::Tensor result = torch::zeros(tree.data.sizes(), tree.compute_options());
+    if (use_simd_basis(tree, opt) &&
+            rays.origins.scalar_type() == at::kFloat) {
+        GradBuffer<float> grad_buf(result.numel());
+        render_ray_backward_simd_kernel(
+            tree,
+            grad_output.packed_accessor32<float, 2, torch::RestrictPtrTraits>(),
+            rays,
+            opt,
+            log,
+            optional_data<float>(fwd_out),
+            optional_data<float>(fwd_trans),
+            grad_buf);
+        grad_buf.reduce_into(result.data_ptr<float>());
+        return result;
+    }
+    SVOX_DISPATCH_DATA_TYPES(tree.data.scalar_type(), __FUNCTION__, [&] {
+            GradBuffer<scalar_t> grad_buf(result.numel());
+            render_ray_backward_kernel<scalar_t, data_t>(
+                tree,
+                grad_output.packed_accessor32<scalar_t, 2, torch::RestrictPtrTraits>(),
+                rays,
+                opt,
+                log,
+                optional_data<scalar_t>(fwd_out),
+                optional_data<scalar_t>(fwd_trans),
+                grad_buf);
+            grad_buf.reduce_into(result.data_ptr<scalar_t>());
+    });
+    return result.to(tree.data.scalar_type());
+}
+
+// Backward of render_image, likewise
+torch::Tensor render_image_backward(
+        TreeSpec& tree, CameraSpec& cam, RenderOptions& opt,
+        torch::Tensor fwd_out, torch::Tensor fwd_trans,
+        torch::Tensor grad_output) {
+    tree.check_cpu();
+    tree.check_no_bricks();
+    cam.check_cpu();
+    CHECK_CPU_INPUT(grad_output);
+    check_forward_output(fwd_out, fwd_trans, grad_output);
+
+    torch::Tensor result = torch::zeros(tree.data.sizes(), tree.compute_options());
+    const bool use_simd = use_simd_basis(tree, opt);
+    SVOX_DISPATCH_DATA_TYPES(tree.data.scalar_type(), __FUNCTION__, [&] {
+            GradBuffer<scalar_t> grad_buf(result.numel());
+            render_image_backward_kernel<scalar_t, data_t>(
+                tree,
+                grad_output.packed_accessor32<scalar_t, 3, torch::RestrictPtrTraits>(),
+                cam,
+                opt,
+                CPU_TILE_SIZE,
+                use_simd,
+                optional_data<scalar_t>(fwd_out),
+                optional_data<scalar_t>(fwd_trans),
+                grad_buf);
+            grad_buf.reduce_into(result.data_ptr<scalar_t>());
+    });
+    return result.to(tree.data.scalar_type());
+}
+
+}  // namespace cpu
+}  // namespace
+
+torch::Tensor volume_render_cpu(TreeSpec& tree, RaysSpec& rays, RenderOptions& opt) {
+    SampleLog no_log;
+    return std::get<0>(cpu::render_rays(tree, rays, opt, no_log));
+}
+
+torch::Tensor volume_render_log_cpu(TreeSpec& tree, RaysSpec& rays,
+                                    RenderOptions& opt, SampleLog& log) {
+    return std::get<0>(cpu::render_rays(tree, rays, opt, log));
+}
+
+std::tuple<torch::Tensor, torch::Tensor> volume_render_trans_cpu(
+        TreeSpec& tree, RaysSpec& rays, RenderOptions& opt, SampleLog& log) {
+    return cpu::render_rays(tree, rays, opt, log);
+}
+
+std::tuple<torch::Tensor, torch::Tensor> volume_render_image_tiled_cpu(
+        TreeSpec& tree, CameraSpec& cam, RenderOptions& opt, int tile_size) {
+    auto result = cpu::render_image(tree, cam, opt, tile_size);
+    return std::template tuple<torch::Tensor, torch::Tensor>(
+            std::get<0>(result), std::get<1>(result));
+}
+
+torch::Tensor volume_render_image_cpu(TreeSpec& tree, CameraSpec& cam, RenderOptions& opt) {
+    return std::get<0>(cpu::render_image(tree, cam, opt, CPU_TILE_SIZE));
+}
+
+std::tuple<torch::Tensor, torch::Tensor> volume_render_image_trans_cpu(
+        TreeSpec& tree, CameraSpec& cam, RenderOptions& opt) {
+    auto result = cpu::render_image(tree, cam, opt, CPU_TILE_SIZE);
+    return std::template tuple<torch::Tensor, torch::Tensor>(
+            std::get<0>(result), std::get<2>(result));
+}
+
+torch::Tensor volume_render_backward_cpu(
+    TreeSpec& tree, RaysSpec& rays,
+    RenderOptions& opt,
+    torch::Tensor grad_output) {
+    SampleLog no_log;
+    return cpu::render_rays_backward(tree, rays, opt, no_log, torch::Tensor(),
+                                     torch::Tensor(), grad_output);
+}
+
+torch::Tensor volume_render_log_backward_cpu(
+    TreeSpec& tree, RaysSpec& rays,
+    RenderOptions& opt,
+    SampleLog& log,
+    torch::Tensor grad_output) {
+    return cpu::render_rays_backward(tree, rays, opt, log, torch::Tensor(),
+                                     torch::Tensor(), grad_output);
+}
+
+torch::Tensor volume_render_fused_backward_cpu(
+    TreeSpec& tree, RaysSpec& rays,
+    RenderOptions& opt,
+    SampleLog& log,
+    torch::Tensor out,
+    torch::Tensor trans,
+    torch::Tensor grad_output) {
+    return cpu::render_rays_backward(tree, rays, opt, log, out, trans,
+                                     grad_output);
+}
+
+torch::Tensor volume_render_image_backward_cpu(TreeSpec& tree, CameraSpec& cam,
+                                               RenderOptions& opt,
+                                               torch::Tensor grad_output) {
+    return cpu::render_image_backward(tree, cam, opt, torch::Tensor(),
+                                      torch::Tensor(), grad_output);
+}
+
+torch::Tensor volume_render_image_fused_backward_cpu(
+        TreeSpec& tree, CameraSpec& cam, RenderOptions& opt,
+        torch::Tensor out, torch::Tensor trans, torch::Tensor grad_output) {
+    return cpu::render_image_backward(tree, cam, opt, out, trans, grad_output);
+}
+
+std::tuple<torch::Tensor, torch::Tensor, torch::Tensor> se_grad_cpu(
+        TreeSpec& tree, RaysSpec& rays, torch::Tensor color, RenderOptions& opt) {
+    tree.check_cpu();
+    tree.check_no_bricks();
+    rays.check_cpu();
+    CHECK_CPU_INPUT(color);
+
+    const auto Q = rays.origins.size(0);
+
+    int out_data_dim = get_out_data_dim(opt.format, opt.basis_dim, tree.data_dim());
+    if (out_data_dim > 4) {
+        throw std::runtime_error("Tree's output dim cannot be > 4 for se_grad");
+    }
+    torch::Tensor result = torch::zeros({Q, out_data_dim}, rays.origins.options());
+    torch::Tensor grad = torch::zeros(tree.data.sizes(), tree.compute_options());
+    torch::Tensor hessdiag = torch::zeros(tree.data.sizes(), tree.compute_options());
+    if (cpu::use_simd_basis(tree, opt) &&
+            rays.origins.scalar_type() == at::kFloat) {
+        GradBuffer<float> grad_buf(grad.numel());
+        GradBuffer<float> hessdiag_buf(hessdiag.numel());
+        cpu::se_grad_simd_kernel(
+                tree, rays, opt,
+                color.packed_accessor32<float, 2, torch::RestrictPtrTraits>(),
+                result.packed_accessor32<float, 2, torch::RestrictPtrTraits>(),
+                grad_buf, hessdiag_buf);
+        grad_buf.reduce_into(grad.data_ptr<float>());
+        hessdiag_buf.reduce_into(hessdiag.data_ptr<float>());
+        return std::template tuple<torch::Tensor, torch::Tensor, torch::Tensor>(result, grad, hessdiag);
+    }
+    SVOX_DISPATCH_DATA_TYPES(tree.data.scalar_type(), __FUNCTION__, [&] {
+            GradBuffer<scalar_t> grad_buf(grad.numel());
+            GradBuffer<scalar_t> hessdiag_buf(hessdiag.numel());
+            cpu::se_grad_kernel<scalar_t, data_t>(
+                    tree, rays, opt,
+                    color.packed_accessor32<scalar_t, 2, torch::RestrictPtrTraits>(),
+                    result.packed_accessor32<scalar_t, 2, torch::RestrictPtrTraits>(),
+                    grad_buf, hessdiag_buf);
+            grad_buf.reduce_into(grad.data_ptr<scalar_t>());
+            hessdiag_buf.reduce_into(hessdiag.data_ptr<scalar_t>());
+    });
+    return std::template tuple<torch::Tensor, torch::Tensor, torch::Tensor>(
+            result, grad.to(tree.data.scalar_type()),
+            hessdiag.to(tree.data.scalar_type()));
+}
+
+std::tuple<torch::Tensor, torch::Tensor, torch::Tensor> se_grad_persp_cpu(
+                            TreeSpec& tree,
+                            CameraSpec& cam,
+                            RenderOptions& opt,
+                            torch::Tensor color) {
+    tree.check_cpu();
+    tree.check_no_bricks();
+    cam.check_cpu();
+    CHECK_CPU_INPUT(color);
+
+    int out_data_dim = get_out_data_dim(opt.format, opt.basis_dim, tree.data_dim());
+    if (out_data_dim > 4) {
+        throw std::runtime_error("Tree's output dim cannot be > 4 for se_grad");
+    }
+    torch::Tensor result = torch::zeros({cam.height, cam.width, out_data_dim},
+            tree.compute_options());
+    torch::Tensor grad = torch::zeros(tree.data.sizes(), tree.compute_options());
+    torch::Tensor hessdiag = torch::zeros(tree.data.sizes(), tree.compute_options());
+
+    const bool use_simd = cpu::use_simd_basis(tree, opt);
+    SVOX_DISPATCH_DATA_TYPES(tree.data.scalar_type(), __FUNCTION__, [&] {
+            GradBuffer<scalar_t> grad_buf(grad.numel());
+            GradBuffer<scalar_t> hessdiag_buf(hessdiag.numel());
+            cpu::se_grad_persp_kernel<scalar_t, data_t>(
+                    tree, cam, opt, CPU_TILE_SIZE,
+                    color.packed_accessor32<scalar_t, 3, torch::RestrictPtrTraits>(),
+                    result.packed_accessor32<scalar_t, 3, torch::RestrictPtrTraits>(),
+                    use_simd,
+                    grad_buf, hessdiag_buf);
+            grad_buf.reduce_into(grad.data_ptr<scalar_t>());
+            hessdiag_buf.reduce_into(hessdiag.data_ptr<scalar_t>());
+    });
+    return std::template tuple<torch::Tensor, torch::Tensor, torch::Tensor>(
+            result, grad.to(tree.data.scalar_type()),
+            hessdiag.to(tree.data.scalar_type()));
+}
+
+// Name of the SIMD instruction set used by the CPU renderer
+std::string cpu_isa_cpu() {
+    return cpu_isa_name(cpu_isa());
+}
@@ -28,6 +28,7 @@
 #include <vector>
 #include "common.cuh"
 #include "data_spec_packed.cuh"
+#include "rt_core.hpp"
 
 namespace {
 
@@ -49,678 +50,15 @@ __host__ void auto_cuda_threads() {
 }
 
 namespace device {
-// SH Coefficients from https://github.com/google/spherical-harmonics
-__device__ __constant__ const float C0 = 0.28209479177387814;
-__device__ __constant__ const float C1 = 0.4886025119029199;
-__device__ __constant__ const float C2[] = {
-    1.0925484305920792,
-    -1.0925484305920792,
-    0.31539156525252005,
-    -1.0925484305920792,
-    0.5462742152960396
-};
-
-__device__ __constant__ const float C3[] = {
-    -0.5900435899266435,
-    2.890611442640554,
-    -0.4570457994644658,
-    0.3731763325901154,
-    -0.4570457994644658,
-    1.445305721320277,
-    -0.5900435899266435
-};
-
-__device__ __constant__ const float C4[] = {
-    2.5033429417967046,
-    -1.7701307697799304,
-    0.9461746957575601,
-    -0.6690465435572892,
-    0.10578554691520431,
-    -0.6690465435572892,
-    0.47308734787878004,
-    -1.7701307697799304,
-    0.6258357354491761,
-};
-
-
-#define _SOFTPLUS_M1(x) (logf(1 + expf((x) - 1)))
-#define _SIGMOID(x) (1 / (1 + expf(-(x))))
-
-template<typename scalar_t>
-__host__ __device__ __inline__ static scalar_t _norm(
-                scalar_t* dir) {
-    return sqrtf(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
-}
-
-template<typename scalar_t>
-__host__ __device__ __inline__ static void _normalize(
-                scalar_t* dir) {
-    scalar_t norm = _norm(dir);
-    dir[0] /= norm; dir[1] /= norm; dir[2] /= norm;
-}
-
-template<typename scalar_t>
-__host__ __device__ __inline__ static scalar_t _dot3(
-        const scalar_t* __restrict__ u,
-        const scalar_t* __restrict__ v) {
-    return u[0] * v[0] + u[1] * v[1] + u[2] * v[2];
-}
-
-
-// Calculate basis functions depending on format, for given view directions
-template <typename scalar_t>
-__device__ __inline__ void maybe_precalc_basis(
-    const int format,
-    const int basis_dim,
-    const torch::PackedTensorAccessor32<scalar_t, 2, torch::RestrictPtrTraits>
-        extra,
-    const scalar_t* __restrict__ dir,
-    scalar_t* __restrict__ out) {
-    switch(format) {
-        case FORMAT_ASG:
-            {
-                // UNTESTED ASG
-                for (int i = 0; i < basis_dim; ++i) {
-                    const auto& ptr = extra[i];
-                    scalar_t S = _dot3(dir, &ptr[8]);
-                    scalar_t dot_x = _dot3(dir, &ptr[2]);
-                    scalar_t dot_y = _dot3(dir, &ptr[5]);
-                    out[i] = S * expf(-ptr[0] * dot_x * dot_x
-                                      -ptr[1] * dot_y * dot_y) / basis_dim;
-                }
-            }  // ASG
-            break;
-        case FORMAT_SG:
-            {
-                for (int i = 0; i < basis_dim; ++i) {
-                    const auto& ptr = extra[i];
-                    out[i] = expf(ptr[0] * (_dot3(dir, &ptr[1]) - 1.f)) / basis_dim;
-                }
-            }  // SG
-            break;
-        case FORMAT_SH:
-            {
-                out[0] = C0;
-                const scalar_t x = dir[0], y = dir[1], z = dir[2];
-                const scalar_t xx = x * x, yy = y * y, zz = z * z;
-                const scalar_t xy = x * y, yz = y * z, xz = x * z;
-                switch (basis_dim) {
-                    case 25:
-                        out[16] = C4[0] * xy * (xx - yy);
-                        out[17] = C4[1] * yz * (3 * xx - yy);
-                        out[18] = C4[2] * xy * (7 * zz - 1.f);
-                        out[19] = C4[3] * yz * (7 * zz - 3.f);
-                        out[20] = C4[4] * (zz * (35 * zz - 30) + 3);
-                        out[21] = C4[5] * xz * (7 * zz - 3);
-                        out[22] = C4[6] * (xx - yy) * (7 * zz - 1.f);
-                        out[23] = C4[7] * xz * (xx - 3 * yy);
-                        out[24] = C4[8] * (xx * (xx - 3 * yy) - yy * (3 * xx - yy));
-                        [[fallthrough]];
-                    case 16:
-                        out[9] = C3[0] * y * (3 * xx - yy);
-                        out[10] = C3[1] * xy * z;
-                        out[11] = C3[2] * y * (4 * zz - xx - yy);
-                        out[12] = C3[3] * z * (2 * zz - 3 * xx - 3 * yy);
-                        out[13] = C3[4] * x * (4 * zz - xx - yy);
-                        out[14] = C3[5] * z * (xx - yy);
-                        out[15] = C3[6] * x * (xx - 3 * yy);
-                        [[fallthrough]];
-                    case 9:
-                        out[4] = C2[0] * xy;
-                        out[5] = C2[1] * yz;
-                        out[6] = C2[2] * (2.0 * zz - xx - yy);
-                        out[7] = C2[3] * xz;
-                        out[8] = C2[4] * (xx - yy);
-                        [[fallthrough]];
-                    case 4:
-                        out[1] = -C1 * y;
-                        out[2] = C1 * z;
-                        out[3] = -C1 * x;
-                }
-            }  // SH
-            break;
-
-        default:
-            // Do nothing
-            break;
-    }  // switch
-}
-
-template <typename scalar_t>
-__device__ __inline__ scalar_t _get_delta_scale(
-    const scalar_t* __restrict__ scaling,
-    scalar_t* __restrict__ dir) {
-    dir[0] *= scaling[0];
-    dir[1] *= scaling[1];
-    dir[2] *= scaling[2];
-    scalar_t delta_scale = 1.f / _norm(dir);
-    dir[0] *= delta_scale;
-    dir[1] *= delta_scale;
-    dir[2] *= delta_scale;
-    return delta_scale;
-}
-
-template <typename scalar_t>
-__device__ __inline__ void _dda_unit(
-        const scalar_t* __restrict__ cen,
-        const scalar_t* __restrict__ invdir,
-        scalar_t* __restrict__ tmin,
-        scalar_t* __restrict__ tmax) {
-    // Intersect unit AABB
-    scalar_t t1, t2;
-    *tmin = 0.0f;
-    *tmax = 1e9f;
-#pragma unroll
-    for (int i = 0; i < 3; ++i) {
-        t1 = - cen[i] * invdir[i];
-        t2 = t1 +  invdir[i];
-        *tmin = max(*tmin, min(t1, t2));
-        *tmax = min(*tmax, max(t1, t2));
-    }
-}
-
-template <typename scalar_t>
-__device__ __inline__ void trace_ray(
-        PackedTreeSpec<scalar_t>& __restrict__ tree,
-        SingleRaySpec<scalar_t> ray,
-        RenderOptions& __restrict__ opt,
-        torch::TensorAccessor<scalar_t, 1, torch::RestrictPtrTraits, int32_t> out) {
-    const scalar_t delta_scale = _get_delta_scale(tree.scaling, ray.dir);
-
-    scalar_t tmin, tmax;
-    scalar_t invdir[3];
-    const int tree_N = tree.child.size(1);
-    const int data_dim = tree.data.size(4);
-    const int out_data_dim = out.size(0);
-
-#pragma unroll
-    for (int i = 0; i < 3; ++i) {
-        invdir[i] = 1.0 / (ray.dir[i] + 1e-9);
-    }
-    _dda_unit(ray.origin, invdir, &tmin, &tmax);
-
-    if (tmax < 0 || tmin > tmax) {
-        // Ray doesn't hit box
-        for (int j = 0; j < out_data_dim; ++j) {
-            out[j] = opt.background_brightness;
-        }
-        return;
-    } else {
-        for (int j = 0; j < out_data_dim; ++j) {
-            out[j] = 0.f;
-        }
-        scalar_t pos[3];
-        scalar_t basis_fn[25];
-        maybe_precalc_basis<scalar_t>(opt.format, opt.basis_dim,
-                tree.extra_data, ray.vdir, basis_fn);
-
-        scalar_t light_intensity = 1.f;
-        scalar_t t = tmin;
-        scalar_t cube_sz;
-        const scalar_t d_rgb_pad = 1 + 2 * opt.rgb_padding;
-        while (t < tmax) {
-            for (int j = 0; j < 3; ++j) {
-                pos[j] = ray.origin[j] + t * ray.dir[j];
-            }
-
-            int64_t node_id;
-            scalar_t* tree_val = query_single_from_root<scalar_t>(tree.data, tree.child,
-                        pos, &cube_sz, tree.weight_accum != nullptr ? &node_id : nullptr);
-
-            scalar_t att;
-            scalar_t subcube_tmin, subcube_tmax;
-            _dda_unit(pos, invdir, &subcube_tmin, &subcube_tmax);
-
-            const scalar_t t_subcube = (subcube_tmax - subcube_tmin) / cube_sz;
-            const scalar_t delta_t = t_subcube + opt.step_size;
-            scalar_t sigma = tree_val[data_dim - 1];
-            if (opt.density_softplus) sigma = _SOFTPLUS_M1(sigma);
-            if (sigma > opt.sigma_thresh) {
-                att = expf(-delta_t * delta_scale * sigma);
-                const scalar_t weight = light_intensity * (1.f - att);
-
-                if (opt.format != FORMAT_RGBA) {
-                    for (int t = 0; t < out_data_dim; ++ t) {
-                        int off = t * opt.basis_dim;
-                        scalar_t tmp = 0.0;
-                        for (int i = opt.min_comp; i <= opt.max_comp; ++i) {
-                            tmp += basis_fn[i] * tree_val[off + i];
-                        }
-                        out[t] += weight * (_SIGMOID(tmp) * d_rgb_pad - opt.rgb_padding);
-                    }
-                } else {
-                    for (int j = 0; j < out_data_dim; ++j) {
-                        out[j] += weight * (_SIGMOID(tree_val[j]) * d_rgb_pad - opt.rgb_padding);
-                    }
-                }
-                light_intensity *= att;
-
-                if (tree.weight_accum != nullptr) {
-                    if (tree.weight_accum_max) {
-                        atomicMax(&tree.weight_accum[node_id], weight);
-                    } else {
-                        atomicAdd(&tree.weight_accum[node_id], weight);
-                    }
-                }
-
-                if (light_intensity <= opt.stop_thresh) {
-                    // Full opacity, stop
-                    scalar_t scale = 1.0 / (1.0 - light_intensity);
-                    for (int j = 0; j < out_data_dim; ++j) {
-                        out[j] *= scale;
-                    }
-                    return;
-                }
-            }
-            t += delta_t;
-        }
-        for (int j = 0; j < out_data_dim; ++j) {
-            out[j] += light_intensity * opt.background_brightness;
-        }
-    }
-}
-
-template <typename scalar_t>
-__device__ __inline__ void trace_ray_backward(
-    PackedTreeSpec<scalar_t>& __restrict__ tree,
-    const torch::TensorAccessor<scalar_t, 1, torch::RestrictPtrTraits, int32_t>
-        grad_output,
-        SingleRaySpec<scalar_t> ray,
-        RenderOptions& __restrict__ opt,
-    torch::PackedTensorAccessor64<scalar_t, 5, torch::RestrictPtrTraits>
-        grad_data_out) {
-    const scalar_t delta_scale = _get_delta_scale(tree.scaling, ray.dir);
-
-    scalar_t tmin, tmax;
-    scalar_t invdir[3];
-    const int tree_N = tree.child.size(1);
-    const int data_dim = tree.data.size(4);
-    const int out_data_dim = grad_output.size(0);
-
-#pragma unroll
-    for (int i = 0; i < 3; ++i) {
-        invdir[i] = 1.0 / (ray.dir[i] + 1e-9);
-    }
-    _dda_unit(ray.origin, invdir, &tmin, &tmax);
-
-    if (tmax < 0 || tmin > tmax) {
-        // Ray doesn't hit box
-        return;
-    } else {
-        scalar_t pos[3];
-        scalar_t basis_fn[25];
-        maybe_precalc_basis<scalar_t>(opt.format, opt.basis_dim, tree.extra_data,
-                ray.vdir, basis_fn);
-
-        scalar_t accum = 0.0;
-        const scalar_t d_rgb_pad = 1 + 2 * opt.rgb_padding;
-        // PASS 1
-        {
-            scalar_t light_intensity = 1.f, t = tmin, cube_sz;
-            while (t < tmax) {
-                for (int j = 0; j < 3; ++j) pos[j] = ray.origin[j] + t * ray.dir[j];
-
-                const scalar_t* tree_val = query_single_from_root<scalar_t>(
-                        tree.data, tree.child, pos, &cube_sz);
-                // Reuse offset on gradient
-                const int64_t curr_leaf_offset = tree_val - tree.data.data();
-                scalar_t* grad_tree_val = grad_data_out.data() + curr_leaf_offset;
-
-                scalar_t att;
-                scalar_t subcube_tmin, subcube_tmax;
-                _dda_unit(pos, invdir, &subcube_tmin, &subcube_tmax);
-
-                const scalar_t t_subcube = (subcube_tmax - subcube_tmin) / cube_sz;
-                const scalar_t delta_t = t_subcube + opt.step_size;
-                scalar_t sigma = tree_val[data_dim - 1];
-                if (opt.density_softplus) sigma = _SOFTPLUS_M1(sigma);
-                if (sigma > 0.0) {
-                    att = expf(-delta_t * sigma * delta_scale);
-                    const scalar_t weight = light_intensity * (1.f - att);
-
-                    scalar_t total_color = 0.f;
-                    if (opt.format != FORMAT_RGBA) {
-                        for (int t = 0; t < out_data_dim; ++ t) {
-                            int off = t * opt.basis_dim;
-                            scalar_t tmp = 0.0;
-                            for (int i = opt.min_comp; i <= opt.max_comp; ++i) {
-                                tmp += basis_fn[i] * tree_val[off + i];
-                            }
-                            const scalar_t sigmoid = _SIGMOID(tmp);
-                            const scalar_t tmp2 = weight * sigmoid * (1.0 - sigmoid) *
-                                                 grad_output[t] * d_rgb_pad;
-                            for (int i = opt.min_comp; i <= opt.max_comp; ++i) {
-                                const scalar_t toadd = basis_fn[i] * tmp2;
-                                atomicAdd(&grad_tree_val[off + i],
-                                        toadd);
-                            }
-                            total_color += (sigmoid * d_rgb_pad - opt.rgb_padding)
-                                            * grad_output[t];
-                        }
-                    } else {
-                        for (int j = 0; j < out_data_dim; ++j) {
-                            const scalar_t sigmoid = _SIGMOID(tree_val[j]);
-                            const scalar_t toadd = weight * sigmoid * (
-                                    1.f - sigmoid) * grad_output[j] * d_rgb_pad;
-                            atomicAdd(&grad_tree_val[j], toadd);
-                            total_color += (sigmoid * d_rgb_pad - opt.rgb_padding)
-                                            * grad_output[j];
-                        }
-                    }
-                    light_intensity *= att;
-                    accum += weight * total_color;
-                }
-                t += delta_t;
-            }
-            scalar_t total_grad = 0.f;
-            for (int j = 0; j < out_data_dim; ++j)
-                total_grad += grad_output[j];
-            accum += light_intensity * opt.background_brightness * total_grad;
-        }
-        // PASS 2
-        {
-            // scalar_t accum_lo = 0.0;
-            scalar_t light_intensity = 1.f, t = tmin, cube_sz;
-            while (t < tmax) {
-                for (int j = 0; j < 3; ++j) pos[j] = ray.origin[j] + t * ray.dir[j];
-                const scalar_t* tree_val = query_single_from_root<scalar_t>(tree.data,
-                        tree.child, pos, &cube_sz);
-                // Reuse offset on gradient
-                const int64_t curr_leaf_offset = tree_val - tree.data.data();
-                scalar_t* grad_tree_val = grad_data_out.data() + curr_leaf_offset;
-
-                scalar_t att;
-                scalar_t subcube_tmin, subcube_tmax;
-                _dda_unit(pos, invdir, &subcube_tmin, &subcube_tmax);
-
-                const scalar_t t_subcube = (subcube_tmax - subcube_tmin) / cube_sz;
-                const scalar_t delta_t = t_subcube + opt.step_size;
-                scalar_t sigma = tree_val[data_dim - 1];
-                const scalar_t raw_sigma = sigma;
-                if (opt.density_softplus) sigma = _SOFTPLUS_M1(sigma);
-                if (sigma > 0.0) {
-                    att = expf(-delta_t * sigma * delta_scale);
-                    const scalar_t weight = light_intensity * (1.f - att);
-
-                    scalar_t total_color = 0.f;
-                    if (opt.format != FORMAT_RGBA) {
-                        for (int t = 0; t < out_data_dim; ++ t) {
-                            int off = t * opt.basis_dim;
-                            scalar_t tmp = 0.0;
-                            for (int i = opt.min_comp; i <= opt.max_comp; ++i) {
-                                tmp += basis_fn[i] * tree_val[off + i];
-                            }
-                            total_color += (_SIGMOID(tmp) * d_rgb_pad - opt.rgb_padding)
-                                            * grad_output[t];
-                        }
-                    } else {
-                        for (int j = 0; j < out_data_dim; ++j) {
-                            total_color += (_SIGMOID(tree_val[j]) * d_rgb_pad - opt.rgb_padding)
-                                            * grad_output[j];
-                        }
-                    }
-                    light_intensity *= att;
-                    accum -= weight * total_color;
-                    atomicAdd(
-                            &grad_tree_val[data_dim - 1],
-                            delta_t * delta_scale * (
-                                total_color * light_intensity - accum)
-                                *  (opt.density_softplus ?
-                                    _SIGMOID(raw_sigma - 1)
-                                    : 1)
-                            );
-                }
-                t += delta_t;
-            }
-        }
-    }
-}  // trace_ray_backward
-
-template <typename scalar_t>
-__device__ __inline__ void trace_ray_se_grad_hess(
-    PackedTreeSpec<scalar_t>& __restrict__ tree,
-    SingleRaySpec<scalar_t> ray,
-    RenderOptions& __restrict__ opt,
-    torch::TensorAccessor<scalar_t, 1, torch::RestrictPtrTraits, int32_t> color_ref,
-    torch::TensorAccessor<scalar_t, 1, torch::RestrictPtrTraits, int32_t> color_out,
-    torch::PackedTensorAccessor64<scalar_t, 5, torch::RestrictPtrTraits>
-        grad_data_out,
-    torch::PackedTensorAccessor64<scalar_t, 5, torch::RestrictPtrTraits>
-        hessdiag_out) {
-    const scalar_t delta_scale = _get_delta_scale(tree.scaling, ray.dir);
-
-    scalar_t tmin, tmax;
-    scalar_t invdir[3];
-    const int tree_N = tree.child.size(1);
-    const int data_dim = tree.data.size(4);
-    const int out_data_dim = color_out.size(0);
-
-#pragma unroll
-    for (int i = 0; i < 3; ++i) {
-        invdir[i] = 1.0 / (ray.dir[i] + 1e-9);
-    }
-    _dda_unit(ray.origin, invdir, &tmin, &tmax);
-
-    if (tmax < 0 || tmin > tmax) {
-        // Ray doesn't hit box
-        for (int j = 0; j < out_data_dim; ++j) {
-            color_out[j] = opt.background_brightness;
-        }
-        return;
-    } else {
-        scalar_t pos[3];
-        scalar_t basis_fn[25];
-        maybe_precalc_basis<scalar_t>(opt.format, opt.basis_dim, tree.extra_data,
-                ray.vdir, basis_fn);
-
-        const scalar_t d_rgb_pad = 1 + 2 * opt.rgb_padding;
-
-        // PASS 1 - compute residual (trace_ray_se_grad_hess)
-        {
-            scalar_t light_intensity = 1.f, t = tmin, cube_sz;
-            while (t < tmax) {
-                for (int j = 0; j < 3; ++j) {
-                    pos[j] = ray.origin[j] + t * ray.dir[j];
-                }
-
-                scalar_t* tree_val = query_single_from_root<scalar_t>(tree.data, tree.child,
-                        pos, &cube_sz, nullptr);
-
-                scalar_t att;
-                scalar_t subcube_tmin, subcube_tmax;
-                _dda_unit(pos, invdir, &subcube_tmin, &subcube_tmax);
-
-                const scalar_t t_subcube = (subcube_tmax - subcube_tmin) / cube_sz;
-                const scalar_t delta_t = t_subcube + opt.step_size;
-                scalar_t sigma = tree_val[data_dim - 1];
-                if (opt.density_softplus) sigma = _SOFTPLUS_M1(sigma);
-                if (sigma > 0.0f) {
-                    att = expf(-delta_t * delta_scale * sigma);
-                    const scalar_t weight = light_intensity * (1.f - att);
-
-                    if (opt.format != FORMAT_RGBA) {
-                        for (int t = 0; t < out_data_dim; ++ t) {
-                            int off = t * opt.basis_dim;
-                            scalar_t tmp = 0.0;
-                            for (int i = opt.min_comp; i <= opt.max_comp; ++i) {
-                                tmp += basis_fn[i] * tree_val[off + i];
-                            }
-                            color_out[t] += weight * (_SIGMOID(tmp) * d_rgb_pad - opt.rgb_padding);
-                        }
-                    } else {
-                        for (int j = 0; j < out_data_dim; ++j) {
-                            color_out[j] += weight * (_SIGMOID(tree_val[j]) *
-                                    d_rgb_pad - opt.rgb_padding);
-                        }
-                    }
-                    light_intensity *= att;
-                }
-                t += delta_t;
-            }
-            // Add background intensity & color -> residual
-            for (int j = 0; j < out_data_dim; ++j) {
-                color_out[j] += light_intensity * opt.background_brightness - color_ref[j];
-            }
-        }
-
-        // PASS 2 - compute RGB gradient & suffix (trace_ray_se_grad_hess)
-        scalar_t color_accum[4] = {0, 0, 0, 0};
-        {
-            scalar_t light_intensity = 1.f, t = tmin, cube_sz;
-            while (t < tmax) {
-                for (int j = 0; j < 3; ++j) pos[j] = ray.origin[j] + t * ray.dir[j];
-
-                const scalar_t* tree_val = query_single_from_root<scalar_t>(
-                        tree.data, tree.child, pos, &cube_sz);
-                // Reuse offset on gradient
-                const int64_t curr_leaf_offset = tree_val - tree.data.data();
-                scalar_t* grad_tree_val = grad_data_out.data() + curr_leaf_offset;
-                scalar_t* hessdiag_tree_val = hessdiag_out.data() + curr_leaf_offset;
-
-                scalar_t att;
-                scalar_t subcube_tmin, subcube_tmax;
-                _dda_unit(pos, invdir, &subcube_tmin, &subcube_tmax);
-
-                const scalar_t t_subcube = (subcube_tmax - subcube_tmin) / cube_sz;
-                const scalar_t delta_t = t_subcube + opt.step_size;
-                scalar_t sigma = tree_val[data_dim - 1];
-                if (opt.density_softplus) sigma = _SOFTPLUS_M1(sigma);
-                if (sigma > 0.0) {
-                    att = expf(-delta_t * sigma * delta_scale);
-                    const scalar_t weight = light_intensity * (1.f - att);
-
-                    if (opt.format != FORMAT_RGBA) {
-                        for (int t = 0; t < out_data_dim; ++ t) {
-                            int off = t * opt.basis_dim;
-                            scalar_t tmp = 0.0;
-                            for (int i = opt.min_comp; i <= opt.max_comp; ++i) {
-                                tmp += basis_fn[i] * tree_val[off + i];
-                            }
-                            const scalar_t sigmoid = _SIGMOID(tmp);
-                            const scalar_t grad_ci = weight * sigmoid * (1.0 - sigmoid) *
-                                                  d_rgb_pad;
-                            // const scalar_t d2_term =
-                            //     (1.f - 2.f * sigmoid) * color_out[t];
-                            for (int i = opt.min_comp; i <= opt.max_comp; ++i) {
-                                const scalar_t grad_wi = basis_fn[i] * grad_ci;
-                                atomicAdd(&grad_tree_val[off + i], grad_wi * color_out[t]);
-                                atomicAdd(&hessdiag_tree_val[off + i],
-                                        // grad_wi * basis_fn[i] * (grad_ci +
-                                        //         d2_term)                   // Newton
-                                        grad_wi * grad_wi                     // Gauss-Newton
-                                    );
-                            }
-                            const scalar_t color_j = sigmoid * d_rgb_pad - opt.rgb_padding;
-                            color_accum[t] += weight * color_j;
-                        }
-                    } else {
-                        for (int j = 0; j < out_data_dim; ++j) {
-                            const scalar_t sigmoid = _SIGMOID(tree_val[j]);
-                            const scalar_t grad_ci = weight * sigmoid * (
-                                    1.f - sigmoid) * d_rgb_pad;
-                            // const scalar_t d2_term = (1.f - 2.f * sigmoid) * color_out[j];
-                            atomicAdd(&grad_tree_val[j], grad_ci * color_out[j]);
-                            // Newton
-                            // atomicAdd(&hessdiag_tree_val[j], grad_ci * (grad_ci + d2_term));
-                            // Gauss-Newton
-                            atomicAdd(&hessdiag_tree_val[j], grad_ci * grad_ci);
-                            const scalar_t color_j = sigmoid * d_rgb_pad - opt.rgb_padding;
-                            color_accum[j] += weight * color_j;
-                        }
-                    }
-                    light_intensity *= att;
-                }
-                t += delta_t;
-            }
-            for (int j = 0; j < out_data_dim; ++j) {
-                color_accum[j] += light_intensity * opt.background_brightness;
-            }
-        }
-
-        // PASS 3 - finish computing sigma gradient (trace_ray_se_grad_hess)
-        {
-            scalar_t light_intensity = 1.f, t = tmin, cube_sz;
-            scalar_t color_curr[4];
-            while (t < tmax) {
-                for (int j = 0; j < 3; ++j) pos[j] = ray.origin[j] + t * ray.dir[j];
-                const scalar_t* tree_val = query_single_from_root<scalar_t>(tree.data,
-                        tree.child, pos, &cube_sz);
-                // Reuse offset on gradient
-                const int64_t curr_leaf_offset = tree_val - tree.data.data();
-                scalar_t* grad_tree_val = grad_data_out.data() + curr_leaf_offset;
-                scalar_t* hessdiag_tree_val = hessdiag_out.data() + curr_leaf_offset;
-
-                scalar_t att;
-                scalar_t subcube_tmin, subcube_tmax;
-                _dda_unit(pos, invdir, &subcube_tmin, &subcube_tmax);
-
-                const scalar_t t_subcube = (subcube_tmax - subcube_tmin) / cube_sz;
-                const scalar_t delta_t = t_subcube + opt.step_size;
-                scalar_t sigma = tree_val[data_dim - 1];
-                const scalar_t raw_sigma = sigma;
-                if (opt.density_softplus) sigma = _SOFTPLUS_M1(sigma);
-                if (sigma > 0.0) {
-                    att = expf(-delta_t * sigma * delta_scale);
-                    const scalar_t weight = light_intensity * (1.f - att);
-
-                    if (opt.format != FORMAT_RGBA) {
-                        for (int u = 0; u < out_data_dim; ++ u) {
-                            int off = u * opt.basis_dim;
-                            scalar_t tmp = 0.0;
-                            for (int i = opt.min_comp; i <= opt.max_comp; ++i) {
-                                tmp += basis_fn[i] * tree_val[off + i];
-                            }
-                            color_curr[u] = _SIGMOID(tmp) * d_rgb_pad - opt.rgb_padding;
-                            color_accum[u] -= weight * color_curr[u];
-                        }
-                    } else {
-                        for (int j = 0; j < out_data_dim; ++j) {
-                            color_curr[j] = _SIGMOID(tree_val[j]) * d_rgb_pad - opt.rgb_padding;
-                            color_accum[j] -= weight * color_curr[j];
-                        }
-                    }
-                    light_intensity *= att;
-                    for (int j = 0; j < out_data_dim; ++j) {
-                        const scalar_t grad_sigma = delta_t * delta_scale * (
-                                color_curr[j] * light_intensity - color_accum[j]);
-                        // Newton
-                        // const scalar_t grad2_sigma =
-                        //     grad_sigma * (grad_sigma - delta_t * delta_scale * color_out[j]);
-                        // Gauss-Newton
-                        const scalar_t grad2_sigma = grad_sigma * grad_sigma;
-                        if (opt.density_softplus) {
-                            const scalar_t sigmoid = _SIGMOID(raw_sigma - 1);
-                            const scalar_t d_sigmoid = sigmoid * (1.f - sigmoid);
-                            // FIXME not sure this works
-                            atomicAdd(&grad_tree_val[data_dim - 1], grad_sigma *
-                                    color_out[j] * sigmoid);
-                            atomicAdd(&hessdiag_tree_val[data_dim - 1],
-                                    grad2_sigma * sigmoid * sigmoid
-                                    + grad_sigma *  d_sigmoid);
-                        } else {
-                            atomicAdd(&grad_tree_val[data_dim - 1],
-                                    grad_sigma * color_out[j]);
-                            atomicAdd(&hessdiag_tree_val[data_dim - 1], grad2_sigma);
-                        }
-                    }
-                }
-                t += delta_t;
-            }
-        }
-        // Residual -> color
-        for (int j = 0; j < out_data_dim; ++j) {
-            color_out[j] += color_ref[j];
-        }
-    }
-}
-
-template <typename scalar_t>
+template <typename scalar_t, typename data_t>
 __global__ void render_ray_kernel(
-        PackedTreeSpec<scalar_t> tree,
+        PackedTreeSpec<scalar_t, data_t> tree,
         PackedRaysSpec<scalar_t> rays,
         RenderOptions opt,
     torch::PackedTensorAccessor32<scalar_t, 2, torch::RestrictPtrTraits>
-        out) {
+        out,
+        PackedSampleLog<scalar_t> log,
+        scalar_t* __restrict__ trans) {
     CUDA_GET_THREAD_ID(tid, rays.origins.size(0));
     scalar_t origin[3] = {rays.origins[tid][0], rays.origins[tid][1], rays.origins[tid][2]};
     transform_coord<scalar_t>(origin, tree.offset, tree.scaling);
@@ -729,17 +67,23 @@ __global__ void render_ray_kernel(
         tree,
         SingleRaySpec<scalar_t>{origin, dir, &rays.vdirs[tid][0]},
         opt,
-        out[tid]);
+        out[tid],
+        nullptr,
+        sample_log_row(log, tid),
+        trans + tid);
 }
 
 
-template <typename scalar_t>
+template <typename scalar_t, typename data_t>
 __global__ void render_ray_backward_kernel(
-    PackedTreeSpec<scalar_t> tree,
+    PackedTreeSpec<scalar_t, data_t> tree,
     const torch::PackedTensorAccessor32<scalar_t, 2, torch::RestrictPtrTraits>
         grad_output,
         PackedRaysSpec<scalar_t> rays,
         RenderOptions opt,
+        PackedSampleLog<scalar_t> log,
+        const scalar_t* __restrict__ fwd_out,
+        const scalar_t* __restrict__ fwd_trans,
     torch::PackedTensorAccessor64<scalar_t, 5, torch::RestrictPtrTraits>
         grad_data_out
         ) {
@@ -747,62 +91,27 @@ __global__ void render_ray_backward_kernel(
     scalar_t origin[3] = {rays.origins[tid][0], rays.origins[tid][1], rays.origins[tid][2]};
     transform_coord<scalar_t>(origin, tree.offset, tree.scaling);
     scalar_t dir[3] = {rays.dirs[tid][0], rays.dirs[tid][1], rays.dirs[tid][2]};
+    AtomicGradSink<scalar_t> grad_sink{grad_data_out.data()};
     trace_ray_backward<scalar_t>(
         tree,
         grad_output[tid],
         SingleRaySpec<scalar_t>{origin, dir, &rays.vdirs[tid][0]},
         opt,
-        grad_data_out);
-}
-
-template <typename scalar_t>
-__device__ __inline__ void cam2world_ray(
-    int ix, int iy,
-    scalar_t* dir,
-    scalar_t* origin,
-    const PackedCameraSpec<scalar_t>& __restrict__ cam) {
-    scalar_t x = (ix - 0.5 * cam.width) / cam.fx;
-    scalar_t y = -(iy - 0.5 * cam.height) / cam.fy;
-    scalar_t z = sqrtf(x * x + y * y + 1.0);
-    x /= z; y /= z; z = -1.0f / z;
-    dir[0] = cam.c2w[0][0] * x + cam.c2w[0][1] * y + cam.c2w[0][2] * z;
-    dir[1] = cam.c2w[1][0] * x + cam.c2w[1][1] * y + cam.c2w[1][2] * z;
-    dir[2] = cam.c2w[2][0] * x + cam.c2w[2][1] * y + cam.c2w[2][2] * z;
-    origin[0] = cam.c2w[0][3]; origin[1] = cam.c2w[1][3]; origin[2] = cam.c2w[2][3];
-}
-
-
-template <typename scalar_t>
-__host__ __device__ __inline__ static void maybe_world2ndc(
-        RenderOptions& __restrict__ opt,
-        scalar_t* __restrict__ dir,
-        scalar_t* __restrict__ cen, scalar_t near = 1.f) {
-    if (opt.ndc_width < 0)
-        return;
-    scalar_t t = -(near + cen[2]) / dir[2];
-    for (int i = 0; i < 3; ++i) {
-        cen[i] = cen[i] + t * dir[i];
-    }
-
-    dir[0] = -((2 * opt.ndc_focal) / opt.ndc_width) * (dir[0] / dir[2] - cen[0] / cen[2]);
-    dir[1] = -((2 * opt.ndc_focal) / opt.ndc_height) * (dir[1] / dir[2] - cen[1] / cen[2]);
-    dir[2] = -2 * near / cen[2];
-
-    cen[0] = -((2 * opt.ndc_focal) / opt.ndc_width) * (cen[0] / cen[2]);
-    cen[1] = -((2 * opt.ndc_focal) / opt.ndc_height) * (cen[1] / cen[2]);
-    cen[2] = 1 + 2 * near / cen[2];
-
-    _normalize(dir);
+        grad_sink,
+        nullptr,
+        sample_log_row(log, tid),
+        fwd_out ? fwd_out + tid * grad_output.size(1) : nullptr,
+        fwd_trans ? fwd_trans + tid : nullptr);
 }
 
-
-template <typename scalar_t>
+template <typename scalar_t, typename data_t>
 __global__ void render_image_kernel(
-    PackedTreeSpec<scalar_t> tree,
+    PackedTreeSpec<scalar_t, data_t> tree,
     PackedCameraSpec<scalar_t> cam,
     RenderOptions opt,
     torch::PackedTensorAccessor32<scalar_t, 3, torch::RestrictPtrTraits>
-        out) {
+        out,
+    scalar_t* __restrict__ trans) {
     CUDA_GET_THREAD_ID(tid, cam.width * cam.height);
     int iy = tid / cam.width, ix = tid % cam.width;
     scalar_t dir[3], origin[3];
@@ -815,16 +124,21 @@ __global__ void render_image_kernel(
         tree,
         SingleRaySpec<scalar_t>{origin, dir, vdir},
         opt,
-        out[iy][ix]);
+        out[iy][ix],
+        nullptr,
+        SingleSampleLog<scalar_t>(),
+        trans + tid);
 }
 
-template <typename scalar_t>
+template <typename scalar_t, typename data_t>
 __global__ void render_image_backward_kernel(
-    PackedTreeSpec<scalar_t> tree,
+    PackedTreeSpec<scalar_t, data_t> tree,
     const torch::PackedTensorAccessor32<scalar_t, 3, torch::RestrictPtrTraits>
         grad_output,
     PackedCameraSpec<scalar_t> cam,
     RenderOptions opt,
+    const scalar_t* __restrict__ fwd_out,
+    const scalar_t* __restrict__ fwd_trans,
     torch::PackedTensorAccessor64<scalar_t, 5, torch::RestrictPtrTraits>
         grad_data_out) {
     CUDA_GET_THREAD_ID(tid, cam.width * cam.height);
@@ -835,17 +149,22 @@ __global__ void render_image_backward_kernel(
     maybe_world2ndc(opt, dir, origin);
 
     transform_coord<scalar_t>(origin, tree.offset, tree.scaling);
+    AtomicGradSink<scalar_t> grad_sink{grad_data_out.data()};
     trace_ray_backward<scalar_t>(
         tree,
         grad_output[iy][ix],
         SingleRaySpec<scalar_t>{origin, dir, vdir},
         opt,
-        grad_data_out);
+        grad_sink,
+        nullptr,
+        SingleSampleLog<scalar_t>(),
+        fwd_out ? fwd_out + tid * grad_output.size(2) : nullptr,
+        fwd_trans ? fwd_trans + tid : nullptr);
 }
 
-template <typename scalar_t>
+template <typename scalar_t, typename data_t>
 __global__ void se_grad_kernel(
-    PackedTreeSpec<scalar_t> tree,
+    PackedTreeSpec<scalar_t, data_t> tree,
     PackedRaysSpec<scalar_t> rays,
     RenderOptions opt,
     torch::PackedTensorAccessor32<scalar_t, 2, torch::RestrictPtrTraits> color_ref,
@@ -857,19 +176,21 @@ __global__ void se_grad_kernel(
     transform_coord<scalar_t>(origin, tree.offset, tree.scaling);
     scalar_t dir[3] = {rays.dirs[tid][0], rays.dirs[tid][1], rays.dirs[tid][2]};
 
+    AtomicGradSink<scalar_t> grad_sink{grad_out.data()};
+    AtomicGradSink<scalar_t> hessdiag_sink{hessdiag_out.data()};
     trace_ray_se_grad_hess<scalar_t>(
         tree,
         SingleRaySpec<scalar_t>{origin, dir, &rays.vdirs[tid][0]},
         opt,
         color_ref[tid],
         color_out[tid],
-        grad_out,
-        hessdiag_out);
+        grad_sink,
+        hessdiag_sink);
 }
 
-template <typename scalar_t>
+template <typename scalar_t, typename data_t>
 __global__ void se_grad_persp_kernel(
-    PackedTreeSpec<scalar_t> tree,
+    PackedTreeSpec<scalar_t, data_t> tree,
     PackedCameraSpec<scalar_t> cam,
     RenderOptions opt,
     torch::PackedTensorAccessor32<scalar_t, 3, torch::RestrictPtrTraits>
@@ -886,14 +207,16 @@ __global__ void se_grad_persp_kernel(
     maybe_world2ndc(opt, dir, origin);
 
     transform_coord<scalar_t>(origin, tree.offset, tree.scaling);
+    AtomicGradSink<scalar_t> grad_sink{grad_out.data()};
+    AtomicGradSink<scalar_t> hessdiag_sink{hessdiag_out.data()};
     trace_ray_se_grad_hess<scalar_t>(
         tree,
         SingleRaySpec<scalar_t>{origin, dir, vdir},
         opt,
         color_ref[iy][ix],
         color_out[iy][ix],
-        grad_out,
-        hessdiag_out);
+        grad_sink,
+        hessdiag_sink);
 }
 
 template <typename scalar_t>
@@ -1004,38 +327,62 @@ __global__ void grid_weight_render_kernel(
 
 }  // namespace device
 
-
-// Compute RGB output dimension from input dimension & SH degree
-__host__ int get_out_data_dim(int format, int basis_dim, int in_data_dim) {
-    if (format != FORMAT_RGBA) {
-        return (in_data_dim - 1) / basis_dim;
-    } else {
-        return in_data_dim - 1;
-    }
+// Checks the forward output out and transmittance trans given to a fused
+// backward pass, of the shape of grad_output (undefined if not fused)
+void check_forward_output(torch::Tensor& out, torch::Tensor& trans,
+                          torch::Tensor& grad_output) {
+    if (!out.defined()) return;
+    CHECK_INPUT(out);
+    CHECK_INPUT(trans);
+    TORCH_CHECK(out.sizes() == grad_output.sizes(),
+                "out must have the shape of grad_output");
+    TORCH_CHECK(trans.numel() * grad_output.size(-1) == out.numel(),
+                "trans must have one value per ray");
+    TORCH_CHECK(out.scalar_type() == grad_output.scalar_type() &&
+                trans.scalar_type() == grad_output.scalar_type());
 }
 
 }  // namespace
 
-torch::Tensor volume_render(TreeSpec& tree, RaysSpec& rays, RenderOptions& opt) {
+std::tuple<torch::Tensor, torch::Tensor> volume_render_trans_cuda(
+        TreeSpec& tree, RaysSpec& rays, RenderOptions& opt, SampleLog& log) {
     tree.check();
     rays.check();
     DEVICE_GUARD(tree.data);
     const auto Q = rays.origins.size(0);
+    if (!log.empty()) {
+        tree.check_no_bricks();
+        log.check(tree.data, Q);
+    }
 
     auto_cuda_threads();
     const int blocks = CUDA_N_BLOCKS_NEEDED(Q, cuda_n_threads);
-    int out_data_dim = get_out_data_dim(opt.format, opt.basis_dim, tree.data.size(4));
+    int out_data_dim = get_out_data_dim(opt.format, opt.basis_dim, tree.data_dim());
     torch::Tensor result = torch::zeros({Q, out_data_dim}, rays.origins.options());
-    AT_DISPATCH_FLOATING_TYPES(rays.origins.type(), __FUNCTION__, [&] {
-            device::render_ray_kernel<scalar_t><<<blocks, cuda_n_threads>>>(
+    torch::Tensor trans = torch::empty({Q}, rays.origins.options());
+    SVOX_DISPATCH_RENDER_TYPES(tree.data.scalar_type(), __FUNCTION__, [&] {
+            device::render_ray_kernel<scalar_t, data_t><<<blocks, cuda_n_threads>>>(
                     tree, rays, opt,
-                    result.packed_accessor32<scalar_t, 2, torch::RestrictPtrTraits>());
+                    result.packed_accessor32<scalar_t, 2, torch::RestrictPtrTraits>(),
+                    log,
+                    trans.data_ptr<scalar_t>());
     });
     CUDA_CHECK_ERRORS;
-    return result;
+    return std::template tuple<torch::Tensor, torch::Tensor>(result, trans);
+}
+
+torch::Tensor volume_render_log_cuda(TreeSpec& tree, RaysSpec& rays,
+                                     RenderOptions& opt, SampleLog& log) {
+    return std::get<0>(volume_render_trans_cuda(tree, rays, opt, log));
 }
 
-torch::Tensor volume_render_image(TreeSpec& tree, CameraSpec& cam, RenderOptions& opt) {
+torch::Tensor volume_render_cuda(TreeSpec& tree, RaysSpec& rays, RenderOptions& opt) {
+    SampleLog no_log;
+    return volume_render_log_cuda(tree, rays, opt, no_log);
+}
+
+std::tuple<torch::Tensor, torch::Tensor> volume_render_image_trans_cuda(
+        TreeSpec& tree, CameraSpec& cam, RenderOptions& opt) {
     tree.check();
     cam.check();
     DEVICE_GUARD(tree.data);
@@ -1043,74 +390,117 @@ torch::Tensor volume_render_image(TreeSpec& tree, CameraSpec& cam, RenderOptions
 
     auto_cuda_threads();
     const int blocks = CUDA_N_BLOCKS_NEEDED(Q, cuda_n_threads);
-    int out_data_dim = get_out_data_dim(opt.format, opt.basis_dim, tree.data.size(4));
+    int out_data_dim = get_out_data_dim(opt.format, opt.basis_dim, tree.data_dim());
     torch::Tensor result = torch::zeros({cam.height, cam.width, out_data_dim},
-            tree.data.options());
+            tree.compute_options());
+    torch::Tensor trans = torch::empty({cam.height, cam.width},
+            tree.compute_options());
 
-    AT_DISPATCH_FLOATING_TYPES(tree.data.type(), __FUNCTION__, [&] {
-            device::render_image_kernel<scalar_t><<<blocks, cuda_n_threads>>>(
+    SVOX_DISPATCH_RENDER_TYPES(tree.data.scalar_type(), __FUNCTION__, [&] {
+            device::render_image_kernel<scalar_t, data_t><<<blocks, cuda_n_threads>>>(
                     tree, cam, opt,
-                    result.packed_accessor32<scalar_t, 3, torch::RestrictPtrTraits>());
+                    result.packed_accessor32<scalar_t, 3, torch::RestrictPtrTraits>(),
+                    trans.data_ptr<scalar_t>());
     });
     CUDA_CHECK_ERRORS;
-    return result;
+    return std::template tuple<torch::Tensor, torch::Tensor>(result, trans);
 }
 
-torch::Tensor volume_render_backward(
+torch::Tensor volume_render_image_cuda(TreeSpec& tree, CameraSpec& cam, RenderOptions& opt) {
+    return std::get<0>(volume_render_image_trans_cuda(tree, cam, opt));
+}
+
+torch::Tensor volume_render_fused_backward_cuda(
     TreeSpec& tree, RaysSpec& rays,
     RenderOptions& opt,
+    SampleLog& log,
+    torch::Tensor out,
+    torch::Tensor trans,
     torch::Tensor grad_output) {
     tree.check();
+    tree.check_no_bricks();
     rays.check();
     DEVICE_GUARD(tree.data);
 
     const int Q = rays.origins.size(0);
+    if (!log.empty()) log.check(tree.data, Q);
+    check_forward_output(out, trans, grad_output);
 
     auto_cuda_threads();
     const int blocks = CUDA_N_BLOCKS_NEEDED(Q, cuda_n_threads);
-    int out_data_dim = get_out_data_dim(opt.format, opt.basis_dim, tree.data.size(4));
-    torch::Tensor result = torch::zeros_like(tree.data);
-    AT_DISPATCH_FLOATING_TYPES(rays.origins.type(), __FUNCTION__, [&] {
-            device::render_ray_backward_kernel<scalar_t><<<blocks, cuda_n_threads>>>(
+    torch::Tensor result = torch::zeros(tree.data.sizes(), tree.compute_options());
+    SVOX_DISPATCH_DATA_TYPES(tree.data.scalar_type(), __FUNCTION__, [&] {
+            device::render_ray_backward_kernel<scalar_t, data_t><<<blocks, cuda_n_threads>>>(
                 tree,
                 grad_output.packed_accessor32<scalar_t, 2, torch::RestrictPtrTraits>(),
                 rays,
                 opt,
+                log,
+                out.defined() ? out.data_ptr<scalar_t>() : nullptr,
+                trans.defined() ? trans.data_ptr<scalar_t>() : nullptr,
                 result.packed_accessor64<scalar_t, 5, torch::RestrictPtrTraits>());
     });
     CUDA_CHECK_ERRORS;
-    return result;
+    return result.to(tree.data.scalar_type());
 }
 
-torch::Tensor volume_render_image_backward(TreeSpec& tree, CameraSpec& cam,
-                                           RenderOptions& opt,
-                                           torch::Tensor grad_output) {
+torch::Tensor volume_render_log_backward_cuda(
+    TreeSpec& tree, RaysSpec& rays,
+    RenderOptions& opt,
+    SampleLog& log,
+    torch::Tensor grad_output) {
+    return volume_render_fused_backward_cuda(tree, rays, opt, log,
+            torch::Tensor(), torch::Tensor(), grad_output);
+}
+
+torch::Tensor volume_render_backward_cuda(
+    TreeSpec& tree, RaysSpec& rays,
+    RenderOptions& opt,
+    torch::Tensor grad_output) {
+    SampleLog no_log;
+    return volume_render_log_backward_cuda(tree, rays, opt, no_log, grad_output);
+}
+
+torch::Tensor volume_render_image_fused_backward_cuda(
+        TreeSpec& tree, CameraSpec& cam, RenderOptions& opt,
+        torch::Tensor out, torch::Tensor trans, torch::Tensor grad_output) {
     tree.check();
+    tree.check_no_bricks();
     cam.check();
     DEVICE_GUARD(tree.data);
+    check_forward_output(out, trans, grad_output);
 
     const size_t Q = size_t(cam.width) * cam.height;
 
     auto_cuda_threads();
     const int blocks = CUDA_N_BLOCKS_NEEDED(Q, cuda_n_threads);
-    int out_data_dim = get_out_data_dim(opt.format, opt.basis_dim, tree.data.size(4));
-    torch::Tensor result = torch::zeros_like(tree.data);
+    torch::Tensor result = torch::zeros(tree.data.sizes(), tree.compute_options());
 
-    AT_DISPATCH_FLOATING_TYPES(tree.data.type(), __FUNCTION__, [&] {
-            device::render_image_backward_kernel<scalar_t><<<blocks, cuda_n_threads>>>(
+    SVOX_DISPATCH_DATA_TYPES(tree.data.scalar_type(), __FUNCTION__, [&] {
+            device::render_image_backward_kernel<scalar_t, data_t><<<blocks, cuda_n_threads>>>(
                 tree,
                 grad_output.packed_accessor32<scalar_t, 3, torch::RestrictPtrTraits>(),
                 cam,
                 opt,
+                out.defined() ? out.data_ptr<scalar_t>() : nullptr,
+                trans.defined() ? trans.data_ptr<scalar_t>() : nullptr,
                 result.packed_accessor64<scalar_t, 5, torch::RestrictPtrTraits>());
     });
     CUDA_CHECK_ERRORS;
-    return result;
+    return result.to(tree.data.scalar_type());
+}
+
+torch::Tensor volume_render_image_backward_cuda(TreeSpec& tree, CameraSpec& cam,
+                                                RenderOptions& opt,
+                                                torch::Tensor grad_output) {
+    return volume_render_image_fused_backward_cuda(tree, cam, opt,
+            torch::Tensor(), torch::Tensor(), grad_output);
 }
 
-std::tuple<torch::Tensor, torch::Tensor, torch::Tensor> se_grad(
+std::tuple<torch::Tensor, torch::Tensor, torch::Tensor> se_grad_cuda(
         TreeSpec& tree, RaysSpec& rays, torch::Tensor color, RenderOptions& opt) {
     tree.check();
+    tree.check_no_bricks();
     rays.check();
     DEVICE_GUARD(tree.data);
     CHECK_INPUT(color);
@@ -1119,15 +509,15 @@ std::tuple<torch::Tensor, torch::Tensor, torch::Tensor> se_grad(
 
     auto_cuda_threads();
     const int blocks = CUDA_N_BLOCKS_NEEDED(Q, cuda_n_threads);
-    int out_data_dim = get_out_data_dim(opt.format, opt.basis_dim, tree.data.size(4));
+    int out_data_dim = get_out_data_dim(opt.format, opt.basis_dim, tree.data_dim());
     if (out_data_dim > 4) {
         throw std::runtime_error("Tree's output dim cannot be > 4 for se_grad");
     }
     torch::Tensor result = torch::zeros({Q, out_data_dim}, rays.origins.options());
-    torch::Tensor grad = torch::zeros_like(tree.data);
-    torch::Tensor hessdiag = torch::zeros_like(tree.data);
-    AT_DISPATCH_FLOATING_TYPES(rays.origins.type(), __FUNCTION__, [&] {
-            device::se_grad_kernel<scalar_t><<<blocks, cuda_n_threads>>>(
+    torch::Tensor grad = torch::zeros(tree.data.sizes(), tree.compute_options());
+    torch::Tensor hessdiag = torch::zeros(tree.data.sizes(), tree.compute_options());
+    SVOX_DISPATCH_DATA_TYPES(tree.data.scalar_type(), __FUNCTION__, [&] {
+            device::se_grad_kernel<scalar_t, data_t><<<blocks, cuda_n_threads>>>(
                     tree, rays, opt,
                     color.packed_accessor32<scalar_t, 2, torch::RestrictPtrTraits>(),
                     result.packed_accessor32<scalar_t, 2, torch::RestrictPtrTraits>(),
@@ -1135,15 +525,18 @@ std::tuple<torch::Tensor, torch::Tensor, torch::Tensor> se_grad(
                     hessdiag.packed_accessor64<scalar_t, 5, torch::RestrictPtrTraits>());
     });
     CUDA_CHECK_ERRORS;
-    return std::template tuple<torch::Tensor, torch::Tensor, torch::Tensor>(result, grad, hessdiag);
+    return std::template tuple<torch::Tensor, torch::Tensor, torch::Tensor>(
+            result, grad.to(tree.data.scalar_type()),
+            hessdiag.to(tree.data.scalar_type()));
 }
 
-std::tuple<torch::Tensor, torch::Tensor, torch::Tensor> se_grad_persp(
+std::tuple<torch::Tensor, torch::Tensor, torch::Tensor> se_grad_persp_cuda(
                             TreeSpec& tree,
                             CameraSpec& cam,
                             RenderOptions& opt,
                             torch::Tensor color) {
     tree.check();
+    tree.check_no_bricks();
     cam.check();
     DEVICE_GUARD(tree.data);
     CHECK_INPUT(color);
@@ -1151,17 +544,17 @@ std::tuple<torch::Tensor, torch::Tensor, torch::Tensor> se_grad_persp(
 
     auto_cuda_threads();
     const int blocks = CUDA_N_BLOCKS_NEEDED(Q, cuda_n_threads);
-    int out_data_dim = get_out_data_dim(opt.format, opt.basis_dim, tree.data.size(4));
+    int out_data_dim = get_out_data_dim(opt.format, opt.basis_dim, tree.data_dim());
     if (out_data_dim > 4) {
         throw std::runtime_error("Tree's output dim cannot be > 4 for se_grad");
     }
     torch::Tensor result = torch::zeros({cam.height, cam.width, out_data_dim},
-            tree.data.options());
-    torch::Tensor grad = torch::zeros_like(tree.data);
-    torch::Tensor hessdiag = torch::zeros_like(tree.data);
+            tree.compute_options());
+    torch::Tensor grad = torch::zeros(tree.data.sizes(), tree.compute_options());
+    torch::Tensor hessdiag = torch::zeros(tree.data.sizes(), tree.compute_options());
 
-    AT_DISPATCH_FLOATING_TYPES(tree.data.type(), __FUNCTION__, [&] {
-            device::se_grad_persp_kernel<scalar_t><<<blocks, cuda_n_threads>>>(
+    SVOX_DISPATCH_DATA_TYPES(tree.data.scalar_type(), __FUNCTION__, [&] {
+            device::se_grad_persp_kernel<scalar_t, data_t><<<blocks, cuda_n_threads>>>(
                     tree, cam, opt,
                     color.packed_accessor32<scalar_t, 3, torch::RestrictPtrTraits>(),
                     result.packed_accessor32<scalar_t, 3, torch::RestrictPtrTraits>(),
@@ -1169,7 +562,9 @@ std::tuple<torch::Tensor, torch::Tensor, torch::Tensor> se_grad_persp(
                     hessdiag.packed_accessor64<scalar_t, 5, torch::RestrictPtrTraits>());
     });
     CUDA_CHECK_ERRORS;
-    return std::template tuple<torch::Tensor, torch::Tensor, torch::Tensor>(result, grad, hessdiag);
+    return std::template tuple<torch::Tensor, torch::Tensor, torch::Tensor>(
+            result, grad.to(tree.data.scalar_type()),
+            hessdiag.to(tree.data.scalar_type()));
 }
 std::vector<torch::Tensor> grid_weight_render(
     torch::Tensor data, CameraSpec& cam, RenderOptions& opt,
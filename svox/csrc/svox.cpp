@@ -24,10 +24,12 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
-// This file contains only forward declarations and Python bindings
+// This file contains only forward declarations, device dispatch
+// and Python bindings
 
 #include <torch/extension.h>
 #include <cstdint>
+#include <string>
 #include <vector>
 
 #include "data_spec.hpp"
@@ -35,30 +37,183 @@
 namespace py = pybind11;
 using torch::Tensor;
 
+// Route to the _cuda or _cpu implementation depending on where _ten lives
+#ifdef WITH_CUDA
+#define DISPATCH_DEVICE(_ten, _fn, ...)        \
+    if ((_ten).is_cuda()) {                    \
+        return _fn##_cuda(__VA_ARGS__);        \
+    }                                          \
+    return _fn##_cpu(__VA_ARGS__)
+#else
+#define DISPATCH_DEVICE(_ten, _fn, ...)        \
+    TORCH_CHECK(!(_ten).is_cuda(),             \
+            "svox was built without CUDA support"); \
+    return _fn##_cpu(__VA_ARGS__)
+#endif
+
+#ifdef WITH_CUDA
 std::vector<torch::Tensor> grid_weight_render(torch::Tensor data,
                                               CameraSpec& cam,
                                               RenderOptions& opt,
                                               torch::Tensor offset,
                                               torch::Tensor scaling);
 
-QueryResult query_vertical(TreeSpec&, Tensor);
-Tensor query_vertical_backward(TreeSpec&, Tensor, Tensor);
-void assign_vertical(TreeSpec&, Tensor, Tensor);
+QueryResult query_vertical_cuda(TreeSpec&, Tensor);
+Tensor query_vertical_backward_cuda(TreeSpec&, Tensor, Tensor);
+void assign_vertical_cuda(TreeSpec&, Tensor, Tensor);
 
-Tensor volume_render(TreeSpec&, RaysSpec&, RenderOptions&);
-Tensor volume_render_image(TreeSpec&, CameraSpec&, RenderOptions&);
-Tensor volume_render_backward(TreeSpec&, RaysSpec&, RenderOptions&, Tensor);
-Tensor volume_render_image_backward(TreeSpec&, CameraSpec&, RenderOptions&,
-                                    Tensor);
+Tensor volume_render_cuda(TreeSpec&, RaysSpec&, RenderOptions&);
+Tensor volume_render_log_cuda(TreeSpec&, RaysSpec&, RenderOptions&, SampleLog&);
+std::tuple<Tensor, Tensor> volume_render_trans_cuda(TreeSpec&, RaysSpec&,
+        RenderOptions&, SampleLog&);
+Tensor volume_render_image_cuda(TreeSpec&, CameraSpec&, RenderOptions&);
+std::tuple<Tensor, Tensor> volume_render_image_trans_cuda(TreeSpec&, CameraSpec&,
+        RenderOptions&);
+Tensor volume_render_backward_cuda(TreeSpec&, RaysSpec&, RenderOptions&, Tensor);
+Tensor volume_render_log_backward_cuda(TreeSpec&, RaysSpec&, RenderOptions&,
+                                       SampleLog&, Tensor);
+Tensor volume_render_image_backward_cuda(TreeSpec&, CameraSpec&, RenderOptions&,
+                                         Tensor);
+Tensor volume_render_fused_backward_cuda(TreeSpec&, RaysSpec&, RenderOptions&,
+        SampleLog&, Tensor, Tensor, Tensor);
+Tensor volume_render_image_fused_backward_cuda(TreeSpec&, CameraSpec&,
+        RenderOptions&, Tensor, Tensor, Tensor);
 
-std::tuple<Tensor, Tensor, Tensor> se_grad(TreeSpec&, RaysSpec&, Tensor,
-                                           RenderOptions&);
-std::tuple<Tensor, Tensor, Tensor> se_grad_persp(TreeSpec&, CameraSpec&,
-                                                 RenderOptions&, Tensor);
+std::tuple<Tensor, Tensor, Tensor> se_grad_cuda(TreeSpec&, RaysSpec&, Tensor,
+                                                RenderOptions&);
+std::tuple<Tensor, Tensor, Tensor> se_grad_persp_cuda(TreeSpec&, CameraSpec&,
+                                                      RenderOptions&, Tensor);
 
 Tensor calc_corners(TreeSpec&, Tensor);
+Tensor build_ropes_cuda(TreeSpec&);
+Tensor build_max_sigma_cuda(TreeSpec&);
+#endif
+
+QueryResult query_vertical_cpu(TreeSpec&, Tensor);
+Tensor query_vertical_backward_cpu(TreeSpec&, Tensor, Tensor);
+void assign_vertical_cpu(TreeSpec&, Tensor, Tensor);
+Tensor build_ropes_cpu(TreeSpec&);
+Tensor build_max_sigma_cpu(TreeSpec&);
+
+Tensor volume_render_cpu(TreeSpec&, RaysSpec&, RenderOptions&);
+Tensor volume_render_log_cpu(TreeSpec&, RaysSpec&, RenderOptions&, SampleLog&);
+std::tuple<Tensor, Tensor> volume_render_trans_cpu(TreeSpec&, RaysSpec&,
+        RenderOptions&, SampleLog&);
+Tensor volume_render_image_cpu(TreeSpec&, CameraSpec&, RenderOptions&);
+std::tuple<Tensor, Tensor> volume_render_image_trans_cpu(TreeSpec&, CameraSpec&,
+        RenderOptions&);
+std::tuple<Tensor, Tensor> volume_render_image_tiled_cpu(TreeSpec&, CameraSpec&,
+                                                         RenderOptions&, int);
+Tensor volume_render_backward_cpu(TreeSpec&, RaysSpec&, RenderOptions&, Tensor);
+Tensor volume_render_log_backward_cpu(TreeSpec&, RaysSpec&, RenderOptions&,
+                                      SampleLog&, Tensor);
+Tensor volume_render_image_backward_cpu(TreeSpec&, CameraSpec&, RenderOptions&,
+                                        Tensor);
+Tensor volume_render_fused_backward_cpu(TreeSpec&, RaysSpec&, RenderOptions&,
+        SampleLog&, Tensor, Tensor, Tensor);
+Tensor volume_render_image_fused_backward_cpu(TreeSpec&, CameraSpec&,
+        RenderOptions&, Tensor, Tensor, Tensor);
+std::tuple<Tensor, Tensor, Tensor> se_grad_cpu(TreeSpec&, RaysSpec&, Tensor,
+                                               RenderOptions&);
+std::tuple<Tensor, Tensor, Tensor> se_grad_persp_cpu(TreeSpec&, CameraSpec&,
+                                                     RenderOptions&, Tensor);
+std::string cpu_isa_cpu();
 
 std::tuple<Tensor, Tensor> quantize_median_cut(Tensor data, Tensor, int32_t);
+Tensor reorder_nodes(Tensor child, int64_t layout);
+
+QueryResult query_vertical(TreeSpec& tree, Tensor indices) {
+    DISPATCH_DEVICE(tree.data, query_vertical, tree, indices);
+}
+
+Tensor query_vertical_backward(TreeSpec& tree, Tensor indices,
+                               Tensor grad_output) {
+    DISPATCH_DEVICE(tree.data, query_vertical_backward, tree, indices,
+                    grad_output);
+}
+
+void assign_vertical(TreeSpec& tree, Tensor indices, Tensor values) {
+    DISPATCH_DEVICE(tree.data, assign_vertical, tree, indices, values);
+}
+
+Tensor build_ropes(TreeSpec& tree) {
+    DISPATCH_DEVICE(tree.data, build_ropes, tree);
+}
+
+Tensor build_max_sigma(TreeSpec& tree) {
+    DISPATCH_DEVICE(tree.data, build_max_sigma, tree);
+}
+
+Tensor volume_render(TreeSpec& tree, RaysSpec& rays, RenderOptions& opt) {
+    DISPATCH_DEVICE(tree.data, volume_render, tree, rays, opt);
+}
+
+Tensor volume_render_log(TreeSpec& tree, RaysSpec& rays, RenderOptions& opt,
+                         SampleLog& log) {
+    DISPATCH_DEVICE(tree.data, volume_render_log, tree, rays, opt, log);
+}
+
+std::tuple<Tensor, Tensor> volume_render_trans(TreeSpec& tree, RaysSpec& rays,
+                                               RenderOptions& opt,
+                                               SampleLog& log) {
+    DISPATCH_DEVICE(tree.data, volume_render_trans, tree, rays, opt, log);
+}
+
+Tensor volume_render_image(TreeSpec& tree, CameraSpec& cam, RenderOptions& opt) {
+    DISPATCH_DEVICE(tree.data, volume_render_image, tree, cam, opt);
+}
+
+std::tuple<Tensor, Tensor> volume_render_image_trans(TreeSpec& tree,
+                                                     CameraSpec& cam,
+                                                     RenderOptions& opt) {
+    DISPATCH_DEVICE(tree.data, volume_render_image_trans, tree, cam, opt);
+}
+
+Tensor volume_render_backward(TreeSpec& tree, RaysSpec& rays,
+                              RenderOptions& opt, Tensor grad_output) {
+    DISPATCH_DEVICE(tree.data, volume_render_backward, tree, rays, opt,
+                    grad_output);
+}
+
+Tensor volume_render_log_backward(TreeSpec& tree, RaysSpec& rays,
+                                  RenderOptions& opt, SampleLog& log,
+                                  Tensor grad_output) {
+    DISPATCH_DEVICE(tree.data, volume_render_log_backward, tree, rays, opt,
+                    log, grad_output);
+}
+
+Tensor volume_render_fused_backward(TreeSpec& tree, RaysSpec& rays,
+                                    RenderOptions& opt, SampleLog& log,
+                                    Tensor out, Tensor trans,
+                                    Tensor grad_output) {
+    DISPATCH_DEVICE(tree.data, volume_render_fused_backward, tree, rays, opt,
+                    log, out, trans, grad_output);
+}
+
+Tensor volume_render_image_backward(TreeSpec& tree, CameraSpec& cam,
+                                    RenderOptions& opt, Tensor grad_output) {
+    DISPATCH_DEVICE(tree.data, volume_render_image_backward, tree, cam, opt,
+                    grad_output);
+}
+
+Tensor volume_render_image_fused_backward(TreeSpec& tree, CameraSpec& cam,
+                                          RenderOptions& opt, Tensor out,
+                                          Tensor trans, Tensor grad_output) {
+    DISPATCH_DEVICE(tree.data, volume_render_image_fused_backward, tree, cam,
+                    opt, out, trans, grad_output);
+}
+
+std::tuple<Tensor, Tensor, Tensor> se_grad(TreeSpec& tree, RaysSpec& rays,
+                                           Tensor color, RenderOptions& opt) {
+    DISPATCH_DEVICE(tree.data, se_grad, tree, rays, color, opt);
+}
+
+std::tuple<Tensor, Tensor, Tensor> se_grad_persp(TreeSpec& tree,
+                                                 CameraSpec& cam,
+                                                 RenderOptions& opt,
+                                                 Tensor color) {
+    DISPATCH_DEVICE(tree.data, se_grad_persp, tree, cam, opt, color);
+}
 
 PYBIND11_MODULE(TORCH_EXTENSION_NAME, m) {
     py::class_<RaysSpec>(m, "RaysSpec")
@@ -67,6 +222,12 @@ PYBIND11_MODULE(TORCH_EXTENSION_NAME, m) {
         .def_readwrite("dirs", &RaysSpec::dirs)
         .def_readwrite("vdirs", &RaysSpec::vdirs);
 
+    py::class_<SampleLog>(m, "SampleLog")
+        .def(py::init<>())
+        .def_readwrite("leaf", &SampleLog::leaf)
+        .def_readwrite("delta_t", &SampleLog::delta_t)
+        .def_readwrite("count", &SampleLog::count);
+
     py::class_<TreeSpec>(m, "TreeSpec")
         .def(py::init<>())
         .def_readwrite("data", &TreeSpec::data)
@@ -76,7 +237,17 @@ PYBIND11_MODULE(TORCH_EXTENSION_NAME, m) {
         .def_readwrite("offset", &TreeSpec::offset)
         .def_readwrite("scaling", &TreeSpec::scaling)
         .def_readwrite("_weight_accum", &TreeSpec::_weight_accum)
-        .def_readwrite("_weight_accum_max", &TreeSpec::_weight_accum_max);
+        .def_readwrite("_weight_accum_max", &TreeSpec::_weight_accum_max)
+        .def_readwrite("ropes", &TreeSpec::ropes)
+        .def_readwrite("max_sigma", &TreeSpec::max_sigma)
+        .def_readwrite("density", &TreeSpec::density)
+        .def_readwrite("quant", &TreeSpec::quant)
+        .def_readwrite("palette", &TreeSpec::palette)
+        .def_readwrite("child_bits", &TreeSpec::child_bits)
+        .def_readwrite("child_list", &TreeSpec::child_list)
+        .def_readwrite("packed_leaves", &TreeSpec::packed_leaves)
+        .def_readwrite("bricks", &TreeSpec::bricks)
+        .def_readwrite("brick", &TreeSpec::brick);
 
     py::class_<CameraSpec>(m, "CameraSpec")
         .def(py::init<>())
@@ -101,22 +272,36 @@ PYBIND11_MODULE(TORCH_EXTENSION_NAME, m) {
         .def_readwrite("sigma_thresh", &RenderOptions::sigma_thresh)
         .def_readwrite("stop_thresh", &RenderOptions::stop_thresh)
         .def_readwrite("density_softplus", &RenderOptions::density_softplus)
-        .def_readwrite("rgb_padding", &RenderOptions::rgb_padding);
+        .def_readwrite("rgb_padding", &RenderOptions::rgb_padding)
+        .def_readwrite("fast_math", &RenderOptions::fast_math);
 
     m.def("query_vertical", &query_vertical);
     m.def("query_vertical_backward", &query_vertical_backward);
     m.def("assign_vertical", &assign_vertical);
+    m.def("build_ropes", &build_ropes);
+    m.def("build_max_sigma", &build_max_sigma);
 
     m.def("volume_render", &volume_render);
+    m.def("volume_render_log", &volume_render_log);
+    m.def("volume_render_trans", &volume_render_trans);
     m.def("volume_render_image", &volume_render_image);
+    m.def("volume_render_image_trans", &volume_render_image_trans);
+    m.def("volume_render_image_tiled", &volume_render_image_tiled_cpu);
     m.def("volume_render_backward", &volume_render_backward);
+    m.def("volume_render_log_backward", &volume_render_log_backward);
+    m.def("volume_render_fused_backward", &volume_render_fused_backward);
     m.def("volume_render_image_backward", &volume_render_image_backward);
-
+    m.def("volume_render_image_fused_backward",
+          &volume_render_image_fused_backward);
     m.def("se_grad", &se_grad);
     m.def("se_grad_persp", &se_grad_persp);
+    m.def("cpu_isa", &cpu_isa_cpu);
 
+#ifdef WITH_CUDA
     m.def("calc_corners", &calc_corners);
 
     m.def("grid_weight_render", &grid_weight_render);
+#endif
     m.def("quantize_median_cut", &quantize_median_cut);
+    m.def("reorder_nodes", &reorder_nodes);
 }
@@ -0,0 +1,270 @@
+/*
+ * Copyright 2021 PlenOctree Authors
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// CPU implementation of the tree query/assignment operations in
+// svox_kernel.cu, parallel over queries on the ATen intra-op thread pool.
+// Where possible, the tree descent runs in blocks of queries with SIMD
+// gathers (svox_packet.hpp).
+
+#include <torch/extension.h>
+#include <algorithm>
+#include <cstdint>
+#include "data_spec_packed.cuh"
+#include "svox_core.hpp"
+#include "cpu_grad.hpp"
+#include "cpu_simd.hpp"
+
+// Minimum number of queries handed to a CPU worker at once
+#define CPU_GRAIN_SIZE 1024
+// Number of queries passed to the SIMD descent at once
+#define CPU_QUERY_BLOCK 256
+
+namespace {
+void check_indices(torch::Tensor& indices) {
+    CHECK_CPU_INPUT(indices);
+    TORCH_CHECK(indices.dim() == 2);
+    TORCH_CHECK(indices.is_floating_point());
+}
+
+namespace cpu {
+
+// Whether the queries can use the SIMD descent, which handles float
+// trees with contiguous, not leaf-packed storage
+bool use_simd_descent(TreeSpec& tree, torch::Tensor& indices) {
+    return cpu_isa() != CPU_ISA_SCALAR &&
+           indices.scalar_type() == at::kFloat &&
+           tree.data.scalar_type() == at::kFloat && !tree.packed_leaves &&
+           tree.data.is_contiguous() && tree.child.is_contiguous();
+}
+
+void simd_query_leaves(
+        PackedTreeSpec<float>& tree,
+        const torch::PackedTensorAccessor32<float, 2, torch::RestrictPtrTraits> indices,
+        int64_t begin, int64_t end, int64_t* leaf_out) {
+#ifdef SVOX_X86_SIMD
+    if (cpu_isa() == CPU_ISA_AVX512) {
+        simd::avx512::query_leaves(tree, indices, begin, end, leaf_out);
+    } else {
+        simd::avx2::query_leaves(tree, indices, begin, end, leaf_out);
+    }
+#endif
+}
+
+// Not reached: use_simd_descent is false for other than float trees
+template <typename scalar_t, typename data_t>
+void simd_query_leaves(
+        PackedTreeSpec<scalar_t, data_t>& tree,
+        const torch::PackedTensorAccessor32<scalar_t, 2, torch::RestrictPtrTraits> indices,
+        int64_t begin, int64_t end, int64_t* leaf_out) {
+    TORCH_CHECK(false, "SIMD tree descent only supports float");
+}
+
+// Calls f(tid, data_ptr, node_id) for each of the queries [begin, end),
+// with the leaf data and node_id as returned by get_tree_leaf_ptr
+template <typename scalar_t, typename data_t, typename func_t>
+void for_each_leaf(
+        PackedTreeSpec<scalar_t, data_t>& tree,
+        const torch::PackedTensorAccessor32<scalar_t, 2, torch::RestrictPtrTraits> indices,
+        int64_t begin, int64_t end,
+        bool use_simd,
+        const func_t& f) {
+    if (use_simd) {
+        const int64_t K = tree.data.size(4);
+        int64_t node_ids[CPU_QUERY_BLOCK];
+        for (int64_t blk = begin; blk < end; blk += CPU_QUERY_BLOCK) {
+            const int64_t blk_end = std::min(end, blk + CPU_QUERY_BLOCK);
+            simd_query_leaves(tree, indices, blk, blk_end, node_ids);
+            for (int64_t tid = blk; tid < blk_end; ++tid) {
+                const int64_t node_id = node_ids[tid - blk];
+                f(tid, tree.data.data() + node_id * K, node_id);
+            }
+        }
+        return;
+    }
+    for (int64_t tid = begin; tid < end; ++tid) {
+        int64_t node_id;
+        data_t* data_ptr = device::get_tree_leaf_ptr(tree.data, tree,
+                &indices[tid][0], &node_id);
+        f(tid, data_ptr, node_id);
+    }
+}
+
+template <typename scalar_t, typename data_t>
+void query_single_kernel(
+        PackedTreeSpec<scalar_t, data_t> tree,
+        const torch::PackedTensorAccessor32<scalar_t, 2, torch::RestrictPtrTraits> indices,
+        torch::PackedTensorAccessor64<scalar_t, 2, torch::RestrictPtrTraits> values_out,
+        torch::PackedTensorAccessor32<int64_t, 1, torch::RestrictPtrTraits> node_ids_out,
+        bool use_simd) {
+    at::parallel_for(0, indices.size(0), CPU_GRAIN_SIZE,
+            [&](int64_t begin, int64_t end) {
+        for_each_leaf(tree, indices, begin, end, use_simd,
+                [&](int64_t tid, const data_t* data_ptr, int64_t node_id) {
+            node_ids_out[tid] = node_id;
+            for (int i = 0; i < tree.data.size(4); ++i)
+                values_out[tid][i] = scalar_t(data_ptr[i]);
+        });
+    });
+}
+
+template <typename scalar_t, typename data_t>
+void query_single_kernel_backward(
+       PackedTreeSpec<scalar_t, data_t> tree,
+       const torch::PackedTensorAccessor32<scalar_t, 2, torch::RestrictPtrTraits> indices,
+       const torch::PackedTensorAccessor64<scalar_t, 2, torch::RestrictPtrTraits> grad_output,
+       GradBuffer<scalar_t>& grad_data_out,
+       bool use_simd) {
+    const int K = grad_output.size(1);
+    at::parallel_for(0, indices.size(0), CPU_GRAIN_SIZE,
+            [&](int64_t begin, int64_t end) {
+        auto grad_sink = grad_data_out.local();
+        for_each_leaf(tree, indices, begin, end, use_simd,
+                [&](int64_t tid, const data_t* data_ptr, int64_t node_id) {
+            const int64_t offset = data_ptr - tree.data.data();
+            for (int i = 0; i < K; ++i)
+                grad_sink.add(offset + i, grad_output[tid][i]);
+        });
+    });
+}
+
+// As with the CUDA kernel, if several queries land in the same leaf, which
+// value ends up stored is unspecified
+template <typename scalar_t, typename data_t>
+void assign_single_kernel(
+       PackedTreeSpec<scalar_t, data_t> tree,
+       const torch::PackedTensorAccessor32<scalar_t, 2, torch::RestrictPtrTraits> indices,
+       const torch::PackedTensorAccessor64<scalar_t, 2, torch::RestrictPtrTraits> values,
+       bool use_simd) {
+    at::parallel_for(0, indices.size(0), CPU_GRAIN_SIZE,
+            [&](int64_t begin, int64_t end) {
+        for_each_leaf(tree, indices, begin, end, use_simd,
+                [&](int64_t tid, data_t* data_ptr, int64_t node_id) {
+            for (int i = 0; i < values.size(1); ++i)
+                data_ptr[i] = data_t(values[tid][i]);
+        });
+    });
+}
+
+}  // namespace cpu
+}  // namespace
+
+QueryResult query_vertical_cpu(TreeSpec& tree, torch::Tensor indices) {
+    tree.check_cpu();
+    check_indices(indices);
+
+    const auto Q = indices.size(0), K = tree.data.size(4);
+
+    torch::Tensor values = torch::empty({Q, K}, indices.options());
+    auto node_ids_options = at::TensorOptions()
+                       .dtype(at::kLong)
+                       .layout(tree.child.layout())
+                       .device(tree.child.device());
+    torch::Tensor node_ids = torch::empty({Q}, node_ids_options);
+    SVOX_DISPATCH_DATA_TYPES(tree.data.scalar_type(), __FUNCTION__, [&] {
+        cpu::query_single_kernel<scalar_t, data_t>(
+                tree,
+                indices.packed_accessor32<scalar_t, 2, torch::RestrictPtrTraits>(),
+                values.packed_accessor64<scalar_t, 2, torch::RestrictPtrTraits>(),
+                node_ids.packed_accessor32<int64_t, 1, torch::RestrictPtrTraits>(),
+                cpu::use_simd_descent(tree, indices));
+    });
+    return QueryResult(values, node_ids);
+}
+
+void assign_vertical_cpu(TreeSpec& tree, torch::Tensor indices, torch::Tensor values) {
+    tree.check_cpu();
+    check_indices(indices);
+    check_indices(values);
+    SVOX_DISPATCH_DATA_TYPES(tree.data.scalar_type(), __FUNCTION__, [&] {
+        cpu::assign_single_kernel<scalar_t, data_t>(
+                tree,
+                indices.packed_accessor32<scalar_t, 2, torch::RestrictPtrTraits>(),
+                values.packed_accessor64<scalar_t, 2, torch::RestrictPtrTraits>(),
+                cpu::use_simd_descent(tree, indices));
+    });
+}
+
+torch::Tensor query_vertical_backward_cpu(
+        TreeSpec& tree,
+        torch::Tensor indices,
+        torch::Tensor grad_output) {
+    tree.check_cpu();
+    check_indices(indices);
+    CHECK_CPU_INPUT(grad_output);
+    torch::Tensor grad_data = torch::zeros(tree.data.sizes(), grad_output.options());
+
+    SVOX_DISPATCH_DATA_TYPES(tree.data.scalar_type(), __FUNCTION__, [&] {
+        GradBuffer<scalar_t> grad_buf(grad_data.numel());
+        cpu::query_single_kernel_backward<scalar_t, data_t>(
+                tree,
+                indices.packed_accessor32<scalar_t, 2, torch::RestrictPtrTraits>(),
+                grad_output.packed_accessor64<scalar_t, 2, torch::RestrictPtrTraits>(),
+                grad_buf,
+                cpu::use_simd_descent(tree, indices));
+        grad_buf.reduce_into(grad_data.data_ptr<scalar_t>());
+    });
+    return grad_data.to(tree.data.scalar_type());
+}
+
+torch::Tensor build_ropes_cpu(TreeSpec& tree) {
+    tree.check_cpu();
+    const auto M = tree.child.size(0);
+    torch::Tensor ropes = torch::empty({M, 6}, tree.child.options());
+    const auto child = tree.child.packed_accessor32<int32_t, 4, torch::RestrictPtrTraits>();
+    const auto parent_depth =
+        tree.parent_depth.packed_accessor32<int32_t, 2, torch::RestrictPtrTraits>();
+    auto ropes_out = ropes.packed_accessor32<int32_t, 2, torch::RestrictPtrTraits>();
+    at::parallel_for(0, M, CPU_GRAIN_SIZE, [&](int64_t begin, int64_t end) {
+        for (int64_t node_id = begin; node_id < end; ++node_id) {
+            for (int face = 0; face < 6; ++face) {
+                ropes_out[node_id][face] =
+                    device::node_rope(child, parent_depth, node_id, face);
+            }
+        }
+    });
+    return ropes;
+}
+
+torch::Tensor build_max_sigma_cpu(TreeSpec& tree) {
+    tree.check_cpu();
+    const auto M = tree.child.size(0), N = tree.child.size(1);
+    torch::Tensor max_sigma = torch::empty({M, N, N, N}, tree.compute_options());
+    SVOX_DISPATCH_RENDER_TYPES(tree.data.scalar_type(), __FUNCTION__, [&] {
+        PackedTreeSpec<scalar_t, data_t> ptree(tree);
+        scalar_t* max_sigma_out = max_sigma.data_ptr<scalar_t>();
+        at::parallel_for(0, M, CPU_GRAIN_SIZE, [&](int64_t begin, int64_t end) {
+            for (int64_t node_id = begin; node_id < end; ++node_id) {
+                device::max_sigma_init_node(ptree, node_id, max_sigma_out);
+            }
+        });
+        at::parallel_for(0, M, CPU_GRAIN_SIZE, [&](int64_t begin, int64_t end) {
+            for (int64_t node_id = begin; node_id < end; ++node_id) {
+                device::max_sigma_climb_node(ptree, node_id, max_sigma_out);
+            }
+        });
+    });
+    return max_sigma;
+}
@@ -27,6 +27,7 @@
 #include <cstdint>
 #include "common.cuh"
 #include "data_spec_packed.cuh"
+#include "svox_core.hpp"
 
 #define CUDA_N_THREADS 1024
 
@@ -39,35 +40,21 @@ void check_indices(torch::Tensor& indices) {
 
 namespace device {
 
-template <typename scalar_t>
-__device__ __inline__ scalar_t* get_tree_leaf_ptr(
-       torch::PackedTensorAccessor64<scalar_t, 5, torch::RestrictPtrTraits>
-        data,
-       PackedTreeSpec<scalar_t>& __restrict__ tree,
-       const scalar_t* __restrict__ xyz_ind,
-       int64_t* node_id=nullptr) {
-    scalar_t xyz[3] = {xyz_ind[0], xyz_ind[1], xyz_ind[2]};
-    transform_coord<scalar_t>(xyz, tree.offset, tree.scaling);
-    scalar_t _cube_sz;
-    return query_single_from_root<scalar_t>(data, tree.child,
-            xyz, &_cube_sz, node_id);
-}
-
-template <typename scalar_t>
+template <typename scalar_t, typename data_t>
 __global__ void query_single_kernel(
-        PackedTreeSpec<scalar_t> tree,
+        PackedTreeSpec<scalar_t, data_t> tree,
         const torch::PackedTensorAccessor32<scalar_t, 2, torch::RestrictPtrTraits> indices,
         torch::PackedTensorAccessor64<scalar_t, 2, torch::RestrictPtrTraits> values_out,
         torch::PackedTensorAccessor32<int64_t, 1, torch::RestrictPtrTraits> node_ids_out) {
     CUDA_GET_THREAD_ID(tid, indices.size(0));
-    scalar_t* data_ptr = get_tree_leaf_ptr(tree.data, tree, &indices[tid][0], &node_ids_out[tid]);
+    data_t* data_ptr = get_tree_leaf_ptr(tree.data, tree, &indices[tid][0], &node_ids_out[tid]);
     for (int i = 0; i < tree.data.size(4); ++i)
-        values_out[tid][i] = data_ptr[i];
+        values_out[tid][i] = scalar_t(data_ptr[i]);
 }
 
-template <typename scalar_t>
+template <typename scalar_t, typename data_t>
 __global__ void query_single_kernel_backward(
-       PackedTreeSpec<scalar_t> tree,
+       PackedTreeSpec<scalar_t, data_t> tree,
        const torch::PackedTensorAccessor32<scalar_t, 2, torch::RestrictPtrTraits> indices,
        const torch::PackedTensorAccessor64<scalar_t, 2, torch::RestrictPtrTraits> grad_output,
        torch::PackedTensorAccessor64<scalar_t, 5, torch::RestrictPtrTraits> grad_data_out) {
@@ -77,24 +64,24 @@ __global__ void query_single_kernel_backward(
         atomicAdd(&data_ptr[i], grad_output[tid][i]);
 }
 
-template <typename scalar_t>
+template <typename scalar_t, typename data_t>
 __global__ void assign_single_kernel(
-       PackedTreeSpec<scalar_t> tree,
+       PackedTreeSpec<scalar_t, data_t> tree,
        const torch::PackedTensorAccessor32<scalar_t, 2, torch::RestrictPtrTraits> indices,
        const torch::PackedTensorAccessor64<scalar_t, 2, torch::RestrictPtrTraits> values) {
     CUDA_GET_THREAD_ID(tid, indices.size(0));
-    scalar_t* data_ptr = get_tree_leaf_ptr(tree.data, tree, &indices[tid][0]);
+    data_t* data_ptr = get_tree_leaf_ptr(tree.data, tree, &indices[tid][0]);
     for (int i = 0; i < values.size(1); ++i)
-        data_ptr[i] = values[tid][i];
+        data_ptr[i] = data_t(values[tid][i]);
 }
 
-template <typename scalar_t>
+template <typename scalar_t, typename data_t>
 __global__ void calc_corner_kernel(
-       PackedTreeSpec<scalar_t> tree,
+       PackedTreeSpec<scalar_t, data_t> tree,
        const torch::PackedTensorAccessor32<int64_t, 2, torch::RestrictPtrTraits> indexer,
        torch::PackedTensorAccessor32<scalar_t, 2, torch::RestrictPtrTraits> output) {
     CUDA_GET_THREAD_ID(tid, indexer.size(0));
-    const int N = tree.data.size(1);
+    const int N = tree.child.size(1);
     const auto* leaf = &indexer[tid][0];
     scalar_t* result = &output[tid][0];
 
@@ -114,10 +101,34 @@ __global__ void calc_corner_kernel(
     }
 }
 
+__global__ void build_ropes_kernel(
+       const torch::PackedTensorAccessor32<int32_t, 4, torch::RestrictPtrTraits> child,
+       const torch::PackedTensorAccessor32<int32_t, 2, torch::RestrictPtrTraits> parent_depth,
+       torch::PackedTensorAccessor32<int32_t, 2, torch::RestrictPtrTraits> ropes_out) {
+    CUDA_GET_THREAD_ID(tid, ropes_out.size(0) * 6);
+    ropes_out[tid / 6][tid % 6] = node_rope(child, parent_depth, tid / 6, tid % 6);
+}
+
+template <typename scalar_t, typename data_t>
+__global__ void max_sigma_init_kernel(
+       PackedTreeSpec<scalar_t, data_t> tree,
+       scalar_t* __restrict__ max_sigma_out) {
+    CUDA_GET_THREAD_ID(tid, tree.child.size(0));
+    max_sigma_init_node(tree, tid, max_sigma_out);
+}
+
+template <typename scalar_t, typename data_t>
+__global__ void max_sigma_climb_kernel(
+       PackedTreeSpec<scalar_t, data_t> tree,
+       scalar_t* __restrict__ max_sigma_out) {
+    CUDA_GET_THREAD_ID(tid, tree.child.size(0));
+    max_sigma_climb_node(tree, tid, max_sigma_out);
+}
+
 }  // namespace device
 }  // namespace
 
-QueryResult query_vertical(TreeSpec& tree, torch::Tensor indices) {
+QueryResult query_vertical_cuda(TreeSpec& tree, torch::Tensor indices) {
     tree.check();
     check_indices(indices);
     DEVICE_GUARD(indices);
@@ -131,8 +142,8 @@ QueryResult query_vertical(TreeSpec& tree, torch::Tensor indices) {
                        .layout(tree.child.layout())
                        .device(tree.child.device());
     torch::Tensor node_ids = torch::empty({Q}, node_ids_options);
-    AT_DISPATCH_FLOATING_TYPES(indices.type(), __FUNCTION__, [&] {
-        device::query_single_kernel<scalar_t><<<blocks, CUDA_N_THREADS>>>(
+    SVOX_DISPATCH_DATA_TYPES(tree.data.scalar_type(), __FUNCTION__, [&] {
+        device::query_single_kernel<scalar_t, data_t><<<blocks, CUDA_N_THREADS>>>(
                 tree,
                 indices.packed_accessor32<scalar_t, 2, torch::RestrictPtrTraits>(),
                 values.packed_accessor64<scalar_t, 2, torch::RestrictPtrTraits>(),
@@ -142,14 +153,14 @@ QueryResult query_vertical(TreeSpec& tree, torch::Tensor indices) {
     return QueryResult(values, node_ids);
 }
 
-void assign_vertical(TreeSpec& tree, torch::Tensor indices, torch::Tensor values) {
+void assign_vertical_cuda(TreeSpec& tree, torch::Tensor indices, torch::Tensor values) {
     tree.check();
     check_indices(indices);
     check_indices(values);
     DEVICE_GUARD(indices);
     const int blocks = CUDA_N_BLOCKS_NEEDED(indices.size(0), CUDA_N_THREADS);
-    AT_DISPATCH_FLOATING_TYPES(indices.type(), __FUNCTION__, [&] {
-        device::assign_single_kernel<scalar_t><<<blocks, CUDA_N_THREADS>>>(
+    SVOX_DISPATCH_DATA_TYPES(tree.data.scalar_type(), __FUNCTION__, [&] {
+        device::assign_single_kernel<scalar_t, data_t><<<blocks, CUDA_N_THREADS>>>(
                 tree,
                 indices.packed_accessor32<scalar_t, 2, torch::RestrictPtrTraits>(),
                 values.packed_accessor64<scalar_t, 2, torch::RestrictPtrTraits>());
@@ -157,20 +168,19 @@ void assign_vertical(TreeSpec& tree, torch::Tensor indices, torch::Tensor values
     CUDA_CHECK_ERRORS;
 }
 
-torch::Tensor query_vertical_backward(
+torch::Tensor query_vertical_backward_cuda(
         TreeSpec& tree,
         torch::Tensor indices,
         torch::Tensor grad_output) {
     tree.check();
     DEVICE_GUARD(indices);
-    const auto Q = indices.size(0), N = tree.child.size(1),
-               K = grad_output.size(1), M = tree.child.size(0);
+    const auto Q = indices.size(0);
     const int blocks = CUDA_N_BLOCKS_NEEDED(Q, CUDA_N_THREADS);
 
-    torch::Tensor grad_data = torch::zeros({M, N, N, N, K}, grad_output.options());
+    torch::Tensor grad_data = torch::zeros(tree.data.sizes(), grad_output.options());
 
-    AT_DISPATCH_FLOATING_TYPES(indices.type(), __FUNCTION__, [&] {
-        device::query_single_kernel_backward<scalar_t><<<blocks, CUDA_N_THREADS>>>(
+    SVOX_DISPATCH_DATA_TYPES(tree.data.scalar_type(), __FUNCTION__, [&] {
+        device::query_single_kernel_backward<scalar_t, data_t><<<blocks, CUDA_N_THREADS>>>(
                 tree,
                 indices.packed_accessor32<scalar_t, 2, torch::RestrictPtrTraits>(),
                 grad_output.packed_accessor64<scalar_t, 2, torch::RestrictPtrTraits>(),
@@ -178,7 +188,7 @@ torch::Tensor query_vertical_backward(
     });
 
     CUDA_CHECK_ERRORS;
-    return grad_data;
+    return grad_data.to(tree.data.scalar_type());
 }
 
 torch::Tensor calc_corners(
@@ -189,10 +199,10 @@ torch::Tensor calc_corners(
     const auto Q = indexer.size(0);
     const int blocks = CUDA_N_BLOCKS_NEEDED(Q, CUDA_N_THREADS);
 
-    torch::Tensor output = torch::zeros({Q, 3}, tree.data.options());
+    torch::Tensor output = torch::zeros({Q, 3}, tree.compute_options());
 
-    AT_DISPATCH_FLOATING_TYPES(tree.data.type(), __FUNCTION__, [&] {
-        device::calc_corner_kernel<scalar_t><<<blocks, CUDA_N_THREADS>>>(
+    SVOX_DISPATCH_DATA_TYPES(tree.data.scalar_type(), __FUNCTION__, [&] {
+        device::calc_corner_kernel<scalar_t, data_t><<<blocks, CUDA_N_THREADS>>>(
                 tree,
                 indexer.packed_accessor32<int64_t, 2, torch::RestrictPtrTraits>(),
                 output.packed_accessor32<scalar_t, 2, torch::RestrictPtrTraits>());
@@ -201,3 +211,37 @@ torch::Tensor calc_corners(
     CUDA_CHECK_ERRORS;
     return output;
 }
+
+torch::Tensor build_ropes_cuda(TreeSpec& tree) {
+    tree.check();
+    DEVICE_GUARD(tree.child);
+    const auto M = tree.child.size(0);
+    const int blocks = CUDA_N_BLOCKS_NEEDED(M * 6, CUDA_N_THREADS);
+
+    torch::Tensor ropes = torch::empty({M, 6}, tree.child.options());
+    device::build_ropes_kernel<<<blocks, CUDA_N_THREADS>>>(
+            tree.child.packed_accessor32<int32_t, 4, torch::RestrictPtrTraits>(),
+            tree.parent_depth.packed_accessor32<int32_t, 2, torch::RestrictPtrTraits>(),
+            ropes.packed_accessor32<int32_t, 2, torch::RestrictPtrTraits>());
+
+    CUDA_CHECK_ERRORS;
+    return ropes;
+}
+
+torch::Tensor build_max_sigma_cuda(TreeSpec& tree) {
+    tree.check();
+    DEVICE_GUARD(tree.data);
+    const auto M = tree.child.size(0), N = tree.child.size(1);
+    const int blocks = CUDA_N_BLOCKS_NEEDED(M, CUDA_N_THREADS);
+
+    torch::Tensor max_sigma = torch::empty({M, N, N, N}, tree.compute_options());
+    SVOX_DISPATCH_RENDER_TYPES(tree.data.scalar_type(), __FUNCTION__, [&] {
+        device::max_sigma_init_kernel<scalar_t, data_t><<<blocks, CUDA_N_THREADS>>>(
+                tree, max_sigma.data_ptr<scalar_t>());
+        device::max_sigma_climb_kernel<scalar_t, data_t><<<blocks, CUDA_N_THREADS>>>(
+                tree, max_sigma.data_ptr<scalar_t>());
+    });
+
+    CUDA_CHECK_ERRORS;
+    return max_sigma;
+}
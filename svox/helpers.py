@@ -31,7 +31,7 @@ class N3TreeView:
         self.single_key = False
         if isinstance(key, tuple) and len(key) >= 3:
             # Handle tree[x, y, z[, c]]
-            main_key = torch.tensor(key[:3], dtype=tree.data.dtype,
+            main_key = torch.tensor(key[:3], dtype=tree.compute_dtype,
                         device=tree.data.device).reshape(1, 3)
             if len(key) > 3:
                 key = (main_key, *key[3:])
@@ -43,8 +43,8 @@ class N3TreeView:
             local = True
         if torch.is_tensor(leaf_key) and leaf_key.ndim == 2 and leaf_key.shape[1] == 3:
             # Handle tree[P[, c]] where P is a (B, 3) matrix of 3D points
-            if leaf_key.dtype != tree.data.dtype:
-                leaf_key = leaf_key.to(dtype=tree.data.dtype)
+            if leaf_key.dtype != tree.compute_dtype:
+                leaf_key = leaf_key.to(dtype=tree.compute_dtype)
             val, target = tree.forward(leaf_key, want_node_ids=True, world=not local)
             self._packed_ids = target.clone()
             leaf_node = (*tree._unpack_index(target).T,)
@@ -88,6 +88,7 @@ class N3TreeView:
             self.tree.data.data[self.key[:-1]] = tmp
         else:
             self.tree.data.data[self.key] = value
+        self.tree.sync_density()
 
     def refine(self, repeats=1):
         """
@@ -305,6 +306,7 @@ class N3TreeView:
         data[inf_mask & (data > 0)] = inf_val
         data[inf_mask & (data < 0)] = -inf_val
         self.tree.data.data[self.key] = data
+        self.tree.sync_density()
 
     def __setitem__(self, key, value):
         """
@@ -362,13 +364,13 @@ def _get_c_extension():
     from warnings import warn
     try:
         import svox.csrc as _C
-        if not hasattr(_C, "query_vertical"):
+        if not hasattr(_C, "volume_render"):
             _C = None
     except:
         _C = None
 
     if _C is None:
-        warn("CUDA extension svox.csrc could not be loaded! " +
+        warn("C++/CUDA extension svox.csrc could not be loaded! " +
              "Operations will be slow.\n" +
              "Please do not import svox in the SVOX source directory.")
     return _C
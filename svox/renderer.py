@@ -45,6 +45,16 @@ def _rays_spec_from_rays(rays):
     spec.vdirs = rays.viewdirs
     return spec
 
+def _make_sample_log(n_rays, max_samples, tree):
+    device = tree.data.device
+    log = _C.SampleLog()
+    log.leaf = torch.empty((n_rays, max_samples), dtype=torch.int32,
+                           device=device)
+    log.delta_t = torch.empty((n_rays, max_samples), dtype=tree.compute_dtype,
+                              device=device)
+    log.count = torch.empty((n_rays,), dtype=torch.int32, device=device)
+    return log
+
 def _make_camera_spec(c2w, width, height, fx, fy):
     spec = _C.CameraSpec()
     spec.c2w = c2w
@@ -56,37 +66,67 @@ def _make_camera_spec(c2w, width, height, fx, fy):
 
 class _VolumeRenderFunction(autograd.Function):
     @staticmethod
-    def forward(ctx, data, tree, rays, opt):
-        out = _C.volume_render(tree, rays, opt)
+    def forward(ctx, data, tree, rays, opt, log=None, fused=False):
+        if fused:
+            out, trans = _C.volume_render_trans(
+                tree, rays, opt, _C.SampleLog() if log is None else log)
+            ctx.save_for_backward(out, trans)
+        elif log is None:
+            out = _C.volume_render(tree, rays, opt)
+        else:
+            out = _C.volume_render_log(tree, rays, opt, log)
         ctx.tree = tree
         ctx.rays = rays
         ctx.opt = opt
+        ctx.log = log
+        ctx.fused = fused
         return out
 
     @staticmethod
     def backward(ctx, grad_out):
         if ctx.needs_input_grad[0]:
-            return _C.volume_render_backward(
-                ctx.tree, ctx.rays, ctx.opt, grad_out.contiguous()
-            ), None, None, None
-        return None, None, None, None
+            if ctx.fused:
+                out, trans = ctx.saved_tensors
+                grad_data = _C.volume_render_fused_backward(
+                    ctx.tree, ctx.rays, ctx.opt,
+                    _C.SampleLog() if ctx.log is None else ctx.log,
+                    out, trans, grad_out.contiguous())
+            elif ctx.log is None:
+                grad_data = _C.volume_render_backward(
+                    ctx.tree, ctx.rays, ctx.opt, grad_out.contiguous())
+            else:
+                grad_data = _C.volume_render_log_backward(
+                    ctx.tree, ctx.rays, ctx.opt, ctx.log, grad_out.contiguous())
+            return grad_data, None, None, None, None, None
+        return None, None, None, None, None, None
 
 class _VolumeRenderImageFunction(autograd.Function):
     @staticmethod
-    def forward(ctx, data, tree, cam, opt):
-        out = _C.volume_render_image(tree, cam, opt)
+    def forward(ctx, data, tree, cam, opt, fused=False):
+        if fused:
+            out, trans = _C.volume_render_image_trans(tree, cam, opt)
+            ctx.save_for_backward(out, trans)
+        else:
+            out = _C.volume_render_image(tree, cam, opt)
         ctx.tree = tree
         ctx.cam = cam
         ctx.opt = opt
+        ctx.fused = fused
         return out
 
     @staticmethod
     def backward(ctx, grad_out):
         if ctx.needs_input_grad[0]:
-            return _C.volume_render_image_backward(
-                ctx.tree, ctx.cam, ctx.opt, grad_out.contiguous()
-            ), None, None, None
-        return None, None, None, None
+            if ctx.fused:
+                out, trans = ctx.saved_tensors
+                grad_data = _C.volume_render_image_fused_backward(
+                    ctx.tree, ctx.cam, ctx.opt, out, trans,
+                    grad_out.contiguous())
+            else:
+                grad_data = _C.volume_render_image_backward(
+                    ctx.tree, ctx.cam, ctx.opt, grad_out.contiguous())
+            return grad_data, None, None, None, None
+        return None, None, None, None, None
 
 
 def convert_to_ndc(origins, directions, focal, w, h, near=1.0):
@@ -123,6 +163,8 @@ class VolumeRenderer(nn.Module):
             max_comp : int=-1,
             density_softplus : bool=False,
             rgb_padding : float=0.0,
+            sample_log : int=0,
+            fused_backward : bool=False,
         ):
         """
         Construct volume renderer associated with given N^3 tree.
@@ -163,6 +205,18 @@ class VolumeRenderer(nn.Module):
                         Please note the padding will NOT be compatible with volrend,
                         although most likely the effect is very small.
                         0.001 is a reasonable value to try.
+        :param sample_log: if > 0, when rendering rays for training (forward),
+                        the native renderer logs up to this many samples
+                        per ray, and the backward pass replays them rather
+                        than tracing the rays through the tree again. Costs
+                        :code:`8 * sample_log` bytes per ray (for float);
+                        rays with more samples are traced as usual.
+        :param fused_backward: if true, the native renderer keeps each ray's
+                        output and final transmittance from the forward pass,
+                        from which the backward pass gets the color behind
+                        each sample, so it walks the ray once rather than
+                        twice. Costs :code:`4 * (rgb_dim + 1)` bytes per ray
+                        (for float) until the backward pass.
 
         """
         super().__init__()
@@ -174,6 +228,8 @@ class VolumeRenderer(nn.Module):
         self.max_comp = max_comp
         self.density_softplus = density_softplus
         self.rgb_padding = rgb_padding
+        self.sample_log = sample_log
+        self.fused_backward = fused_backward
         if isinstance(tree.data_format, DataFormat):
             self._data_format = None
         else:
@@ -192,19 +248,27 @@ class VolumeRenderer(nn.Module):
 
         :param rays: namedtuple :code:`svox.Rays` of origins
                      :code:`(B, 3)`, dirs :code:`(B, 3):, viewdirs :code:`(B, 3)`
-        :param cuda: whether to use CUDA kernel if available. If false,
-                     uses only PyTorch version. *Only True supported right now*
+        :param cuda: whether to use the native extension if available
+                     (CUDA kernel, or multithreaded CPU implementation for
+                     trees stored on CPU). If false, uses only PyTorch version.
         :param fast: if True, enables faster evaluation, potentially leading
-                     to some loss of accuracy.
+                     to some loss of accuracy: skips samples with small
+                     density, stops rays once nearly opaque, and uses
+                     approximate exp/log (see :ref:`fast-math`).
+                     The backward pass skips and stops likewise, giving
+                     the gradient of the output as rendered.
 
         :return: :code:`(B, rgb_dim)`.
                 Where *rgb_dim* is :code:`tree.data_dim - 1` if
                 :code:`data_format.format == DataFormat.RGBA`
                 or :code:`(tree.data_dim - 1) / tree.data_format.basis_dim` else.
         """
-        if not cuda or _C is None or not self.tree.data.is_cuda:
+        if not self._use_native(cuda):
             assert self.data_format.format in [DataFormat.RGBA, DataFormat.SH], \
                  "Unsupported data format for slow volume rendering"
+            assert not self.tree.is_quantized and not self.tree.packed_leaves \
+                   and self.tree.bricks is None, \
+                 "Quantized, leaf-packed and bricked trees are only rendered by the C++/CUDA extension"
             warn("Using slow volume rendering, should only be used for debugging")
             def dda_unit(cen, invdir):
                 """
@@ -278,13 +342,21 @@ class VolumeRenderer(nn.Module):
                 if sh_mult is not None:
                     sh_mult = sh_mult[mask]
                 tmax = tmax[mask]
-            out_rgb += light_intensity * self.background_brightness
+            out_rgb += light_intensity[:, None] * self.background_brightness
             return out_rgb
+        opts = self._get_options(fast)
+        grad = self._needs_grad()
+        log = None
+        if self.sample_log > 0 and grad:
+            log = _make_sample_log(rays.origins.size(0), self.sample_log,
+                                   self.tree)
         return _VolumeRenderFunction.apply(
             self.tree.data,
-            self.tree._spec(),
+            self._get_spec(cache=not grad),
             _rays_spec_from_rays(rays),
-            self._get_options(fast)
+            opts,
+            log,
+            self.fused_backward
         )
 
     def render_persp(self, c2w, width=800, height=800, fx=1111.111, fy=None,
@@ -297,10 +369,15 @@ class VolumeRenderer(nn.Module):
         :param height: int output image height
         :param fx: float output image focal length (x)
         :param fy: float output image focal length (y), if not specified uses fx
-        :param cuda: whether to use CUDA kernel if available. If false,
-                     uses only PyTorch version. *Only True supported right now*
+        :param cuda: whether to use the native extension if available
+                     (CUDA kernel, or tiled multithreaded CPU implementation for
+                     trees stored on CPU). If false, uses only PyTorch version.
         :param fast: if True, enables faster evaluation, potentially leading
-                     to some loss of accuracy.
+                     to some loss of accuracy: skips samples with small
+                     density, stops rays once nearly opaque, and uses
+                     approximate exp/log (see :ref:`fast-math`).
+                     The backward pass skips and stops likewise, giving
+                     the gradient of the output as rendered.
 
         :return: :code:`(height, width, rgb_dim)`
                 where *rgb_dim* is :code:`tree.data_dim - 1` if
@@ -308,17 +385,19 @@ class VolumeRenderer(nn.Module):
                 or :code:`(tree.data_dim - 1) / tree.data_format.basis_dim` else.
 
         """
-        if not cuda or _C is None or not self.tree.data.is_cuda:
+        if not self._use_native(cuda):
             return self(VolumeRenderer.persp_rays(c2w, width, height, fx, fy),
                         cuda=False, fast=fast)
         if fy is None:
             fy = fx
+        opts = self._get_options(fast)
         return _VolumeRenderImageFunction.apply(
             self.tree.data,
-            self.tree._spec(),
-            _make_camera_spec(c2w.to(dtype=self.tree.data.dtype),
+            self._get_spec(cache=not self._needs_grad()),
+            _make_camera_spec(c2w.to(dtype=self.tree.compute_dtype),
                               width, height, fx, fy),
-            self._get_options(fast)
+            opts,
+            self.fused_backward
         )
 
     def se_grad(self, rays : Rays, colors):
@@ -343,10 +422,12 @@ class VolumeRenderer(nn.Module):
         :return: :code:`colors (B, rgb_dim), grad (shape of tree.data),
                                diag_hessian (shape of tree.data)`
         """
-        if _C is None or not self.tree.data.is_cuda:
-            assert False, "Not supported in current version, use CUDA kernel"
-        return _C.se_grad(self.tree._spec(), _rays_spec_from_rays(rays),
-                          colors, self._get_options(False))
+        if _C is None:
+            assert False, "Not supported in current version, use C++/CUDA extension"
+        opts = self._get_options(False)
+        return _C.se_grad(self._get_spec(cache=False),
+                          _rays_spec_from_rays(rays),
+                          colors, opts)
 
     def se_grad_persp(self, c2w, colors, width=800, height=800, fx=1111.111, fy=None):
         """
@@ -375,13 +456,14 @@ class VolumeRenderer(nn.Module):
         """
         if fy is None:
             fy = fx
-        if _C is None or not self.tree.data.is_cuda:
-            assert False, "Not supported in current version, use CUDA kernel"
+        if _C is None:
+            assert False, "Not supported in current version, use C++/CUDA extension"
+        opts = self._get_options(False)
         return _C.se_grad_persp(
-            self.tree._spec(),
-            _make_camera_spec(c2w.to(dtype=self.tree.data.dtype),
+            self._get_spec(cache=False),
+            _make_camera_spec(c2w.to(dtype=self.tree.compute_dtype),
                               width, height, fx, fy),
-            self._get_options(False),
+            opts,
             colors)
 
     @staticmethod
@@ -429,6 +511,29 @@ class VolumeRenderer(nn.Module):
     def data_format(self):
         return self._data_format or self.tree.data_format
 
+    def _use_native(self, cuda):
+        """
+        Whether the C++/CUDA extension can be used (on either device)
+        """
+        return cuda and _C is not None
+
+    def _needs_grad(self):
+        """
+        Whether a render now would differentiate the tree data
+        """
+        return torch.is_grad_enabled() and self.tree.data.requires_grad
+
+    def _get_spec(self, cache=True):
+        """
+        Make TreeSpec to send to C++, with the acceleration structures
+
+        :param cache: whether the structures built from the data may be
+                      reused from an earlier render; False for renders that
+                      differentiate the data (see N3Tree._get_max_sigma),
+                      whose backward pass reuses the spec of the forward pass
+        """
+        return self.tree._spec(accel=True, cache=cache)
+
     def _get_options(self, fast=False):
         """
         Make RenderOptions struct to send to C++
@@ -461,9 +566,12 @@ class VolumeRenderer(nn.Module):
         else:
             opts.sigma_thresh = 0.0
             opts.stop_thresh = 0.0
+        opts.fast_math = fast
         # Override
         if hasattr(self, "sigma_thresh"):
             opts.sigma_thresh = self.sigma_thresh
         if hasattr(self, "stop_thresh"):
             opts.stop_thresh = self.stop_thresh
+        if hasattr(self, "fast_math"):
+            opts.fast_math = self.fast_math
         return opts
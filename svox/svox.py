@@ -35,6 +35,15 @@ from warnings import warn
 
 _C = _get_c_extension()
 
+# Data types the tree data may be stored in at half precision; the kernels
+# compute in float32 for these, and for quantized (int8) and palette index
+# (int16 / int32) data (see N3Tree.compute_dtype)
+_HALF_DTYPES = (torch.float16, torch.bfloat16)
+_QUANT_DTYPES = (torch.int8, torch.int16, torch.int32)
+
+def _compute_dtype(dtype):
+    return torch.float32 if dtype in _HALF_DTYPES + _QUANT_DTYPES else dtype
+
 class _QueryVerticalFunction(autograd.Function):
     @staticmethod
     def forward(ctx, data, tree_spec, indices):
@@ -74,7 +83,10 @@ class N3Tree(nn.Module):
             extra_data=None,
             device="cpu",
             dtype=torch.float32,
-            map_location=None):
+            map_location=None,
+            split_density=False,
+            compact_child=False,
+            ropes=False):
         """
         Construct N^3 Tree
 
@@ -96,8 +108,42 @@ class N3Tree(nn.Module):
         :param data_format: a string to indicate the data format. :code:`RGBA | SH# | SG# | ASG#`
         :param extra_data: extra data to include with tree
         :param device: str device to put data
-        :param dtype: str tree data type, torch.float32 (default) | torch.float64
+        :param dtype: str tree data type, torch.float32 (default) | torch.float64 |
+                      torch.float16 | torch.bfloat16. Half precision data
+                      halves the memory and bandwidth of the tree;
+                      the renderer and queries still compute (and take
+                      rays/points) in float32, see :code:`compute_dtype`
         :param map_location: str DEPRECATED old name for device (will override device and warn)
+        :param split_density: bool, whether the renderer reads the densities
+                              from a contiguous copy of :code:`data[..., -1]`
+                              (kept in sync with the data), loading a leaf's
+                              other channels only for samples with density
+                              above sigma_thresh; faster for trees with many
+                              channels and much empty or occluded space.
+                              May also be set later as :code:`tree.split_density`
+        :param compact_child: bool, whether tree descents (rendering and
+                              queries) read a compact copy of :code:`child`
+                              (a bit mask of the slots with a child and the
+                              list of child offsets of each node, rebuilt
+                              after the tree structure changes), 8 bytes per
+                              node plus 4 per child for octrees instead of
+                              32 bytes per node; keeps more of the tree in
+                              cache while traversing large trees. On the CPU
+                              the ranking through the masks costs more than
+                              that saves: renders measured 10-20% slower
+                              than with the plain :code:`child`, on trees
+                              with up to 14 MB of it. Leaf-packed trees
+                              (see :code:`pack_leaves`) always use it.
+                              May also be set later as :code:`tree.compact_child`
+        :param ropes: bool, whether the renderer links each node to its face
+                      neighbors (rebuilt after the tree structure changes,
+                      24 bytes per node) and follows those links from leaf
+                      to leaf along rays instead of descending from the
+                      root for each sample. Helps mostly the scalar
+                      tracing loops (backward pass, se_grad) on deep trees;
+                      the SIMD forward renderer descends from the root
+                      either way.
+                      May also be set later as :code:`tree.ropes`
 
         """
         super().__init__()
@@ -108,7 +154,8 @@ class N3Tree(nn.Module):
         if map_location is not None:
             warn('map_location has been renamed to device and may be removed')
             device = map_location
-        assert dtype == torch.float32 or dtype == torch.float64, 'Unsupported dtype'
+        assert dtype in (torch.float32, torch.float64) + _HALF_DTYPES, \
+               'Unsupported dtype'
 
         self.data_format = DataFormat(data_format) if data_format is not None else None
         self.data_dim : int = data_dim
@@ -131,26 +178,43 @@ class N3Tree(nn.Module):
 
         if isinstance(radius, float) or isinstance(radius, int):
             radius = [radius] * 3
-        radius = torch.tensor(radius, dtype=dtype, device=device)
-        center = torch.tensor(center, dtype=dtype, device=device)
+        radius = torch.tensor(radius, dtype=_compute_dtype(dtype), device=device)
+        center = torch.tensor(center, dtype=_compute_dtype(dtype), device=device)
 
         self.register_buffer("invradius", 0.5 / radius)
         self.register_buffer("offset", 0.5 * (1.0 - center / radius))
 
         self.depth_limit = depth_limit
         self.geom_resize_fact = geom_resize_fact
+        self.split_density = split_density
+        self.compact_child = compact_child
+        self.ropes = ropes
+        # Whether data holds only the leaves (see pack_leaves)
+        self.packed_leaves = False
 
         if extra_data is not None:
             assert isinstance(extra_data, torch.Tensor)
-            self.register_buffer("extra_data", extra_data.to(dtype=dtype, device=device))
+            self.register_buffer("extra_data", extra_data.to(
+                dtype=_compute_dtype(dtype), device=device))
         else:
             self.extra_data = None
+        # Scale/offset, palette and density of quantized trees (see quantize,
+        # palettize)
+        self.register_buffer("quant", None)
+        self.register_buffer("palette", None)
+        self.register_buffer("quant_sigma", None)
+        # Dense bricks of the subtrees they replace and brick of each node
+        # (see to_bricks)
+        self.register_buffer("bricks", None)
+        self.register_buffer("brick", None)
 
         self._ver = 0
         self._invalidate()
         self._lock_tree_structure = False
         self._weight_accum = None
         self._weight_accum_op = None
+        self._ropes = None
+        self._child_bits = None
 
         self.refine(repeats=init_refine)
 
@@ -162,8 +226,9 @@ class N3Tree(nn.Module):
 
         :param indices: torch.Tensor :code:`(Q, 3)`
         :param values: torch.Tensor :code:`(Q, K)`
-        :param cuda: whether to use CUDA kernel if available. If false,
-                     uses only PyTorch version.
+        :param cuda: whether to use the native extension if available
+                     (CUDA kernel, or multithreaded CPU implementation for
+                     trees stored on CPU). If false, uses only PyTorch version.
 
         """
         assert len(indices.shape) == 2
@@ -172,7 +237,8 @@ class N3Tree(nn.Module):
         indices = indices.to(device=self.data.device)
         values = values.to(device=self.data.device)
 
-        if not cuda or _C is None or not self.data.is_cuda:
+        if not cuda or _C is None:
+            assert not self.packed_leaves, "Leaf-packed trees need the native extension"
             warn("Using slow assignment")
             indices = self.world2tree(indices)
 
@@ -203,15 +269,18 @@ class N3Tree(nn.Module):
 
                 remain_mask &= nonterm_mask
         else:
-            _C.assign_vertical(self._spec(), indices, values)
+            _C.assign_vertical(self._spec(), indices.to(dtype=self.compute_dtype),
+                               values.to(dtype=self.compute_dtype))
+        self.sync_density()
 
     def forward(self, indices, cuda=True, want_node_ids=False, world=True):
         """
         Get tree values. Differentiable.
 
         :param indices: :code:`(Q, 3)` the points
-        :param cuda: whether to use CUDA kernel if available. If false,
-                     uses only PyTorch version.
+        :param cuda: whether to use the native extension if available
+                     (CUDA kernel, or multithreaded CPU implementation for
+                     trees stored on CPU). If false, uses only PyTorch version.
         :param want_node_ids: if true, returns node ID for each query.
         :param world: use world space instead of :code:`[0,1]^3`, default True
 
@@ -221,7 +290,8 @@ class N3Tree(nn.Module):
         assert not indices.requires_grad  # Grad wrt indices not supported
         assert len(indices.shape) == 2
 
-        if not cuda or _C is None or not self.data.is_cuda:
+        if not cuda or _C is None:
+            assert not self.packed_leaves, "Leaf-packed trees need the native extension"
             if not want_node_ids:
                 warn("Using slow query")
             if world:
@@ -231,7 +301,7 @@ class N3Tree(nn.Module):
 
             n_queries, _ = indices.shape
             node_ids = torch.zeros(n_queries, dtype=torch.long, device=indices.device)
-            result = torch.empty((n_queries, self.data_dim), dtype=self.data.dtype,
+            result = torch.empty((n_queries, self.data_dim), dtype=self.compute_dtype,
                                   device=indices.device)
             remain_indices = torch.arange(n_queries, dtype=torch.long, device=indices.device)
             ind = indices.clone()
@@ -268,7 +338,8 @@ class N3Tree(nn.Module):
             return result
         else:
             result, node_ids = _QueryVerticalFunction.apply(
-                                self.data, self._spec(world), indices);
+                                self.data, self._spec(world),
+                                indices.to(dtype=self.compute_dtype));
             return (result, node_ids) if want_node_ids else result
 
     # Special features
@@ -290,11 +361,16 @@ class N3Tree(nn.Module):
 
         :param data_sel: data channel selector, default is all channels
         :param data_format: data format for new tree, default is current format
-        :param dtype: new data type, torch.float32 | torch.float64
+        :param dtype: new data type, torch.float32 | torch.float64 |
+                      torch.float16 | torch.bfloat16
         :param device: where to put result tree
 
+        Quantized trees (see quantize, palettize) can only be copied whole,
+        in their data type.
+
         :return: partial N3Tree (copy)
         """
+        assert not self.packed_leaves, "Unpack the leaves first (unpack_leaves)"
         if device is None:
             device = self.data.device
         if data_sel is None:
@@ -307,31 +383,158 @@ class N3Tree(nn.Module):
             new_data_dim = sel_indices.numel()
         if dtype is None:
             dtype = self.data.dtype
+        if self.is_quantized:
+            assert data_sel is None and dtype == self.data.dtype, \
+                   "Quantized trees can only be copied whole"
         t2 = N3Tree(N=self.N, data_dim=new_data_dim,
                 data_format=data_format or str(self.data_format),
                 depth_limit=self.depth_limit,
                 geom_resize_fact=self.geom_resize_fact,
-                dtype=dtype,
-                device=device)
-        def copy_to_device(x):
-            return torch.empty(x.shape, dtype=x.dtype, device=device).copy_(x)
-        t2.invradius = copy_to_device(self.invradius)
-        t2.offset = copy_to_device(self.offset)
+                dtype=_compute_dtype(dtype),
+                device=device,
+                split_density=self.split_density,
+                compact_child=self.compact_child,
+                ropes=self.ropes)
+        def copy_to_device(x, dtype=None):
+            return torch.empty(x.shape, dtype=dtype or x.dtype, device=device).copy_(x)
+        t2.invradius = copy_to_device(self.invradius, t2.compute_dtype)
+        t2.offset = copy_to_device(self.offset, t2.compute_dtype)
         t2.child = copy_to_device(self.child)
         t2.parent_depth = copy_to_device(self.parent_depth)
         t2._n_internal = copy_to_device(self._n_internal)
         t2._n_free = copy_to_device(self._n_free)
         if self.extra_data is not None:
-            t2.extra_data = copy_to_device(self.extra_data)
+            t2.extra_data = copy_to_device(self.extra_data, t2.compute_dtype)
         else:
             t2.extra_data = None
         t2.data_format = self.data_format
         if data_sel is None:
-            t2.data = nn.Parameter(copy_to_device(self.data.data))
+            t2.data = nn.Parameter(copy_to_device(self.data.data, dtype),
+                                   requires_grad=not self.is_quantized)
         else:
-            t2.data = nn.Parameter(copy_to_device(self.data.data[..., sel_indices].contiguous()))
+            t2.data = nn.Parameter(copy_to_device(
+                self.data.data[..., sel_indices].contiguous(), dtype))
+        for name in ("quant", "palette", "quant_sigma"):
+            if getattr(self, name) is not None:
+                setattr(t2, name, copy_to_device(getattr(self, name)))
+        if self.bricks is not None:
+            bricks = self.bricks if data_sel is None else \
+                     self.bricks[..., sel_indices].contiguous()
+            t2.bricks = copy_to_device(bricks, dtype)
+            t2.brick = copy_to_device(self.brick)
+            t2.data.requires_grad_(False)
         return t2
 
+    def quantize(self, per_channel=False):
+        """
+        Get a copy of the tree for rendering, with the color coefficients
+        (:code:`data[..., :-1]`) stored as int8 and dequantized by the
+        renderer on the fly: each block of coefficients (all of a leaf's,
+        or one output channel's if per_channel) stands for
+        :code:`scale * q + offset`, with q the int8 values and scale, offset
+        spanning the block's range (kept in :code:`quant`). The densities
+        are kept in float32 (:code:`quant_sigma`), as is needed for
+        skipping empty space. Reads a quarter of the coefficient bytes of a
+        float32 tree, e.g. 88 instead of 304 bytes per leaf for SH25 (per
+        leaf scale).
+
+        The copy can be rendered (forward only, with the C++/CUDA
+        extension), saved and loaded, but not queried, optimized or
+        refined; shrink the tree (shrink_to_fit) before quantizing it.
+
+        :param per_channel: bool, one scale and offset per output channel
+                            of each leaf (more accurate) instead of per leaf;
+                            for SH/SG/ASG data formats
+        :return: quantized N3Tree (copy)
+        """
+        assert not self.is_quantized, "Tree is already quantized"
+        assert self.bricks is None, "Convert the bricks back first (from_bricks)"
+        n_blocks = 1
+        if per_channel:
+            assert self.data_format is not None and \
+                   self.data_format.format != DataFormat.RGBA, \
+                   "per_channel needs a basis data format (SH/SG/ASG)"
+            n_blocks = (self.data_dim - 1) // self.data_format.basis_dim
+        t2 = self.partial(data_sel=-1, data_format="RGBA", dtype=self.compute_dtype)
+        t2.quant_sigma = t2.data.data[..., 0].to(dtype=torch.float32).contiguous()
+        leaf_shape = self.data.shape[:-1]
+        q = torch.zeros(self.data.shape, dtype=torch.int8, device=t2.child.device)
+        quant = torch.empty((*leaf_shape, 2 * n_blocks), dtype=torch.float32,
+                            device=t2.child.device)
+        # In chunks of nodes, to bound the temporaries
+        chunk = 4096
+        for begin in range(0, self.capacity, chunk):
+            end = min(begin + chunk, self.capacity)
+            coeffs = self.data.data[begin:end, ..., :-1].to(
+                    device=t2.child.device, dtype=torch.float32)
+            coeffs = coeffs.reshape(*coeffs.shape[:-1], n_blocks, -1)
+            lo = coeffs.min(dim=-1).values
+            scale = (coeffs.max(dim=-1).values - lo) / 255
+            offset = lo + 128 * scale
+            qc = (coeffs - offset[..., None]) / scale.clamp_min(1e-20)[..., None]
+            q[begin:end, ..., :-1] = qc.round_().clamp_(-128, 127).to(
+                    dtype=torch.int8).reshape(*qc.shape[:-2], -1)
+            quant[begin:end] = torch.stack((scale, offset), dim=-1).reshape(
+                    *scale.shape[:-1], -1)
+        t2.data = nn.Parameter(q, requires_grad=False)
+        t2.quant = quant
+        t2.data_dim = self.data_dim
+        t2.data_format = self.data_format
+        t2.split_density = True
+        return t2
+
+    def palettize(self, order=12):
+        """
+        Get a copy of the tree for rendering, with the color coefficients
+        (:code:`data[..., :-1]`) of each leaf replaced by the index of a row of
+        a shared palette (:code:`palette`) of 2^order coefficient vectors,
+        found by median cut (see csrc/quantizer.cpp). The data holds the
+        indices, int16 (int32 if order > 15); the renderer looks the
+        coefficients up in the palette, which is small enough to stay in
+        cache. The densities are kept in float32 (:code:`quant_sigma`), as
+        for quantize. Takes 6 instead of 304 bytes per leaf for SH25, plus
+        the palette.
+
+        The copy can be rendered (forward only, with the C++/CUDA
+        extension), saved and loaded, but not queried, optimized or
+        refined; shrink the tree (shrink_to_fit) before palettizing it.
+
+        :param order: int, log2 of the palette size; the tree must have at
+                      least 2^order leaves
+        :return: palettized N3Tree (copy)
+        """
+        assert not self.is_quantized, "Tree is already quantized"
+        assert self.bricks is None, "Convert the bricks back first (from_bricks)"
+        assert order < 31, "Palette too large"
+        t2 = self.partial(data_sel=-1, data_format="RGBA", dtype=self.compute_dtype)
+        t2.quant_sigma = t2.data.data[..., 0].to(dtype=torch.float32).contiguous()
+        # The median cut runs on CPU, over the leaves only
+        leaf_mask = self.child.cpu() == 0
+        coeffs = self.data.data[..., :-1].cpu()[leaf_mask].to(
+                dtype=torch.float32).contiguous()
+        assert coeffs.shape[0] >= 2 ** order, \
+               "The tree has fewer leaves than palette entries"
+        palette, color_id_map = _C.quantize_median_cut(
+                coeffs, torch.empty(0, dtype=torch.float32), order)
+        index_dtype = torch.int16 if order <= 15 else torch.int32
+        indices = torch.zeros((*self.data.shape[:-1], 1), dtype=index_dtype)
+        indices[leaf_mask] = color_id_map.to(dtype=index_dtype)[:, None]
+        t2.data = nn.Parameter(indices.to(device=t2.child.device),
+                               requires_grad=False)
+        t2.palette = palette.to(device=t2.child.device)
+        t2.data_dim = self.data_dim
+        t2.data_format = self.data_format
+        t2.split_density = True
+        return t2
+
+    @property
+    def is_quantized(self):
+        """
+        Whether the tree's data is quantized, to int8 (see quantize) or to
+        palette indices (see palettize)
+        """
+        return self.quant is not None or self.palette is not None
+
     def expand(self, data_format, data_dim=None, remap=None):
         """
         Modify the size of the data stored at the octree leaves.
@@ -348,6 +551,7 @@ class N3Tree(nn.Module):
         .. warning::
                 Will change the nn.Parameter size (data), breaking optimizer! Please re-create the optimizer
         """
+        assert not self.packed_leaves, "Unpack the leaves first (unpack_leaves)"
         assert isinstance(data_format, str), "Please specify valid data format"
         old_data_format = self.data_format
         old_data_dim = self.data_dim
@@ -453,6 +657,7 @@ class N3Tree(nn.Module):
                    If a tuple is returned, uses first result.
 
         """
+        assert not self.packed_leaves, "Unpack the leaves first (unpack_leaves)"
         if self.n_internal - self._n_free.item() <= 1:
             raise RuntimeError("Cannot merge root node")
         nid = self._frontier if frontier_sel is None else self._frontier[frontier_sel]
@@ -652,6 +857,7 @@ class N3Tree(nn.Module):
             memory will be wasted. We do not dedup here for efficiency reasons.
 
         """
+        assert not self.packed_leaves, "Unpack the leaves first (unpack_leaves)"
         if self._lock_tree_structure:
             raise RuntimeError("Tree locked")
         with torch.no_grad():
@@ -752,6 +958,7 @@ class N3Tree(nn.Module):
         .. warning::
                 Will change the nn.Parameter size (data), breaking optimizer!
         """
+        assert not self.packed_leaves, "Unpack the leaves first (unpack_leaves)"
         if self._lock_tree_structure:
             raise RuntimeError("Tree locked")
         n_int = self.n_internal
@@ -787,7 +994,217 @@ class N3Tree(nn.Module):
         self._invalidate()
         return True
 
+    def reorder(self, layout="dfs"):
+        """
+        Permute the nodes into a cache-friendly order, rewriting the child
+        offsets and parents; the tree holds the same values at the same
+        positions. Node ids otherwise follow refinement order, which can put
+        spatially adjacent leaves far apart in memory.
+
+        :param layout: str, node order: :code:`dfs` (depth-first, default),
+                       :code:`bfs` (breadth-first; the children of each
+                       node become contiguous), :code:`morton`
+                       (depth-first, children in Z order of their cells;
+                       the same as dfs for octrees), :code:`veb` (van Emde
+                       Boas: the top half of the levels, then each subtree
+                       below it, recursively)
+
+        .. warning::
+                Permutes the data (nn.Parameter) in place, breaking optimizer state! Please re-create the optimizer
+        """
+        assert not self.packed_leaves, "Unpack the leaves first (unpack_leaves)"
+        if self._lock_tree_structure:
+            raise RuntimeError("Tree locked")
+        assert self._n_free.item() == 0, "Defragment the tree first (shrink_to_fit)"
+        layouts = ["dfs", "bfs", "morton", "veb"]
+        assert layout in layouts, "Unknown layout " + layout
+        n_int = self.n_internal
+        order = _C.reorder_nodes(self.child[:n_int].cpu().contiguous(),
+                                 layouts.index(layout)).to(device=self.child.device)
+        with torch.no_grad():
+            inv = torch.empty_like(order)
+            inv[order] = torch.arange(n_int, device=order.device)
+            node = torch.arange(n_int, device=order.device)
+            # Leaf slots (child 0) get 0 again
+            new_child = inv[node[:, None, None, None] + self.child[:n_int].long()] - \
+                        inv[node][:, None, None, None]
+            self.child[:n_int] = new_child[order].to(dtype=self.child.dtype)
+
+            N3 = self.N ** 3
+            parent = self.parent_depth[:n_int, 0].long()
+            parent_depth = self.parent_depth[:n_int].clone()
+            parent_depth[:, 0] = inv[parent // N3] * N3 + parent % N3
+            self.parent_depth[:n_int] = parent_depth[order]
+
+            self.data.data[:n_int] = self.data.data[order]
+            for buf in (self.quant, self.quant_sigma, self.brick):
+                if buf is not None:
+                    buf[:n_int] = buf[order]
+        self._invalidate()
+
     # Misc
+    def pack_leaves(self):
+        """
+        Store only the leaves' data: :code:`data` becomes
+        :code:`(n_leaves, 1, 1, 1, data_dim)`, the rows of the slots
+        without a child in slot order, which the native kernels (rendering
+        forward and backward, queries, set) address through the compact
+        child encoding (see compact_child, always used while packed).
+        Saves the rows of the internal slots, about 1/N^3 of the data.
+
+        Use unpack_leaves to restore the usual layout before anything else
+        (refining, indexing, saving, ...).
+
+        .. warning::
+                Will change the nn.Parameter size (data), breaking optimizer! Please re-create the optimizer
+        """
+        assert not self.packed_leaves, "Tree is already leaf-packed"
+        self.data = nn.Parameter(
+                self.data.data[self.child == 0][:, None, None, None].contiguous(),
+                requires_grad=self.data.requires_grad)
+        self.packed_leaves = True
+        self.sync_density()
+
+    def unpack_leaves(self):
+        """
+        Undo pack_leaves, with zeros at the internal slots.
+
+        .. warning::
+                Will change the nn.Parameter size (data), breaking optimizer! Please re-create the optimizer
+        """
+        assert self.packed_leaves, "Tree is not leaf-packed"
+        data = torch.zeros((*self.child.shape, self.data.shape[-1]),
+                           dtype=self.data.dtype, device=self.data.device)
+        data[self.child == 0] = self.data.data[:, 0, 0, 0]
+        self.data = nn.Parameter(data, requires_grad=self.data.requires_grad)
+        self.packed_leaves = False
+        self.sync_density()
+
+    def to_bricks(self, levels=2):
+        """
+        Get a copy of the tree for rendering, in which each node whose
+        subtree is uniformly refined over :code:`levels` levels (all of its
+        leaves that many levels below it) is replaced by a dense brick of
+        its N^levels cells per side (:code:`bricks`, e.g. 4^3 or 8^3 for
+        octrees with levels 2 or 3), which the renderer marches as a grid,
+        without descending the tree (see csrc/include/rt_core.hpp
+        trace_ray). Such a node keeps its slots, as leaves holding the mean
+        coefficients and the maximum density of the cells they cover (which
+        queries, and the structures skipping empty space, see); the nodes
+        below it are removed. :code:`brick` holds the brick of each node,
+        or -1.
+
+        The copy can be rendered (forward only, with the C++/CUDA
+        extension), saved and loaded, but not optimized or refined; use
+        from_bricks to get the usual layout back.
+
+        :param levels: int, depth of the subtrees replaced by bricks, at
+                       least 2
+        :return: N3Tree with bricks (copy); without any if no subtree is
+                 uniformly refined over that many levels
+        """
+        assert not self.is_quantized, "Quantized trees cannot hold bricks"
+        assert self.bricks is None, "Tree already has bricks"
+        assert levels >= 2, "Bricks must span at least 2 levels"
+        t2 = self.partial()
+        t2.shrink_to_fit()
+        N, n_int = t2.N, t2.n_internal
+        with torch.no_grad():
+            child = t2.child[:n_int].view(n_int, -1).long()
+            node = torch.arange(n_int, device=child.device)
+            # Number of levels over which the subtree of each node is
+            # uniformly refined, 0 if its leaves are at different depths
+            height = torch.zeros(n_int, dtype=torch.long, device=child.device)
+            height[(child == 0).all(dim=1)] = 1
+            full = (child != 0).all(dim=1)
+            depth = t2.parent_depth[:n_int, 1]
+            for d in range(depth.max().item() - 1, -1, -1):
+                sel = node[full & (depth == d)]
+                if sel.numel() == 0:
+                    continue
+                h = height[sel[:, None] + child[sel]]
+                uniform = (h == h[:, :1]).all(dim=1) & (h[:, 0] > 0)
+                height[sel[uniform]] = h[uniform, 0] + 1
+            roots = node[height == levels]
+            if roots.numel() == 0:
+                return t2
+
+            grid, below = t2._brick_nodes(roots, levels)
+            B, D = roots.shape[0], t2.data.shape[-1]
+            r = grid.shape[1]
+            R = r * N
+            bricks = t2.data.data[grid].view(B, r, r, r, N, N, N, D).permute(
+                    0, 1, 4, 2, 5, 3, 6, 7).reshape(B, R, R, R, D)
+            cells = bricks.to(dtype=t2.compute_dtype).view(B, N, r, N, r, N, r, D)
+            coarse = cells.mean(dim=(2, 4, 6))
+            coarse[..., -1] = cells[..., -1].amax(dim=(2, 4, 6))
+            t2.data.data[roots] = coarse.to(dtype=t2.data.dtype)
+
+            t2.child[roots] = 0
+            t2.parent_depth[below] = -1
+            t2.child[below] = -1
+            t2._n_free += below.shape[0]
+            brick = torch.full((n_int,), -1, dtype=torch.int32, device=child.device)
+            brick[roots] = torch.arange(B, dtype=torch.int32, device=child.device)
+            brick = brick[t2.parent_depth[:n_int, 0] != -1]
+        t2.shrink_to_fit()
+        t2.bricks = bricks.contiguous()
+        t2.brick = brick.contiguous()
+        t2.data.requires_grad_(False)
+        return t2
+
+    def from_bricks(self):
+        """
+        Get a copy of a tree with bricks (see to_bricks) in the usual
+        layout, with the subtree of each brick refined again and holding
+        its cells.
+
+        :return: N3Tree (copy)
+        """
+        assert self.bricks is not None, "Tree has no bricks"
+        t2 = self.partial()
+        bricks, brick = t2.bricks, t2.brick.long()
+        t2.bricks = t2.brick = None
+        t2.data.requires_grad_(True)
+        N, N3 = t2.N, t2.N ** 3
+        B, R, D = bricks.shape[0], bricks.shape[1], bricks.shape[-1]
+        levels = round(math.log(R) / math.log(N))
+        with torch.no_grad():
+            sel = torch.nonzero(brick >= 0)[:, 0]
+            roots = torch.empty_like(sel)
+            roots[brick[sel]] = sel
+            nodes = roots
+            for _ in range(levels - 1):
+                slots = (nodes[:, None] * N3 + torch.arange(
+                        N3, device=nodes.device)).view(-1)
+                t2.refine(sel=(*t2._unpack_index(slots).long().T,))
+                nodes = (nodes[:, None] + t2.child[nodes].view(-1, N3)).view(-1)
+            grid, _ = t2._brick_nodes(roots, levels)
+            r = R // N
+            t2.data.data[grid] = bricks.view(B, r, N, r, N, r, N, D).permute(
+                    0, 1, 3, 5, 2, 4, 6, 7).to(dtype=t2.data.dtype)
+        t2._invalidate()
+        return t2
+
+    def _brick_nodes(self, roots, levels):
+        """
+        Nodes of the subtrees of the given roots, uniformly refined over
+        levels levels (see to_bricks)
+
+        :return: ((B, r, r, r) ids of the nodes levels - 1 below each root,
+                 r = N^(levels - 1), by the position of their cube in the
+                 root's; ids of all the nodes below the roots)
+        """
+        N = self.N
+        grid = roots.view(-1, 1, 1, 1)
+        below = []
+        for _ in range(levels - 1):
+            B, r = grid.shape[0], grid.shape[1]
+            grid = (grid[..., None, None, None] + self.child[grid].long()).permute(
+                    0, 1, 4, 2, 5, 3, 6).reshape(B, r * N, r * N, r * N)
+            below.append(grid.reshape(-1))
+        return grid, torch.cat(below)
+
     @property
     def n_leaves(self):
         return self._all_leaves().shape[0]
@@ -800,6 +1217,16 @@ class N3Tree(nn.Module):
     def capacity(self):
         return self.parent_depth.shape[0]
 
+    @property
+    def compute_dtype(self):
+        """
+        Type the native kernels compute in, and that of the rays, query
+        points, renderer outputs and the tree's other floating point buffers
+        (offset, invradius, extra_data): float32 if the data is stored in
+        half precision (float16 / bfloat16) or quantized, else the data dtype
+        """
+        return _compute_dtype(self.data.dtype)
+
     @property
     def max_depth(self):
         """
@@ -841,7 +1268,8 @@ class N3Tree(nn.Module):
         :param compress: whether to compress the npz; may be slow
 
         """
-        if shrink:
+        assert not self.packed_leaves, "Unpack the leaves first (unpack_leaves)"
+        if shrink and not self.is_quantized:
             self.shrink_to_fit()
         data = {
             "data_dim" : self.data_dim,
@@ -853,8 +1281,18 @@ class N3Tree(nn.Module):
             "offset" : self.offset.cpu(),
             "depth_limit": self.depth_limit,
             "geom_resize_fact": self.geom_resize_fact,
-            "data": self.data.data.half().cpu().numpy()  # save CPU Memory
+            "data": self.data.data.cpu().numpy() if self.is_quantized else
+                    self.data.data.half().cpu().numpy()  # save CPU Memory
         }
+        if self.is_quantized:
+            if self.quant is not None:
+                data["quant"] = self.quant.cpu()
+            else:
+                data["palette"] = self.palette.cpu()
+            data["quant_sigma"] = self.quant_sigma.cpu()
+        if self.bricks is not None:
+            data["bricks"] = self.bricks.half().cpu().numpy()
+            data["brick"] = self.brick.cpu()
         if self.data_format is not None:
             data["data_format"] = repr(self.data_format)
         if self.extra_data is not None:
@@ -903,14 +1341,17 @@ class N3Tree(nn.Module):
 
         :param path: npz path
         :param device: str device to put data
-        :param dtype: str torch.float32 (default) | torch.float64
+        :param dtype: str torch.float32 (default) | torch.float64 |
+                      torch.float16 | torch.bfloat16. The file stores
+                      float16 data, which half precision trees keep as is
         :param map_location: str DEPRECATED old name for device
 
         """
         if map_location is not None:
             warn('map_location has been renamed to device and may be removed')
             device = map_location
-        assert dtype == torch.float32 or dtype == torch.float64, 'Unsupported dtype'
+        assert dtype in (torch.float32, torch.float64) + _HALF_DTYPES, \
+               'Unsupported dtype'
         tree = cls(dtype=dtype, device=device)
         z = np.load(path)
         tree.data_dim = int(z["data_dim"])
@@ -918,23 +1359,44 @@ class N3Tree(nn.Module):
         tree.N = tree.child.shape[-1]
         tree.parent_depth = torch.from_numpy(z["parent_depth"]).to(device)
         tree._n_internal.fill_(z["n_internal"].item())
-        if "invradius3" in z.files:
-            tree.invradius = torch.from_numpy(z["invradius3"].astype(
-                                np.float32)).to(device)
-        else:
-            tree.invradius.fill_(z["invradius"].item())
-        tree.offset = torch.from_numpy(z["offset"].astype(np.float32)).to(device)
         tree.depth_limit = int(z["depth_limit"])
         tree.geom_resize_fact = float(z["geom_resize_fact"])
-        tree.data.data = torch.from_numpy(z["data"].astype(np.float32)).to(device)
+        if "quant" in z.files or "palette" in z.files:
+            # Quantized tree (see quantize, palettize); dtype does not apply
+            tree.data = nn.Parameter(torch.from_numpy(z["data"]).to(device),
+                                     requires_grad=False)
+            if "quant" in z.files:
+                tree.quant = torch.from_numpy(z["quant"]).to(device)
+            else:
+                tree.palette = torch.from_numpy(z["palette"]).to(device)
+            tree.quant_sigma = torch.from_numpy(z["quant_sigma"]).to(device)
+            tree.split_density = True
+        else:
+            tree.data.data = torch.from_numpy(z["data"]).to(device=device, dtype=dtype)
+        if "bricks" in z.files:
+            # Tree with bricks (see to_bricks)
+            tree.bricks = torch.from_numpy(z["bricks"]).to(device=device, dtype=dtype)
+            tree.brick = torch.from_numpy(z["brick"]).to(device)
+            tree.data.requires_grad_(False)
+        # The transform and extra_data follow the compute dtype of the data
+        # as installed, which for a quantized tree is not that of dtype
+        if "invradius3" in z.files:
+            tree.invradius = torch.from_numpy(z["invradius3"]).to(
+                                device=device, dtype=tree.compute_dtype)
+        else:
+            tree.invradius = torch.full_like(tree.invradius,
+                    z["invradius"].item(), dtype=tree.compute_dtype)
+        tree.offset = torch.from_numpy(z["offset"]).to(
+                device=device, dtype=tree.compute_dtype)
         if 'n_free' in z.files:
             tree._n_free.fill_(z["n_free"].item())
         else:
             tree._n_free.zero_()
         tree.data_format = DataFormat(z['data_format'].item()) if \
                 'data_format' in z.files else None
-        tree.extra_data = torch.from_numpy(z['extra_data']).to(device) if \
-                          'extra_data' in z.files else None
+        tree.extra_data = torch.from_numpy(z['extra_data']).to(
+                device=device, dtype=tree.compute_dtype) if \
+                'extra_data' in z.files else None
         return tree
 
     # Magic
@@ -948,6 +1410,7 @@ class N3Tree(nn.Module):
         """
         Get N3TreeView
         """
+        assert not self.packed_leaves, "Unpack the leaves first (unpack_leaves)"
         return N3TreeView(self, key)
 
     def __setitem__(self, key, val):
@@ -996,7 +1459,7 @@ class N3Tree(nn.Module):
 
         curr = nodes.clone()
         mask = torch.ones(Q, device=curr.device, dtype=torch.bool)
-        output = torch.zeros(Q, 3, device=curr.device, dtype=self.data.dtype)
+        output = torch.zeros(Q, 3, device=curr.device, dtype=self.compute_dtype)
 
         while True:
             output[mask] += curr[:, 1:]
@@ -1080,26 +1543,170 @@ class N3Tree(nn.Module):
         self._ver += 1
         self._last_all_leaves = None
         self._last_frontier = None
+        self._density = None
+        self._max_sigma = None
+
+    def sync_density(self):
+        """
+        Mark the density array of a :code:`split_density` tree and the
+        subtree maximum sigma summary (see _get_max_sigma) stale, to be
+        rebuilt on the next render. Needed only after writing to
+        :code:`tree.data.data` directly, which torch does not track, before
+        rendering without gradient (renders that differentiate the data
+        always rebuild them); the tree's own methods and in-place updates of
+        :code:`tree.data` (e.g. optimizer steps) are accounted for.
+        """
+        self._density = None
+        self._max_sigma = None
+
+    def _get_ropes(self):
+        """
+        Face neighbor links of the nodes, used by the renderer to step from
+        leaf to leaf along rays if :code:`ropes` is set (see TreeWalker in
+        csrc/include/common.hpp). Built on first use after the tree
+        structure changes.
+
+        :return: (n_nodes, 6) int32 tensor, the node adjacent across
+                 each face -x, +x, -y, +y, -z, +z (of equal or larger size), or -1
+        """
+        key = (self._ver, self.child.data_ptr(), self.child.shape[0])
+        cached = getattr(self, '_ropes', None)
+        if cached is None or cached[0] != key:
+            self._ropes = (key, _C.build_ropes(self._spec()))
+        return self._ropes[1]
+
+    def _get_child_bits(self):
+        """
+        Compact encoding of :code:`child`, which tree descents read instead
+        if :code:`compact_child` is set (see TreeSpec::child_bits in
+        csrc/include/data_spec.hpp). Built on first use after the tree
+        structure changes.
+
+        :return: (child_bits, child_list), the (n_nodes, 1 + ceil(N^3 / 32))
+                 int32 index of each node's first entry in child_list and
+                 bit mask of its slots with a child, and the (n_children,)
+                 int32 child entries of those slots
+        """
+        key = (self._ver, self.child.data_ptr(), self.child.shape[0])
+        cached = getattr(self, '_child_bits', None)
+        if cached is None or cached[0] != key:
+            child = self.child.reshape(self.child.shape[0], -1)
+            has_child = child != 0
+            n_words = (child.shape[1] + 31) // 32
+            bits = torch.zeros((child.shape[0], n_words * 32),
+                               dtype=torch.int64, device=child.device)
+            bits[:, :child.shape[1]] = has_child
+            words = (bits.view(child.shape[0], n_words, 32) << torch.arange(
+                    32, device=child.device)).sum(dim=-1)
+            # As int32, with bit 31 as the sign bit
+            words = torch.where(words >= 2 ** 31, words - 2 ** 32, words)
+            counts = has_child.sum(dim=-1)
+            base = torch.cumsum(counts, dim=0) - counts
+            child_bits = torch.cat((base[:, None], words), dim=1).to(
+                    dtype=torch.int32).contiguous()
+            self._child_bits = (key, (child_bits, child[has_child].contiguous()))
+        return self._child_bits[1]
+
+    def _get_max_sigma(self, cache=True):
+        """
+        Maximum raw sigma over the leaves under each slot of each node, used
+        by the renderer to step over empty subtrees at once. Built by a
+        native pass over the tree.
+
+        :param cache: bool, whether to reuse the summary from the last call
+                      if the structure and the data have not changed since:
+                      in-place updates of :code:`tree.data` are tracked
+                      through its version counter, and writes to
+                      :code:`tree.data.data` need sync_density.
+                      The renderer caches only when not differentiating the
+                      data; optimization loops write :code:`tree.data.data`
+                      between steps, so those renders rebuild it every time.
+
+        :return: (n_nodes, N, N, N) tensor of the compute dtype
+        """
+        if not cache:
+            self._max_sigma = None
+            return _C.build_max_sigma(self._spec())
+        key = (self._ver, self.data.data_ptr(), self.data.shape,
+               self.data._version)
+        if self._max_sigma is None or self._max_sigma[0] != key:
+            self._max_sigma = (key, _C.build_max_sigma(self._spec()))
+        return self._max_sigma[1]
+
+    def _get_density(self, cache=True):
+        """
+        Copy of the raw sigma of each slot, :code:`data[..., -1]`, which the
+        renderer reads instead of the data if :code:`split_density` is set
+        (see csrc/include/rt_core.hpp _leaf_sigma).
 
-    def _spec(self, world=True):
+        :param cache: bool, whether to reuse the copy from the last call if
+                      the data has not changed since (see _get_max_sigma)
+
+        :return: (n_nodes, N, N, N) contiguous tensor of the data dtype
+                 (for a quantized tree, its float32 :code:`quant_sigma`)
+        """
+        if self.is_quantized:
+            return self.quant_sigma
+        key = (self.data.data_ptr(), self.data.shape, self.data._version)
+        cached = getattr(self, '_density', None)
+        if not cache or cached is None or cached[0] != key:
+            if self.packed_leaves:
+                density = torch.zeros(self.child.shape, dtype=self.data.dtype,
+                                      device=self.data.device)
+                density[self.child == 0] = self.data.data[:, 0, 0, 0, -1]
+            else:
+                density = self.data.data[..., -1].contiguous()
+            if not cache:
+                self._density = None
+                return density
+            self._density = (key, density)
+        return self._density[1]
+
+    def _spec(self, world=True, accel=False, cache=True):
         """
         Pack tree into a TreeSpec (for passing data to C++ extension)
+
+        :param accel: bool, whether to include the acceleration structures
+                      only the renderer uses (_get_max_sigma, and
+                      _get_ropes and _get_density if ropes and
+                      split_density are set)
+        :param cache: bool, whether those built from the data may be reused
+                      from an earlier call (see _get_max_sigma)
         """
         tree_spec = _C.TreeSpec()
         tree_spec.data = self.data
         tree_spec.child = self.child
         tree_spec.parent_depth = self.parent_depth
         tree_spec.extra_data = self.extra_data if self.extra_data is not None else \
-                torch.empty((0, 0), dtype=self.data.dtype, device=self.data.device)
+                torch.empty((0, 0), dtype=self.compute_dtype, device=self.data.device)
         tree_spec.offset = self.offset if world else torch.tensor(
-                  [0.0, 0.0, 0.0], dtype=self.data.dtype, device=self.data.device)
+                  [0.0, 0.0, 0.0], dtype=self.compute_dtype, device=self.data.device)
         tree_spec.scaling = self.invradius if world else torch.tensor(
-                  [1.0, 1.0, 1.0], dtype=self.data.dtype, device=self.data.device)
+                  [1.0, 1.0, 1.0], dtype=self.compute_dtype, device=self.data.device)
         if hasattr(self, '_weight_accum'):
             tree_spec._weight_accum = self._weight_accum if \
                     self._weight_accum is not None else torch.empty(
-                            0, dtype=self.data.dtype, device=self.data.device)
+                            0, dtype=self.compute_dtype, device=self.data.device)
             tree_spec._weight_accum_max = (self._weight_accum_op == 'max')
+        if self.compact_child or self.packed_leaves:
+            tree_spec.child_bits, tree_spec.child_list = self._get_child_bits()
+            tree_spec.packed_leaves = self.packed_leaves
+        if self.bricks is not None:
+            tree_spec.bricks = self.bricks
+            tree_spec.brick = self.brick
+        if accel:
+            if self.ropes:
+                tree_spec.ropes = self._get_ropes()
+            tree_spec.max_sigma = self._get_max_sigma(cache)
+            if self.split_density:
+                tree_spec.density = self._get_density(cache)
+        if self.is_quantized:
+            # The densities of a quantized tree are only in quant_sigma
+            if self.quant is not None:
+                tree_spec.quant = self.quant
+            else:
+                tree_spec.palette = self.palette
+            tree_spec.density = self.quant_sigma
         return tree_spec
 
     def _maybe_auto_data_dim(self):
@@ -1142,7 +1749,7 @@ class WeightAccumulator():
     def __enter__(self):
         self.tree._lock_tree_structure = True
         self.tree._weight_accum = torch.zeros(
-                self.tree.child.shape, dtype=self.tree.data.dtype,
+                self.tree.child.shape, dtype=self.tree.compute_dtype,
                 device=self.tree.data.device)
         self.tree._weight_accum_op = self.op
         self.weight_accum = self.tree._weight_accum
@@ -0,0 +1,162 @@
+"""
+Shared fixtures: a small octree with leaves at several depths and random
+data, rays through it, and rendering. The tests need the C++/CUDA
+extension; they run on CPU, and also on CUDA when it is available.
+"""
+import os
+import subprocess
+import sys
+import pytest
+import torch
+import svox
+from svox.helpers import _get_c_extension
+
+_C = _get_c_extension()
+
+
+def pytest_runtest_setup(item):
+    if _C is None:
+        pytest.skip("svox C++/CUDA extension not built")
+
+
+@pytest.fixture(params=["cpu", "cuda"])
+def device(request):
+    if request.param == "cuda" and not torch.cuda.is_available():
+        pytest.skip("CUDA not available")
+    return request.param
+
+
+def make_tree(data_format="SH4", seed=0, device="cpu", dtype=torch.float32):
+    """
+    Octree over the unit cube, refined to 4^3 leaves, then once more over
+    the octant at the origin (which becomes uniformly refined over two
+    levels, see N3Tree.to_bricks) and twice around the opposite corner.
+    About a third of the leaves are empty.
+    """
+    gen = torch.Generator().manual_seed(seed)
+    tree = svox.N3Tree(data_format=data_format, init_refine=1, dtype=dtype)
+    c = torch.tensor([0.125, 0.375], dtype=dtype)
+    tree[torch.cartesian_prod(c, c, c)].refine()
+    tree[torch.tensor([[0.875, 0.875, 0.875]], dtype=dtype)].refine()
+    tree[torch.tensor([[0.97, 0.97, 0.97]], dtype=dtype)].refine()
+    tree.shrink_to_fit()
+
+    data = torch.randn(tree.data.shape, generator=gen)
+    sigma = torch.rand(tree.data.shape[:-1], generator=gen) * 20
+    sigma[torch.rand(sigma.shape, generator=gen) < 0.3] = 0
+    data[..., -1] = sigma
+    tree.data.data.copy_(data)
+    return tree.partial(device=device)
+
+
+def make_rays(n=1024, seed=1, device="cpu", dtype=torch.float32):
+    """
+    Rays from random points of the unit cube in random directions
+    """
+    gen = torch.Generator().manual_seed(seed)
+    origins = torch.rand((n, 3), generator=gen, dtype=dtype)
+    dirs = torch.randn((n, 3), generator=gen, dtype=dtype)
+    dirs /= dirs.norm(dim=-1, keepdim=True)
+    return svox.Rays(origins=origins.to(device), dirs=dirs.to(device),
+                     viewdirs=dirs.to(device))
+
+
+def render(tree, rays, fast=False, **kwargs):
+    """
+    Render the rays through the tree with the native extension
+    """
+    with torch.no_grad():
+        return svox.VolumeRenderer(tree, **kwargs)(rays, fast=fast)
+
+
+def render_reference(tree, rays, **kwargs):
+    """
+    Render the rays through the tree with the PyTorch implementation
+    (cuda=False), differentiably. It normalizes the directions in place,
+    so it gets a copy of the rays.
+    """
+    rays = svox.Rays(origins=rays.origins.clone(), dirs=rays.dirs.clone(),
+                     viewdirs=rays.viewdirs.clone())
+    return svox.VolumeRenderer(tree, **kwargs)(rays, cuda=False)
+
+
+def check_grad(tree, rays, fast=False, n=8, eps=1e-3, **kwargs):
+    """
+    Check the gradient of a random weighting of the output of the native
+    renderer (with options kwargs) against central differences, at the n
+    entries of the data with the largest gradient and n random others.
+    The tree and rays should be float64 (the kernels evaluate exp in
+    float32 even then, hence the large eps). Densities below 0.1, which
+    may be at the kinks of relu or of skipping below sigma_thresh, are
+    left out.
+    """
+    gen = torch.Generator().manual_seed(4)
+    ren = svox.VolumeRenderer(tree, **kwargs)
+    tree.data.grad = None
+    out = ren(rays, fast=fast)
+    weight = torch.rand(out.shape, generator=gen, dtype=out.dtype).to(out.device)
+    (out * weight).sum().backward()
+    grad = tree.data.grad.flatten()
+
+    kink = torch.zeros(tree.data.shape, dtype=torch.bool, device=grad.device)
+    kink[..., -1] = tree.data.data[..., -1] < 0.1
+    kink = kink.flatten()
+    largest = grad.abs().masked_fill(kink, -1).topk(n).indices
+    smooth = torch.nonzero(~kink)[:, 0]
+    other = smooth[torch.randperm(smooth.numel(), generator=gen)[:n]
+                   .to(smooth.device)]
+    idx = torch.cat((largest, other))
+
+    data = tree.data.data.view(-1)
+    diff = []
+    for i in idx.tolist():
+        value = data[i].item()
+        loss = []
+        for x in (value + eps, value - eps):
+            data[i] = x
+            with torch.no_grad():
+                loss.append((ren(rays, fast=fast) * weight).sum().item())
+        data[i] = value
+        diff.append((loss[0] - loss[1]) / (2 * eps))
+    torch.testing.assert_close(torch.tensor(diff, dtype=grad.dtype),
+                               grad[idx].cpu(), rtol=1e-3, atol=1e-5)
+
+
+def make_c2w(device="cpu"):
+    """
+    Pose of a camera 2 units in front of the unit cube (on +z), looking at
+    its center
+    """
+    c2w = torch.eye(4)
+    c2w[:3, 3] = torch.tensor([0.5, 0.5, 2.5])
+    return c2w.to(device)
+
+
+def run_with_isa(isa, script, tmp_path):
+    """
+    Run script in a new interpreter with the CPU kernels limited to isa
+    (SVOX_CPU_ISA, which is read once per process) and this file
+    importable. The script saves its results with torch.save(..., OUT);
+    they are returned.
+    """
+    out = str(tmp_path / f"{isa}.pt")
+    env = dict(os.environ, SVOX_CPU_ISA=isa)
+    subprocess.run([sys.executable, "-c", f"OUT = {out!r}\n{script}"],
+                   env=env, cwd=os.path.dirname(os.path.abspath(__file__)),
+                   check=True)
+    return torch.load(out)
+
+
+def make_points(n=2048, seed=2, device="cpu"):
+    gen = torch.Generator().manual_seed(seed)
+    return torch.rand((n, 3), generator=gen).to(device)
+
+
+@pytest.fixture
+def tree(device):
+    return make_tree(device=device)
+
+
+@pytest.fixture
+def rays(device):
+    return make_rays(device=device)
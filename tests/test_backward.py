@@ -0,0 +1,57 @@
+"""
+CPU volume rendering backward pass (user-003)
+"""
+import pytest
+import torch
+import svox
+from conftest import (check_grad, make_c2w, make_rays, make_tree,
+                      render_reference)
+
+
+def grad_of(tree, out):
+    gen = torch.Generator().manual_seed(5)
+    weight = torch.rand(out.shape, generator=gen).to(out.device)
+    tree.data.grad = None
+    (out * weight).sum().backward()
+    return tree.data.grad.clone()
+
+
+@pytest.mark.parametrize("data_format", ["RGBA", "SH4", "SH9"])
+def test_backward(device, rays, data_format):
+    # The gradient autograd takes through the PyTorch renderer
+    tree = make_tree(data_format, device=device)
+    grad = grad_of(tree, svox.VolumeRenderer(tree)(rays))
+    ref = grad_of(tree, render_reference(tree, rays))
+    assert grad.abs().sum() > 0
+    torch.testing.assert_close(grad, ref, rtol=1e-4, atol=1e-5)
+
+
+@pytest.mark.parametrize("data_format", ["RGBA", "SH4"])
+def test_finite_difference(device, data_format):
+    tree = make_tree(data_format, device=device, dtype=torch.float64)
+    check_grad(tree, make_rays(n=64, device=device, dtype=torch.float64))
+
+
+def test_image(device):
+    # The image backward pass, against that of the same rays
+    tree = make_tree(device=device)
+    ren = svox.VolumeRenderer(tree)
+    c2w = make_c2w(device)
+    grad = grad_of(tree, ren.render_persp(c2w, width=32, height=24, fx=40))
+    rays = svox.VolumeRenderer.persp_rays(c2w, width=32, height=24, fx=40)
+    ref = grad_of(tree, ren(rays).view(24, 32, 3))
+    torch.testing.assert_close(grad, ref, rtol=1e-4, atol=1e-5)
+
+
+def test_threads():
+    # The thread-local gradient buffers sum to the single-threaded gradient
+    tree, rays = make_tree(), make_rays()
+    n_threads = torch.get_num_threads()
+    try:
+        torch.set_num_threads(1)
+        grad = grad_of(tree, svox.VolumeRenderer(tree)(rays))
+        torch.set_num_threads(4)
+        grad_mt = grad_of(tree, svox.VolumeRenderer(tree)(rays))
+    finally:
+        torch.set_num_threads(n_threads)
+    torch.testing.assert_close(grad_mt, grad, rtol=1e-5, atol=1e-6)
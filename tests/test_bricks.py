@@ -0,0 +1,77 @@
+"""
+Dense bricks at uniformly refined subtrees (user-025)
+"""
+import pytest
+import torch
+import svox
+from conftest import make_points, render
+
+
+def test_structure(tree):
+    # Only the octant at the origin is uniformly refined over two levels
+    b = tree.to_bricks(levels=2)
+    assert b.bricks.shape == (1, 4, 4, 4, tree.data_dim)
+    assert (b.brick >= 0).sum() == 1
+    assert b.n_internal == tree.n_internal - 8
+    assert b.n_leaves == tree.n_leaves - 64 + 8
+    b.check_integrity()
+    assert tree.to_bricks(levels=3).bricks is None
+
+
+@pytest.mark.parametrize("fast", [False, True])
+def test_render(tree, rays, fast):
+    b = tree.to_bricks()
+    torch.testing.assert_close(render(b, rays, fast=fast),
+                               render(tree, rays, fast=fast),
+                               rtol=0, atol=1e-4)
+
+
+def test_query(tree, device):
+    # Outside of the bricks, queries see the original leaves
+    b = tree.to_bricks()
+    points = make_points(device=device) * 0.5 + 0.5
+    with torch.no_grad():
+        torch.testing.assert_close(b(points), tree(points), rtol=0, atol=0)
+
+
+def test_from_bricks(tree, rays):
+    t2 = tree.to_bricks().from_bricks()
+    assert t2.bricks is None and t2.brick is None
+    t2.check_integrity()
+    assert t2.n_internal == tree.n_internal and t2.n_leaves == tree.n_leaves
+    with torch.no_grad():
+        centers = tree.corners + tree.lengths * 0.5
+        torch.testing.assert_close(t2(centers), tree.values, rtol=0, atol=0)
+    torch.testing.assert_close(render(t2, rays), render(tree, rays),
+                               rtol=0, atol=1e-6)
+
+
+def test_save_load(tree, rays, device, tmp_path):
+    b = tree.to_bricks()
+    path = str(tmp_path / "tree.npz")
+    b.save(path)
+    loaded = svox.N3Tree.load(path, device=device)
+    assert loaded.bricks is not None
+    torch.testing.assert_close(loaded.brick, b.brick, rtol=0, atol=0)
+    # The file stores float16 data and bricks
+    expected = b.partial(dtype=torch.float16).partial(dtype=torch.float32)
+    torch.testing.assert_close(render(loaded, rays), render(expected, rays),
+                               rtol=0, atol=1e-5)
+
+
+@pytest.mark.parametrize("layout", ["dfs", "bfs", "morton", "veb"])
+def test_reorder(tree, rays, layout):
+    # brick follows the nodes
+    b = tree.to_bricks()
+    t2 = b.partial()
+    t2.reorder(layout)
+    torch.testing.assert_close(render(t2, rays), render(b, rays),
+                               rtol=0, atol=1e-6)
+
+
+def test_backward_rejected(tree, rays):
+    b = tree.to_bricks()
+    b.data.requires_grad_(True)
+    out = svox.VolumeRenderer(b)(rays)
+    with pytest.raises(RuntimeError):
+        out.sum().backward()
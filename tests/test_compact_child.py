@@ -0,0 +1,58 @@
+"""
+Compact bit mask child encoding (user-022)
+"""
+import pytest
+import torch
+import svox
+from conftest import make_points, make_rays, render
+
+
+def compact(tree):
+    t2 = tree.partial()
+    t2.compact_child = True
+    return t2
+
+
+def check_same(tree, rays, points):
+    t2 = compact(tree)
+    torch.testing.assert_close(render(t2, rays), render(tree, rays),
+                               rtol=0, atol=1e-6)
+    with torch.no_grad():
+        out, ids = tree(points, want_node_ids=True)
+        out2, ids2 = t2(points, want_node_ids=True)
+    torch.testing.assert_close(out2, out, rtol=0, atol=0)
+    assert torch.equal(ids2, ids)
+
+
+def test_render_query(tree, rays, device):
+    check_same(tree, rays, make_points(device=device))
+
+
+def test_wide_nodes(device):
+    # N^3 = 64 slots, two mask words per node
+    gen = torch.Generator().manual_seed(0)
+    tree = svox.N3Tree(N=4, data_format="RGBA", init_refine=1)
+    tree[torch.rand((40, 3), generator=gen)].refine()
+    tree.shrink_to_fit()
+    tree.data.data.copy_(torch.rand(tree.data.shape, generator=gen) * 10)
+    tree = tree.partial(device=device)
+    check_same(tree, make_rays(device=device), make_points(device=device))
+
+
+def test_refine(tree, rays, device):
+    # The encoding is rebuilt after the structure changes
+    t2 = compact(tree)
+    render(t2, rays)
+    points = make_points(n=16, seed=3, device=device)
+    tree[points].refine()
+    t2[points].refine()
+    torch.testing.assert_close(render(t2, rays), render(tree, rays),
+                               rtol=0, atol=1e-6)
+
+
+def test_backward(tree, rays):
+    t2 = compact(tree)
+    for t in (tree, t2):
+        svox.VolumeRenderer(t)(rays).sum().backward()
+    torch.testing.assert_close(t2.data.grad, tree.data.grad,
+                               rtol=1e-5, atol=1e-6)
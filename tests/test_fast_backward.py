@@ -0,0 +1,32 @@
+"""
+Backward and se_grad passes that skip and stop as the forward pass does
+(user-017)
+"""
+import pytest
+import torch
+import svox
+from svox.renderer import _rays_spec_from_rays
+from conftest import _C, check_grad, make_rays, make_tree
+
+
+@pytest.mark.parametrize("kwargs", [{}, {"sample_log": 256},
+                                    {"fused_backward": True}])
+def test_finite_difference(device, kwargs):
+    # The gradient of the output as rendered
+    tree = make_tree(device=device, dtype=torch.float64)
+    check_grad(tree, make_rays(n=64, device=device, dtype=torch.float64),
+               fast=True, **kwargs)
+
+
+def test_se_grad(tree, rays):
+    # se_grad of the fast render, as autograd takes it
+    ren = svox.VolumeRenderer(tree)
+    out = ren(rays, fast=True)
+    gen = torch.Generator().manual_seed(5)
+    colors = torch.rand(out.shape, generator=gen).to(out.device)
+    tree.data.grad = None
+    (0.5 * (out - colors) ** 2).sum().backward()
+    se_out, grad, _ = _C.se_grad(tree._spec(), _rays_spec_from_rays(rays),
+                                 colors, ren._get_options(True))
+    torch.testing.assert_close(se_out, out.detach(), rtol=0, atol=1e-5)
+    torch.testing.assert_close(grad, tree.data.grad, rtol=1e-4, atol=1e-5)
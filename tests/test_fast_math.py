@@ -0,0 +1,54 @@
+"""
+Approximate exp/log math mode of the renderer (user-009)
+"""
+import pytest
+import torch
+import svox
+from conftest import render
+
+
+def render_fast_math(tree, rays, **kwargs):
+    ren = svox.VolumeRenderer(tree, **kwargs)
+    ren.fast_math = True
+    with torch.no_grad():
+        return ren(rays)
+
+
+@pytest.mark.parametrize("density_softplus", [False, True])
+def test_render(tree, rays, density_softplus):
+    # Only the transcendentals differ
+    torch.testing.assert_close(
+            render_fast_math(tree, rays, density_softplus=density_softplus),
+            render(tree, rays, density_softplus=density_softplus),
+            rtol=0, atol=1e-4)
+
+
+def test_render_fast(tree, rays):
+    # Also skipping samples with sigma below 1e-2 and stopping rays at
+    # transmittance 1e-2
+    torch.testing.assert_close(render(tree, rays, fast=True),
+                               render(tree, rays), rtol=0, atol=2e-2)
+
+
+@pytest.mark.parametrize("density_softplus", [False, True])
+def test_backward(tree, rays, density_softplus):
+    # The backward passes use the approximations too, on the host as well
+    grads = []
+    for fast_math in (False, True):
+        tree.data.grad = None
+        ren = svox.VolumeRenderer(tree, density_softplus=density_softplus)
+        ren.fast_math = fast_math
+        ren(rays).sum().backward()
+        grads.append(tree.data.grad.clone())
+    assert not torch.equal(grads[1], grads[0])
+    torch.testing.assert_close(grads[1], grads[0], rtol=1e-3, atol=1e-4)
+
+
+def test_softplus_large_sigma(tree, rays):
+    # Raw densities past the float32 range of exp used to give inf
+    tree.data.data[..., -1] = 200.0
+    for fast_math in (False, True):
+        ren = svox.VolumeRenderer(tree, density_softplus=True)
+        ren.fast_math = fast_math
+        with torch.no_grad():
+            assert torch.isfinite(ren(rays)).all()
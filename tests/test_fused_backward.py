@@ -0,0 +1,40 @@
+"""
+One-pass backward from the forward output and transmittance (user-016)
+"""
+import pytest
+import torch
+import svox
+from conftest import check_grad, make_c2w, make_rays, make_tree
+
+
+def render_grad(tree, rays, **kwargs):
+    tree.data.grad = None
+    out = svox.VolumeRenderer(tree, **kwargs)(rays)
+    out.sum().backward()
+    return out.detach(), tree.data.grad
+
+
+@pytest.mark.parametrize("sample_log", [0, 256])
+def test_backward(tree, rays, sample_log):
+    out, grad = render_grad(tree, rays, fused_backward=True,
+                            sample_log=sample_log)
+    ref_out, ref_grad = render_grad(tree, rays)
+    torch.testing.assert_close(out, ref_out, rtol=0, atol=1e-6)
+    torch.testing.assert_close(grad, ref_grad, rtol=1e-4, atol=1e-5)
+
+
+def test_image(tree, device):
+    c2w = make_c2w(device)
+    grads = []
+    for fused in (False, True):
+        tree.data.grad = None
+        ren = svox.VolumeRenderer(tree, fused_backward=fused)
+        ren.render_persp(c2w, width=32, height=24, fx=40).sum().backward()
+        grads.append(tree.data.grad.clone())
+    torch.testing.assert_close(grads[1], grads[0], rtol=1e-4, atol=1e-5)
+
+
+def test_finite_difference(device):
+    tree = make_tree(device=device, dtype=torch.float64)
+    check_grad(tree, make_rays(n=64, device=device, dtype=torch.float64),
+               fused_backward=True)
@@ -0,0 +1,62 @@
+"""
+Half precision (float16 / bfloat16) tree data (user-019)
+"""
+import pytest
+import torch
+import svox
+from conftest import make_points, render
+
+
+@pytest.mark.parametrize("dtype", [torch.float16, torch.bfloat16])
+def test_render_matches_rounded_fp32(tree, rays, dtype):
+    half = tree.partial(dtype=dtype)
+    assert half.data.dtype == dtype
+    assert half.compute_dtype == torch.float32
+    # The kernels accumulate in float32, so the half tree renders as the
+    # float32 tree holding the same (rounded) values
+    rounded = half.partial(dtype=torch.float32)
+    out = render(half, rays)
+    assert out.dtype == torch.float32
+    torch.testing.assert_close(out, render(rounded, rays), rtol=0, atol=1e-5)
+    # and close to the original
+    atol = 1e-2 if dtype == torch.float16 else 5e-2
+    torch.testing.assert_close(out, render(tree, rays), rtol=0, atol=atol)
+
+
+@pytest.mark.parametrize("dtype", [torch.float16, torch.bfloat16])
+def test_query(tree, device, dtype):
+    half = tree.partial(dtype=dtype)
+    points = make_points(device=device)
+    out = half(points)
+    assert out.dtype == torch.float32
+    torch.testing.assert_close(
+            out, tree(points).to(dtype=dtype).float(), rtol=0, atol=0)
+
+
+@pytest.mark.parametrize("dtype", [torch.float32, torch.float16])
+def test_save_load(tree, rays, device, tmp_path, dtype):
+    path = str(tmp_path / "tree.npz")
+    tree.save(path)
+    loaded = svox.N3Tree.load(path, device=device, dtype=dtype)
+    assert loaded.data.dtype == dtype
+    assert loaded.offset.dtype == loaded.invradius.dtype == torch.float32
+    # The file stores float16 data
+    expected = tree.partial(dtype=torch.float16)
+    torch.testing.assert_close(loaded.data.data.float(),
+                               expected.data.data.float(), rtol=0, atol=0)
+    torch.testing.assert_close(render(loaded, rays), render(expected, rays),
+                               rtol=0, atol=1e-5)
+
+
+def test_load_quantized_keeps_compute_dtype(tree, rays, device, tmp_path):
+    # dtype does not apply to quantized data, nor to the float32 transform
+    # of the tree computing in float32
+    quant = tree.quantize()
+    path = str(tmp_path / "tree.npz")
+    quant.save(path)
+    loaded = svox.N3Tree.load(path, device=device, dtype=torch.float64)
+    assert loaded.data.dtype == torch.int8
+    assert loaded.compute_dtype == torch.float32
+    assert loaded.offset.dtype == loaded.invradius.dtype == torch.float32
+    torch.testing.assert_close(render(loaded, rays), render(quant, rays),
+                               rtol=0, atol=0)
@@ -0,0 +1,74 @@
+"""
+Empty-space skipping via per-node max-sigma summaries (user-012)
+"""
+import pytest
+import torch
+import svox
+from svox.renderer import _rays_spec_from_rays
+from conftest import _C, check_grad, make_rays, make_tree, render
+
+
+def clear_octant(tree):
+    """
+    Zero the density of the octant at the origin, which makes two levels
+    of empty subtrees
+    """
+    with torch.no_grad():
+        centers = tree.corners + tree.lengths * 0.5
+        inside = centers[(centers < 0.5).all(dim=-1)]
+        values = tree(inside)
+        values[:, -1] = 0
+        tree.set(inside, values)
+
+
+def render_grad(tree, rays):
+    tree.data.grad = None
+    out = svox.VolumeRenderer(tree)(rays)
+    out.sum().backward()
+    return out.detach(), tree.data.grad
+
+
+def render_plain(tree, rays, fast):
+    # Without the summary (nor the other acceleration structures)
+    opt = svox.VolumeRenderer(tree)._get_options(fast)
+    with torch.no_grad():
+        return _C.volume_render(tree._spec(), _rays_spec_from_rays(rays), opt)
+
+
+@pytest.mark.parametrize("fast", [False, True])
+def test_render(tree, rays, fast):
+    # Stepping over an empty subtree at once ends where stepping through
+    # its leaves does
+    clear_octant(tree)
+    torch.testing.assert_close(render(tree, rays, fast=fast),
+                               render_plain(tree, rays, fast),
+                               rtol=0, atol=1e-5)
+
+
+def test_finite_difference(device):
+    tree = make_tree(device=device, dtype=torch.float64)
+    clear_octant(tree)
+    check_grad(tree, make_rays(n=64, device=device, dtype=torch.float64))
+
+
+def test_data_data_write(tree, rays):
+    # Optimization loops write tree.data.data between steps (see
+    # docs/source/ex_opt_toy.py), which does not bump the version of data
+    sigma = tree.data.data[..., -1].clone()
+    tree.data.data[..., -1] = 0
+    render_grad(tree, rays)
+    tree.data.data[..., -1] = sigma
+    out, grad = render_grad(tree, rays)
+    ref_out, ref_grad = render_grad(tree.partial(), rays)
+    assert grad.abs().sum() > 0
+    torch.testing.assert_close(out, ref_out, rtol=0, atol=0)
+    torch.testing.assert_close(grad, ref_grad, rtol=0, atol=0)
+
+
+def test_sync_density(tree, rays):
+    # Renders without gradient reuse the summary until told otherwise
+    render(tree, rays)
+    tree.data.data[..., -1] *= 2
+    tree.sync_density()
+    torch.testing.assert_close(render(tree, rays), render(tree.partial(), rays),
+                               rtol=0, atol=0)
@@ -0,0 +1,56 @@
+"""
+Leaf-packed data storage (user-023)
+"""
+import pytest
+import torch
+import svox
+from conftest import make_points, render
+
+
+def packed(tree, split_density=False):
+    t2 = tree.partial()
+    t2.split_density = split_density
+    t2.pack_leaves()
+    return t2
+
+
+@pytest.mark.parametrize("split_density", [False, True])
+def test_render_query(tree, rays, device, split_density):
+    t2 = packed(tree, split_density)
+    assert t2.packed_leaves
+    assert t2.data.shape == (tree.n_leaves, 1, 1, 1, tree.data_dim)
+    torch.testing.assert_close(render(t2, rays), render(tree, rays),
+                               rtol=0, atol=1e-6)
+    points = make_points(device=device)
+    with torch.no_grad():
+        torch.testing.assert_close(t2(points), tree(points), rtol=0, atol=0)
+
+
+def test_backward(tree, rays):
+    t2 = packed(tree)
+    for t in (tree, t2):
+        svox.VolumeRenderer(t)(rays).sum().backward()
+    torch.testing.assert_close(t2.data.grad[:, 0, 0, 0],
+                               tree.data.grad[tree.child == 0],
+                               rtol=1e-5, atol=1e-6)
+
+
+def test_unpack(tree, rays, device, tmp_path):
+    t2 = packed(tree)
+    render(t2, rays)
+    t2.unpack_leaves()
+    assert not t2.packed_leaves
+    leaves = tree.child == 0
+    torch.testing.assert_close(t2.data.data[leaves], tree.data.data[leaves],
+                               rtol=0, atol=0)
+    assert (t2.data.data[~leaves] == 0).all()
+    torch.testing.assert_close(render(t2, rays), render(tree, rays),
+                               rtol=0, atol=1e-6)
+
+    path = str(tmp_path / "tree.npz")
+    t2.save(path)
+    loaded = svox.N3Tree.load(path, device=device)
+    loaded.pack_leaves()
+    torch.testing.assert_close(render(loaded, rays),
+                               render(tree.partial(dtype=torch.float16), rays),
+                               rtol=0, atol=1e-5)
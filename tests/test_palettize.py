@@ -0,0 +1,43 @@
+"""
+Rendering from a median-cut palette of coefficient vectors (user-021)
+"""
+import pytest
+import torch
+import svox
+from conftest import render
+
+
+def lookup(pal, tree):
+    """
+    Float32 copy of tree holding the palette rows pal's leaves index
+    """
+    ref = tree.partial()
+    leaves = tree.child == 0
+    ref.data.data[..., :-1][leaves] = pal.palette[
+            pal.data.data[..., 0][leaves].long()].to(device=tree.data.device)
+    return ref
+
+
+@pytest.mark.parametrize("order", [4, 6])
+def test_render(tree, rays, order):
+    pal = tree.palettize(order)
+    assert pal.is_quantized and pal.data.dtype == torch.int16
+    assert pal.palette.shape == (2 ** order, tree.data_dim - 1)
+    leaf_ids = pal.data.data[..., 0][tree.child == 0]
+    assert leaf_ids.min() >= 0 and leaf_ids.max() < 2 ** order
+    torch.testing.assert_close(render(pal, rays),
+                               render(lookup(pal, tree), rays),
+                               rtol=0, atol=1e-5)
+
+
+def test_save_load(tree, rays, device, tmp_path):
+    pal = tree.palettize(6)
+    path = str(tmp_path / "tree.npz")
+    pal.save(path)
+    loaded = svox.N3Tree.load(path, device=device)
+    assert loaded.is_quantized and loaded.quant is None
+    for name in ("data", "palette", "quant_sigma"):
+        torch.testing.assert_close(getattr(loaded, name).data,
+                                   getattr(pal, name).data, rtol=0, atol=0)
+    torch.testing.assert_close(render(loaded, rays), render(pal, rays),
+                               rtol=0, atol=0)
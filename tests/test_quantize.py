@@ -0,0 +1,67 @@
+"""
+Int8 block-quantized color coefficients (user-020)
+"""
+import pytest
+import torch
+import svox
+from conftest import render
+
+
+def dequantize(quant, tree):
+    """
+    Float32 copy of tree holding the coefficients quant stands for
+    """
+    n_blocks = quant.quant.shape[-1] // 2
+    q = quant.data.data[..., :-1].float()
+    q = q.view(*q.shape[:-1], n_blocks, -1)
+    scale, offset = quant.quant.view(*q.shape[:-2], n_blocks, 2).unbind(-1)
+    ref = tree.partial()
+    ref.data.data[..., :-1] = (q * scale[..., None] +
+                               offset[..., None]).flatten(-2)
+    return ref
+
+
+@pytest.mark.parametrize("per_channel", [False, True])
+def test_render(tree, rays, per_channel):
+    quant = tree.quantize(per_channel=per_channel)
+    assert quant.is_quantized and quant.data.dtype == torch.int8
+    assert quant.compute_dtype == torch.float32
+    torch.testing.assert_close(quant.quant_sigma, tree.data.data[..., -1],
+                               rtol=0, atol=0)
+    out = render(quant, rays)
+    # The renderer dequantizes exactly
+    torch.testing.assert_close(out, render(dequantize(quant, tree), rays),
+                               rtol=0, atol=1e-5)
+    # within half a step of each block's range of the original
+    torch.testing.assert_close(out, render(tree, rays), rtol=0, atol=5e-2)
+
+
+def test_render_fast(tree, rays):
+    quant = tree.quantize()
+    torch.testing.assert_close(
+            render(quant, rays, fast=True),
+            render(dequantize(quant, tree), rays, fast=True),
+            rtol=0, atol=1e-5)
+
+
+def test_save_load(tree, rays, device, tmp_path):
+    quant = tree.quantize(per_channel=True)
+    path = str(tmp_path / "tree.npz")
+    quant.save(path)
+    loaded = svox.N3Tree.load(path, device=device)
+    assert loaded.is_quantized
+    for name in ("data", "quant", "quant_sigma"):
+        torch.testing.assert_close(getattr(loaded, name).data,
+                                   getattr(quant, name).data, rtol=0, atol=0)
+    torch.testing.assert_close(render(loaded, rays), render(quant, rays),
+                               rtol=0, atol=0)
+
+
+@pytest.mark.parametrize("palette", [False, True])
+def test_clone(tree, rays, palette):
+    quant = tree.palettize(6) if palette else tree.quantize()
+    t2 = quant.clone()
+    assert t2.is_quantized and t2.data.dtype == quant.data.dtype
+    assert not t2.data.requires_grad
+    torch.testing.assert_close(render(t2, rays), render(quant, rays),
+                               rtol=0, atol=0)
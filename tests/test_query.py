@@ -0,0 +1,41 @@
+"""
+Native CPU query_vertical, assign_vertical and their backward pass (user-005)
+"""
+import torch
+from conftest import make_points
+
+
+def test_query(tree, device):
+    points = make_points(device=device)
+    with torch.no_grad():
+        out, ids = tree(points, want_node_ids=True)
+        ref, ref_ids = tree(points.clone(), cuda=False, want_node_ids=True)
+    torch.testing.assert_close(out, ref, rtol=0, atol=0)
+    assert torch.equal(ids, ref_ids)
+
+
+def test_backward(tree, device):
+    # Points falling in the same leaf add up their gradients
+    points = make_points(device=device)
+    gen = torch.Generator().manual_seed(5)
+    weight = torch.rand((points.size(0), tree.data_dim), generator=gen).to(device)
+    grads = []
+    for cuda in (True, False):
+        tree.data.grad = None
+        (tree(points.clone(), cuda=cuda) * weight).sum().backward()
+        grads.append(tree.data.grad)
+    torch.testing.assert_close(grads[0], grads[1], rtol=1e-5, atol=1e-5)
+
+
+def test_set(tree, device):
+    # One point per leaf, as the order of writes to a leaf is unspecified
+    with torch.no_grad():
+        centers = tree.corners + tree.lengths * 0.5
+    gen = torch.Generator().manual_seed(5)
+    values = torch.rand((centers.size(0), tree.data_dim), generator=gen).to(device)
+    ref = tree.partial()
+    tree.set(centers, values)
+    ref.set(centers.clone(), values, cuda=False)
+    torch.testing.assert_close(tree.data.data, ref.data.data, rtol=0, atol=0)
+    with torch.no_grad():
+        torch.testing.assert_close(tree(centers), values, rtol=0, atol=0)
@@ -0,0 +1,30 @@
+"""
+Multithreaded CPU volume rendering (user-001)
+"""
+import pytest
+import torch
+from conftest import make_rays, make_tree, render, render_reference
+
+
+@pytest.mark.parametrize("data_format", ["RGBA", "SH4", "SH9"])
+def test_render(device, rays, data_format):
+    # The native renderer takes the same samples as the PyTorch one
+    tree = make_tree(data_format, device=device)
+    with torch.no_grad():
+        ref = render_reference(tree, rays)
+    torch.testing.assert_close(render(tree, rays), ref, rtol=0, atol=1e-4)
+
+
+def test_threads():
+    # Each ray is rendered whole by one thread, so up to rounding the output
+    # does not depend on how the rays are split among threads
+    tree, rays = make_tree(), make_rays()
+    n_threads = torch.get_num_threads()
+    try:
+        torch.set_num_threads(1)
+        out = render(tree, rays)
+        torch.set_num_threads(4)
+        out_mt = render(tree, rays)
+    finally:
+        torch.set_num_threads(n_threads)
+    torch.testing.assert_close(out_mt, out, rtol=0, atol=1e-6)
@@ -0,0 +1,44 @@
+"""
+Tiled CPU volume_render_image (user-002)
+"""
+import pytest
+import torch
+import svox
+from svox.renderer import _make_camera_spec
+from conftest import _C, make_c2w, make_tree, render_reference
+
+W, H, FX = 48, 40, 60.0
+
+
+def render_persp(ren, c2w, **kwargs):
+    with torch.no_grad():
+        return ren.render_persp(c2w, width=W, height=H, fx=FX, **kwargs)
+
+
+@pytest.mark.parametrize("data_format", ["RGBA", "SH4"])
+def test_render_persp(device, data_format):
+    tree = make_tree(data_format, device=device)
+    ren = svox.VolumeRenderer(tree)
+    c2w = make_c2w(device)
+    im = render_persp(ren, c2w)
+    assert im.shape == (H, W, 3)
+    rays = svox.VolumeRenderer.persp_rays(c2w, width=W, height=H, fx=FX)
+    with torch.no_grad():
+        ref = render_reference(tree, rays).view(H, W, 3)
+    torch.testing.assert_close(im, ref, rtol=0, atol=1e-4)
+
+
+@pytest.mark.parametrize("tile_size", [1, 7, 16, 64])
+def test_tile_size(tile_size):
+    # Tiles of any size, including partial ones at the right and bottom
+    # edges, cover the image
+    tree = make_tree()
+    ren = svox.VolumeRenderer(tree)
+    c2w = make_c2w()
+    with torch.no_grad():
+        im, tile_ms = _C.volume_render_image_tiled(
+                tree._spec(), _make_camera_spec(c2w, W, H, FX, FX),
+                ren._get_options(), tile_size)
+    assert tile_ms.shape == ((H + tile_size - 1) // tile_size,
+                             (W + tile_size - 1) // tile_size)
+    torch.testing.assert_close(im, render_persp(ren, c2w), rtol=0, atol=1e-6)
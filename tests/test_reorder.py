@@ -0,0 +1,48 @@
+"""
+Locality-preserving node reordering (user-024)
+"""
+import pytest
+import torch
+import svox
+from conftest import make_points, render
+
+LAYOUTS = ["dfs", "bfs", "morton", "veb"]
+
+
+def reordered(tree, layout):
+    t2 = tree.partial()
+    t2.reorder(layout)
+    t2.check_integrity()
+    return t2
+
+
+@pytest.mark.parametrize("layout", LAYOUTS)
+def test_render_query(tree, rays, device, layout):
+    t2 = reordered(tree, layout)
+    assert t2.n_internal == tree.n_internal and t2.n_leaves == tree.n_leaves
+    torch.testing.assert_close(render(t2, rays), render(tree, rays),
+                               rtol=0, atol=1e-6)
+    with torch.no_grad():
+        # The same leaves, at the same positions
+        centers = tree.corners + tree.lengths * 0.5
+        torch.testing.assert_close(t2(centers), tree.values, rtol=0, atol=0)
+        points = make_points(device=device)
+        torch.testing.assert_close(t2(points), tree(points), rtol=0, atol=0)
+
+
+@pytest.mark.parametrize("layout", LAYOUTS)
+def test_quantized(tree, rays, layout):
+    # quant and quant_sigma follow the nodes
+    quant = tree.quantize()
+    ref = render(quant, rays)
+    quant.reorder(layout)
+    torch.testing.assert_close(render(quant, rays), ref, rtol=0, atol=1e-6)
+
+
+def test_repeat(tree, rays):
+    t2 = tree.partial()
+    for layout in LAYOUTS + LAYOUTS[::-1]:
+        t2.reorder(layout)
+    t2.check_integrity()
+    torch.testing.assert_close(render(t2, rays), render(tree, rays),
+                               rtol=0, atol=1e-6)
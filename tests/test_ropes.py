@@ -0,0 +1,45 @@
+"""
+Face neighbor links for leaf-to-leaf ray traversal (user-011)
+"""
+import torch
+import svox
+from conftest import make_points, render
+
+
+def roped(tree):
+    t2 = tree.partial()
+    t2.ropes = True
+    return t2
+
+
+def test_render(tree, rays):
+    # Following ropes reaches the same leaves as descending from the root
+    torch.testing.assert_close(render(roped(tree), rays), render(tree, rays),
+                               rtol=0, atol=1e-6)
+
+
+def test_backward(tree, rays):
+    t2 = roped(tree)
+    for t in (tree, t2):
+        svox.VolumeRenderer(t)(rays).sum().backward()
+    torch.testing.assert_close(t2.data.grad, tree.data.grad,
+                               rtol=1e-5, atol=1e-6)
+
+
+def test_se_grad(tree, rays):
+    colors = torch.rand((rays.origins.size(0), 3), device=rays.origins.device)
+    out = svox.VolumeRenderer(roped(tree)).se_grad(rays, colors)
+    ref = svox.VolumeRenderer(tree).se_grad(rays, colors)
+    for a, b in zip(out, ref):
+        torch.testing.assert_close(a, b, rtol=1e-5, atol=1e-6)
+
+
+def test_refine(tree, rays, device):
+    # The links are rebuilt after the structure changes
+    t2 = roped(tree)
+    render(t2, rays)
+    points = make_points(n=16, seed=3, device=device)
+    tree[points].refine()
+    t2[points].refine()
+    torch.testing.assert_close(render(t2, rays), render(tree, rays),
+                               rtol=0, atol=1e-6)
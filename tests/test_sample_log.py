@@ -0,0 +1,29 @@
+"""
+Replaying a forward sample log in the ray backward pass (user-015)
+"""
+import pytest
+import torch
+import svox
+from conftest import check_grad, make_rays, make_tree
+
+
+def render_grad(tree, rays, **kwargs):
+    tree.data.grad = None
+    out = svox.VolumeRenderer(tree, **kwargs)(rays)
+    out.sum().backward()
+    return out.detach(), tree.data.grad
+
+
+@pytest.mark.parametrize("sample_log", [4, 256])
+def test_backward(tree, rays, sample_log):
+    # With 4 samples, most rays overflow the log and are traced again
+    out, grad = render_grad(tree, rays, sample_log=sample_log)
+    ref_out, ref_grad = render_grad(tree, rays)
+    torch.testing.assert_close(out, ref_out, rtol=0, atol=1e-6)
+    torch.testing.assert_close(grad, ref_grad, rtol=1e-5, atol=1e-6)
+
+
+def test_finite_difference(device):
+    tree = make_tree(device=device, dtype=torch.float64)
+    check_grad(tree, make_rays(n=64, device=device, dtype=torch.float64),
+               sample_log=256)
@@ -0,0 +1,54 @@
+"""
+CPU se_grad and se_grad_persp (user-004)
+"""
+import torch
+import svox
+from conftest import make_c2w, make_rays
+
+
+def colors_like(out):
+    gen = torch.Generator().manual_seed(5)
+    return torch.rand(out.shape, generator=gen).to(out.device)
+
+
+def test_se_grad(tree, rays):
+    # Output and gradient of the squared error as autograd takes them
+    ren = svox.VolumeRenderer(tree)
+    out = ren(rays)
+    colors = colors_like(out)
+    tree.data.grad = None
+    (0.5 * (out - colors) ** 2).sum().backward()
+    se_out, grad, _ = ren.se_grad(rays, colors)
+    torch.testing.assert_close(se_out, out.detach(), rtol=0, atol=1e-6)
+    torch.testing.assert_close(grad, tree.data.grad, rtol=1e-4, atol=1e-5)
+
+
+def test_hessian(tree, device):
+    # The Gauss-Newton diagonal: the sum over the outputs of the squared
+    # gradient of each
+    rays = make_rays(n=16, device=device)
+    ren = svox.VolumeRenderer(tree)
+    out = ren(rays)
+    ref = torch.zeros_like(tree.data)
+    for i in range(out.size(0)):
+        for c in range(out.size(1)):
+            grad, = torch.autograd.grad(out[i, c], tree.data,
+                                        retain_graph=True)
+            ref += grad ** 2
+    _, _, hess = ren.se_grad(rays, colors_like(out))
+    assert hess.abs().sum() > 0
+    torch.testing.assert_close(hess, ref, rtol=1e-4, atol=1e-8)
+
+
+def test_se_grad_persp(tree, device):
+    # The same as se_grad of the camera's rays
+    ren = svox.VolumeRenderer(tree)
+    c2w = make_c2w(device)
+    colors = colors_like(torch.empty((24, 32, 3), device=device))
+    out, grad, hess = ren.se_grad_persp(c2w, colors, width=32, height=24,
+                                        fx=40)
+    rays = svox.VolumeRenderer.persp_rays(c2w, width=32, height=24, fx=40)
+    ref = ren.se_grad(rays, colors.view(-1, 3))
+    torch.testing.assert_close(out, ref[0].view(24, 32, 3), rtol=0, atol=1e-5)
+    torch.testing.assert_close(grad, ref[1], rtol=1e-4, atol=1e-5)
+    torch.testing.assert_close(hess, ref[2], rtol=1e-4, atol=1e-6)
@@ -0,0 +1,81 @@
+"""
+SIMD kernels of the CPU backend against the scalar ones: the packet ray
+tracer (user-006), the batched tree descent of queries (user-007) and the
+SH evaluation of the backward passes (user-008). The instruction set is
+chosen once per process, so each one runs in a subprocess.
+"""
+import pytest
+import torch
+from conftest import run_with_isa
+
+RENDER = """
+import torch
+from conftest import _C, make_rays, make_tree, render
+out = {"isa": _C.cpu_isa()}
+rays = make_rays()
+for data_format in ("RGBA", "SH4", "SH9"):
+    tree = make_tree(data_format)
+    for fast in (False, True):
+        out[f"{data_format} fast={fast}"] = render(tree, rays, fast=fast)
+torch.save(out, OUT)
+"""
+
+QUERY = """
+import torch
+import svox
+from conftest import _C, make_points, make_tree
+out = {"isa": _C.cpu_isa()}
+gen = torch.Generator().manual_seed(0)
+wide = svox.N3Tree(N=4, data_format="RGBA", init_refine=1)
+wide[torch.rand((40, 3), generator=gen)].refine()
+wide.data.data.copy_(torch.rand(wide.data.shape, generator=gen))
+points = make_points()
+for name, tree in (("N=2", make_tree()), ("N=4", wide)):
+    with torch.no_grad():
+        out[name], out[name + " ids"] = tree(points, want_node_ids=True)
+torch.save(out, OUT)
+"""
+
+BACKWARD = """
+import torch
+import svox
+from conftest import _C, make_rays, make_tree
+out = {"isa": _C.cpu_isa()}
+rays = make_rays()
+gen = torch.Generator().manual_seed(5)
+colors = torch.rand((rays.origins.size(0), 3), generator=gen)
+for data_format in ("SH4", "SH9", "SH16"):
+    tree = make_tree(data_format)
+    ren = svox.VolumeRenderer(tree)
+    ren(rays).sum().backward()
+    out[data_format + " grad"] = tree.data.grad
+    for name, x in zip(("out", "grad", "hess"), ren.se_grad(rays, colors)):
+        out[f"{data_format} se_grad {name}"] = x
+torch.save(out, OUT)
+"""
+
+
+def compare(script, isa, tmp_path, rtol, atol):
+    out = run_with_isa(isa, script, tmp_path)
+    if out.pop("isa") != isa:
+        pytest.skip(f"CPU does not support {isa}")
+    ref = run_with_isa("scalar", script, tmp_path)
+    assert ref.pop("isa") == "scalar"
+    assert out.keys() == ref.keys()
+    for key in ref:
+        torch.testing.assert_close(out[key], ref[key], rtol=rtol, atol=atol)
+
+
+@pytest.mark.parametrize("isa", ["avx2", "avx512"])
+def test_render(isa, tmp_path):
+    compare(RENDER, isa, tmp_path, rtol=0, atol=1e-5)
+
+
+@pytest.mark.parametrize("isa", ["avx2", "avx512"])
+def test_query(isa, tmp_path):
+    compare(QUERY, isa, tmp_path, rtol=0, atol=0)
+
+
+@pytest.mark.parametrize("isa", ["avx2", "avx512"])
+def test_backward(isa, tmp_path):
+    compare(BACKWARD, isa, tmp_path, rtol=1e-4, atol=1e-5)
@@ -0,0 +1,46 @@
+"""
+Optional split density array read ahead of the leaf data (user-018)
+"""
+import pytest
+import torch
+import svox
+from conftest import render
+
+
+def render_grad(tree, rays, **kwargs):
+    tree.data.grad = None
+    out = svox.VolumeRenderer(tree, **kwargs)(rays)
+    out.sum().backward()
+    return out.detach(), tree.data.grad
+
+
+def split(tree):
+    t2 = tree.partial()
+    t2.split_density = True
+    return t2
+
+
+@pytest.mark.parametrize("fast", [False, True])
+def test_render(tree, rays, fast):
+    torch.testing.assert_close(render(split(tree), rays, fast=fast),
+                               render(tree, rays, fast=fast),
+                               rtol=0, atol=1e-6)
+
+
+def test_backward(tree, rays):
+    out, grad = render_grad(split(tree), rays)
+    ref_out, ref_grad = render_grad(tree, rays)
+    torch.testing.assert_close(out, ref_out, rtol=0, atol=1e-6)
+    torch.testing.assert_close(grad, ref_grad, rtol=0, atol=1e-5)
+
+
+def test_data_data_write(tree, rays):
+    # Optimization loops write tree.data.data between steps (see
+    # docs/source/ex_opt_toy.py), which does not bump the version of data
+    t2 = split(tree)
+    render_grad(t2, rays)
+    t2.data.data[..., -1] = t2.data.data[..., -1].flip(0)
+    out, grad = render_grad(t2, rays)
+    ref_out, ref_grad = render_grad(t2.partial(), rays)
+    torch.testing.assert_close(out, ref_out, rtol=0, atol=0)
+    torch.testing.assert_close(grad, ref_grad, rtol=0, atol=0)
@@ -0,0 +1,60 @@
+"""
+Incremental tree traversal along rays (user-010)
+"""
+import pytest
+import torch
+import svox
+from conftest import make_points, make_tree, render, render_reference
+
+
+def check_reference(tree, rays):
+    with torch.no_grad():
+        ref = render_reference(tree, rays)
+    torch.testing.assert_close(render(tree, rays), ref, rtol=0, atol=1e-4)
+
+
+def test_deep(device):
+    # Rays through leaves of sides 1/4 down to 1/128, converging on the
+    # smallest
+    tree = make_tree(device=device)
+    target = torch.tensor([[0.3, 0.6, 0.45]], device=device)
+    for _ in range(5):
+        tree[target].refine()
+    origins = make_points(n=256, seed=4, device=device)
+    dirs = target - origins
+    dirs /= dirs.norm(dim=-1, keepdim=True)
+    check_reference(tree, svox.Rays(origins=origins, dirs=dirs,
+                                    viewdirs=dirs))
+
+
+@pytest.mark.parametrize("axis", [0, 1, 2])
+def test_axis_aligned(tree, device, axis):
+    # Rays along an axis, both ways, some of them in the planes between
+    # nodes
+    c = torch.tensor([0.125, 0.25, 0.3, 0.5, 0.875, 0.97])
+    other = [i for i in range(3) if i != axis]
+    origins = torch.zeros((2, c.numel() ** 2, 3))
+    origins[:, :, other] = torch.cartesian_prod(c, c)
+    origins[1, :, axis] = 0.999
+    dirs = torch.zeros_like(origins)
+    dirs[0, :, axis] = 1
+    dirs[1, :, axis] = -1
+    origins = origins.view(-1, 3).to(device)
+    dirs = dirs.view(-1, 3).to(device)
+    check_reference(tree, svox.Rays(origins=origins, dirs=dirs,
+                                    viewdirs=dirs))
+
+
+def test_wide_nodes(device):
+    # N = 4: the path from the root is kept as for octrees
+    gen = torch.Generator().manual_seed(0)
+    tree = svox.N3Tree(N=4, data_format="RGBA", init_refine=1)
+    tree[torch.rand((40, 3), generator=gen)].refine()
+    tree.shrink_to_fit()
+    tree.data.data.copy_(torch.rand(tree.data.shape, generator=gen) * 10)
+    tree = tree.partial(device=device)
+    origins = make_points(n=512, seed=4, device=device)
+    dirs = torch.randn((512, 3), generator=gen).to(device)
+    dirs /= dirs.norm(dim=-1, keepdim=True)
+    check_reference(tree, svox.Rays(origins=origins, dirs=dirs,
+                                    viewdirs=dirs))